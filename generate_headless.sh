@@ -0,0 +1,5 @@
+#!/bin/sh
+# Generates makefiles for the headless CPU simulation, build with: make config=release headless
+mkdir -p bin
+cp premake/settings/* bin/
+premake/premake5 --file=premake/headless.lua gmake2
@@ -1,13 +1,16 @@
 outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 dirs = {}
 dirs["root"] 			= os.realpath("../")
-dirs["bin"]	            = os.realpath(dirs.root .. "bin/")
-dirs["dependencies"]	= os.realpath(dirs.root .. "dependencies/")
-dirs["localfiles"]	    = os.realpath(dirs.root .. "local/")
-dirs["temp"]	        = os.realpath(dirs.root .. "temp/")
-dirs["source"] 			= os.realpath(dirs.root .. "source/")
-dirs["game"]			= os.realpath(dirs.root .. "source/game/")
-dirs["engine"]			= os.realpath(dirs.root .. "source/engine/")
-dirs["external"]		= os.realpath(dirs.root .. "source/external/")  
-dirs["pix"]		        = os.realpath(dirs.root .. "source/external/pix/")  
-dirs["imgui"]		    = os.realpath(dirs.root .. "source/external/imgui/")  
\ No newline at end of file
+-- os.realpath drops the trailing separator and returns nil for missing folders outside of Windows
+if not dirs.root:find("[/\\]$") then dirs["root"] = dirs.root .. "/" end
+dirs["bin"]	            = path.getabsolute(dirs.root .. "bin/")
+dirs["dependencies"]	= path.getabsolute(dirs.root .. "dependencies/")
+dirs["localfiles"]	    = path.getabsolute(dirs.root .. "local/")
+dirs["temp"]	        = path.getabsolute(dirs.root .. "temp/")
+dirs["source"] 			= path.getabsolute(dirs.root .. "source/")
+dirs["game"]			= path.getabsolute(dirs.root .. "source/game/")
+dirs["engine"]			= path.getabsolute(dirs.root .. "source/engine/")
+dirs["external"]		= path.getabsolute(dirs.root .. "source/external/")  
+dirs["pix"]		        = path.getabsolute(dirs.root .. "source/external/pix/")  
+dirs["headless"]		= path.getabsolute(dirs.root .. "source/headless/")
+dirs["imgui"]		    = path.getabsolute(dirs.root .. "source/external/imgui/")  
\ No newline at end of file
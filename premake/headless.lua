@@ -0,0 +1,14 @@
+-- Standalone workspace for the headless CPU simulation, for machines without Visual Studio or a GPU
+workspace "headless"
+	location "../"
+	startproject "headless"
+	architecture "x64"
+
+	configurations {
+		"Debug",
+		"Release",
+		"Retail"
+	}
+
+include "common.lua"
+include (dirs.headless)
\ No newline at end of file
@@ -10,7 +10,6 @@ struct Boid
 
 #define groupSize THREAD_GROUP_SIZE
 #define doubleGroupSize DOUBLE_THREAD_GROUP_SIZE
-#define maxBoids 10000000
 
 RWStructuredBuffer<Boid> boidsIn : register(u0);
 RWStructuredBuffer<Boid> boidsOut : register(u1);
@@ -24,4 +23,21 @@ cbuffer sortingStageBuffer : register(b1)
     uint2 groupIterationPadding;
 };
 
-StructuredBuffer<Boid> boids : register(t0);
\ No newline at end of file
+StructuredBuffer<Boid> boids : register(t0);
+// The boids before the last step, in the same slots as boids
+StructuredBuffer<Boid> previousBoids : register(t1);
+
+uint3 getGridIndices(Boid boid)
+{
+    uint indexX = (uint) (max(0.f, boid.pos.x - minPos.x) / cellSize);
+    uint indexY = (uint) (max(0.f, boid.pos.y - minPos.y) / cellSize);
+    uint indexZ = (uint) (max(0.f, boid.pos.z - minPos.z) / cellSize);
+    
+    return uint3(min(indexX, gridDims.x - 1), min(indexY, gridDims.y - 1), min(indexZ, gridDims.z - 1));
+}
+
+uint getCellIndex(Boid boid)
+{
+    uint3 gridIndices = getGridIndices(boid);
+    return (gridDims.x * gridDims.y * gridIndices.z) + (gridDims.x * gridIndices.y) + gridIndices.x;
+}
\ No newline at end of file
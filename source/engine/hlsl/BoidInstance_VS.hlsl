@@ -2,12 +2,18 @@
 #include "ObjectBuffer.hlsli"
 #include "Common.hlsli"
 #include "BoidCommon.hlsli"
+#include "Instance.hlsli"
 
 PixelInputType main(VertexInputType input)
 {        
-    Boid b = boids[input.instanceID];
+    RenderInstance b = unpackInstance(instances[input.instanceID]);
+    RenderInstance previous = unpackInstance(previousInstances[input.instanceID]);
+    b.pos = lerp(previous.pos, b.pos, interpolationAlpha);
+    // A boid that turned around within the step keeps its latest heading
+    float3 heading = lerp(previous.heading, b.heading, interpolationAlpha);
+    b.heading = dot(heading, heading) > 0.f ? heading : b.heading;
         
-    float3 forward = normalize(b.vel);
+    float3 forward = normalize(b.heading);
     float3 up = float3(0, 1, 0);
     float3 right = normalize(cross(forward, up));
     up = cross(right, forward);
@@ -36,7 +42,7 @@ PixelInputType main(VertexInputType input)
     float altColor = 0.f;
     if (flockSizeToFullyColor > 0)
     {
-        altColor = min(1.f, ((float) b.flockSize / (float) flockSizeToFullyColor));
+        altColor = min(1.f, b.flockSize / (float) flockSizeToFullyColor);
         mainColor = 1.f - altColor;                
     }
     output.color = float4(boidColor * mainColor + boidAltColor * altColor , 1.0);
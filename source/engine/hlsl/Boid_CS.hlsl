@@ -1,6 +1,19 @@
 #include "FrameBuffer.hlsli"
 #include "Common.hlsli"
 #include "BoidCommon.hlsli"
+#include "Instance.hlsli"
+
+// Steps since the boids were initialized, staggers the LOD updates of the cells.
+// init writes the boids in [initBegin, initEnd), the slots a grown buffer added or all of them.
+cbuffer simulationStepBuffer : register(b2)
+{
+    uint lodStep;
+    uint initBegin;
+    uint initEnd;
+    uint simulationStepPadding;
+};
+
+#define maxLodTier 7
 
 void BoidBehaviors(inout Boid boid)
 {
@@ -43,51 +56,233 @@ void BoidBehaviors(inout Boid boid)
     boid.vel += close * separationFactor * deltaTime;
 }
 
-void BoidBehaviorsGridded(inout Boid boid)
+// How many cells the stencil row dy, dz cells from the center reaches out in x, or -1 if none of its cells
+// can hold a boid within the visual range. The gap to a cell dx away is (|dx| - 1) cells.
+// Boids may have left their cells by the lazy grid margin since they were binned, so the stencil reaches that much further.
+int getStencilRowHalfWidth(int dy, int dz, int rings)
+{
+    float searchRange = sqrt(visualRangeSqr) + lazyGridMargin;
+    float cellRangeSqr = searchRange * searchRange / (cellSize * cellSize);
+    float gapY = max(abs(dy) - 1, 0);
+    float gapZ = max(abs(dz) - 1, 0);
+    float rest = cellRangeSqr - gapY * gapY - gapZ * gapZ;
+    if (rest <= 0.f)
+    {
+        return -1;
+    }
+    
+    int halfWidth = 1;
+    while (halfWidth < rings && (float) (halfWidth * halfWidth) < rest)
+    {
+        halfWidth++;
+    }
+    return halfWidth;
+}
+
+// Slack of the cell culling tests, so float rounding in the per-boid tests can't reject fewer boids than a culled cell held
+#define cullBoxMargin 0.001f
+#define cullCosMargin 0.001f
+
+// Bounds along one axis of the cells first..last, boids outside the bounds are in the edge cells so those reach out to infinity.
+// Grown by the lazy grid margin, boids binned in the cells can have moved that far out of them.
+void getCellSpanBounds(int first, int last, float minCoord, uint dim, out float low, out float high)
+{
+    float margin = cellSize * cullBoxMargin + lazyGridMargin;
+    low = first <= 0 ? -asfloat(0x7f800000) : minCoord + first * cellSize - margin;
+    high = last >= (int) dim - 1 ? asfloat(0x7f800000) : minCoord + (last + 1) * cellSize + margin;
+}
+
+float getAxisGap(float coord, float low, float high)
+{
+    return coord < low ? low - coord : (high < coord ? coord - high : 0.f);
+}
+
+int getCullCellX(float x)
+{
+    return (int) clamp(floor((x - minPos.x) / cellSize), 0.f, (float) (gridDims.x - 1));
+}
+
+// Trims the cells firstX..lastX of the row y, z to the ones that can hold a boid the boid sees, false if none can.
+// Cells are only dropped when all of their boids fail the visual range or the FOV test. The FOV test rejects neighbours
+// with dot(dir, velDir) > 2 * fieldOfViewPercent - 1, a convex cone for FOVs of at least 180 degrees, so a box is inside it if its corners are.
+bool cullCellRow(float3 pos, float3 velDir, int y, int z, inout int firstX, inout int lastX)
+{
+    float minY, maxY, minZ, maxZ;
+    getCellSpanBounds(y, y, minPos.y, gridDims.y, minY, maxY);
+    getCellSpanBounds(z, z, minPos.z, gridDims.z, minZ, maxZ);
+    float gapY = getAxisGap(pos.y, minY, maxY);
+    float gapZ = getAxisGap(pos.z, minZ, maxZ);
+    float rest = visualRangeSqr - gapY * gapY - gapZ * gapZ;
+    if (rest <= 0.f)
+    {
+        return false;
+    }
+    
+    // The x extent of the visual range sphere at this row
+    float reach = sqrt(rest) + cellSize * cullBoxMargin + lazyGridMargin;
+    firstX = max(firstX, getCullCellX(pos.x - reach));
+    lastX = min(lastX, getCullCellX(pos.x + reach));
+    if (firstX > lastX)
+    {
+        return false;
+    }
+    
+    float cosLimit = 2.f * fieldOfViewPercent - 1.f + cullCosMargin;
+    if (cosLimit < cullCosMargin || 1.f <= cosLimit)
+    {
+        return true;
+    }
+    
+    float minX, maxX;
+    getCellSpanBounds(firstX, lastX, minPos.x, gridDims.x, minX, maxX);
+    if (isinf(minX) || isinf(maxX) || isinf(minY) || isinf(maxY) || isinf(minZ) || isinf(maxZ))
+    {
+        return true;
+    }
+    
+    for (uint corner = 0; corner < 8; corner++)
+    {
+        float3 vecTo = float3((corner & 1u) ? maxX : minX, (corner & 2u) ? maxY : minY, (corner & 4u) ? maxZ : minZ) - pos;
+        if (!(dot(vecTo, velDir) > cosLimit * length(vecTo)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// False if the sphere is fully outside the frustum. The plane of a clip component is its row of worldToClipMatrix,
+// a point is inside if -w <= x, y <= w and 0 <= z <= w.
+bool isSphereInFrustum(float3 center, float radius)
+{
+    float4 planes[6] =
+    {
+        worldToClipMatrix[3] + worldToClipMatrix[0], worldToClipMatrix[3] - worldToClipMatrix[0],
+        worldToClipMatrix[3] + worldToClipMatrix[1], worldToClipMatrix[3] - worldToClipMatrix[1],
+        worldToClipMatrix[2], worldToClipMatrix[3] - worldToClipMatrix[2]
+    };
+    for (uint i = 0; i < 6; i++)
+    {
+        if (dot(planes[i], float4(center, 1.f)) < -radius * length(planes[i].xyz))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The boids of a cell update their behavior every 1 << tier steps. Cells within lodDistance of the camera are tier 0,
+// every doubling of the distance beyond it adds a tier up to lodMaxTier, which cells outside the frustum take.
+uint getLodTier(uint3 cellCoords)
+{
+    uint maxTier = min(lodMaxTier, maxLodTier);
+    if (!(0.f < lodDistance) || maxTier == 0)
+    {
+        return 0;
+    }
+    
+    float halfCell = cellSize * 0.5f;
+    float3 center = minPos + (float3) cellCoords * cellSize + halfCell;
+    float radius = halfCell * 1.7320508f;
+    if (lodFrustum != 0 && !isSphereInFrustum(center, radius))
+    {
+        return maxTier;
+    }
+    
+    float dist = length(center - camPos) - radius;
+    uint tier = 0;
+    float reach = lodDistance;
+    while (tier < maxTier && reach <= dist)
+    {
+        tier++;
+        reach *= 2.f;
+    }
+    return tier;
+}
+
+// Staggered by the cell index so the cells of a tier don't all update in the same step
+bool isLodUpdateStep(uint cell, uint tier)
+{
+    return ((lodStep + cell) & ((1u << tier) - 1u)) == 0;
+}
+
+// behaviorTime is the time since the last update of the boid's cell, deltaTime without LOD
+void BoidBehaviorsGridded(inout Boid boid, float behaviorTime)
 {
     float3 center = 0;
     float3 close = 0;
     float3 avgVel = 0;
     uint flockSize = 0;
-    int cell = boid.cellIndex;
+    // The cell of the current position, cellIndex is stale in steps that reuse the binning
+    int cell = (int) getCellIndex(boid);
+    int lastCell = (int)cellCount - 1;
+    float3 velDir = normalize(boid.vel);
     
     int yStep = gridDims.x;
     int zStep = gridDims.x * gridDims.y;
+    int3 cellCoords = int3(cell % yStep, (cell / yStep) % (int) gridDims.y, cell / zStep);
+    // Cells smaller than the visual range need more than one ring of neighbour cells
+    int rings = max((int)cellRings, 1);
     
-    for (int z = -zStep; z <= zStep; z += zStep)
+    for (int z = -rings; z <= rings; z++)
     {
-        for (int y = -yStep; y <= yStep; y += yStep)
+        for (int y = -rings; y <= rings; y++)
         {
-            for (int x = -1; x <= 1; x++)
-            {                              
-                uint curr = (((cell + x) + y) + z);
-                
-                uint start = 0;
-                if (curr > 0)
+            int halfWidth = getStencilRowHalfWidth(y, z, rings);
+            if (halfWidth < 0)
+            {
+                continue;
+            }
+            
+            // The cells of a row are adjacent in the sorted buffer, so a row is one range.
+            // Cells outside the grid are empty.
+            int rowCell = cell + y * yStep + z * zStep;
+            int first = max(rowCell - halfWidth, 0);
+            int last = min(rowCell + halfWidth, lastCell);
+            if (first > last)
+            {
+                continue;
+            }
+            
+            // Rows inside the grid are trimmed to the cells this boid can see, rows that leave it run into other rows
+            int3 rowCoords = cellCoords + int3(0, y, z);
+            int firstX = rowCoords.x - halfWidth;
+            int lastX = rowCoords.x + halfWidth;
+            if (all(rowCoords.yz >= 0) && all(rowCoords.yz < (int2) gridDims.yz) && firstX >= 0 && lastX < (int) gridDims.x)
+            {
+                if (!cullCellRow(boid.pos, velDir, rowCoords.y, rowCoords.z, firstX, lastX))
                 {
-                    start = sumBuffer[curr - 1];
+                    continue;
                 }
-                uint end = sumBuffer[curr];
+                first = rowCell + firstX - rowCoords.x;
+                last = rowCell + lastX - rowCoords.x;
+            }
+            
+            uint start = 0;
+            if (first > 0)
+            {
+                start = sumBuffer[first - 1];
+            }
+            uint end = sumBuffer[last];
                                
-                for (uint i = start; i < end; i++)
+            for (uint i = start; i < end; i++)
+            {
+                Boid other = boidsIn[i];
+                float3 vecTo = other.pos - boid.pos;
+                if (fieldOfViewPercent < (dot(normalize(vecTo), velDir) + 1.f) * 0.5f)
                 {
-                    Boid other = boidsIn[i];
-                    float3 vecTo = other.pos - boid.pos;
-                    if (fieldOfViewPercent < (dot(normalize(vecTo), normalize(boid.vel)) + 1.f) * 0.5f)
-                    {
-                        continue;
-                    }
-                    float distSqr = dot(vecTo, vecTo);
-                    if (distSqr > 0 && distSqr < visualRangeSqr)
+                    continue;
+                }
+                float distSqr = dot(vecTo, vecTo);
+                if (distSqr > 0 && distSqr < visualRangeSqr)
+                {
+                    if (distSqr < protectedRangeSqr)
                     {
-                        if (distSqr < protectedRangeSqr)
-                        {
-                            close -= vecTo / distSqr;
-                        }
-                        center += other.pos;
-                        avgVel += other.vel;
-                        flockSize++;
+                        close -= vecTo / distSqr;
                     }
+                    center += other.pos;
+                    avgVel += other.vel;
+                    flockSize++;
                 }
             }
         }
@@ -98,12 +293,12 @@ void BoidBehaviorsGridded(inout Boid boid)
         center /= flockSize;
         avgVel /= flockSize;
 
-        boid.vel += (center - boid.pos) * cohesionFactor * deltaTime;
-        boid.vel += (avgVel - boid.vel) * alignmentFactor * deltaTime;
+        boid.vel += (center - boid.pos) * cohesionFactor * behaviorTime;
+        boid.vel += (avgVel - boid.vel) * alignmentFactor * behaviorTime;
     }
 
     boid.flockSize = flockSize;
-    boid.vel += close * separationFactor * deltaTime;
+    boid.vel += close * separationFactor * behaviorTime;
 }
 
 void ClampVels(inout Boid boid)
@@ -206,7 +401,12 @@ void mainGridded(uint3 threadID : SV_DispatchThreadID)
         return;
     }
     Boid b = boidsIn[threadID.x];
-    BoidBehaviorsGridded(b);
+    // Boids in the cells the LOD skips this step keep their velocity and only move
+    uint tier = getLodTier(getGridIndices(b));
+    if (isLodUpdateStep(getCellIndex(b), tier))
+    {
+        BoidBehaviorsGridded(b, deltaTime * (float) (1u << tier));
+    }
     AvoidWallBehavior(b);
     if (playerAttraction != 0.f)
         PlayerAttraction(b);
@@ -221,12 +421,13 @@ void mainGridded(uint3 threadID : SV_DispatchThreadID)
 [numthreads(groupSize, 1, 1)]
 void init(uint3 threadID : SV_DispatchThreadID)
 {
-    if (threadID.x >= maxBoids)
+    uint index = initBegin + threadID.x;
+    if (index >= initEnd)
     {
         return;
     }
         
-    uint seed = threadID.x;
+    uint seed = index ^ (initSeed * 0x9E3779B9);
     float3 frac = float3(randomFloat(seed),
                         randomFloat(seed),
                         randomFloat(seed));
@@ -243,8 +444,23 @@ void init(uint3 threadID : SV_DispatchThreadID)
 
     float3 vel = frac2 - float3(0.5f, 0.5f, 0.5f);
     
-    boidsIn[threadID.x].pos = pos;
-    boidsIn[threadID.x].vel = vel;
-    boidsOut[threadID.x].pos = pos;
-    boidsOut[threadID.x].vel = vel;
+    Boid b;
+    b.pos = pos;
+    b.cellIndex = 0;
+    b.vel = vel;
+    b.flockSize = 0;
+    boidsIn[index] = b;
+    boidsOut[index] = b;
+}
+
+// Packs boids into instancesOut for rendering
+[numthreads(groupSize, 1, 1)]
+void packInstances(uint3 threadID : SV_DispatchThreadID)
+{
+    if (boidCount <= threadID.x)
+    {
+        return;
+    }
+    
+    instancesOut[threadID.x] = packInstance(boids[threadID.x]);
 }
\ No newline at end of file
@@ -58,8 +58,26 @@ struct FrameBufferData
 
 	Vector3<float> playerColor;
 	float playerAttraction;
+
+	unsigned int cellRings;
+	float lazyGridMargin; //How far boids may be from the cells they were binned in, 0 if the grid is rebuilt every step
+	float interpolationAlpha; //Where rendering is between the last two simulation steps, 1 for the latest
+	float lodDistance; //Gridded behaviors update every step within it, every 2^tier steps in each doubling beyond it, 0 for no LOD
+
+	unsigned int lodMaxTier;
+	unsigned int lodFrustum; //Cells outside the frustum of worldToClipMatrix take lodMaxTier
+	unsigned int initSeed; //Mixed into the index seed of every boid's init stream, 0 for the index alone
+	unsigned int deterministic; //Sorts every cell into a fixed order so the atomic sort doesn't change the result
 };
 struct ObjectBufferData
 {
 	Matrix4x4<float> modelToWorldMatrix;
+};
+// The range the render instances were packed with, see RenderInstance
+struct InstanceBufferData
+{
+	Vector3<float> minPos;
+	float minPosPadding;
+	Vector3<float> extent;
+	float extentPadding;
 };
\ No newline at end of file
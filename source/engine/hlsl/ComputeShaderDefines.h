@@ -1,2 +1,10 @@
 #define THREAD_GROUP_SIZE 256
-#define DOUBLE_THREAD_GROUP_SIZE 512
\ No newline at end of file
+#define DOUBLE_THREAD_GROUP_SIZE 512
+
+// Bits of the packed render instances, see RenderInstance
+#define INSTANCE_POS_BITS 21
+#define INSTANCE_HEADING_BITS 12
+// The flock size is stored as log2(1 + flockSize) in steps of 1 / this, 255 steps reach about 60000
+#define INSTANCE_FLOCK_OCTAVE_STEPS 16
+// Positions are quantized over the bounds padded by this much of their size on every side, boids further out are clamped
+#define INSTANCE_BOUNDS_PADDING 0.5f
\ No newline at end of file
@@ -52,4 +52,14 @@ cbuffer FrameBuffer : register(b0)
 
 	float3 playerColor;
     float playerAttraction;
+
+    uint cellRings;
+    float lazyGridMargin;
+    float interpolationAlpha;
+    float lodDistance;
+
+    uint lodMaxTier;
+    uint lodFrustum;
+    uint initSeed;
+    uint deterministic;
 }
\ No newline at end of file
@@ -2,33 +2,23 @@
 #include "Common.hlsli"
 #include "BoidCommon.hlsli"
 
-uint3 getGridIndices(Boid boid)
-{
-    uint indexX = (uint) (max(0.f, boid.pos.x - minPos.x) / cellSize);
-    uint indexY = (uint) (max(0.f, boid.pos.y - minPos.y) / cellSize);
-    uint indexZ = (uint) (max(0.f, boid.pos.z - minPos.z) / cellSize);
-    
-    return uint3(min(indexX, gridDims.x - 1), min(indexY, gridDims.y - 1), min(indexZ, gridDims.z - 1));
-}
-
-uint getCellIndex(Boid boid)
-{
-    uint3 gridIndices = getGridIndices(boid);
-    return (gridDims.x * gridDims.y * gridIndices.z) + (gridDims.x * gridIndices.y) + gridIndices.x;
-}
-
 [numthreads(groupSize, 1, 1)]
 void main(uint3 threadID : SV_DispatchThreadID)
 {
 }
 
+// Only the cells of this frame are cleared, the scan and the neighbour ranges never read past cellCount.
+// unsortedSumBuffer is left as is, copy or sum overwrite all of its cells before sort reads them.
 [numthreads(doubleGroupSize, 1, 1)]
 void clear(uint3 threadID : SV_DispatchThreadID)
 {
     uint index = threadID.x;
+    if (cellCount <= index)
+    {
+        return;
+    }
     
     sumBuffer[index] = 0;
-    unsortedSumBuffer[index] = 0;
 }
 
 [numthreads(groupSize, 1, 1)]
@@ -163,6 +153,18 @@ void copy(uint3 threadID : SV_DispatchThreadID)
     unsortedSumBuffer[threadID.x] = sumBuffer[threadID.x];
 }
 
+// Brings the boids of the last step back to the slots they were sorted to, for steps that reuse the binning
+[numthreads(groupSize, 1, 1)]
+void copyBoids(uint3 threadID : SV_DispatchThreadID)
+{
+    if (boidCount <= threadID.x)
+    {
+        return;
+    }
+    
+    boidsIn[threadID.x] = boidsOut[threadID.x];
+}
+
 [numthreads(groupSize, 1, 1)]
 void sort(uint3 threadID : SV_DispatchThreadID)
 {
@@ -176,4 +178,48 @@ void sort(uint3 threadID : SV_DispatchThreadID)
     InterlockedAdd(unsortedSumBuffer[b.cellIndex], -1, offset);
       
     boidsIn[offset - 1] = b;
+}
+
+// Lexicographic order of the position and velocity bits, boids that compare equal are the same boid state
+bool isBoidBefore(Boid a, Boid b)
+{
+    uint aBits[6] = { asuint(a.pos.x), asuint(a.pos.y), asuint(a.pos.z), asuint(a.vel.x), asuint(a.vel.y), asuint(a.vel.z) };
+    uint bBits[6] = { asuint(b.pos.x), asuint(b.pos.y), asuint(b.pos.z), asuint(b.vel.x), asuint(b.vel.y), asuint(b.vel.z) };
+    for (uint i = 0; i < 6; i++)
+    {
+        if (aBits[i] != bBits[i])
+        {
+            return aBits[i] < bBits[i];
+        }
+    }
+    return false;
+}
+
+// Deterministic mode, sort leaves the boids of a cell in the order the threads got their slots in.
+// Every boid counts the boids of its cell that order before it by their bits and writes itself to that rank of the cell in
+// boidsOut, copyBoids then brings them back. Each thread only walks its own cell once, so a dense cell costs its boid count
+// per thread instead of one thread insertion sorting it, and the same state always gives the same slots and neighbour sums.
+[numthreads(groupSize, 1, 1)]
+void orderCells(uint3 threadID : SV_DispatchThreadID)
+{
+    uint index = threadID.x;
+    if (boidCount <= index)
+    {
+        return;
+    }
+    
+    Boid b = boidsIn[index];
+    uint start = b.cellIndex > 0 ? sumBuffer[b.cellIndex - 1] : 0;
+    uint end = sumBuffer[b.cellIndex];
+    uint rank = 0;
+    for (uint i = start; i < end; i++)
+    {
+        //Boids with the same bits are the same state, their slots only keep them apart
+        Boid other = boidsIn[i];
+        if (isBoidBefore(other, b) || (i < index && !isBoidBefore(b, other)))
+        {
+            rank++;
+        }
+    }
+    boidsOut[start + rank] = b;
 }
\ No newline at end of file
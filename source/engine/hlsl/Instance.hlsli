@@ -0,0 +1,80 @@
+// 12 byte render instances, packed like RenderInstance in RenderInstances.h. Include after BoidCommon.hlsli.
+#define instancePosMax ((1u << INSTANCE_POS_BITS) - 1)
+#define instanceHeadingMax ((1u << INSTANCE_HEADING_BITS) - 1)
+#define instanceZLowBits (32 - INSTANCE_POS_BITS)
+
+// The range the instances were packed with
+cbuffer InstanceBuffer : register(b3)
+{
+    float3 instanceMinPos;
+    float instanceMinPosPadding;
+    float3 instanceExtent;
+    float instanceExtentPadding;
+};
+
+RWStructuredBuffer<uint3> instancesOut : register(u4);
+
+StructuredBuffer<uint3> instances : register(t2);
+// The instances before the last step, in the same slots as instances
+StructuredBuffer<uint3> previousInstances : register(t3);
+
+struct RenderInstance
+{
+    float3 pos;
+    float3 heading;
+    float flockSize;
+};
+
+uint quantize(float value, uint maxValue)
+{
+    return (uint) clamp(floor(value * maxValue + 0.5f), 0.f, (float) maxValue);
+}
+
+uint3 packInstance(Boid boid)
+{
+    uint3 pos;
+    pos.x = quantize((boid.pos.x - instanceMinPos.x) / instanceExtent.x, instancePosMax);
+    pos.y = quantize((boid.pos.y - instanceMinPos.y) / instanceExtent.y, instancePosMax);
+    pos.z = quantize((boid.pos.z - instanceMinPos.z) / instanceExtent.z, instancePosMax);
+    
+    // Octahedral heading, the lower hemisphere is folded over the diagonals. A boid without velocity faces +z.
+    float velSum = abs(boid.vel.x) + abs(boid.vel.y) + abs(boid.vel.z);
+    float2 uv = 0;
+    if (velSum > 0.f)
+    {
+        uv = boid.vel.xy / velSum;
+        if (boid.vel.z < 0.f)
+        {
+            uv = (1.f - abs(uv.yx)) * float2(uv.x >= 0.f ? 1.f : -1.f, uv.y >= 0.f ? 1.f : -1.f);
+        }
+    }
+    uint headingU = quantize(uv.x * 0.5f + 0.5f, instanceHeadingMax);
+    uint headingV = quantize(uv.y * 0.5f + 0.5f, instanceHeadingMax);
+    uint flockSize = quantize(log2(1.f + (float) boid.flockSize) * INSTANCE_FLOCK_OCTAVE_STEPS / 255.f, 255);
+    
+    return uint3(pos.x | (pos.z << INSTANCE_POS_BITS),
+                 pos.y | ((pos.z >> instanceZLowBits) << INSTANCE_POS_BITS),
+                 headingU | (headingV << INSTANCE_HEADING_BITS) | (flockSize << 24));
+}
+
+RenderInstance unpackInstance(uint3 data)
+{
+    uint3 pos = uint3(data.x & instancePosMax,
+                      data.y & instancePosMax,
+                      (data.x >> INSTANCE_POS_BITS) | ((data.y >> INSTANCE_POS_BITS) << instanceZLowBits));
+    
+    RenderInstance instance;
+    instance.pos = instanceMinPos + (float3) pos / instancePosMax * instanceExtent;
+    
+    float3 heading;
+    heading.x = (float) (data.z & instanceHeadingMax) / instanceHeadingMax * 2.f - 1.f;
+    heading.y = (float) ((data.z >> INSTANCE_HEADING_BITS) & instanceHeadingMax) / instanceHeadingMax * 2.f - 1.f;
+    heading.z = 1.f - abs(heading.x) - abs(heading.y);
+    float fold = saturate(-heading.z);
+    heading.x += heading.x >= 0.f ? -fold : fold;
+    heading.y += heading.y >= 0.f ? -fold : fold;
+    instance.heading = normalize(heading);
+    
+    instance.flockSize = exp2((float) (data.z >> 24) / INSTANCE_FLOCK_OCTAVE_STEPS) - 1.f;
+    return instance;
+}
\ No newline at end of file
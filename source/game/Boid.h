@@ -1,13 +1,19 @@
 #pragma once
-#include <commonUtilities/vector3.h>
+#include "CommonUtilities/Vector3.h"
 
 struct Boid
 {
 	CommonUtilities::Vector3<float> pos{};
 	unsigned int cellIndex;
 	CommonUtilities::Vector3<float> vel{};
-	unsigned int neighbours;
+	unsigned int flockSize;
 };
 
-constexpr unsigned int MAX_BOIDS = 10000000;
-constexpr unsigned int MAX_CELLS = 100000000;
\ No newline at end of file
+// How many boids and cells the simulation buffers may grow to, worked out from the memoryBudgetMB setting
+// by SimulationFrameData::GetCapacity. The defaults hold until a capacity is set.
+struct SimulationCapacity
+{
+	unsigned int maxBoids = 10000000;
+	unsigned int maxCells = 100000000;
+};
+constexpr unsigned int MAX_CELL_RINGS = 4; // Cells down to a quarter of the visual range
\ No newline at end of file
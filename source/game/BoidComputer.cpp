@@ -1,19 +1,26 @@
 #include "BoidComputer.h"
 #include <stdio.h>
+#include <cmath>
 #include <crtdbg.h>
 #include "util/ComputeShaderFunctions.h"
 #include "commonUtilities/Vector2.h"
 #include "Boid.h"
+#include "cpu/StateHash.h"
 #include <cstring>
 #include "GraphicsEngine.h"
 #include "hlsl/ComputeShaderDefines.h"
+#include "util/SimulationFrameData.h"
 #include <unordered_map>
 #include <stack>
+#include <chrono>
 
 using namespace CommonUtilities;
 
+constexpr float LAZY_GRID_MARGIN_SLACK = 0.99f; //Keeps float rounding in the displacement bound from letting a boid slip past the margin
+
 int BoidComputer::Init(GraphicsEngine& aGraphicsEngine)
 {
+	graphicsEngine = &aGraphicsEngine;
 	gEDevice = aGraphicsEngine.GetDevice();
 	gEContext = aGraphicsEngine.GetContext();
 
@@ -26,6 +33,9 @@ int BoidComputer::Init(GraphicsEngine& aGraphicsEngine)
 	if (FAILED(CreateComputeShader(L"../source/engine/hlsl/Boid_CS.hlsl", "init", gEDevice, &initBoidCS)))
 		return 1;
 
+	if (FAILED(CreateComputeShader(L"../source/engine/hlsl/Boid_CS.hlsl", "packInstances", gEDevice, &packInstancesCS)))
+		return 1;
+
 	if (FAILED(CreateComputeShader(L"../source/engine/hlsl/Grid_CS.hlsl", "count", gEDevice, &countCS)))
 		return 1;
 
@@ -50,109 +60,264 @@ int BoidComputer::Init(GraphicsEngine& aGraphicsEngine)
 	if (FAILED(CreateComputeShader(L"../source/engine/hlsl/Grid_CS.hlsl", "clear", gEDevice, &clearCS)))
 		return 1;
 
-	CreateStructuredBuffer(gEDevice, sizeof(unsigned int), MAX_CELLS, nullptr, &sumBuffer);
-	CreateBufferUAV(gEDevice, sumBuffer, &uavSumBuffer);
+	if (FAILED(CreateComputeShader(L"../source/engine/hlsl/Grid_CS.hlsl", "copyBoids", gEDevice, &copyBoidsCS)))
+		return 1;
 
-	CreateStructuredBuffer(gEDevice, sizeof(unsigned int), MAX_CELLS, nullptr, &unsortedSumBuffer);
-	CreateBufferUAV(gEDevice, unsortedSumBuffer, &uavUnsortedSumBuffer);
+	if (FAILED(CreateComputeShader(L"../source/engine/hlsl/Grid_CS.hlsl", "orderCells", gEDevice, &orderCellsCS)))
+		return 1;
 
 	std::array<UINT, 2> iterInit = { 1, DOUBLE_THREAD_GROUP_SIZE };
 	CreateConstantBuffer(gEDevice, sizeof(unsigned int), 2, &iterInit, &sortingStageBuffer);
 
-	CreateStructuredBuffer(gEDevice, sizeof(Boid), MAX_BOIDS, nullptr, &boidsIn);
-	CreateBufferUAV(gEDevice, boidsIn, &uavBoidsIn);
+	std::array<UINT, 4> stepInit = { 0, 0, 0, 0 };
+	CreateConstantBuffer(gEDevice, sizeof(unsigned int), 4, &stepInit, &simulationStepBuffer);
 
-	CreateStructuredBuffer(gEDevice, sizeof(Boid), MAX_BOIDS, nullptr, &boidsOut);
-	CreateBufferUAV(gEDevice, boidsOut, &uavBoidsOut);
-	CreateBufferSRV(gEDevice, boidsOut, &srvBoidsOut);
+	InstanceBufferData instanceInit = {};
+	CreateConstantBuffer(gEDevice, sizeof(InstanceBufferData), 1, &instanceInit, &instanceBuffer);
+
+	ID3D11Buffer* constantBuffers[2] = { sortingStageBuffer, simulationStepBuffer };
+	gEContext->CSSetConstantBuffers(1, 2, constantBuffers);
+
+	//Only for the deterministic cost shown in the UI, the cell ordering runs untimed without them
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	gEDevice->CreateQuery(&queryDesc, &orderCellsDisjointQuery);
+	queryDesc.Query = D3D11_QUERY_TIMESTAMP;
+	gEDevice->CreateQuery(&queryDesc, &orderCellsStartQuery);
+	gEDevice->CreateQuery(&queryDesc, &orderCellsEndQuery);
 	
 	return 0;
 }
 
+void BoidComputer::SetBackend(const SimulationBackend aBackend, const UINT aCPUThreadCount)
+{
+	if (aBackend == SimulationBackend::CPU && backend != aBackend)
+	{
+		cpuComputer.Init(aCPUThreadCount);
+		//The CPU backend keeps the boids and cells on the host
+		ReleaseBoidBuffers();
+		ReleaseCellBuffers();
+	}
+	else if (aBackend == SimulationBackend::GPU && backend != aBackend)
+		cpuComputer.UnInit();
+
+	if (backend != aBackend)
+		gridBinned = false;
+	backend = aBackend;
+}
+
+void BoidComputer::SetCPUThreadCount(const UINT aCPUThreadCount)
+{
+	if (backend == SimulationBackend::CPU)
+		cpuComputer.SetThreadCount(aCPUThreadCount);
+}
+
+void BoidComputer::SetCPULayout(const BoidLayout aLayout)
+{
+	cpuComputer.SetLayout(aLayout);
+}
+
+void BoidComputer::SetCPUInstructionSet(const InstructionSet aInstructionSet)
+{
+	cpuComputer.SetInstructionSet(aInstructionSet);
+}
+
+void BoidComputer::SetCPUStableSort(const bool aStableSort)
+{
+	cpuComputer.SetStableSort(aStableSort);
+}
+
+void BoidComputer::SetCPUWorkStealing(const bool aWorkStealing)
+{
+	cpuComputer.SetWorkStealing(aWorkStealing);
+}
+
+void BoidComputer::SetCPUCellOrder(const CellOrder aCellOrder)
+{
+	cpuComputer.SetCellOrder(aCellOrder);
+}
+
+void BoidComputer::SetCPUIncrementalRebin(const bool aIncrementalRebin)
+{
+	cpuComputer.SetIncrementalRebin(aIncrementalRebin);
+}
+
+void BoidComputer::SetCPUHalfShell(const bool aHalfShell)
+{
+	cpuComputer.SetHalfShell(aHalfShell);
+}
+
+void BoidComputer::SetCPUCellCulling(const bool aCellCulling)
+{
+	cpuComputer.SetCellCulling(aCellCulling);
+}
+
+void BoidComputer::SetCPUNeighbourLists(const bool aNeighbourLists, const float aSkin, const int aBudgetMB)
+{
+	cpuComputer.SetNeighbourLists(aNeighbourLists, aSkin, (size_t)(aBudgetMB > 0 ? aBudgetMB : 0) * 1024 * 1024);
+}
+
+void BoidComputer::SetCPUStepBounds(const bool aStepBounds)
+{
+	cpuComputer.SetStepBounds(aStepBounds);
+}
+
+void BoidComputer::SetGPULazyGrid(const bool aLazyGrid, const int aMaxFrames)
+{
+	lazyGrid = aLazyGrid;
+	lazyGridMaxFrames = aMaxFrames > 0 ? (UINT)aMaxFrames : 0;
+	gridBinned = false;
+}
+
+void BoidComputer::SetCapacity(const SimulationCapacity& aCapacity)
+{
+	capacity = aCapacity;
+	cpuComputer.SetCapacity(aCapacity);
+}
+
+void BoidComputer::SetRenderInterpolation(const bool aRenderInterpolation)
+{
+	renderInterpolation = aRenderInterpolation;
+}
+
 void BoidComputer::InitBoidTransforms()
 {
-	ID3D11UnorderedAccessView* aUAVViews[2] = { uavBoidsIn, uavBoidsOut };
-	RunComputeShader(initBoidCS, 0, 0, nullptr, 0, 2, aUAVViews,
-		(MAX_BOIDS + THREAD_GROUP_SIZE - 1) / THREAD_GROUP_SIZE, 1, 1);
+	gridBinned = false;
+
+	const FrameBufferData& frameBufferData = graphicsEngine->GetFrameBufferData();
+	if (backend == SimulationBackend::CPU)
+	{
+		cpuComputer.InitBoidTransforms(frameBufferData);
+		UploadCPUInstances(frameBufferData);
+		return;
+	}
 
-	gEContext->CSSetConstantBuffers(1, 1, &sortingStageBuffer);
+	EnsureBoidBuffers(frameBufferData.boidCount);
+	InitBoids(0, boidCapacity);
+	SetRenderBuffers();
+	lodStep = 0;
+	PackInstances(frameBufferData);
 }
 
 
 void BoidComputer::RunBoidsGPUGridded(const UINT aBoidCount, const UINT aCellCount)
 {
+	EnsureBoidBuffers(aBoidCount);
+	EnsureCellBuffers(aCellCount);
 	ID3D11UnorderedAccessView* aUAVViews[4] = { uavBoidsIn, uavBoidsOut, uavSumBuffer, uavUnsortedSumBuffer };
 
 	UINT threadGroupCell = (aCellCount + THREAD_GROUP_SIZE - 1) / THREAD_GROUP_SIZE;
 	threadGroupCell;
 	UINT threadGroupBoid = (aBoidCount + THREAD_GROUP_SIZE - 1) / THREAD_GROUP_SIZE;
-	UINT clearAllDispatch = (MAX_CELLS + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
+	UINT clearDispatch = (aCellCount + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
+
+	const FrameBufferData& frameBufferData = graphicsEngine->GetFrameBufferData();
+	const bool rebuildGrid = NeedsGridRebuild(frameBufferData);
 
 	gEContext->CSSetUnorderedAccessViews(0, 4, aUAVViews, nullptr);
 
-	gEContext->CSSetShader(clearCS, nullptr, 0);
-	gEContext->Dispatch(clearAllDispatch, 1, 1);
+	//Compared to clearing both sum buffers over all allocated cells, which the clear did before it was bounded by the cell count
+	clearedBytes = rebuildGrid ? (size_t)aCellCount * sizeof(unsigned int) : 0;
+	clearBytesSaved = rebuildGrid ? (size_t)cellCapacity * 2 * sizeof(unsigned int) - clearedBytes : 0;
 
-	gEContext->CSSetShader(countCS, nullptr, 0);
-	gEContext->Dispatch(threadGroupBoid, 1, 1);
+	if (!rebuildGrid)
+	{
+		//The boids are still in the slots of the last sort, so the cell ranges in sumBuffer hold
+		gEContext->CSSetShader(copyBoidsCS, nullptr, 0);
+		gEContext->Dispatch(threadGroupBoid, 1, 1);
+	}
+	else
+	{
+		gEContext->CSSetShader(clearCS, nullptr, 0);
+		gEContext->Dispatch(clearDispatch, 1, 1);
+
+		gEContext->CSSetShader(countCS, nullptr, 0);
+		gEContext->Dispatch(threadGroupBoid, 1, 1);
 
 #define PARALLEL_SUM
 #ifdef PARALLEL_SUM
 #define PARALLEL_BLOCK
 #ifdef PARALLEL_BLOCK
 
-	UINT halfThreadGroupCell = (aCellCount + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
-	UINT coverage = 1;
-	UINT dispatch = halfThreadGroupCell;
-	float groupsToHandle = (float)aCellCount;
+		UINT halfThreadGroupCell = (aCellCount + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
+		UINT coverage = 1;
+		UINT dispatch = halfThreadGroupCell;
+		float groupsToHandle = (float)aCellCount;
 
-	gEContext->CSSetShader(sweepCS, nullptr, 0);
-	while (coverage < aCellCount)
-	{
-		gEContext->Dispatch(dispatch, 1, 1);
-		coverage *= DOUBLE_THREAD_GROUP_SIZE;
-		if (coverage < aCellCount)
+		gEContext->CSSetShader(sweepCS, nullptr, 0);
+		while (coverage < aCellCount)
 		{
-			groupsToHandle = groupsToHandle / (float)DOUBLE_THREAD_GROUP_SIZE;
-			dispatch = ((UINT)groupsToHandle + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
-			std::array<UINT, 2> iterInit = { coverage, coverage * coverage };
-			gEContext->UpdateSubresource(sortingStageBuffer, 0, nullptr, &iterInit, 0, 0);
+			gEContext->Dispatch(dispatch, 1, 1);
+			coverage *= DOUBLE_THREAD_GROUP_SIZE;
+			if (coverage < aCellCount)
+			{
+				groupsToHandle = groupsToHandle / (float)DOUBLE_THREAD_GROUP_SIZE;
+				dispatch = ((UINT)groupsToHandle + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
+				std::array<UINT, 2> iterInit = { coverage, coverage * coverage };
+				gEContext->UpdateSubresource(sortingStageBuffer, 0, nullptr, &iterInit, 0, 0);
+			}
 		}
-	}
 	
-	//Check to see if multiple dispatches were made
-	if (DOUBLE_THREAD_GROUP_SIZE < aCellCount)
-		coverage /= DOUBLE_THREAD_GROUP_SIZE;
+		//Check to see if multiple dispatches were made
+		if (DOUBLE_THREAD_GROUP_SIZE < aCellCount)
+			coverage /= DOUBLE_THREAD_GROUP_SIZE;
 		
-	gEContext->CSSetShader(groupBlockSumCS, nullptr, 0);
+		gEContext->CSSetShader(groupBlockSumCS, nullptr, 0);
 	
-	while (coverage > 1)
-	{
-		UINT lastCoverage = coverage;
-		coverage /= DOUBLE_THREAD_GROUP_SIZE;
-		std::array<UINT, 2> iterInit = { coverage, lastCoverage };
-		gEContext->UpdateSubresource(sortingStageBuffer, 0, nullptr, &iterInit, 0, 0);
-		groupsToHandle *= DOUBLE_THREAD_GROUP_SIZE;
-		dispatch = ((UINT)(groupsToHandle - 1.f) + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
-		gEContext->Dispatch(dispatch, 1, 1);
-	}
+		while (coverage > 1)
+		{
+			UINT lastCoverage = coverage;
+			coverage /= DOUBLE_THREAD_GROUP_SIZE;
+			std::array<UINT, 2> iterInit = { coverage, lastCoverage };
+			gEContext->UpdateSubresource(sortingStageBuffer, 0, nullptr, &iterInit, 0, 0);
+			groupsToHandle *= DOUBLE_THREAD_GROUP_SIZE;
+			dispatch = ((UINT)(groupsToHandle - 1.f) + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
+			gEContext->Dispatch(dispatch, 1, 1);
+		}
 #else
-	UINT halfThreadGroupCell = (aCellCount + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
-	gEContext->CSSetShader(sweepCS, nullptr, 0);
-	gEContext->Dispatch(halfThreadGroupCell, 1, 1);
-	gEContext->CSSetShader(blockSumCS, nullptr, 0);
-	gEContext->Dispatch(1, 1, 1);
+		UINT halfThreadGroupCell = (aCellCount + DOUBLE_THREAD_GROUP_SIZE - 1) / DOUBLE_THREAD_GROUP_SIZE;
+		gEContext->CSSetShader(sweepCS, nullptr, 0);
+		gEContext->Dispatch(halfThreadGroupCell, 1, 1);
+		gEContext->CSSetShader(blockSumCS, nullptr, 0);
+		gEContext->Dispatch(1, 1, 1);
 #endif //PARALLEL_BLOCK
 #else
-	gEContext->CSSetShader(sumCS, nullptr, 0);
-	gEContext->Dispatch(1, 1, 1);
+		gEContext->CSSetShader(sumCS, nullptr, 0);
+		gEContext->Dispatch(1, 1, 1);
 #endif // PARALLEL_SUM
 
-	gEContext->CSSetShader(copyCS, nullptr, 0);
-	gEContext->Dispatch(threadGroupCell, 1, 1);
+		gEContext->CSSetShader(copyCS, nullptr, 0);
+		gEContext->Dispatch(threadGroupCell, 1, 1);
 
-	gEContext->CSSetShader(sortBoidsCS, nullptr, 0);
-	gEContext->Dispatch(threadGroupBoid, 1, 1);
+		gEContext->CSSetShader(sortBoidsCS, nullptr, 0);
+		gEContext->Dispatch(threadGroupBoid, 1, 1);
+
+		//The atomic sort fills a cell in a different order every run, the neighbour sums follow the slots.
+		//The ordered boids go to boidsOut, which the step overwrites anyway, and are copied back.
+		if (frameBufferData.deterministic)
+		{
+			const bool timed = orderCellsDisjointQuery != nullptr && orderCellsStartQuery != nullptr && orderCellsEndQuery != nullptr;
+			if (timed)
+			{
+				gEContext->Begin(orderCellsDisjointQuery);
+				gEContext->End(orderCellsStartQuery);
+			}
+			gEContext->CSSetShader(orderCellsCS, nullptr, 0);
+			gEContext->Dispatch(threadGroupBoid, 1, 1);
+			gEContext->CSSetShader(copyBoidsCS, nullptr, 0);
+			gEContext->Dispatch(threadGroupBoid, 1, 1);
+			if (timed)
+			{
+				gEContext->End(orderCellsEndQuery);
+				gEContext->End(orderCellsDisjointQuery);
+				orderCellsQueued = true;
+			}
+		}
+	}
+
+	std::array<UINT, 4> stepData = { lodStep, 0, 0, 0 };
+	gEContext->UpdateSubresource(simulationStepBuffer, 0, nullptr, &stepData, 0, 0);
+	lodStep++;
 
 	gEContext->CSSetShader(runBoidGriddedCS, nullptr, 0);
 	gEContext->Dispatch(threadGroupBoid, 1, 1);
@@ -160,29 +325,393 @@ void BoidComputer::RunBoidsGPUGridded(const UINT aBoidCount, const UINT aCellCou
 	gEContext->CSSetShader(nullptr, nullptr, 0);
 	ID3D11UnorderedAccessView* uavNull[4] = { nullptr, nullptr, nullptr, nullptr };
 	gEContext->CSSetUnorderedAccessViews(0, 4, uavNull, nullptr);
+	SetRenderBuffers();
+	PackInstances(frameBufferData);
+
+	if (rebuildGrid)
+	{
+		gridBinned = true;
+		staleGridFrames = 0;
+		gridDisplacement = 0.f;
+		binnedFrame = frameBufferData;
+	}
+	else
+	{
+		staleGridFrames++;
+	}
+
+	//ClampVels caps the speed before gravity is added, so no boid moves further than this in the step
+	const float maxSpeed = frameBufferData.maxSpeed > frameBufferData.minSpeed ? frameBufferData.maxSpeed : frameBufferData.minSpeed;
+	gridDisplacement += (maxSpeed + std::abs(frameBufferData.gravity)) * frameBufferData.deltaTime;
 }
 
 void BoidComputer::RunBoidsGPU(const UINT aBoidCount)
 {
+	gridBinned = false;
+	clearedBytes = 0;
+	clearBytesSaved = 0;
+	EnsureBoidBuffers(aBoidCount);
 	ID3D11UnorderedAccessView* aUAVViews[3] = { uavBoidsIn, uavBoidsOut, uavSumBuffer };
 	RunComputeShader(runBoidCS, 0, 0, nullptr, 0, 3, aUAVViews,
 		(aBoidCount + THREAD_GROUP_SIZE - 1) / THREAD_GROUP_SIZE, 1, 1);
+	SetRenderBuffers();
+	PackInstances(graphicsEngine->GetFrameBufferData());
+}
+
+void BoidComputer::RunBoidsCPUGridded()
+{
+	const FrameBufferData& frameBufferData = graphicsEngine->GetFrameBufferData();
+	cpuComputer.RunBoidsCPUGridded(frameBufferData);
+	UploadCPUInstances(frameBufferData);
+}
+
+void BoidComputer::RunBoidsCPU()
+{
+	const FrameBufferData& frameBufferData = graphicsEngine->GetFrameBufferData();
+	cpuComputer.RunBoidsCPU(frameBufferData);
+	UploadCPUInstances(frameBufferData);
 }
 
 void BoidComputer::SwapBuffers()
 {
-	std::swap(uavBoidsIn, uavBoidsOut);
+	if (backend == SimulationBackend::CPU)
+		cpuComputer.SwapBuffers();
+	else
+	{
+		//The buffers move with their views, so boidsOut stays the buffer uavBoidsOut writes to
+		std::swap(boidsIn, boidsOut);
+		std::swap(uavBoidsIn, uavBoidsOut);
+		std::swap(srvBoidsIn, srvBoidsOut);
+	}
+}
+
+unsigned long long BoidComputer::GetStateHash(const UINT aBoidCount)
+{
+	if (backend == SimulationBackend::CPU)
+		return cpuComputer.GetStats().stateHash;
+
+	//Reads the boids of the last step back, which waits for the GPU to finish everything queued so far
+	const UINT boidCount = aBoidCount < boidCapacity ? aBoidCount : boidCapacity;
+	if (boidCount == 0)
+		return StateHash::Finish(0, 0);
+	if (srvRenderCurrent == nullptr)
+		return 0;
+
+	const auto readbackStart = std::chrono::steady_clock::now();
+
+	if (stateReadbackCount < boidCount)
+	{
+		SAFE_RELEASE(stateReadbackBuffer);
+		stateReadbackCount = 0;
+
+		D3D11_BUFFER_DESC desc = {};
+		desc.ByteWidth = (UINT)(boidCount * sizeof(Boid));
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		if (FAILED(gEDevice->CreateBuffer(&desc, nullptr, &stateReadbackBuffer)))
+			return 0;
+		stateReadbackCount = boidCount;
+	}
+
+	ID3D11Resource* current = nullptr;
+	srvRenderCurrent->GetResource(&current);
+	D3D11_BOX box = {};
+	box.right = boidCount * sizeof(Boid);
+	box.bottom = 1;
+	box.back = 1;
+	gEContext->CopySubresourceRegion(stateReadbackBuffer, 0, 0, 0, 0, current, 0, &box);
+	SAFE_RELEASE(current);
+
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	if (FAILED(gEContext->Map(stateReadbackBuffer, 0, D3D11_MAP_READ, 0, &mappedResource)))
+		return 0;
+
+	const Boid* boids = (const Boid*)mappedResource.pData;
+	unsigned long long hashSum = 0;
+	for (UINT i = 0; i < boidCount; i++)
+	{
+		hashSum += StateHash::HashBoid(boids[i]);
+	}
+	gEContext->Unmap(stateReadbackBuffer, 0);
+	stateReadbackMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - readbackStart).count();
+
+	//The readback waited for the cell ordering too, so its timestamps are ready unless the queries were dropped
+	if (orderCellsQueued)
+	{
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint = {};
+		UINT64 orderStart = 0;
+		UINT64 orderEnd = 0;
+		if (gEContext->GetData(orderCellsDisjointQuery, &disjoint, sizeof(disjoint), 0) == S_OK &&
+			gEContext->GetData(orderCellsStartQuery, &orderStart, sizeof(orderStart), 0) == S_OK &&
+			gEContext->GetData(orderCellsEndQuery, &orderEnd, sizeof(orderEnd), 0) == S_OK)
+		{
+			orderCellsMs = !disjoint.Disjoint && disjoint.Frequency > 0 ? (float)((double)(orderEnd - orderStart) * 1000.0 / (double)disjoint.Frequency) : 0.f;
+		}
+		orderCellsQueued = false;
+	}
+
+	return StateHash::Finish(hashSum, boidCount);
 }
 
 void BoidComputer::BindStructuredBuffer()
 {
-	gEContext->VSSetShaderResources(0, 1, &srvBoidsOut);
+	ID3D11ShaderResourceView* srvInstances[2] = { srvInstancesCurrent, renderInterpolation ? srvInstancesPrevious : srvInstancesCurrent };
+	gEContext->VSSetShaderResources(2, 2, srvInstances);
+	gEContext->VSSetConstantBuffers(3, 1, &instanceBuffer);
 }
 
 void BoidComputer::UnbindStructuredBuffer()
 {
-	ID3D11ShaderResourceView* srvNull[1] = { nullptr };
-	gEContext->VSSetShaderResources(0, 1, srvNull);
+	ID3D11ShaderResourceView* srvNull[2] = { nullptr, nullptr };
+	gEContext->VSSetShaderResources(2, 2, srvNull);
+	ID3D11Buffer* bufferNull = nullptr;
+	gEContext->VSSetConstantBuffers(3, 1, &bufferNull);
+}
+
+SimulationBackend BoidComputer::GetBackend() const
+{
+	return backend;
+}
+
+const CPUSimulationStats& BoidComputer::GetCPUStats() const
+{
+	return cpuComputer.GetStats();
+}
+
+UINT BoidComputer::GetGPUStaleGridFrames() const
+{
+	return staleGridFrames;
+}
+
+size_t BoidComputer::GetGPUClearedBytes() const
+{
+	return clearedBytes;
+}
+
+size_t BoidComputer::GetGPUClearBytesSaved() const
+{
+	return clearBytesSaved;
+}
+
+float BoidComputer::GetGPUOrderCellsMs() const
+{
+	return orderCellsMs;
+}
+
+float BoidComputer::GetGPUStateReadbackMs() const
+{
+	return stateReadbackMs;
+}
+
+UINT BoidComputer::GetBoidCapacity() const
+{
+	return instancesCurrent != nullptr ? boidCapacity : 0;
+}
+
+size_t BoidComputer::GetBufferBytes() const
+{
+	size_t bytes = (size_t)cellCapacity * 2 * sizeof(unsigned int);
+	if (boidsIn != nullptr)
+		bytes += (size_t)boidCapacity * 2 * sizeof(Boid);
+	if (instancesCurrent != nullptr)
+		bytes += (size_t)boidCapacity * 2 * sizeof(RenderInstance);
+	return bytes;
+}
+
+UINT BoidComputer::GetCPUThreadCount() const
+{
+	return cpuComputer.GetThreadCount();
+}
+
+InstructionSet BoidComputer::GetCPUInstructionSet() const
+{
+	return cpuComputer.GetInstructionSet();
+}
+
+void BoidComputer::EnsureBoidBuffers(const UINT aBoidCount)
+{
+	//The CPU backend simulates on the host, it only needs the render instances
+	const bool simulationBuffers = backend == SimulationBackend::GPU;
+	const UINT newCapacity = SimulationFrameData::GetBufferCapacity(boidCapacity, aBoidCount, capacity.maxBoids);
+	if (newCapacity == boidCapacity && (boidsIn != nullptr) == simulationBuffers && instancesCurrent != nullptr)
+		return;
+
+	//The boids in the slots both buffers have are copied over, the slots a grown buffer adds are initialized
+	ID3D11Buffer* newBoidsIn = nullptr;
+	ID3D11Buffer* newBoidsOut = nullptr;
+	UINT keptBoids = 0;
+	if (simulationBuffers && newCapacity > 0
+		&& SUCCEEDED(CreateStructuredBuffer(gEDevice, sizeof(Boid), newCapacity, nullptr, &newBoidsIn))
+		&& SUCCEEDED(CreateStructuredBuffer(gEDevice, sizeof(Boid), newCapacity, nullptr, &newBoidsOut)))
+	{
+		keptBoids = boidsIn != nullptr ? (boidCapacity < newCapacity ? boidCapacity : newCapacity) : 0;
+		if (keptBoids > 0)
+		{
+			D3D11_BOX box = {};
+			box.right = keptBoids * sizeof(Boid);
+			box.bottom = 1;
+			box.back = 1;
+			gEContext->CopySubresourceRegion(newBoidsIn, 0, 0, 0, 0, boidsIn, 0, &box);
+			gEContext->CopySubresourceRegion(newBoidsOut, 0, 0, 0, 0, boidsOut, 0, &box);
+		}
+	}
+	else
+	{
+		SAFE_RELEASE(newBoidsIn);
+		SAFE_RELEASE(newBoidsOut);
+	}
+
+	ReleaseBoidBuffers();
+	if (newCapacity == 0)
+		return;
+
+	//Packed again at the end of every step, so the instances start out empty
+	if (FAILED(CreateStructuredBuffer(gEDevice, sizeof(RenderInstance), newCapacity, nullptr, &instancesCurrent))
+		|| FAILED(CreateStructuredBuffer(gEDevice, sizeof(RenderInstance), newCapacity, nullptr, &instancesPrevious)))
+	{
+		SAFE_RELEASE(newBoidsIn);
+		SAFE_RELEASE(newBoidsOut);
+		ReleaseBoidBuffers();
+		return;
+	}
+	CreateBufferUAV(gEDevice, instancesCurrent, &uavInstancesCurrent);
+	CreateBufferSRV(gEDevice, instancesCurrent, &srvInstancesCurrent);
+	CreateBufferUAV(gEDevice, instancesPrevious, &uavInstancesPrevious);
+	CreateBufferSRV(gEDevice, instancesPrevious, &srvInstancesPrevious);
+	boidCapacity = newCapacity;
+
+	if (newBoidsIn != nullptr)
+	{
+		boidsIn = newBoidsIn;
+		boidsOut = newBoidsOut;
+		CreateBufferUAV(gEDevice, boidsIn, &uavBoidsIn);
+		CreateBufferSRV(gEDevice, boidsIn, &srvBoidsIn);
+		CreateBufferUAV(gEDevice, boidsOut, &uavBoidsOut);
+		CreateBufferSRV(gEDevice, boidsOut, &srvBoidsOut);
+		InitBoids(keptBoids, boidCapacity);
+	}
+	SetRenderBuffers();
+}
+
+void BoidComputer::EnsureCellBuffers(const UINT aCellCount)
+{
+	const UINT newCapacity = SimulationFrameData::GetBufferCapacity(cellCapacity, aCellCount, capacity.maxCells);
+	if (newCapacity == cellCapacity && sumBuffer != nullptr)
+		return;
+
+	//Every gridded step that bins writes the cell ranges anew, only the lazy grid has to rebuild them
+	ReleaseCellBuffers();
+	gridBinned = false;
+	if (newCapacity == 0
+		|| FAILED(CreateStructuredBuffer(gEDevice, sizeof(unsigned int), newCapacity, nullptr, &sumBuffer))
+		|| FAILED(CreateStructuredBuffer(gEDevice, sizeof(unsigned int), newCapacity, nullptr, &unsortedSumBuffer)))
+	{
+		ReleaseCellBuffers();
+		return;
+	}
+	CreateBufferUAV(gEDevice, sumBuffer, &uavSumBuffer);
+	CreateBufferUAV(gEDevice, unsortedSumBuffer, &uavUnsortedSumBuffer);
+	cellCapacity = newCapacity;
+}
+
+void BoidComputer::ReleaseBoidBuffers()
+{
+	SAFE_RELEASE(uavBoidsIn);
+	SAFE_RELEASE(srvBoidsIn);
+	SAFE_RELEASE(uavBoidsOut);
+	SAFE_RELEASE(srvBoidsOut);
+	SAFE_RELEASE(boidsIn);
+	SAFE_RELEASE(boidsOut);
+	SAFE_RELEASE(uavInstancesCurrent);
+	SAFE_RELEASE(srvInstancesCurrent);
+	SAFE_RELEASE(uavInstancesPrevious);
+	SAFE_RELEASE(srvInstancesPrevious);
+	SAFE_RELEASE(instancesCurrent);
+	SAFE_RELEASE(instancesPrevious);
+	boidCapacity = 0;
+	SetRenderBuffers();
+}
+
+void BoidComputer::ReleaseCellBuffers()
+{
+	SAFE_RELEASE(uavSumBuffer);
+	SAFE_RELEASE(uavUnsortedSumBuffer);
+	SAFE_RELEASE(sumBuffer);
+	SAFE_RELEASE(unsortedSumBuffer);
+	cellCapacity = 0;
+}
+
+void BoidComputer::InitBoids(const UINT aBegin, const UINT aEnd)
+{
+	if (aEnd <= aBegin || uavBoidsIn == nullptr)
+		return;
+
+	std::array<UINT, 4> stepData = { lodStep, aBegin, aEnd, 0 };
+	gEContext->UpdateSubresource(simulationStepBuffer, 0, nullptr, &stepData, 0, 0);
+	ID3D11UnorderedAccessView* aUAVViews[2] = { uavBoidsIn, uavBoidsOut };
+	RunComputeShader(initBoidCS, 0, 0, nullptr, 0, 2, aUAVViews,
+		(aEnd - aBegin + THREAD_GROUP_SIZE - 1) / THREAD_GROUP_SIZE, 1, 1);
+}
+
+void BoidComputer::PackInstances(const FrameBufferData& aFrameBufferData)
+{
+	//Packed with the range of this step, the vertex shader unpacks with the same range even if the bounds change before the next one
+	const InstanceBufferData packing = RenderInstances::GetPacking(aFrameBufferData);
+	gEContext->UpdateSubresource(instanceBuffer, 0, nullptr, &packing, 0, 0);
+	gEContext->CSSetConstantBuffers(3, 1, &instanceBuffer);
+
+	UINT boidCount = aFrameBufferData.boidCount < boidCapacity ? aFrameBufferData.boidCount : boidCapacity;
+	UINT threadGroupBoid = (boidCount + THREAD_GROUP_SIZE - 1) / THREAD_GROUP_SIZE;
+	if (threadGroupBoid == 0)
+		return;
+
+	RunComputeShader(packInstancesCS, 0, 1, &srvRenderCurrent, 4, 1, &uavInstancesCurrent, threadGroupBoid, 1, 1);
+	if (renderInterpolation)
+		RunComputeShader(packInstancesCS, 0, 1, &srvRenderPrevious, 4, 1, &uavInstancesPrevious, threadGroupBoid, 1, 1);
+}
+
+void BoidComputer::UploadCPUInstances(const FrameBufferData& aFrameBufferData)
+{
+	//Only the 12 byte instances go to the GPU, the CPU result is packed straight from its layout
+	EnsureBoidBuffers(aFrameBufferData.boidCount);
+	UINT boidCount = aFrameBufferData.boidCount < GetBoidCapacity() ? aFrameBufferData.boidCount : GetBoidCapacity();
+	if (boidCount == 0)
+		return;
+
+	const InstanceBufferData packing = RenderInstances::GetPacking(aFrameBufferData);
+	gEContext->UpdateSubresource(instanceBuffer, 0, nullptr, &packing, 0, 0);
+
+	D3D11_BOX box = {};
+	box.right = boidCount * sizeof(RenderInstance);
+	box.bottom = 1;
+	box.back = 1;
+	gEContext->UpdateSubresource(instancesCurrent, 0, &box, cpuComputer.PackRenderInstances(aFrameBufferData, false), 0, 0);
+	if (renderInterpolation)
+		gEContext->UpdateSubresource(instancesPrevious, 0, &box, cpuComputer.PackRenderInstances(aFrameBufferData, true), 0, 0);
+}
+
+void BoidComputer::SetRenderBuffers()
+{
+	//Every pass reads boidsIn and writes boidsOut in the same slots, so the two hold the same boids one step apart
+	srvRenderCurrent = srvBoidsOut;
+	srvRenderPrevious = srvBoidsIn;
+}
+
+bool BoidComputer::NeedsGridRebuild(const FrameBufferData& aFrameBufferData) const
+{
+	const FrameBufferData& f = aFrameBufferData;
+	const FrameBufferData& b = binnedFrame;
+	if (!lazyGrid || !gridBinned || lazyGridMaxFrames <= staleGridFrames || f.lazyGridMargin <= 0.f)
+		return true;
+
+	//The cell ranges in sumBuffer belong to the boid count and cells of the build
+	if (f.boidCount != b.boidCount || f.cellSize != b.cellSize || f.lazyGridMargin != b.lazyGridMargin
+		|| f.minPos.x != b.minPos.x || f.minPos.y != b.minPos.y || f.minPos.z != b.minPos.z
+		|| f.gridDims.x != b.gridDims.x || f.gridDims.y != b.gridDims.y || f.gridDims.z != b.gridDims.z)
+		return true;
+
+	//The shader finds every neighbour as long as no boid is further than the margin from the cell it was binned in
+	return f.lazyGridMargin * LAZY_GRID_MARGIN_SLACK < gridDisplacement;
 }
 
 void BoidComputer::RunComputeShader(ID3D11ComputeShader* aComputeShader, UINT aSRVSlot, UINT aSRVCount, ID3D11ShaderResourceView** someSRV, UINT aUAVSlot, UINT aUAVCount, ID3D11UnorderedAccessView** someUAV, UINT X, UINT Y, UINT Z)
@@ -244,25 +773,30 @@ Boid* BoidComputer::DebugMapBoids(ID3D11Buffer** aBufffer)
 
 void BoidComputer::UnInit()
 {
-	SAFE_RELEASE(boidsIn);
-	SAFE_RELEASE(boidsOut);
-	SAFE_RELEASE(sumBuffer);
-	SAFE_RELEASE(unsortedSumBuffer);
-	SAFE_RELEASE(sortingStageBuffer);
+	cpuComputer.UnInit();
 
-	SAFE_RELEASE(uavBoidsIn);
-	SAFE_RELEASE(uavBoidsOut);
-	SAFE_RELEASE(srvBoidsOut);
-	SAFE_RELEASE(uavSumBuffer);
-	SAFE_RELEASE(uavUnsortedSumBuffer);
+	ReleaseBoidBuffers();
+	ReleaseCellBuffers();
+	SAFE_RELEASE(sortingStageBuffer);
+	SAFE_RELEASE(simulationStepBuffer);
+	SAFE_RELEASE(stateReadbackBuffer);
+	stateReadbackCount = 0;
+	SAFE_RELEASE(orderCellsDisjointQuery);
+	SAFE_RELEASE(orderCellsStartQuery);
+	SAFE_RELEASE(orderCellsEndQuery);
+	orderCellsQueued = false;
+	SAFE_RELEASE(instanceBuffer);
 
 	SAFE_RELEASE(runBoidCS);
 	SAFE_RELEASE(runBoidGriddedCS);
 	SAFE_RELEASE(initBoidCS);
+	SAFE_RELEASE(packInstancesCS);
 	SAFE_RELEASE(clearCS);
 	SAFE_RELEASE(countCS);
 	SAFE_RELEASE(sumCS);
 	SAFE_RELEASE(sortBoidsCS);
+	SAFE_RELEASE(copyBoidsCS);
+	SAFE_RELEASE(orderCellsCS);
 	SAFE_RELEASE(sweepCS);
 	SAFE_RELEASE(blockSumCS);
 	SAFE_RELEASE(copyCS);
@@ -1,4 +1,5 @@
 #pragma once
+#include "cpu/BoidComputerCPU.h"
 
 struct ID3D11Device;
 struct ID3D11DeviceContext;
@@ -6,24 +7,85 @@ struct ID3D11ComputeShader;
 struct ID3D11Buffer;
 struct ID3D11UnorderedAccessView;
 struct ID3D11ShaderResourceView;
+struct ID3D11Query;
 class GraphicsEngine;
 struct Boid;
 
 typedef unsigned int UINT;
 
+enum class SimulationBackend
+{
+	GPU,
+	CPU
+};
+
 class BoidComputer
 {
 public:
 	int Init(GraphicsEngine& aGraphicsEngine);
+	void SetBackend(const SimulationBackend aBackend, const UINT aCPUThreadCount);
+	void SetCPUThreadCount(const UINT aCPUThreadCount);
+	void SetCPULayout(const BoidLayout aLayout);
+	void SetCPUInstructionSet(const InstructionSet aInstructionSet);
+	void SetCPUStableSort(const bool aStableSort);
+	void SetCPUWorkStealing(const bool aWorkStealing);
+	void SetCPUCellOrder(const CellOrder aCellOrder);
+	void SetCPUIncrementalRebin(const bool aIncrementalRebin);
+	void SetCPUHalfShell(const bool aHalfShell);
+	void SetCPUCellCulling(const bool aCellCulling);
+	void SetCPUNeighbourLists(const bool aNeighbourLists, const float aSkin, const int aBudgetMB);
+	// Reduces the max speed and min separation of every CPU step into the stats, see SimulationFrameData::GetAdaptiveStepTime
+	void SetCPUStepBounds(const bool aStepBounds);
+	// Lets RunBoidsGPUGridded skip the clear/count/scan/sort for up to aMaxFrames steps.
+	// Only has an effect with a lazy grid margin in the frame buffer, which sets how far boids may move before a rebuild.
+	void SetGPULazyGrid(const bool aLazyGrid, const int aMaxFrames);
+	// Caps how far the buffers may grow past the boid and cell counts they are sized for, see SimulationFrameData::GetCapacity
+	void SetCapacity(const SimulationCapacity& aCapacity);
+	// Also packs the boids before the last step into render instances, so rendering can interpolate between the two steps
+	void SetRenderInterpolation(const bool aRenderInterpolation);
 	void InitBoidTransforms();
 	void RunBoidsGPUGridded(const UINT aBoidCount, const UINT aCellCount);
 	void RunBoidsGPU(const UINT aBoidCount);
+	void RunBoidsCPUGridded();
+	void RunBoidsCPU();
 	void SwapBuffers();
+	// StateHash of the boids after the last step. The CPU backend hashes deterministic frames as it runs them,
+	// the GPU backend reads the boids back for it and stalls until the queued steps are done. 0 if they can't be read back.
+	unsigned long long GetStateHash(const UINT aBoidCount);
+	// Binds the render instances packed at the end of the last step to the boid vertex shader
 	void BindStructuredBuffer();
 	void UnbindStructuredBuffer();
 	void UnInit();
 
+	SimulationBackend GetBackend() const;
+	const CPUSimulationStats& GetCPUStats() const;
+	UINT GetCPUThreadCount() const;
+	InstructionSet GetCPUInstructionSet() const;
+	// Steps since the GPU grid was last rebuilt
+	UINT GetGPUStaleGridFrames() const;
+	// Bytes the last gridded GPU step cleared, and how many fewer than a clear of both sum buffers over all allocated cells
+	size_t GetGPUClearedBytes() const;
+	size_t GetGPUClearBytesSaved() const;
+	// GPU time of the cell ordering the last deterministic gridded step added, 0 if it couldn't be timed
+	float GetGPUOrderCellsMs() const;
+	// Wall time of the last GPU GetStateHash, the stall for the queued steps included
+	float GetGPUStateReadbackMs() const;
+	// Boids the render instances have room for, rendering draws no more than this
+	UINT GetBoidCapacity() const;
+	// Bytes of the boid, render instance and sum buffers as they are allocated now
+	size_t GetBufferBytes() const;
+
 private:
+	void EnsureBoidBuffers(const UINT aBoidCount);
+	void EnsureCellBuffers(const UINT aCellCount);
+	void ReleaseBoidBuffers();
+	void ReleaseCellBuffers();
+	void InitBoids(const UINT aBegin, const UINT aEnd);
+	void PackInstances(const FrameBufferData& aFrameBufferData);
+	void UploadCPUInstances(const FrameBufferData& aFrameBufferData);
+	bool NeedsGridRebuild(const FrameBufferData& aFrameBufferData) const;
+	void SetRenderBuffers();
+
 	void RunComputeShader(ID3D11ComputeShader* aComputeShader,
 		UINT aSRVSlot, UINT aSRVCount, ID3D11ShaderResourceView** someSRV,
 		UINT aUAVSlot, UINT aUAVCount, ID3D11UnorderedAccessView** someUAV,
@@ -32,9 +94,13 @@ private:
 	Boid* DebugMapBoids(ID3D11Buffer** aBufffer);
 	unsigned int* DebugMapCounts(ID3D11Buffer** aBufffer);
 
+	GraphicsEngine* graphicsEngine = nullptr;
 	ID3D11Device* gEDevice = nullptr;
 	ID3D11DeviceContext* gEContext = nullptr;
 
+	SimulationBackend backend = SimulationBackend::GPU;
+	BoidComputerCPU cpuComputer;
+
 	//Grid_CS
 	ID3D11ComputeShader* countCS = nullptr;
 	ID3D11ComputeShader* sumCS = nullptr;
@@ -44,11 +110,14 @@ private:
 	ID3D11ComputeShader* clearCS = nullptr;
 	ID3D11ComputeShader* copyCS = nullptr;
 	ID3D11ComputeShader* sortBoidsCS = nullptr;
+	ID3D11ComputeShader* copyBoidsCS = nullptr;
+	ID3D11ComputeShader* orderCellsCS = nullptr;
 
 	//Boid_CS
 	ID3D11ComputeShader* initBoidCS = nullptr;
 	ID3D11ComputeShader* runBoidCS = nullptr;
 	ID3D11ComputeShader* runBoidGriddedCS = nullptr;
+	ID3D11ComputeShader* packInstancesCS = nullptr;
 
 	ID3D11Buffer* sumBuffer = nullptr;
 	ID3D11Buffer* unsortedSumBuffer = nullptr;
@@ -56,11 +125,56 @@ private:
 	ID3D11UnorderedAccessView* uavSumBuffer = nullptr;
 	ID3D11UnorderedAccessView* uavUnsortedSumBuffer = nullptr;
 
+	//Sized on demand, see SimulationFrameData::GetBufferCapacity. The CPU backend only has the render instances on the GPU.
+	SimulationCapacity capacity;
+	UINT boidCapacity = 0;
+	UINT cellCapacity = 0;
+
 	ID3D11Buffer* boidsIn = nullptr;
+	ID3D11ShaderResourceView* srvBoidsIn = nullptr;
 	ID3D11UnorderedAccessView* uavBoidsIn = nullptr;
 
 	ID3D11Buffer* boidsOut = nullptr;
 	ID3D11ShaderResourceView* srvBoidsOut = nullptr;
 	ID3D11UnorderedAccessView* uavBoidsOut = nullptr;
+
+	//Rendering, the output and input of the last step
+	bool renderInterpolation = true;
+	ID3D11ShaderResourceView* srvRenderCurrent = nullptr;
+	ID3D11ShaderResourceView* srvRenderPrevious = nullptr;
+
+	//The two steps packed into RenderInstances for the vertex shader, with the range they were quantized over
+	ID3D11Buffer* instancesCurrent = nullptr;
+	ID3D11ShaderResourceView* srvInstancesCurrent = nullptr;
+	ID3D11UnorderedAccessView* uavInstancesCurrent = nullptr;
+	ID3D11Buffer* instancesPrevious = nullptr;
+	ID3D11ShaderResourceView* srvInstancesPrevious = nullptr;
+	ID3D11UnorderedAccessView* uavInstancesPrevious = nullptr;
+	ID3D11Buffer* instanceBuffer = nullptr;
+
+	//Lazy grid rebuild
+	bool lazyGrid = false;
+	UINT lazyGridMaxFrames = 0;
+	bool gridBinned = false;
+	UINT staleGridFrames = 0;
+	float gridDisplacement = 0.f; //Bound on how far any boid has moved since the grid was built
+	FrameBufferData binnedFrame = {};
+	size_t clearedBytes = 0;
+	size_t clearBytesSaved = 0;
+
+	//Simulation LOD, the steps since init are uploaded before every gridded step to stagger the cell updates
+	ID3D11Buffer* simulationStepBuffer = nullptr;
+	UINT lodStep = 0;
+
+	//Deterministic mode, staging copy of the boids for GetStateHash
+	ID3D11Buffer* stateReadbackBuffer = nullptr;
+	UINT stateReadbackCount = 0;
+	float stateReadbackMs = 0.f;
+	//Timestamps around the cell ordering, read by GetStateHash once its readback has waited for them
+	ID3D11Query* orderCellsDisjointQuery = nullptr;
+	ID3D11Query* orderCellsStartQuery = nullptr;
+	ID3D11Query* orderCellsEndQuery = nullptr;
+	bool orderCellsQueued = false;
+	float orderCellsMs = 0.f;
 };
 
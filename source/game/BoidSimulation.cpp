@@ -6,16 +6,32 @@
 
 #include <imgui/imgui.h>
 #include <string>
+#include <climits>
+#include <cmath>
 
 #include "Boid.h"
+#include "util/SimulationFrameData.h"
 #include "commonUtilities/UtilityFunctions.h"
 #include "commonUtilities/Quaternion.h"
 
 using namespace CommonUtilities;
 constexpr float IMGUI_SPACING = 200.f;
-constexpr float MAX_BOIDS_PER_CELL = 50000;
 constexpr float MIN_FRAME_TIME = 10.f;
 
+static InstructionSet GetCPUInstructionSet(const CPUSettings& aCPUSettings)
+{
+	if (aCPUSettings.instructionSet < 0 || aCPUSettings.instructionSet >= (int)InstructionSet::Count)
+		return NeighbourKernel::GetBestSupported();
+	return (InstructionSet)aCPUSettings.instructionSet;
+}
+
+static BoidLayout GetCPULayout(const CPUSettings& aCPUSettings)
+{
+	if (aCPUSettings.compactStorage)
+		return BoidLayout::Compact;
+	return aCPUSettings.structureOfArrays ? BoidLayout::SoA : BoidLayout::AoS;
+}
+
 BoidSimulation::~BoidSimulation()
 {
 	myBoidComputer.UnInit();
@@ -62,7 +78,26 @@ bool BoidSimulation::InitBoidComputer()
 
 void BoidSimulation::ResetSimulation()
 {
+	SimulationBackend backend = mySimSettings.cpu.enabled ? SimulationBackend::CPU : SimulationBackend::GPU;
+	myBoidComputer.SetBackend(backend, (UINT)mySimSettings.cpu.threadCount);
+	myBoidComputer.SetCPULayout(GetCPULayout(mySimSettings.cpu));
+	myBoidComputer.SetCPUInstructionSet(GetCPUInstructionSet(mySimSettings.cpu));
+	myBoidComputer.SetCPUStableSort(mySimSettings.cpu.stableSort);
+	myBoidComputer.SetCPUWorkStealing(mySimSettings.cpu.workStealing);
+	myBoidComputer.SetCPUCellOrder((CellOrder)mySimSettings.cpu.cellOrder);
+	myBoidComputer.SetCPUIncrementalRebin(mySimSettings.cpu.incrementalRebin);
+	myBoidComputer.SetCPUHalfShell(mySimSettings.cpu.halfShell);
+	myBoidComputer.SetCPUCellCulling(mySimSettings.cpu.cellCulling);
+	myBoidComputer.SetCPUNeighbourLists(mySimSettings.cpu.neighbourLists, mySimSettings.cpu.neighbourListSkin, mySimSettings.cpu.neighbourListBudgetMB);
+	myBoidComputer.SetGPULazyGrid(mySimSettings.gpu.lazyGrid, mySimSettings.gpu.lazyGridMaxFrames);
+	myBoidComputer.SetRenderInterpolation(mySimSettings.fixedTimeStep && mySimSettings.renderInterpolation);
+	myBoidComputer.SetCPUStepBounds(mySimSettings.adaptiveTimeStep);
 	myBoidComputer.InitBoidTransforms();
+	myStepAccumulator = 0.f;
+	myStepTime = 0.f;
+	myStepCount = 0;
+	mySimulatedSteps = 0;
+	myStateHash = 0;
 
 	myFPSHaltFlag = false;
 	myAutoHaltFlag = false;
@@ -93,6 +128,26 @@ void BoidSimulation::BeginFrame(const float aDeltaTime, const float aUnscaledDel
 	}
 	myDeltaTime = aDeltaTime;
 	myFrame++;
+
+	if (!mySimSettings.fixedTimeStep)
+	{
+		myStepAccumulator = 0.f;
+		myStepTime = 0.f;
+		myStepCount = myDeltaTime != 0 ? 1 : 0;
+		return;
+	}
+
+	//Whole steps of the accumulated scaled time, the rest carries over and places rendering between the last two steps.
+	//The step time is kept for the whole frame since the frame buffer is only uploaded once.
+	myStepTime = GetStepTime();
+	const float stepTime = myStepTime;
+	const unsigned int maxSteps = mySimSettings.maxStepsPerFrame > 0 ? (unsigned int)mySimSettings.maxStepsPerFrame : 1;
+	myStepAccumulator += aDeltaTime > 0.f ? aDeltaTime : 0.f;
+	const unsigned int dueSteps = (unsigned int)(myStepAccumulator / stepTime);
+	myStepCount = dueSteps < maxSteps ? dueSteps : maxSteps;
+	myStepAccumulator -= (float)myStepCount * stepTime;
+	if (stepTime <= myStepAccumulator)
+		myStepAccumulator = std::fmod(myStepAccumulator, stepTime);
 }
 
 const SimulationMessage BoidSimulation::UpdateSimulationSettings()
@@ -117,19 +172,23 @@ const SimulationMessage BoidSimulation::UpdateSimulationSettings()
 		returnMsg = SimulationMessage::Reset;
 
 	ImGui::Text("BoidCount Count"); ImGui::SameLine(IMGUI_SPACING);
-	ImVec4 boidTextColor = mySimSettings.boidCount > MAX_BOIDS ?
+	ImVec4 boidTextColor = (unsigned int)mySimSettings.boidCount > myCapacity.maxBoids ?
 		ImVec4(1, 0, 0, 1) :
 		ImVec4(0, 1, 0, 1);
 	ImGui::TextColored(boidTextColor, std::to_string(mySimSettings.boidCount).c_str());
 
+	const bool hashedCells = mySimSettings.cpu.enabled && mySimSettings.cpu.cellOrder == (int)CellOrder::Hashed;
 	auto color = mySimSettings.griddingOn ?
-		(myCellCount == 0 || myCellCount > MAX_CELLS) ?
+		(!hashedCells && (myCellCount == 0 || myCellCount > myCapacity.maxCells)) ?
 			ImVec4(1, 0, 0, 1) :
 			ImVec4(0, 1, 0, 1) :
 		ImVec4(1, 1, 0, 1);
 	ImGui::Text("Cell Count"); ImGui::SameLine(IMGUI_SPACING);
 	ImGui::TextColored(color, std::to_string(myCellCount).c_str());
 
+	ImGui::Text("Buffers"); ImGui::SameLine(IMGUI_SPACING);
+	ImGui::Text("%.1f of %d MB", (double)myBoidComputer.GetBufferBytes() / (1024.0 * 1024.0), mySimSettings.memoryBudgetMB);
+
 	ImGui::Text("");
 	bool clicked = myPlayer.controlled ?
 		ImGui::Button("Control Camera") :
@@ -155,7 +214,8 @@ const SimulationMessage BoidSimulation::UpdateSimulationSettings()
 
 	if (ImGui::CollapsingHeader("Boid Settings"))
 	{
-		ImGui::DragInt("BoidCount", &mySimSettings.boidCount, 10.f, 0, MAX_BOIDS);
+		ImGui::DragInt("BoidCount", &mySimSettings.boidCount, 10.f, 0, myCapacity.maxBoids < (unsigned int)INT_MAX ? (int)myCapacity.maxBoids : INT_MAX);
+		ImGui::DragInt("Memory Budget (MB)", &mySimSettings.memoryBudgetMB, 1.f, 1, 1024 * 1024);
 		ImGui::DragFloat("Cohesion", &mySimSettings.cohesionFactor, 0.1f, 0, 100.f);
 		ImGui::DragFloat("Separation", &mySimSettings.separationFactor, 0.1f, 0, 100.f);
 		ImGui::DragFloat("Alignment", &mySimSettings.alignmentFactor, 0.1f, 0, 100.f);
@@ -166,15 +226,169 @@ const SimulationMessage BoidSimulation::UpdateSimulationSettings()
 		ImGui::DragFloat("Min Speed", &mySimSettings.minSpeed, 0.1f, 0.f, mySimSettings.maxSpeed);
 		ImGui::DragFloat("Gravity", &mySimSettings.gravity, 0.1f, 0.f, 100.f);
 	}
+	if (ImGui::CollapsingHeader("Time Step Settings"))
+	{
+		bool interpolationChanged = ImGui::Checkbox("Fixed Time Step", &mySimSettings.fixedTimeStep);
+		ImGui::DragInt("Steps Per Second", &mySimSettings.stepRate, 0.5f, 1, 1000);
+		ImGui::DragInt("Max Steps Per Frame", &mySimSettings.maxStepsPerFrame, 0.1f, 1, 100);
+		interpolationChanged |= ImGui::Checkbox("Interpolate Rendering", &mySimSettings.renderInterpolation);
+		if (interpolationChanged)
+			myBoidComputer.SetRenderInterpolation(mySimSettings.fixedTimeStep && mySimSettings.renderInterpolation);
+		if (ImGui::Checkbox("Adaptive Step (CPU)", &mySimSettings.adaptiveTimeStep))
+			myBoidComputer.SetCPUStepBounds(mySimSettings.adaptiveTimeStep);
+		ImGui::DragFloat("Step Range Fraction", &mySimSettings.adaptiveStepFraction, 0.005f, 0.01f, 1.f);
+		ImGui::DragFloat("Min Step Time", &mySimSettings.minStepTime, 0.0001f, 0.0001f, mySimSettings.maxStepTime, "%.4f");
+		ImGui::DragFloat("Max Step Time", &mySimSettings.maxStepTime, 0.0001f, mySimSettings.minStepTime, 1.f, "%.4f");
+		ImGui::Text("Steps this frame"); ImGui::SameLine(IMGUI_SPACING);
+		ImGui::Text(std::to_string(myStepCount).c_str());
+		ImGui::Text("Step time"); ImGui::SameLine(IMGUI_SPACING);
+		ImGui::Text(std::to_string(myStepTime).c_str());
+	}
+	if (ImGui::CollapsingHeader("LOD Settings"))
+	{
+		//Goes into the frame buffer through SimulationFrameData::Fill, only the gridded passes use it
+		ImGui::Checkbox("Simulation LOD", &mySimSettings.simulationLod);
+		ImGui::DragFloat("LOD Distance", &mySimSettings.lodDistance, 1.f, 1.f, 10000.f);
+		ImGui::DragInt("LOD Max Tier", &mySimSettings.lodMaxTier, 0.05f, 0, (int)MAX_LOD_TIER);
+		ImGui::Checkbox("Max tier outside the view", &mySimSettings.lodFrustum);
+		if (myBoidComputer.GetBackend() == SimulationBackend::CPU)
+		{
+			ImGui::Text("Skipped boids"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(std::to_string(myBoidComputer.GetCPUStats().lodSkippedBoids).c_str());
+		}
+	}
+	if (ImGui::CollapsingHeader("Reproducibility Settings"))
+	{
+		//Both go into the frame buffer through SimulationFrameData::Fill, the seed only takes effect on init
+		ImGui::Checkbox("Deterministic", &mySimSettings.deterministic);
+		if (ImGui::InputInt("Init Seed", &mySimSettings.initSeed))
+			returnMsg = SimulationMessage::Reset;
+		ImGui::Text("Steps"); ImGui::SameLine(IMGUI_SPACING);
+		ImGui::Text("%llu", mySimulatedSteps);
+		if (mySimSettings.deterministic)
+		{
+			ImGui::Text("State hash"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text("%016llx", myStateHash);
+		}
+		if (mySimSettings.deterministic && myBoidComputer.GetBackend() == SimulationBackend::CPU)
+		{
+			//The stable sort is forced on and the hash is part of the step, the normal times are from before deterministic was turned on
+			const CPUSimulationStats& stats = myBoidComputer.GetCPUStats();
+			ImGui::Text("Hash ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text("%.3f", stats.hashMs);
+			ImGui::Text("Step ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text("%.3f (normal %.3f)", stats.totalMs, myNormalStepMs);
+			ImGui::Text("Sort ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text("%.3f stable (normal %.3f %s)", stats.sortMs, myNormalSortMs, mySimSettings.cpu.stableSort ? "stable" : "atomic");
+		}
+		else if (mySimSettings.deterministic)
+		{
+			//A normal GPU step does neither, so these two are what deterministic mode adds to it
+			ImGui::Text("Order cells ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text("%.3f", myBoidComputer.GetGPUOrderCellsMs());
+			ImGui::Text("Readback ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text("%.3f", myBoidComputer.GetGPUStateReadbackMs());
+		}
+	}
 	if (ImGui::CollapsingHeader("Grid Settings"))
 	{
 		ImGui::Checkbox("Grid On", &mySimSettings.griddingOn);
-		ImGui::DragFloat("Cell Size Mult", &mySimSettings.cellSizeMult, 0.1f, 1.f, 100.f);
+		ImGui::DragFloat("Cell Size Mult", &mySimSettings.cellSizeMult, 0.05f, 1.f / (float)MAX_CELL_RINGS, 100.f);
 		ImGui::DragFloat3("Min Pos", &mySimSettings.minPos.x, 0.1f, -10000.f, 0.f);
 		ImGui::DragFloat3("Max Pos", &mySimSettings.maxPos.x, 0.1f, 0.f, 10000.f);
 		ImGui::DragFloat("Turn Speed", &mySimSettings.turnSpeed, 0.1f, 0.1f, 100.f);
 		ImGui::DragFloat("Turn Margin", &mySimSettings.turnMagin, 0.1f, 0.f, 100.f);
 	}
+	if (ImGui::CollapsingHeader("CPU Settings"))
+	{
+		if (ImGui::Checkbox("Simulate on CPU", &mySimSettings.cpu.enabled))
+			returnMsg = SimulationMessage::Reset;
+		ImGui::DragInt("Threads (0 = all cores)", &mySimSettings.cpu.threadCount, 0.1f, 0, 256);
+		if (ImGui::IsItemDeactivatedAfterEdit())
+			myBoidComputer.SetCPUThreadCount((UINT)mySimSettings.cpu.threadCount);
+		if (ImGui::Checkbox("Structure of arrays", &mySimSettings.cpu.structureOfArrays))
+			myBoidComputer.SetCPULayout(GetCPULayout(mySimSettings.cpu));
+		if (ImGui::Checkbox("Compact storage (row major)", &mySimSettings.cpu.compactStorage))
+			myBoidComputer.SetCPULayout(GetCPULayout(mySimSettings.cpu));
+		int kernelItem = mySimSettings.cpu.instructionSet + 1;
+		if (ImGui::Combo("SoA kernel", &kernelItem, "Auto\0Scalar\0SSE4\0AVX2\0AVX-512\0"))
+		{
+			mySimSettings.cpu.instructionSet = kernelItem - 1;
+			myBoidComputer.SetCPUInstructionSet(GetCPUInstructionSet(mySimSettings.cpu));
+		}
+		if (ImGui::Checkbox("Deterministic sort", &mySimSettings.cpu.stableSort))
+			myBoidComputer.SetCPUStableSort(mySimSettings.cpu.stableSort);
+		if (ImGui::Checkbox("Cost balanced work stealing", &mySimSettings.cpu.workStealing))
+			myBoidComputer.SetCPUWorkStealing(mySimSettings.cpu.workStealing);
+		if (ImGui::Combo("Cell keys", &mySimSettings.cpu.cellOrder, "Row major\0Morton\0Hashed\0Padded\0"))
+			myBoidComputer.SetCPUCellOrder((CellOrder)mySimSettings.cpu.cellOrder);
+		if (ImGui::Checkbox("Incremental rebinning", &mySimSettings.cpu.incrementalRebin))
+			myBoidComputer.SetCPUIncrementalRebin(mySimSettings.cpu.incrementalRebin);
+		if (ImGui::Checkbox("Half shell pairs (row major)", &mySimSettings.cpu.halfShell))
+			myBoidComputer.SetCPUHalfShell(mySimSettings.cpu.halfShell);
+		if (ImGui::Checkbox("Cell culling", &mySimSettings.cpu.cellCulling))
+			myBoidComputer.SetCPUCellCulling(mySimSettings.cpu.cellCulling);
+		bool neighbourListsChanged = ImGui::Checkbox("Verlet neighbour lists", &mySimSettings.cpu.neighbourLists);
+		neighbourListsChanged |= ImGui::DragFloat("List Skin", &mySimSettings.cpu.neighbourListSkin, 0.05f, 0.f, 100.f);
+		neighbourListsChanged |= ImGui::DragInt("List Budget MB", &mySimSettings.cpu.neighbourListBudgetMB, 1.f, 0, 65536);
+		if (neighbourListsChanged)
+			myBoidComputer.SetCPUNeighbourLists(mySimSettings.cpu.neighbourLists, mySimSettings.cpu.neighbourListSkin, mySimSettings.cpu.neighbourListBudgetMB);
+
+		if (myBoidComputer.GetBackend() == SimulationBackend::CPU)
+		{
+			const CPUSimulationStats& stats = myBoidComputer.GetCPUStats();
+			ImGui::Text("Running threads"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(std::to_string(myBoidComputer.GetCPUThreadCount()).c_str());
+			ImGui::Text("Running kernel"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(NeighbourKernel::GetName(myBoidComputer.GetCPUInstructionSet()));
+			ImGui::Text("Step ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(std::to_string(stats.totalMs).c_str());
+			ImGui::Text("Clear/Count ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text((std::to_string(stats.clearMs) + " / " + std::to_string(stats.countMs)).c_str());
+			ImGui::Text("Scan/Sort ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text((std::to_string(stats.scanMs) + " / " + std::to_string(stats.sortMs)).c_str());
+			ImGui::Text("Schedule/Behavior ms"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text((std::to_string(stats.scheduleMs) + " / " + std::to_string(stats.behaviorMs)).c_str());
+			ImGui::Text("Cell keys"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(std::to_string(stats.cellKeys).c_str());
+			ImGui::Text("Cleared/saved MB"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text((std::to_string((double)stats.clearedBytes / (1024.0 * 1024.0)) + " / " + std::to_string((double)stats.clearBytesSaved / (1024.0 * 1024.0))).c_str());
+			ImGui::Text("Occupied cell blocks"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(std::to_string(stats.occupiedCellBlocks).c_str());
+			ImGui::Text("Moved/Shifted boids"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(stats.rebinned ? (std::to_string(stats.movedBoids) + " / " + std::to_string(stats.shiftedBoids)).c_str() : "Rebuilt");
+			ImGui::Text("Tasks/Steals"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text((std::to_string(stats.behaviorTasks) + " / " + std::to_string(stats.steals)).c_str());
+			ImGui::Text("Culled candidates"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(std::to_string(stats.culledCandidates).c_str());
+			ImGui::Text("List age/MB"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(stats.neighbourLists ? (std::to_string(stats.listAge) + " / " + std::to_string((double)stats.listBytes / (1024.0 * 1024.0))).c_str()
+				: (stats.listsOverBudget ? "Over budget" : "Off"));
+			if (stats.neighbourCandidates > 0 && stats.behaviorMs > 0.f)
+			{
+				ImGui::Text(stats.halfShell ? "Pairs/s per thread (half shell)" : "Pairs/s per thread"); ImGui::SameLine(IMGUI_SPACING);
+				ImGui::Text(std::to_string((double)stats.neighbourCandidates / (stats.behaviorMs * 0.001) / myBoidComputer.GetCPUThreadCount()).c_str());
+			}
+		}
+	}
+	if (ImGui::CollapsingHeader("GPU Settings"))
+	{
+		//The margin goes into the frame buffer through SimulationFrameData::Fill, the cells grow with it
+		bool lazyGridChanged = ImGui::Checkbox("Lazy grid rebuild", &mySimSettings.gpu.lazyGrid);
+		ImGui::DragFloat("Lazy Grid Margin", &mySimSettings.gpu.lazyGridMargin, 0.05f, 0.f, 100.f);
+		lazyGridChanged |= ImGui::DragInt("Lazy Grid Max Frames", &mySimSettings.gpu.lazyGridMaxFrames, 0.1f, 0, 1000);
+		if (lazyGridChanged)
+			myBoidComputer.SetGPULazyGrid(mySimSettings.gpu.lazyGrid, mySimSettings.gpu.lazyGridMaxFrames);
+
+		if (!mySimSettings.cpu.enabled)
+		{
+			ImGui::Text("Frames since grid rebuild"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text(std::to_string(myBoidComputer.GetGPUStaleGridFrames()).c_str());
+			ImGui::Text("Cleared/saved MB"); ImGui::SameLine(IMGUI_SPACING);
+			ImGui::Text((std::to_string((double)myBoidComputer.GetGPUClearedBytes() / (1024.0 * 1024.0)) + " / "
+				+ std::to_string((double)myBoidComputer.GetGPUClearBytesSaved() / (1024.0 * 1024.0))).c_str());
+		}
+	}
 	if (ImGui::CollapsingHeader("Graphics Settings"))
 	{
 		ImGui::Checkbox("Render Bounds", &myGraphicsSettings.renderBounds);
@@ -330,55 +544,24 @@ void BoidSimulation::UpdateFrameBuffer()
 	frameBufferData.fogDist = myGraphicsSettings.viewDist;
 
 	frameBufferData.camPos = myCamera->GetPos();
-	frameBufferData.deltaTime = myDeltaTime;
-
-	frameBufferData.cohesionFactor = mySimSettings.cohesionFactor;
-	frameBufferData.separationFactor = mySimSettings.separationFactor;
-	frameBufferData.alignmentFactor = mySimSettings.alignmentFactor;
-	frameBufferData.fieldOfViewPercent = mySimSettings.fieldOfView / 360.f;
-	frameBufferData.visualRangeSqr = mySimSettings.visualRange * mySimSettings.visualRange;
-	frameBufferData.protectedRangeSqr = mySimSettings.protectedRange * mySimSettings.protectedRange;
-	frameBufferData.gravity = mySimSettings.gravity;
+	const bool stepped = mySimSettings.fixedTimeStep && 0.f < myStepTime;
+	frameBufferData.deltaTime = stepped ? myStepTime : myDeltaTime;
+	frameBufferData.interpolationAlpha = stepped && mySimSettings.renderInterpolation ? myStepAccumulator / myStepTime : 1.f;
 
-	frameBufferData.maxSpeed = mySimSettings.maxSpeed;
-	frameBufferData.minSpeed = mySimSettings.minSpeed;
-	frameBufferData.turnMargin = mySimSettings.turnMagin;
-	frameBufferData.turnSpeed = mySimSettings.turnSpeed;
-
-	frameBufferData.minPos = mySimSettings.minPos;
-	frameBufferData.maxPos = mySimSettings.maxPos;
+	SimulationFrameData::Fill(frameBufferData, mySimSettings);
 
 	frameBufferData.playerAttraction = myPlayerSettings.boidAttraction;
 	frameBufferData.playerPosition = myPlayer.transform.GetTranslation();
 	frameBufferData.playerFuturePosition = myPlayer.transform.GetTranslation() + myPlayer.transform.GetZ() * myPlayer.velocity * 0.8f;
 
-	auto cubeSize = mySimSettings.maxPos - mySimSettings.minPos;
-
-	float cellSize = mySimSettings.visualRange * mySimSettings.cellSizeMult;
-
-	frameBufferData.cellSize = cellSize;
-
-	frameBufferData.gridDims = {
-		(unsigned int)(ceil(cubeSize.x / cellSize)),
-		(unsigned int)(ceil(cubeSize.y / cellSize)),
-		(unsigned int)(ceil(cubeSize.z / cellSize)) };
-
-	myCellCount = (frameBufferData.gridDims.x * frameBufferData.gridDims.y * frameBufferData.gridDims.z);
-	frameBufferData.cellCount = myCellCount;
+	myCellCount = frameBufferData.cellCount;
+	myCapacity = SimulationFrameData::GetCapacity(frameBufferData, mySimSettings);
+	myBoidComputer.SetCapacity(myCapacity);
 
-	frameBufferData.boidCount = mySimSettings.boidCount;
+	auto cubeSize = mySimSettings.maxPos - mySimSettings.minPos;
 	auto cubePos = (mySimSettings.minPos + mySimSettings.maxPos) * 0.5f;
 
-	bool invalidSettings = (
-		cubeSize.x <= 0
-		|| cubeSize.y <= 0
-		|| cubeSize.z <= 0
-		|| myCellCount == 0
-		|| myCellCount > MAX_CELLS
-		|| mySimSettings.boidCount > MAX_BOIDS
-		|| (mySimSettings.griddingOn && mySimSettings.boidCount / myCellCount > MAX_BOIDS_PER_CELL)
-		|| (!mySimSettings.griddingOn && mySimSettings.boidCount > MAX_BOIDS_PER_CELL)
-		);
+	bool invalidSettings = !SimulationFrameData::IsValid(frameBufferData, mySimSettings);
 
 	myAutoHaltFlag = invalidSettings;
 
@@ -393,12 +576,43 @@ void BoidSimulation::UpdateFrameBuffer()
 	}
 }
 
-void BoidSimulation::SimulateGPU()
+void BoidSimulation::Simulate()
 {
 	if (myAutoHaltFlag || myFPSHaltFlag || myDeltaTime == 0)
 		return;
 
-	if (mySimSettings.griddingOn)
+	for (unsigned int step = 0; step < myStepCount; step++)
+	{
+		SimulateStep();
+	}
+	mySimulatedSteps += myStepCount;
+
+	if (mySimSettings.deterministic && myStepCount > 0)
+	{
+		myStateHash = myBoidComputer.GetStateHash((UINT)mySimSettings.boidCount);
+	}
+	else if (myStepCount > 0 && myBoidComputer.GetBackend() == SimulationBackend::CPU)
+	{
+		myNormalStepMs = myBoidComputer.GetCPUStats().totalMs;
+		myNormalSortMs = myBoidComputer.GetCPUStats().sortMs;
+	}
+}
+
+void BoidSimulation::SimulateStep()
+{
+	if (myBoidComputer.GetBackend() == SimulationBackend::CPU)
+	{
+		if (mySimSettings.griddingOn)
+		{
+			myBoidComputer.RunBoidsCPUGridded();
+		}
+		else
+		{
+			myBoidComputer.RunBoidsCPU();
+			myBoidComputer.SwapBuffers();
+		}
+	}
+	else if (mySimSettings.griddingOn)
 	{
 		myBoidComputer.RunBoidsGPUGridded(mySimSettings.boidCount, myCellCount);
 	}
@@ -421,10 +635,23 @@ void BoidSimulation::Render()
 	}
 
 	myBoidComputer.BindStructuredBuffer();
-	myGraphicsEngine->RenderBoids(&myBoidMesh, min(MAX_BOIDS, (UINT)mySimSettings.boidCount));
+	myGraphicsEngine->RenderBoids(&myBoidMesh, min(myBoidComputer.GetBoidCapacity(), (UINT)mySimSettings.boidCount));
 	myBoidComputer.UnbindStructuredBuffer();
 }
 
+float BoidSimulation::GetStepTime() const
+{
+	const float fixedStepTime = 1.f / (float)(mySimSettings.stepRate > 0 ? mySimSettings.stepRate : 1);
+	if (!mySimSettings.adaptiveTimeStep || myBoidComputer.GetBackend() != SimulationBackend::CPU)
+		return fixedStepTime;
+
+	//Bounds of the last CPU step, the first step after a reset has none and takes the fixed step
+	const CPUSimulationStats& stats = myBoidComputer.GetCPUStats();
+	if (!stats.stepBounds)
+		return fixedStepTime;
+	return SimulationFrameData::GetAdaptiveStepTime(mySimSettings, stats.maxSpeed, stats.minSeparation);
+}
+
 const bool BoidSimulation::GetPlayerControlled() const
 {
 	return myPlayer.controlled;
@@ -36,7 +36,7 @@ public:
 	void ShowPlayerControls();
 	void UpdatePlayer(InputHandler& aInputHandler);
 	void UpdateFrameBuffer();
-	void SimulateGPU();
+	void Simulate();
 	void Render();
 
 	//Getters
@@ -48,6 +48,9 @@ public:
 	const PlayerSettings& GetPlayerSettings() const;
 
 private:
+	void SimulateStep();
+	float GetStepTime() const;
+
 	Mesh myBoidMesh;
 	Mesh myCubeMesh;
 	SimulationSettings mySimSettings;
@@ -64,10 +67,18 @@ private:
 	float myDeltaTimeSum = 0;
 	float myFrameCountSum = 0;
 	float myDeltaTime = 0;
+	float myStepAccumulator = 0.f;
+	float myStepTime = 0.f;
+	unsigned int myStepCount = 0;
+	unsigned long long mySimulatedSteps = 0;
+	unsigned long long myStateHash = 0;
+	float myNormalStepMs = 0.f; //CPU step and sort time of the last step with deterministic off, to compare the deterministic ones with
+	float myNormalSortMs = 0.f;
 	float myLastFPS = 0.f;
 	uint64_t myLastFPSUpdateFrame = 0;
 	uint64_t myFrame = 0;
 	unsigned int myCellCount = 0;
+	SimulationCapacity myCapacity;
 	float mySaveTimeStamp = -SAVE_TEXT_DISPLAY_TIME;
 	bool myAutoHaltFlag = false;
 	bool myFPSHaltFlag = false;
@@ -0,0 +1,415 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include "Boid.h"
+#include "BoidStreams.h"
+#include "hlsl/CBuffer.h"
+
+// Far cells update their behavior at most every 1 << MAX_LOD_TIER steps
+constexpr unsigned int MAX_LOD_TIER = 7;
+
+// C++ mirror of the per-boid functions in Boid_CS.hlsl and Grid_CS.hlsl.
+// Keep these in sync with the shaders, the CPU backend is expected to give the same per-boid results.
+namespace BoidCS
+{
+	struct FlockAccumulator
+	{
+		Vector3<float> center;
+		Vector3<float> close;
+		Vector3<float> avgVel;
+		unsigned int flockSize = 0;
+		// CPU only, the squared distance to the closest neighbour in the protected range that bounds the adaptive step
+		float closestSqr = FLT_MAX;
+	};
+
+	// HLSL normalize, a zero vector gives NaN just like on the GPU
+	inline Vector3<float> Normalize(const Vector3<float>& aVector)
+	{
+		return aVector / std::sqrt(aVector.Dot(aVector));
+	}
+
+	inline unsigned int Xorshift(unsigned int aState)
+	{
+		aState ^= aState << 13;
+		aState ^= aState >> 17;
+		aState ^= aState << 5;
+		return aState;
+	}
+
+	inline float RandomFloat(unsigned int& aState)
+	{
+		aState = Xorshift(aState);
+		return (float)aState / 4294967295.f;
+	}
+
+	// aSeed picks another start for the same boid count, every boid's stream only depends on its index and aSeed
+	inline void InitBoid(Boid& aBoid, const unsigned int aIndex, const unsigned int aSeed, const Vector3<float>& aMinPos, const Vector3<float>& aMaxPos)
+	{
+		unsigned int seed = aIndex ^ (aSeed * 0x9E3779B9u);
+		Vector3<float> frac;
+		frac.x = RandomFloat(seed);
+		frac.y = RandomFloat(seed);
+		frac.z = RandomFloat(seed);
+
+		Vector3<float> frac2;
+		frac2.x = RandomFloat(seed);
+		frac2.y = RandomFloat(seed);
+		frac2.z = RandomFloat(seed);
+
+		Vector3<float> size = aMaxPos - aMinPos;
+
+		aBoid.pos = { aMinPos.x + size.x * frac.x, aMinPos.y + size.y * frac.y, aMinPos.z + size.z * frac.z };
+		aBoid.vel = frac2 - Vector3<float>(0.5f, 0.5f, 0.5f);
+		aBoid.cellIndex = 0;
+		aBoid.flockSize = 0;
+	}
+
+	// The clamped cell coordinates getCellIndex flattens
+	inline Vector3<unsigned int> GetCellCoords(const Vector3<float>& aPos, const FrameBufferData& aFrame)
+	{
+		unsigned int indexX = (unsigned int)(std::max(0.f, aPos.x - aFrame.minPos.x) / aFrame.cellSize);
+		unsigned int indexY = (unsigned int)(std::max(0.f, aPos.y - aFrame.minPos.y) / aFrame.cellSize);
+		unsigned int indexZ = (unsigned int)(std::max(0.f, aPos.z - aFrame.minPos.z) / aFrame.cellSize);
+
+		indexX = std::min(indexX, aFrame.gridDims.x - 1);
+		indexY = std::min(indexY, aFrame.gridDims.y - 1);
+		indexZ = std::min(indexZ, aFrame.gridDims.z - 1);
+
+		return { indexX, indexY, indexZ };
+	}
+
+	inline unsigned int GetCellIndex(const Vector3<float>& aPos, const FrameBufferData& aFrame)
+	{
+		Vector3<unsigned int> index = GetCellCoords(aPos, aFrame);
+		return (aFrame.gridDims.x * aFrame.gridDims.y * index.z) + (aFrame.gridDims.x * index.y) + index.x;
+	}
+
+	// isSphereInFrustum, false if the sphere is fully outside the frustum of aWorldToClip. Row vectors multiply the matrix,
+	// so the plane of a clip component is its column, and a point is inside if -w <= x, y <= w and 0 <= z <= w.
+	inline bool IsSphereInFrustum(const Vector3<float>& aCenter, const float aRadius, const Matrix4x4<float>& aWorldToClip)
+	{
+		Vector4<float> columns[4];
+		for (int c = 0; c < 4; c++)
+		{
+			columns[c] = { aWorldToClip(1, c + 1), aWorldToClip(2, c + 1), aWorldToClip(3, c + 1), aWorldToClip(4, c + 1) };
+		}
+		const Vector4<float> planes[6] = { columns[3] + columns[0], columns[3] - columns[0], columns[3] + columns[1],
+			columns[3] - columns[1], columns[2], columns[3] - columns[2] };
+		for (const Vector4<float>& plane : planes)
+		{
+			const float distance = plane.x * aCenter.x + plane.y * aCenter.y + plane.z * aCenter.z + plane.w;
+			if (distance < -aRadius * std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z))
+				return false;
+		}
+		return true;
+	}
+
+	// getLodTier, the boids of a cell update their behavior every 1 << tier steps. Cells within lodDistance of the camera
+	// are tier 0, every doubling of the distance beyond it adds a tier up to lodMaxTier, which cells outside the frustum take.
+	inline unsigned int GetLodTier(const Vector3<unsigned int>& aCellCoords, const FrameBufferData& aFrame)
+	{
+		const unsigned int maxTier = aFrame.lodMaxTier < MAX_LOD_TIER ? aFrame.lodMaxTier : MAX_LOD_TIER;
+		if (!(0.f < aFrame.lodDistance) || maxTier == 0)
+			return 0;
+
+		const float halfCell = aFrame.cellSize * 0.5f;
+		const Vector3<float> center(aFrame.minPos.x + (float)aCellCoords.x * aFrame.cellSize + halfCell,
+			aFrame.minPos.y + (float)aCellCoords.y * aFrame.cellSize + halfCell,
+			aFrame.minPos.z + (float)aCellCoords.z * aFrame.cellSize + halfCell);
+		const float radius = halfCell * 1.7320508f;
+		if (aFrame.lodFrustum != 0 && !IsSphereInFrustum(center, radius, aFrame.worldToClipMatrix))
+			return maxTier;
+
+		const float distance = (center - aFrame.camPos).Length() - radius;
+		unsigned int tier = 0;
+		float reach = aFrame.lodDistance;
+		while (tier < maxTier && reach <= distance)
+		{
+			tier++;
+			reach *= 2.f;
+		}
+		return tier;
+	}
+
+	// isLodUpdateStep, staggered by the row major cell index so the cells of a tier don't all update in the same step
+	inline bool IsLodUpdateStep(const unsigned int aCellIndex, const unsigned int aTier, const unsigned int aStep)
+	{
+		return ((aStep + aCellIndex) & ((1u << aTier) - 1u)) == 0;
+	}
+
+	// Inner loop body of BoidBehaviors/BoidBehaviorsGridded. aVelDir is normalize(boid.vel).
+	inline void AccumulateNeighbour(FlockAccumulator& aAccumulator, const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const Vector3<float>& aOtherPos, const Vector3<float>& aOtherVel, const FrameBufferData& aFrame)
+	{
+		Vector3<float> vecTo = aOtherPos - aPos;
+		if (aFrame.fieldOfViewPercent < (Normalize(vecTo).Dot(aVelDir) + 1.f) * 0.5f)
+			return;
+
+		float distSqr = vecTo.Dot(vecTo);
+		if (distSqr > 0 && distSqr < aFrame.visualRangeSqr)
+		{
+			if (distSqr < aFrame.protectedRangeSqr)
+			{
+				aAccumulator.close -= vecTo / distSqr;
+				aAccumulator.closestSqr = distSqr < aAccumulator.closestSqr ? distSqr : aAccumulator.closestSqr;
+			}
+			aAccumulator.center += aOtherPos;
+			aAccumulator.avgVel += aOtherVel;
+			aAccumulator.flockSize++;
+		}
+	}
+
+	inline void ApplyFlockAccumulator(Boid& aBoid, FlockAccumulator aAccumulator, const FrameBufferData& aFrame)
+	{
+		if (aAccumulator.flockSize > 0)
+		{
+			aAccumulator.center /= (float)aAccumulator.flockSize;
+			aAccumulator.avgVel /= (float)aAccumulator.flockSize;
+
+			aBoid.vel += (aAccumulator.center - aBoid.pos) * aFrame.cohesionFactor * aFrame.deltaTime;
+			aBoid.vel += (aAccumulator.avgVel - aBoid.vel) * aFrame.alignmentFactor * aFrame.deltaTime;
+		}
+
+		aBoid.flockSize = aAccumulator.flockSize;
+		aBoid.vel += aAccumulator.close * aFrame.separationFactor * aFrame.deltaTime;
+	}
+
+	// Returns the closestSqr of the boid's accumulator, see FlockAccumulator
+	inline float BoidBehaviors(Boid& aBoid, const Boid* aBoidsIn, const FrameBufferData& aFrame)
+	{
+		FlockAccumulator accumulator;
+		Vector3<float> velDir = Normalize(aBoid.vel);
+
+		for (unsigned int i = 0; i < aFrame.boidCount; i++)
+		{
+			AccumulateNeighbour(accumulator, aBoid.pos, velDir, aBoidsIn[i].pos, aBoidsIn[i].vel, aFrame);
+		}
+
+		ApplyFlockAccumulator(aBoid, accumulator, aFrame);
+		return accumulator.closestSqr;
+	}
+
+	// Rings of neighbour cells around a cell that cover the visual range, cellRings of 0 counts as 1
+	inline int GetCellRings(const FrameBufferData& aFrame)
+	{
+		return aFrame.cellRings > 1 ? (int)aFrame.cellRings : 1;
+	}
+
+	// getStencilRowHalfWidth, how many cells the stencil row aY, aZ cells from the center reaches out in x,
+	// or -1 if none of its cells can hold a boid within the visual range. The gap to a cell aX away is (|aX| - 1) cells.
+	inline int GetStencilRowHalfWidth(const int aY, const int aZ, const FrameBufferData& aFrame)
+	{
+		const int rings = GetCellRings(aFrame);
+		const float cellRangeSqr = aFrame.visualRangeSqr / (aFrame.cellSize * aFrame.cellSize);
+		const float gapY = (float)std::max(std::abs(aY) - 1, 0);
+		const float gapZ = (float)std::max(std::abs(aZ) - 1, 0);
+		const float rest = cellRangeSqr - gapY * gapY - gapZ * gapZ;
+		if (rest <= 0.f)
+			return -1;
+
+		int halfWidth = 1;
+		while (halfWidth < rings && (float)(halfWidth * halfWidth) < rest)
+		{
+			halfWidth++;
+		}
+		return halfWidth;
+	}
+
+	// Slack of the cell culling tests, boxes grow by this fraction of a cell and the view cone shrinks by this much cosine,
+	// so float rounding in the per-boid tests can't reject fewer boids than a culled cell held
+	constexpr float CULL_BOX_MARGIN = 0.001f;
+	constexpr float CULL_COS_MARGIN = 0.001f;
+
+	// Bounds along one axis of the cells aFirst..aLast. With aClampedGrid, boids outside the bounds are binned
+	// to the edge cells, so those reach out to infinity.
+	inline void GetCellSpanBounds(const int aFirst, const int aLast, const float aMinPos, const unsigned int aDim, const bool aClampedGrid,
+		const FrameBufferData& aFrame, float& aOutMin, float& aOutMax)
+	{
+		const float margin = aFrame.cellSize * CULL_BOX_MARGIN;
+		aOutMin = aClampedGrid && aFirst <= 0 ? -INFINITY : aMinPos + (float)aFirst * aFrame.cellSize - margin;
+		aOutMax = aClampedGrid && aLast >= (int)aDim - 1 ? INFINITY : aMinPos + (float)(aLast + 1) * aFrame.cellSize + margin;
+	}
+
+	inline float GetAxisGap(const float aPos, const float aMin, const float aMax)
+	{
+		return aPos < aMin ? aMin - aPos : (aMax < aPos ? aPos - aMax : 0.f);
+	}
+
+	// Cell along x that aX falls in, clamped to the grid like GetCellCoords for aClampedGrid
+	inline int GetCullCellX(const float aX, const bool aClampedGrid, const FrameBufferData& aFrame)
+	{
+		float cell = std::floor((aX - aFrame.minPos.x) / aFrame.cellSize);
+		if (aClampedGrid)
+		{
+			const float lastCell = (float)(aFrame.gridDims.x - 1);
+			cell = cell < 0.f ? 0.f : (cell > lastCell ? lastCell : cell);
+		}
+		return (int)cell;
+	}
+
+	// cullCellRow, trims the cells aFirstX..aLastX of the row aY, aZ to the ones that can hold a boid aPos sees, false if none can.
+	// Conservative, cells are only dropped when all of their boids fail the visual range or the FOV test of AccumulateNeighbour.
+	// That test rejects neighbours with dot(dir, velDir) > 2 * fieldOfViewPercent - 1, a convex cone as long as the FOV is
+	// at least 180 degrees, so a box is inside it if its 8 corners are. Without aViewCone only the symmetric range test is used.
+	inline bool CullCellRow(const Vector3<float>& aPos, const Vector3<float>& aVelDir, const int aY, const int aZ, int& aFirstX, int& aLastX,
+		const bool aClampedGrid, const bool aViewCone, const FrameBufferData& aFrame)
+	{
+		float minY, maxY, minZ, maxZ;
+		GetCellSpanBounds(aY, aY, aFrame.minPos.y, aFrame.gridDims.y, aClampedGrid, aFrame, minY, maxY);
+		GetCellSpanBounds(aZ, aZ, aFrame.minPos.z, aFrame.gridDims.z, aClampedGrid, aFrame, minZ, maxZ);
+		const float gapY = GetAxisGap(aPos.y, minY, maxY);
+		const float gapZ = GetAxisGap(aPos.z, minZ, maxZ);
+		const float rest = aFrame.visualRangeSqr - gapY * gapY - gapZ * gapZ;
+		if (rest <= 0.f)
+			return false;
+
+		//The x extent of the visual range sphere at this row
+		const float reach = std::sqrt(rest) + aFrame.cellSize * CULL_BOX_MARGIN;
+		const int firstX = GetCullCellX(aPos.x - reach, aClampedGrid, aFrame);
+		const int lastX = GetCullCellX(aPos.x + reach, aClampedGrid, aFrame);
+		aFirstX = firstX > aFirstX ? firstX : aFirstX;
+		aLastX = lastX < aLastX ? lastX : aLastX;
+		if (aFirstX > aLastX)
+			return false;
+
+		const float cosLimit = 2.f * aFrame.fieldOfViewPercent - 1.f + CULL_COS_MARGIN;
+		if (!aViewCone || cosLimit < CULL_COS_MARGIN || 1.f <= cosLimit)
+			return true;
+
+		float minX, maxX;
+		GetCellSpanBounds(aFirstX, aLastX, aFrame.minPos.x, aFrame.gridDims.x, aClampedGrid, aFrame, minX, maxX);
+		if (std::isinf(minX) || std::isinf(maxX) || std::isinf(minY) || std::isinf(maxY) || std::isinf(minZ) || std::isinf(maxZ))
+			return true;
+
+		for (unsigned int corner = 0; corner < 8; corner++)
+		{
+			const Vector3<float> vecTo(((corner & 1u) ? maxX : minX) - aPos.x, ((corner & 2u) ? maxY : minY) - aPos.y, ((corner & 4u) ? maxZ : minZ) - aPos.z);
+			if (!(vecTo.Dot(aVelDir) > cosLimit * std::sqrt(vecTo.Dot(vecTo))))
+				return true;
+		}
+		return false;
+	}
+
+	// Both directions of AccumulateNeighbour for one pair. The distance and direction are shared,
+	// only the view cone test is done per boid. Gives each boid the same terms as two AccumulateNeighbour calls.
+	inline void AccumulatePair(FlockAccumulator& aAccumulator, const Vector3<float>& aPos, const Vector3<float>& aVelDir, const Vector3<float>& aVel,
+		FlockAccumulator& aOtherAccumulator, const Vector3<float>& aOtherPos, const Vector3<float>& aOtherVelDir, const Vector3<float>& aOtherVel, const FrameBufferData& aFrame)
+	{
+		Vector3<float> vecTo = aOtherPos - aPos;
+		float distSqr = vecTo.Dot(vecTo);
+		if (!(distSqr > 0 && distSqr < aFrame.visualRangeSqr))
+			return;
+
+		Vector3<float> dir = vecTo / std::sqrt(distSqr);
+		Vector3<float> otherDir = dir * -1.f;
+		const bool close = distSqr < aFrame.protectedRangeSqr;
+		if (!(aFrame.fieldOfViewPercent < (dir.Dot(aVelDir) + 1.f) * 0.5f))
+		{
+			if (close)
+			{
+				aAccumulator.close -= vecTo / distSqr;
+				aAccumulator.closestSqr = distSqr < aAccumulator.closestSqr ? distSqr : aAccumulator.closestSqr;
+			}
+			aAccumulator.center += aOtherPos;
+			aAccumulator.avgVel += aOtherVel;
+			aAccumulator.flockSize++;
+		}
+		if (!(aFrame.fieldOfViewPercent < (otherDir.Dot(aOtherVelDir) + 1.f) * 0.5f))
+		{
+			if (close)
+			{
+				aOtherAccumulator.close += vecTo / distSqr;
+				aOtherAccumulator.closestSqr = distSqr < aOtherAccumulator.closestSqr ? distSqr : aOtherAccumulator.closestSqr;
+			}
+			aOtherAccumulator.center += aPos;
+			aOtherAccumulator.avgVel += aVel;
+			aOtherAccumulator.flockSize++;
+		}
+	}
+
+	// Scalar neighbour loop over the SoA streams, the SIMD versions are in NeighbourKernel
+	inline void AccumulateRange(FlockAccumulator& aAccumulator, const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd, const FrameBufferData& aFrame)
+	{
+		const float* posX = aBoidsIn.posX.data();
+		const float* posY = aBoidsIn.posY.data();
+		const float* posZ = aBoidsIn.posZ.data();
+		const float* velX = aBoidsIn.velX.data();
+		const float* velY = aBoidsIn.velY.data();
+		const float* velZ = aBoidsIn.velZ.data();
+
+		for (unsigned int i = aStart; i < aEnd; i++)
+		{
+			AccumulateNeighbour(aAccumulator, aPos, aVelDir, { posX[i], posY[i], posZ[i] }, { velX[i], velY[i], velZ[i] }, aFrame);
+		}
+	}
+
+	inline void ClampVels(Boid& aBoid, const FrameBufferData& aFrame)
+	{
+		float speed = aBoid.vel.Length();
+		if (aFrame.maxSpeed < speed)
+		{
+			aBoid.vel = Normalize(aBoid.vel) * aFrame.maxSpeed;
+		}
+		if (speed < aFrame.minSpeed)
+		{
+			aBoid.vel = Normalize(aBoid.vel) * aFrame.minSpeed;
+		}
+	}
+
+	inline void AvoidWallBehavior(Boid& aBoid, const FrameBufferData& aFrame)
+	{
+		Vector3<float> maxPosDiff = aFrame.maxPos - aBoid.pos;
+		Vector3<float> minPosDiff = aBoid.pos - aFrame.minPos;
+		const float turn = aFrame.deltaTime * aFrame.turnSpeed;
+
+		if (maxPosDiff.x < aFrame.turnMargin)
+			aBoid.vel.x -= turn * (aFrame.turnMargin - maxPosDiff.x);
+		if (maxPosDiff.y < aFrame.turnMargin)
+			aBoid.vel.y -= turn * (aFrame.turnMargin - maxPosDiff.y);
+		if (maxPosDiff.z < aFrame.turnMargin)
+			aBoid.vel.z -= turn * (aFrame.turnMargin - maxPosDiff.z);
+
+		if (minPosDiff.x < aFrame.turnMargin)
+			aBoid.vel.x += turn * (aFrame.turnMargin - minPosDiff.x);
+		if (minPosDiff.y < aFrame.turnMargin)
+			aBoid.vel.y += turn * (aFrame.turnMargin - minPosDiff.y);
+		if (minPosDiff.z < aFrame.turnMargin)
+			aBoid.vel.z += turn * (aFrame.turnMargin - minPosDiff.z);
+	}
+
+	inline void PlayerAttraction(Boid& aBoid, const FrameBufferData& aFrame)
+	{
+		Vector3<float> vecFrom = aBoid.pos - aFrame.playerPosition;
+		Vector3<float> playerTrajectory = aFrame.playerFuturePosition - aFrame.playerPosition;
+
+		float fraction = std::max(0.f, vecFrom.Dot(playerTrajectory) / playerTrajectory.Dot(playerTrajectory));
+		Vector3<float> closesPointOnTrajectory = aFrame.playerPosition + playerTrajectory * std::min(1.f, fraction);
+
+		Vector3<float> vecTo = closesPointOnTrajectory - aBoid.pos;
+		float distSqr = vecTo.Dot(vecTo);
+
+		if (distSqr > 0 && distSqr < aFrame.visualRangeSqr)
+		{
+			if (distSqr < aFrame.protectedRangeSqr)
+			{
+				aBoid.vel -= vecTo / distSqr;
+			}
+			aBoid.vel += Normalize(vecTo) * aFrame.playerAttraction * aFrame.deltaTime;
+		}
+	}
+
+	// Tail of main/mainGridded, everything after the flocking behaviors
+	inline void MoveBoid(Boid& aBoid, const FrameBufferData& aFrame)
+	{
+		AvoidWallBehavior(aBoid, aFrame);
+		if (aFrame.playerAttraction != 0.f)
+			PlayerAttraction(aBoid, aFrame);
+		ClampVels(aBoid, aFrame);
+
+		aBoid.vel -= Vector3<float>(0, aFrame.gravity, 0);
+		aBoid.pos += aBoid.vel * aFrame.deltaTime;
+	}
+}
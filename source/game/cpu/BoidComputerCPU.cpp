@@ -0,0 +1,1715 @@
+#include "BoidComputerCPU.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include "BoidCS.h"
+#include "Interlocked.h"
+#include "StateHash.h"
+
+constexpr size_t BOID_GRAIN_SIZE = 4096;
+constexpr size_t BEHAVIOR_GRAIN_SIZE = 256;
+constexpr size_t COST_UNIT_SIZE = 32;
+constexpr size_t COST_UNIT_GRAIN_SIZE = 256;
+constexpr unsigned int BOID_COST_OVERHEAD = 32;
+constexpr unsigned int DENSE_CELL_OCCUPANCY = 4;
+constexpr unsigned int TASKS_PER_THREAD = 32;
+constexpr unsigned int HALF_SHELL_PHASE_BLOCKS = 128; // Blocks each half shell phase is split into at least, where the grid has them. Every band reads the rows next to it again, so not many more
+constexpr unsigned int SPARSE_CELL_ENDS_MAX_FRACTION = 4; // Only read the atomic scan sparsely while up to 1 / SPARSE_CELL_ENDS_MAX_FRACTION of the cell blocks are occupied
+constexpr unsigned int MAX_REBIN_FRACTION = 2; // Rebuild when more than 1 / MAX_REBIN_FRACTION of the boids would move
+constexpr unsigned int LIST_RETRY_FRAMES = 60; // Frames to run on the cell ranges after the neighbour lists went over budget
+
+namespace
+{
+	typedef std::chrono::steady_clock PassClock;
+
+	float MillisecondsSince(const PassClock::time_point& aStart)
+	{
+		return std::chrono::duration<float, std::milli>(PassClock::now() - aStart).count();
+	}
+
+	//Everything the cell keys depend on
+	bool IsSameGrid(const FrameBufferData& aFrame, const FrameBufferData& aOtherFrame)
+	{
+		return aFrame.boidCount == aOtherFrame.boidCount && aFrame.cellSize == aOtherFrame.cellSize && aFrame.cellRings == aOtherFrame.cellRings
+			&& aFrame.minPos.x == aOtherFrame.minPos.x && aFrame.minPos.y == aOtherFrame.minPos.y && aFrame.minPos.z == aOtherFrame.minPos.z
+			&& aFrame.gridDims.x == aOtherFrame.gridDims.x && aFrame.gridDims.y == aOtherFrame.gridDims.y && aFrame.gridDims.z == aOtherFrame.gridDims.z;
+	}
+
+	struct LodCell
+	{
+		unsigned int cellIndex = ~0u;
+		const FrameBufferData* behaviorFrame = nullptr;
+	};
+
+	//The frame the behavior of a boid at aPos is applied with this step, its deltaTime covers the steps since the cell's last update.
+	//Null if the LOD skips the cell this step. Sorted boids share cells, so the tier is only worked out when the cell changes.
+	const FrameBufferData* GetLodBehaviorFrame(const Vector3<float>& aPos, const FrameBufferData& aFrame, const FrameBufferData* aLodFrames,
+		const unsigned int aLodStep, LodCell& aInOutCell)
+	{
+		const Vector3<unsigned int> coords = BoidCS::GetCellCoords(aPos, aFrame);
+		const unsigned int cellIndex = (aFrame.gridDims.x * aFrame.gridDims.y * coords.z) + (aFrame.gridDims.x * coords.y) + coords.x;
+		if (cellIndex != aInOutCell.cellIndex)
+		{
+			const unsigned int tier = BoidCS::GetLodTier(coords, aFrame);
+			aInOutCell.cellIndex = cellIndex;
+			aInOutCell.behaviorFrame = BoidCS::IsLodUpdateStep(cellIndex, tier, aLodStep) ? &aLodFrames[tier] : nullptr;
+		}
+		return aInOutCell.behaviorFrame;
+	}
+
+	//The boid layouts the gridded behavior pass reads and writes. Every chunk works on its own copy, so the decode caches stay per thread.
+	//Store returns the key of the cell the boid is stored in, the layouts that don't keep it only work it out to track moves.
+	struct GriddedAoS
+	{
+		const Boid* boidsIn;
+		Boid* boidsOut;
+		const CellGrid* cellGrid;
+
+		Boid Load(const size_t aIndex)
+		{
+			return boidsIn[aIndex];
+		}
+
+		void Accumulate(BoidCS::FlockAccumulator& aAccumulator, const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+			const FrameBufferData& aFrame)
+		{
+			for (unsigned int r = 0; r < aRanges.count; r++)
+			{
+				for (unsigned int j = aRanges.start[r]; j < aRanges.end[r]; j++)
+				{
+					BoidCS::AccumulateNeighbour(aAccumulator, aPos, aVelDir, boidsIn[j].pos, boidsIn[j].vel, aFrame);
+				}
+			}
+		}
+
+		unsigned int Store(const size_t aIndex, Boid aBoid, const bool aTrackMoves)
+		{
+			if (aTrackMoves)
+				aBoid.cellIndex = cellGrid->GetCellKey(aBoid.pos);
+			boidsOut[aIndex] = aBoid;
+			return aBoid.cellIndex;
+		}
+	};
+
+	struct GriddedSoA
+	{
+		const BoidStreams* boidsIn;
+		BoidStreams* boidsOut;
+		const CellGrid* cellGrid;
+		NeighbourKernel::AccumulateGriddedFunction accumulateGridded;
+
+		Boid Load(const size_t aIndex)
+		{
+			return boidsIn->Load(aIndex);
+		}
+
+		void Accumulate(BoidCS::FlockAccumulator& aAccumulator, const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+			const FrameBufferData& aFrame)
+		{
+			accumulateGridded(aAccumulator, aPos, aVelDir, aRanges, *boidsIn, aFrame);
+		}
+
+		unsigned int Store(const size_t aIndex, Boid aBoid, const bool aTrackMoves)
+		{
+			if (aTrackMoves)
+				aBoid.cellIndex = cellGrid->GetCellKey(aBoid.pos);
+			boidsOut->Store(aIndex, aBoid);
+			return aBoid.cellIndex;
+		}
+	};
+
+	//Neighbours are decoded as they are read, the ranges are runs of cells so the cell middles are cached
+	struct GriddedCompact
+	{
+		const CompactBoids* boidsIn;
+		CompactBoids* boidsOut;
+		CompactCellCache boidCell;
+		CompactCellCache neighbourCell;
+
+		Boid Load(const size_t aIndex)
+		{
+			Boid b;
+			b.pos = boidsIn->LoadPos(aIndex, boidCell);
+			b.vel = CompactBoids::DecodeVel(boidsIn->boids[aIndex]);
+			b.cellIndex = boidsIn->boids[aIndex].cellIndex;
+			b.flockSize = boidsIn->flockSize[aIndex];
+			return b;
+		}
+
+		void Accumulate(BoidCS::FlockAccumulator& aAccumulator, const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+			const FrameBufferData& aFrame)
+		{
+			for (unsigned int r = 0; r < aRanges.count; r++)
+			{
+				for (unsigned int j = aRanges.start[r]; j < aRanges.end[r]; j++)
+				{
+					BoidCS::AccumulateNeighbour(aAccumulator, aPos, aVelDir, boidsIn->LoadPos(j, neighbourCell), CompactBoids::DecodeVel(boidsIn->boids[j]), aFrame);
+				}
+			}
+		}
+
+		//The cell Store picks for the decoded position, a boid next to a face can round into the neighbouring one
+		unsigned int Store(const size_t aIndex, const Boid& aBoid, const bool)
+		{
+			boidsOut->Store(aIndex, aBoid);
+			return boidsOut->boids[aIndex].cellIndex;
+		}
+	};
+
+	template<typename T>
+	void ShiftRange(std::vector<T>& aStream, const IncrementalCellRebin::Move& aShift)
+	{
+		memmove(aStream.data() + aShift.to, aStream.data() + aShift.from, aShift.count * sizeof(T));
+	}
+}
+
+void BoidComputerCPU::Init(const unsigned int aThreadCount)
+{
+	myThreadPool.Init(aThreadCount);
+}
+
+void BoidComputerCPU::SetThreadCount(const unsigned int aThreadCount)
+{
+	myThreadPool.Init(aThreadCount);
+}
+
+unsigned int BoidComputerCPU::GetThreadCount() const
+{
+	return myThreadPool.GetThreadCount();
+}
+
+void BoidComputerCPU::SetLayout(const BoidLayout aLayout)
+{
+	if (aLayout == myLayout)
+		return;
+
+	//Every layout converts through AoS
+	if (myLayout == BoidLayout::SoA)
+	{
+		const size_t count = myStreamsIn.Size();
+		myBoidsIn.resize(count);
+		myBoidsOut.resize(count);
+		myThreadPool.ParallelFor(count, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					myBoidsIn[i] = myStreamsIn.Load(i);
+					myBoidsOut[i] = myStreamsOut.Load(i);
+				}
+			});
+		myStreamsIn.Release();
+		myStreamsOut.Release();
+	}
+	else if (myLayout == BoidLayout::Compact)
+	{
+		const size_t count = myCompactIn.Size();
+		myBoidsIn.resize(count);
+		myBoidsOut.resize(count);
+		myThreadPool.ParallelFor(count, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					myBoidsIn[i] = myCompactIn.Load(i);
+					myBoidsOut[i] = myCompactOut.Load(i);
+				}
+			});
+		myCompactIn.Release();
+		myCompactOut.Release();
+		myDecodedBoids = std::vector<Boid>();
+	}
+
+	if (aLayout == BoidLayout::SoA)
+	{
+		const size_t count = myBoidsIn.size();
+		myStreamsIn.Resize(count);
+		myStreamsOut.Resize(count);
+		myThreadPool.ParallelFor(count, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					myStreamsIn.Store(i, myBoidsIn[i]);
+					myStreamsOut.Store(i, myBoidsOut[i]);
+				}
+			});
+		myBoidsIn = std::vector<Boid>();
+		myBoidsOut = std::vector<Boid>();
+	}
+	else if (aLayout == BoidLayout::Compact)
+	{
+		//Boids only exist after InitBoidTransforms, which set the storage frame
+		const size_t count = myBoidsIn.size();
+		myCompactIn.Resize(count);
+		myCompactOut.Resize(count);
+		myCompactIn.SetGrid(myStorageFrame);
+		myCompactOut.SetGrid(myStorageFrame);
+		myThreadPool.ParallelFor(count, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					myCompactIn.Store(i, myBoidsIn[i]);
+					myCompactOut.Store(i, myBoidsOut[i]);
+				}
+			});
+		myBoidsIn = std::vector<Boid>();
+		myBoidsOut = std::vector<Boid>();
+	}
+
+	myRenderBoids = std::vector<Boid>();
+	myRenderPreviousBoids = std::vector<Boid>();
+	myRenderBoidsDirty = true;
+	myRenderPreviousBoidsDirty = true;
+	myRebinReady = false;
+	myVerletLists.Invalidate();
+	myLayout = aLayout;
+}
+
+BoidLayout BoidComputerCPU::GetLayout() const
+{
+	return myLayout;
+}
+
+size_t BoidComputerCPU::GetBytesPerBoid(const BoidLayout aLayout)
+{
+	if (aLayout == BoidLayout::Compact)
+		return sizeof(CompactBoid) + sizeof(unsigned short);
+	return sizeof(Boid);
+}
+
+void BoidComputerCPU::SetInstructionSet(const InstructionSet aInstructionSet)
+{
+	myInstructionSet = NeighbourKernel::IsSupported(aInstructionSet) ? aInstructionSet : NeighbourKernel::GetBestSupported();
+	myKernel = NeighbourKernel::GetFunctions(myInstructionSet);
+}
+
+InstructionSet BoidComputerCPU::GetInstructionSet() const
+{
+	return myInstructionSet;
+}
+
+void BoidComputerCPU::SetStableSort(const bool aStableSort)
+{
+	myStableSort = aStableSort;
+}
+
+bool BoidComputerCPU::GetStableSort() const
+{
+	return myStableSort;
+}
+
+bool BoidComputerCPU::UsesStableSort(const FrameBufferData& aFrame) const
+{
+	return myStableSort || aFrame.deterministic != 0;
+}
+
+void BoidComputerCPU::SetWorkStealing(const bool aWorkStealing)
+{
+	myWorkStealing = aWorkStealing;
+}
+
+bool BoidComputerCPU::GetWorkStealing() const
+{
+	return myWorkStealing;
+}
+
+void BoidComputerCPU::SetCellOrder(const CellOrder aCellOrder)
+{
+	myCellOrder = aCellOrder;
+	myRebinReady = false;
+	myVerletLists.Invalidate();
+}
+
+CellOrder BoidComputerCPU::GetCellOrder() const
+{
+	return myCellGrid.GetOrder();
+}
+
+void BoidComputerCPU::SetIncrementalRebin(const bool aIncrementalRebin)
+{
+	myIncrementalRebin = aIncrementalRebin;
+	myRebinReady = false;
+}
+
+bool BoidComputerCPU::GetIncrementalRebin() const
+{
+	return myIncrementalRebin;
+}
+
+void BoidComputerCPU::SetHalfShell(const bool aHalfShell)
+{
+	myHalfShell = aHalfShell;
+}
+
+bool BoidComputerCPU::GetHalfShell() const
+{
+	return myHalfShell;
+}
+
+void BoidComputerCPU::SetCellCulling(const bool aCellCulling)
+{
+	myCellCulling = aCellCulling;
+}
+
+bool BoidComputerCPU::GetCellCulling() const
+{
+	return myCellCulling;
+}
+
+void BoidComputerCPU::SetNeighbourLists(const bool aNeighbourLists, const float aSkin, const size_t aBudgetBytes)
+{
+	if (aNeighbourLists != myNeighbourLists || aSkin != myListSkin || aBudgetBytes != myListBudgetBytes)
+	{
+		myVerletLists.Release();
+		myListRetryFrames = 0;
+		myRebinReady = false;
+	}
+	myNeighbourLists = aNeighbourLists;
+	myListSkin = aSkin > 0.f ? aSkin : 0.f;
+	myListBudgetBytes = aBudgetBytes;
+}
+
+bool BoidComputerCPU::GetNeighbourLists() const
+{
+	return myNeighbourLists;
+}
+
+void BoidComputerCPU::SetCapacity(const SimulationCapacity& aCapacity)
+{
+	myCapacity = aCapacity;
+}
+
+void BoidComputerCPU::SetStepBounds(const bool aStepBounds)
+{
+	myStepBounds = aStepBounds;
+}
+
+bool BoidComputerCPU::GetStepBounds() const
+{
+	return myStepBounds;
+}
+
+void BoidComputerCPU::InitBoidTransforms(const FrameBufferData& aFrame)
+{
+	//Boids are initialized lazily as the boid count grows, init only depends on the index, the seed and the bounds
+	myInitMinPos = aFrame.minPos;
+	myInitMaxPos = aFrame.maxPos;
+	myInitSeed = aFrame.initSeed;
+	myInitializedBoidCount = 0;
+	myStorageFrame = aFrame;
+	EnsureBoids(aFrame);
+	myRenderBoidCount = aFrame.boidCount;
+	myRenderBoidsDirty = true;
+	myRenderPreviousBoidsDirty = true;
+	myRebinReady = false;
+	myVerletLists.Invalidate();
+	myLodStep = 0;
+	myStats = CPUSimulationStats();
+}
+
+void BoidComputerCPU::RunBoidsCPUGridded(const FrameBufferData& aFrame)
+{
+	const auto start = PassClock::now();
+	EnsureBoids(aFrame);
+	if (myStepBounds && myClosestSqr.size() < aFrame.boidCount)
+		myClosestSqr.resize(aFrame.boidCount);
+
+	//With neighbour lists the cells cover the visual range plus the skin, the behavior still uses the visual range of aFrame
+	FrameBufferData gridFrame = aFrame;
+	bool neighbourLists = myNeighbourLists && myListRetryFrames == 0 && GetListGridFrame(aFrame, gridFrame);
+	if (myListRetryFrames > 0)
+		myListRetryFrames--;
+	const bool compact = myLayout == BoidLayout::Compact;
+	myCellGrid.Init(gridFrame, compact ? CellOrder::RowMajor : myCellOrder, myCapacity.maxCells);
+	EnsureCells(myCellGrid.GetKeyCount());
+	myStats.cellKeys = myCellGrid.GetKeyCount();
+	myStats.clearedBytes = 0;
+	myStats.clearBytesSaved = 0;
+	myStats.occupiedCellBlocks = 0;
+	myStorageFrame = gridFrame;
+
+	//Compact positions are relative to the cells they were stored in, they are stored again before a new grid bins them
+	if (compact && !myCompactOut.HasGrid(gridFrame))
+		RequantizeCompact(gridFrame);
+
+	auto passStart = PassClock::now();
+	const bool reuseLists = neighbourLists && myVerletLists.CanReuse(gridFrame);
+	myStats.rebinned = false;
+	myStats.listsRebuilt = false;
+	if (reuseLists)
+	{
+		//The lists index the slots of the last frame, its output is the input as is
+		std::swap(myBoidsIn, myBoidsOut);
+		std::swap(myStreamsIn, myStreamsOut);
+		std::swap(myCompactIn, myCompactOut);
+		myStats.clearMs = 0.f;
+		myStats.countMs = 0.f;
+		myStats.scanMs = 0.f;
+		myStats.sortMs = 0.f;
+		myStats.movedBoids = 0;
+		myStats.shiftedBoids = 0;
+	}
+	else
+	{
+		myStats.rebinned = myIncrementalRebin && RebinIncremental(gridFrame);
+		if (myStats.rebinned)
+		{
+			myStats.clearMs = 0.f;
+			myStats.countMs = 0.f;
+			myStats.scanMs = 0.f;
+			myStats.sortMs = MillisecondsSince(passStart);
+		}
+		else
+		{
+			myStats.movedBoids = 0;
+			myStats.shiftedBoids = 0;
+			RebuildCells(gridFrame);
+		}
+	}
+
+	passStart = PassClock::now();
+	myTaskCount = 0;
+	if (neighbourLists && !reuseLists)
+	{
+		myStats.listsRebuilt = BuildNeighbourLists(gridFrame);
+		neighbourLists = myStats.listsRebuilt;
+	}
+	myStats.listsOverBudget = myNeighbourLists && myListRetryFrames > 0;
+
+	//Each LOD tier applies the behavior with the time since the last update of its cells
+	myLod = 0.f < aFrame.lodDistance && aFrame.lodMaxTier > 0;
+	for (unsigned int tier = 0; myLod && tier <= MAX_LOD_TIER; tier++)
+	{
+		myLodFrames[tier] = aFrame;
+		myLodFrames[tier].deltaTime = aFrame.deltaTime * (float)(1u << tier);
+	}
+
+	//The half shell pass schedules by grid layer, its slabs follow the rings of aFrame.
+	//It adds every pair to both boids, so it can't skip the boids of LOD cells.
+	myStats.neighbourLists = neighbourLists;
+	myStats.halfShell = !neighbourLists && myHalfShell && !myLod && gridFrame.cellRings == aFrame.cellRings && myCellGrid.SupportsForwardRanges();
+	if (myWorkStealing && !myStats.halfShell && !neighbourLists)
+		BuildBehaviorTasks(aFrame);
+	myStats.scheduleMs = MillisecondsSince(passStart);
+
+	passStart = PassClock::now();
+	//Only the passes that go through ForEachBehaviorRange use the behavior tasks
+	myStats.behaviorTasks = 0;
+	myStats.steals = 0;
+	myStats.neighbourCandidates = 0;
+	myStats.culledCandidates = 0;
+	myStats.lodSkippedBoids = 0;
+	if (myIncrementalRebin)
+		myCellRebin.BeginFrame(myThreadPool.GetThreadCount());
+	if (compact)
+		myCompactOut.SetGrid(gridFrame);
+	if (neighbourLists)
+		MainNeighbourLists(aFrame);
+	else if (myStats.halfShell)
+		MainGriddedHalfShell(aFrame);
+	else if (myLayout == BoidLayout::SoA)
+		MainGriddedSoA(aFrame);
+	else if (compact)
+		MainGriddedCompact(aFrame);
+	else
+		MainGridded(aFrame);
+	myStats.behaviorMs = MillisecondsSince(passStart);
+	myStats.listAge = neighbourLists ? myVerletLists.GetAge() : 0;
+	myStats.listEntries = neighbourLists ? myVerletLists.GetEntryCount() : 0;
+	myStats.listBytes = neighbourLists ? myVerletLists.GetByteCount() : 0;
+
+	//The behavior pass found the boids that change cell for the next frame, the list passes keep the cells of the build
+	myRebinReady = myIncrementalRebin && !neighbourLists;
+	myRebinFrame = gridFrame;
+
+	myRenderBoidCount = aFrame.boidCount;
+	myRenderBoidsDirty = true;
+	myRenderPreviousBoidsDirty = true;
+	myLodStep++;
+	ReduceStepBounds(aFrame.boidCount);
+	HashState(aFrame);
+	myStats.totalMs = MillisecondsSince(start);
+}
+
+void BoidComputerCPU::RebuildCells(const FrameBufferData& aFrame)
+{
+	const bool stableSort = UsesStableSort(aFrame);
+	if (stableSort && myLayout != BoidLayout::SoA && myCellIndices.size() < aFrame.boidCount)
+		myCellIndices.resize(aFrame.boidCount);
+
+	auto passStart = PassClock::now();
+	if (!stableSort)
+		Clear(aFrame);
+	myStats.clearMs = MillisecondsSince(passStart);
+
+	passStart = PassClock::now();
+	if (myLayout == BoidLayout::SoA)
+		CountSoA(aFrame);
+	else if (myLayout == BoidLayout::Compact)
+		CountCompact(aFrame);
+	else
+		Count(aFrame);
+	myStats.countMs = MillisecondsSince(passStart);
+
+	passStart = PassClock::now();
+	if (!stableSort)
+	{
+		Sum(aFrame);
+		Copy(aFrame);
+	}
+	myStats.scanMs = MillisecondsSince(passStart);
+
+	passStart = PassClock::now();
+	if (stableSort)
+		SortStable(aFrame);
+	else if (myLayout == BoidLayout::SoA)
+		SortSoA(aFrame);
+	else if (myLayout == BoidLayout::Compact)
+		SortCompact(aFrame);
+	else
+		Sort(aFrame);
+	myStats.sortMs = MillisecondsSince(passStart);
+}
+
+bool BoidComputerCPU::RebinIncremental(const FrameBufferData& aFrame)
+{
+	if (!myRebinReady || !IsSameGrid(aFrame, myRebinFrame))
+		return false;
+
+	const unsigned int movedCount = myCellRebin.GetMovedCount();
+	if (movedCount > aFrame.boidCount / MAX_REBIN_FRACTION)
+		return false;
+
+	//The boids in between only shift by a few slots, that is a memmove instead of a scatter, in parallel where the shifts don't overlap
+	//The fix up changes the ends of the cells in between too, the empty blocks an atomic rebuild skipped are written first
+	if (mySparseCellEnds)
+	{
+		myCellOccupancy.Densify(mySumBuffer.data(), myCellGrid.GetKeyCount(), myThreadPool);
+		mySparseCellEnds = false;
+	}
+	myCellRebin.Plan(mySumBuffer.data(), aFrame.boidCount);
+	myCellRebin.UpdateSumBuffer(mySumBuffer.data(), myThreadPool);
+
+	//The output of the last frame is still sorted by the old cells, it is fixed up in place and becomes the input
+	const std::vector<IncrementalCellRebin::Move>& movedBoids = myCellRebin.GetMovedBoids();
+	if (myLayout == BoidLayout::SoA)
+	{
+		myRebinScratch.resize(movedCount);
+		std::swap(myStreamsIn, myStreamsOut);
+		for (unsigned int i = 0; i < movedCount; i++)
+		{
+			myRebinScratch[i] = myStreamsIn.Load(movedBoids[i].from);
+		}
+		BoidStreams& streams = myStreamsIn;
+		myCellRebin.ForEachShift(myThreadPool, [&](const IncrementalCellRebin::Move& aShift)
+			{
+				ShiftRange(streams.posX, aShift);
+				ShiftRange(streams.posY, aShift);
+				ShiftRange(streams.posZ, aShift);
+				ShiftRange(streams.velX, aShift);
+				ShiftRange(streams.velY, aShift);
+				ShiftRange(streams.velZ, aShift);
+				ShiftRange(streams.cellIndex, aShift);
+				ShiftRange(streams.flockSize, aShift);
+			});
+		for (unsigned int i = 0; i < movedCount; i++)
+		{
+			myStreamsIn.Store(movedBoids[i].to, myRebinScratch[i]);
+		}
+	}
+	else if (myLayout == BoidLayout::Compact)
+	{
+		//The records move as they are, the grid is the same so the offsets stay valid
+		std::swap(myCompactIn, myCompactOut);
+		myCompactRebinScratch.resize(movedCount);
+		myCompactFlockScratch.resize(movedCount);
+		for (unsigned int i = 0; i < movedCount; i++)
+		{
+			myCompactRebinScratch[i] = myCompactIn.boids[movedBoids[i].from];
+			myCompactFlockScratch[i] = myCompactIn.flockSize[movedBoids[i].from];
+		}
+		CompactBoids& compactBoids = myCompactIn;
+		myCellRebin.ForEachShift(myThreadPool, [&](const IncrementalCellRebin::Move& aShift)
+			{
+				ShiftRange(compactBoids.boids, aShift);
+				ShiftRange(compactBoids.flockSize, aShift);
+			});
+		for (unsigned int i = 0; i < movedCount; i++)
+		{
+			myCompactIn.boids[movedBoids[i].to] = myCompactRebinScratch[i];
+			myCompactIn.flockSize[movedBoids[i].to] = myCompactFlockScratch[i];
+		}
+	}
+	else
+	{
+		myRebinScratch.resize(movedCount);
+		std::swap(myBoidsIn, myBoidsOut);
+		for (unsigned int i = 0; i < movedCount; i++)
+		{
+			myRebinScratch[i] = myBoidsIn[movedBoids[i].from];
+		}
+		std::vector<Boid>& boids = myBoidsIn;
+		myCellRebin.ForEachShift(myThreadPool, [&](const IncrementalCellRebin::Move& aShift)
+			{
+				ShiftRange(boids, aShift);
+			});
+		for (unsigned int i = 0; i < movedCount; i++)
+		{
+			myBoidsIn[movedBoids[i].to] = myRebinScratch[i];
+		}
+	}
+
+	myStats.movedBoids = movedCount;
+	myStats.shiftedBoids = myCellRebin.GetShiftedCount();
+	return true;
+}
+
+void BoidComputerCPU::RunBoidsCPU(const FrameBufferData& aFrame)
+{
+	const auto start = PassClock::now();
+	EnsureBoids(aFrame);
+	if (myStepBounds && myClosestSqr.size() < aFrame.boidCount)
+		myClosestSqr.resize(aFrame.boidCount);
+	myStorageFrame = aFrame;
+
+	if (myLayout == BoidLayout::SoA)
+	{
+		MainSoA(aFrame);
+	}
+	else
+	{
+		//Every boid reads every other, so compact boids are decoded once up front
+		const bool compact = myLayout == BoidLayout::Compact;
+		if (compact)
+		{
+			if (myDecodedBoids.size() < aFrame.boidCount)
+				myDecodedBoids.resize(aFrame.boidCount);
+			myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+				{
+					for (size_t i = aBegin; i < aEnd; i++)
+					{
+						myDecodedBoids[i] = myCompactIn.Load(i);
+					}
+				});
+			myCompactOut.SetGrid(aFrame);
+		}
+
+		const Boid* boidsIn = compact ? myDecodedBoids.data() : myBoidsIn.data();
+		Boid* boidsOut = myBoidsOut.data();
+		float* closestSqr = myStepBounds ? myClosestSqr.data() : nullptr;
+		myThreadPool.ParallelFor(aFrame.boidCount, BEHAVIOR_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					Boid b = boidsIn[i];
+					const float boidClosestSqr = BoidCS::BoidBehaviors(b, boidsIn, aFrame);
+					if (closestSqr)
+						closestSqr[i] = boidClosestSqr;
+					BoidCS::MoveBoid(b, aFrame);
+					if (compact)
+						myCompactOut.Store(i, b);
+					else
+						boidsOut[i] = b;
+				}
+			});
+	}
+
+	myRenderBoidCount = aFrame.boidCount;
+	myRenderBoidsDirty = true;
+	myRenderPreviousBoidsDirty = true;
+	myRebinReady = false;
+	myVerletLists.Invalidate();
+	myStats = CPUSimulationStats();
+	myStats.neighbourCandidates = (unsigned long long)aFrame.boidCount * aFrame.boidCount;
+	myStats.behaviorMs = MillisecondsSince(start);
+	ReduceStepBounds(aFrame.boidCount);
+	HashState(aFrame);
+	myStats.totalMs = MillisecondsSince(start);
+}
+
+void BoidComputerCPU::SwapBuffers()
+{
+	std::swap(myBoidsIn, myBoidsOut);
+	std::swap(myStreamsIn, myStreamsOut);
+	std::swap(myCompactIn, myCompactOut);
+	myRenderBoidsDirty = true;
+	myRenderPreviousBoidsDirty = true;
+	myRebinReady = false;
+	myVerletLists.Invalidate();
+}
+
+void BoidComputerCPU::UnInit()
+{
+	myThreadPool.UnInit();
+	myBoidsIn = std::vector<Boid>();
+	myBoidsOut = std::vector<Boid>();
+	myStreamsIn.Release();
+	myStreamsOut.Release();
+	myCompactIn.Release();
+	myCompactOut.Release();
+	myDecodedBoids = std::vector<Boid>();
+	myRenderBoids = std::vector<Boid>();
+	myRenderPreviousBoids = std::vector<Boid>();
+	myRenderInstances = std::vector<RenderInstance>();
+	myRenderPreviousInstances = std::vector<RenderInstance>();
+	myRenderBoidsDirty = true;
+	myRenderPreviousBoidsDirty = true;
+	mySumBuffer = std::vector<unsigned int>();
+	myUnsortedSumBuffer = std::vector<unsigned int>();
+	myCellIndices = std::vector<unsigned int>();
+	myCellOccupancy.Release();
+	mySparseCellEnds = false;
+	myCellSort.Release();
+	myCellRebin.Release();
+	myRebinScratch = std::vector<Boid>();
+	myCompactRebinScratch = std::vector<CompactBoid>();
+	myCompactFlockScratch = std::vector<unsigned short>();
+	myPairBoids = std::vector<PairBoid>();
+	myPairAccumulators = std::vector<BoidCS::FlockAccumulator>();
+	myVerletLists.Release();
+	myRebinReady = false;
+	myInitializedBoidCount = 0;
+}
+
+const Boid* BoidComputerCPU::GetBoids()
+{
+	if (myLayout == BoidLayout::AoS)
+		return myBoidsOut.data();
+	if (myLayout == BoidLayout::Compact)
+		return PackRenderBoids(myCompactOut, myRenderBoids, myRenderBoidsDirty);
+
+	return PackRenderBoids(myStreamsOut, myRenderBoids, myRenderBoidsDirty);
+}
+
+const Boid* BoidComputerCPU::GetPreviousBoids()
+{
+	//The passes read the input in the slots they write the output to, so it is the state before the step
+	if (myLayout == BoidLayout::AoS)
+		return myBoidsIn.data();
+	if (myLayout == BoidLayout::Compact)
+		return PackRenderBoids(myCompactIn, myRenderPreviousBoids, myRenderPreviousBoidsDirty);
+
+	return PackRenderBoids(myStreamsIn, myRenderPreviousBoids, myRenderPreviousBoidsDirty);
+}
+
+template<typename Storage>
+const Boid* BoidComputerCPU::PackRenderBoids(const Storage& aStorage, std::vector<Boid>& aOutBoids, bool& aDirty)
+{
+	//Render boundary, the instance buffer and the shaders stay AoS
+	if (aDirty)
+	{
+		if (aOutBoids.size() < myRenderBoidCount)
+			aOutBoids.resize(myRenderBoidCount);
+
+		myThreadPool.ParallelFor(myRenderBoidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					aOutBoids[i] = aStorage.Load(i);
+				}
+			});
+		aDirty = false;
+	}
+	return aOutBoids.data();
+}
+
+const RenderInstance* BoidComputerCPU::PackRenderInstances(const FrameBufferData& aFrame, const bool aPrevious)
+{
+	std::vector<RenderInstance>& instances = aPrevious ? myRenderPreviousInstances : myRenderInstances;
+	if (instances.size() < myRenderBoidCount)
+		instances.resize(myRenderBoidCount);
+
+	const InstanceBufferData packing = RenderInstances::GetPacking(aFrame);
+	if (myLayout == BoidLayout::AoS)
+	{
+		RenderInstances::PackBoids(aPrevious ? myBoidsIn.data() : myBoidsOut.data(), myRenderBoidCount, packing, instances.data(), myThreadPool);
+		return instances.data();
+	}
+
+	//The other layouts are packed as they are loaded, without the Boid records GetBoids would build
+	RenderInstance* outInstances = instances.data();
+	myThreadPool.ParallelFor(myRenderBoidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				outInstances[i] = RenderInstances::Pack(aPrevious ? LoadInput(i) : LoadOutput(i), packing);
+			}
+		});
+	return instances.data();
+}
+
+const CPUSimulationStats& BoidComputerCPU::GetStats() const
+{
+	return myStats;
+}
+
+void BoidComputerCPU::EnsureBoids(const FrameBufferData& aFrame)
+{
+	const unsigned int boidCount = aFrame.boidCount;
+	if (boidCount <= myInitializedBoidCount)
+		return;
+
+	if (myLayout == BoidLayout::SoA && myStreamsIn.Size() < boidCount)
+	{
+		myStreamsIn.Resize(boidCount);
+		myStreamsOut.Resize(boidCount);
+	}
+	else if (myLayout == BoidLayout::Compact && myCompactIn.Size() < boidCount)
+	{
+		myCompactIn.Resize(boidCount);
+		myCompactOut.Resize(boidCount);
+	}
+	else if (myLayout == BoidLayout::AoS && myBoidsIn.size() < boidCount)
+	{
+		myBoidsIn.resize(boidCount);
+		myBoidsOut.resize(boidCount);
+	}
+
+	//New compact boids are stored in the cells of the boids they join, or of aFrame when all boids are new
+	if (myLayout == BoidLayout::Compact && (myInitializedBoidCount == 0 || myCompactIn.grid.cellSize == 0.f))
+	{
+		myCompactIn.SetGrid(aFrame);
+		myCompactOut.SetGrid(aFrame);
+	}
+
+	const unsigned int first = myInitializedBoidCount;
+	myThreadPool.ParallelFor(boidCount - first, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = first + aBegin; i < first + aEnd; i++)
+			{
+				Boid b;
+				BoidCS::InitBoid(b, (unsigned int)i, myInitSeed, myInitMinPos, myInitMaxPos);
+				if (myLayout == BoidLayout::SoA)
+				{
+					myStreamsIn.Store(i, b);
+					myStreamsOut.Store(i, b);
+				}
+				else if (myLayout == BoidLayout::Compact)
+				{
+					myCompactIn.Store(i, b);
+					myCompactOut.Store(i, b);
+				}
+				else
+				{
+					myBoidsIn[i] = b;
+					myBoidsOut[i] = b;
+				}
+			}
+		});
+	myInitializedBoidCount = boidCount;
+}
+
+Boid BoidComputerCPU::LoadInput(const size_t aIndex) const
+{
+	if (myLayout == BoidLayout::SoA)
+		return myStreamsIn.Load(aIndex);
+	if (myLayout == BoidLayout::Compact)
+		return myCompactIn.Load(aIndex);
+	return myBoidsIn[aIndex];
+}
+
+Vector3<float> BoidComputerCPU::LoadInputPos(const size_t aIndex) const
+{
+	if (myLayout == BoidLayout::SoA)
+		return { myStreamsIn.posX[aIndex], myStreamsIn.posY[aIndex], myStreamsIn.posZ[aIndex] };
+	if (myLayout == BoidLayout::Compact)
+		return myCompactIn.LoadPos(aIndex);
+	return myBoidsIn[aIndex].pos;
+}
+
+Boid BoidComputerCPU::LoadOutput(const size_t aIndex) const
+{
+	if (myLayout == BoidLayout::SoA)
+		return myStreamsOut.Load(aIndex);
+	if (myLayout == BoidLayout::Compact)
+		return myCompactOut.Load(aIndex);
+	return myBoidsOut[aIndex];
+}
+
+unsigned int BoidComputerCPU::StoreOutput(const size_t aIndex, const Boid& aBoid)
+{
+	if (myLayout == BoidLayout::SoA)
+	{
+		myStreamsOut.Store(aIndex, aBoid);
+	}
+	else if (myLayout == BoidLayout::Compact)
+	{
+		//The cell of the decoded position, a boid next to a face can round into the neighbouring one
+		myCompactOut.Store(aIndex, aBoid);
+		return myCompactOut.boids[aIndex].cellIndex;
+	}
+	else
+	{
+		myBoidsOut[aIndex] = aBoid;
+	}
+	return aBoid.cellIndex;
+}
+
+void BoidComputerCPU::EnsureCells(const unsigned int aKeyCount)
+{
+	if (mySumBuffer.size() < aKeyCount)
+	{
+		mySumBuffer.resize(aKeyCount);
+		myUnsortedSumBuffer.resize(aKeyCount);
+		myCellOccupancy.Resize(aKeyCount);
+	}
+}
+
+CellEnds BoidComputerCPU::GetCellEnds() const
+{
+	if (mySparseCellEnds)
+		return myCellOccupancy.GetCellEnds(mySumBuffer.data());
+
+	CellEnds cellEnds;
+	cellEnds.ends = mySumBuffer.data();
+	return cellEnds;
+}
+
+void BoidComputerCPU::Clear(const FrameBufferData&)
+{
+	//Only the blocks the last count put boids in hold counts, the sum buffer is written in full by the scan
+	const unsigned int clearedCells = myCellOccupancy.Clear(myUnsortedSumBuffer.data(), myThreadPool);
+	myStats.clearedBytes = (size_t)clearedCells * sizeof(unsigned int);
+	myStats.clearBytesSaved = (mySumBuffer.size() + myUnsortedSumBuffer.size()) * sizeof(unsigned int) - myStats.clearedBytes;
+}
+
+void BoidComputerCPU::Count(const FrameBufferData& aFrame)
+{
+	Boid* boidsOut = myBoidsOut.data();
+	unsigned int* counts = myUnsortedSumBuffer.data();
+	CellOccupancy& cellOccupancy = myCellOccupancy;
+	unsigned int* cellIndices = myCellIndices.data();
+	const CellGrid& cellGrid = myCellGrid;
+	const bool stableSort = UsesStableSort(aFrame);
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				unsigned int cellIndex = cellGrid.GetCellKey(boidsOut[i].pos);
+				boidsOut[i].cellIndex = cellIndex;
+				if (stableSort)
+				{
+					cellIndices[i] = cellIndex;
+				}
+				else
+				{
+					InterlockedAdd(counts[cellIndex], 1);
+					cellOccupancy.Mark(cellIndex);
+				}
+			}
+		});
+}
+
+void BoidComputerCPU::Sum(const FrameBufferData&)
+{
+	const unsigned int keyCount = myCellGrid.GetKeyCount();
+	myCellOccupancy.InclusiveScan(myUnsortedSumBuffer.data(), mySumBuffer.data(), keyCount, myThreadPool);
+	myStats.occupiedCellBlocks = myCellOccupancy.GetOccupiedBlockCount();
+
+	//With most blocks occupied, writing the empty ones costs less than the sparse reads of the neighbour passes
+	const unsigned int blockCount = (keyCount + OCCUPANCY_BLOCK_CELLS - 1) / OCCUPANCY_BLOCK_CELLS;
+	mySparseCellEnds = (unsigned long long)myStats.occupiedCellBlocks * SPARSE_CELL_ENDS_MAX_FRACTION < blockCount;
+	if (!mySparseCellEnds)
+		myCellOccupancy.Densify(mySumBuffer.data(), keyCount, myThreadPool);
+}
+
+void BoidComputerCPU::Copy(const FrameBufferData&)
+{
+	//Sort only reads the cells it has boids for
+	myCellOccupancy.CopyOccupied(mySumBuffer.data(), myUnsortedSumBuffer.data(), myCellGrid.GetKeyCount(), myThreadPool);
+}
+
+void BoidComputerCPU::Sort(const FrameBufferData& aFrame)
+{
+	const Boid* boidsOut = myBoidsOut.data();
+	Boid* boidsIn = myBoidsIn.data();
+	unsigned int* unsortedSumBuffer = myUnsortedSumBuffer.data();
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				const Boid& b = boidsOut[i];
+				unsigned int offset = InterlockedDecrement(unsortedSumBuffer[b.cellIndex]);
+				boidsIn[offset - 1] = b;
+			}
+		});
+}
+
+template<typename Layout>
+void BoidComputerCPU::MainGriddedLayout(const FrameBufferData& aFrame, const Layout& aLayout)
+{
+	const CellEnds sumBuffer = GetCellEnds();
+	const CellGrid& cellGrid = myCellGrid;
+	const bool trackMoves = myIncrementalRebin;
+	const bool cellCulling = myCellCulling;
+	IncrementalCellRebin& rebin = myCellRebin;
+	std::atomic<unsigned long long> candidates(0);
+	std::atomic<unsigned long long> culled(0);
+	float* closestSqr = myStepBounds ? myClosestSqr.data() : nullptr;
+	const FrameBufferData* lodFrames = myLod ? myLodFrames : nullptr;
+	const unsigned int lodStep = myLodStep;
+	std::atomic<unsigned int> lodSkipped(0);
+	ForEachBehaviorRange(aFrame, [&](size_t aBegin, size_t aEnd, unsigned int aThreadIndex)
+		{
+			//Boids are sorted, so the ranges are gathered once per cell and only culled per boid
+			Layout layout = aLayout;
+			NeighbourRanges ranges;
+			NeighbourRanges culledRanges;
+			unsigned long long rangesCell = ~0ull;
+			unsigned long long chunkCandidates = 0;
+			unsigned long long chunkCulled = 0;
+			LodCell lodCell;
+			unsigned int chunkSkipped = 0;
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				Boid b = layout.Load(i);
+				//Boids in the cells the LOD skips this step keep their velocity and only move
+				const FrameBufferData* behaviorFrame = lodFrames ? GetLodBehaviorFrame(b.pos, aFrame, lodFrames, lodStep, lodCell) : &aFrame;
+				if (behaviorFrame)
+				{
+					const unsigned long long cell = cellGrid.GetCellId(b.pos, b.cellIndex);
+					if (cell != rangesCell)
+					{
+						cellGrid.GatherNeighbourRanges(b.pos, b.cellIndex, sumBuffer, ranges);
+						rangesCell = cell;
+					}
+
+					BoidCS::FlockAccumulator accumulator;
+					const Vector3<float> velDir = BoidCS::Normalize(b.vel);
+					const NeighbourRanges* boidRanges = &ranges;
+					if (cellCulling)
+					{
+						cellGrid.CullNeighbourRanges(ranges, b.pos, velDir, sumBuffer, true, culledRanges);
+						chunkCulled += ranges.candidates - culledRanges.candidates;
+						boidRanges = &culledRanges;
+					}
+					layout.Accumulate(accumulator, b.pos, velDir, *boidRanges, aFrame);
+					chunkCandidates += boidRanges->candidates;
+					BoidCS::ApplyFlockAccumulator(b, accumulator, *behaviorFrame);
+					if (closestSqr)
+						closestSqr[i] = accumulator.closestSqr;
+				}
+				else
+				{
+					chunkSkipped++;
+					if (closestSqr)
+						closestSqr[i] = FLT_MAX;
+				}
+				BoidCS::MoveBoid(b, aFrame);
+				const unsigned int cellKey = layout.Store(i, b, trackMoves);
+				if (trackMoves && cellKey != b.cellIndex)
+					rebin.AddMoved(aThreadIndex, (unsigned int)i, b.cellIndex, cellKey);
+			}
+			lodSkipped += chunkSkipped;
+			candidates += chunkCandidates;
+			culled += chunkCulled;
+		});
+	myStats.neighbourCandidates = candidates;
+	myStats.culledCandidates = culled;
+	myStats.lodSkippedBoids = lodSkipped;
+}
+
+void BoidComputerCPU::MainGridded(const FrameBufferData& aFrame)
+{
+	MainGriddedLayout(aFrame, GriddedAoS{ myBoidsIn.data(), myBoidsOut.data(), &myCellGrid });
+}
+
+void BoidComputerCPU::CountSoA(const FrameBufferData& aFrame)
+{
+	//Only the position streams are read and only the cell index stream is written
+	const float* posX = myStreamsOut.posX.data();
+	const float* posY = myStreamsOut.posY.data();
+	const float* posZ = myStreamsOut.posZ.data();
+	unsigned int* cellIndices = myStreamsOut.cellIndex.data();
+	unsigned int* counts = myUnsortedSumBuffer.data();
+	CellOccupancy& cellOccupancy = myCellOccupancy;
+	const CellGrid& cellGrid = myCellGrid;
+	const bool stableSort = UsesStableSort(aFrame);
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				unsigned int cellIndex = cellGrid.GetCellKey({ posX[i], posY[i], posZ[i] });
+				cellIndices[i] = cellIndex;
+				if (!stableSort)
+				{
+					InterlockedAdd(counts[cellIndex], 1);
+					cellOccupancy.Mark(cellIndex);
+				}
+			}
+		});
+}
+
+void BoidComputerCPU::SortSoA(const FrameBufferData& aFrame)
+{
+	//flockSize is rewritten by the behavior pass and is not carried through the sort
+	const BoidStreams& boidsOut = myStreamsOut;
+	BoidStreams& boidsIn = myStreamsIn;
+	unsigned int* unsortedSumBuffer = myUnsortedSumBuffer.data();
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				unsigned int cellIndex = boidsOut.cellIndex[i];
+				unsigned int offset = InterlockedDecrement(unsortedSumBuffer[cellIndex]) - 1;
+				boidsIn.posX[offset] = boidsOut.posX[i];
+				boidsIn.posY[offset] = boidsOut.posY[i];
+				boidsIn.posZ[offset] = boidsOut.posZ[i];
+				boidsIn.velX[offset] = boidsOut.velX[i];
+				boidsIn.velY[offset] = boidsOut.velY[i];
+				boidsIn.velZ[offset] = boidsOut.velZ[i];
+				boidsIn.cellIndex[offset] = cellIndex;
+			}
+		});
+}
+
+void BoidComputerCPU::MainGriddedSoA(const FrameBufferData& aFrame)
+{
+	MainGriddedLayout(aFrame, GriddedSoA{ &myStreamsIn, &myStreamsOut, &myCellGrid, myKernel.accumulateGridded });
+}
+
+void BoidComputerCPU::RequantizeCompact(const FrameBufferData& aFrame)
+{
+	//Decoded with the cells of the old grid and stored in the cells of the new one
+	CompactBoids oldGrid;
+	oldGrid.SetGrid(myCompactOut.grid);
+	CompactBoids& boidsOut = myCompactOut;
+	boidsOut.SetGrid(aFrame);
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				const CompactBoid& compact = boidsOut.boids[i];
+				Boid b;
+				b.pos = oldGrid.DecodePos(compact, oldGrid.GetCellMiddle(compact.cellIndex));
+				b.vel = CompactBoids::DecodeVel(compact);
+				b.flockSize = boidsOut.flockSize[i];
+				boidsOut.Store(i, b);
+			}
+		});
+}
+
+void BoidComputerCPU::CountCompact(const FrameBufferData& aFrame)
+{
+	//Store already worked out the row major cells, only the cell indices are read
+	const CompactBoid* boidsOut = myCompactOut.boids.data();
+	unsigned int* counts = myUnsortedSumBuffer.data();
+	CellOccupancy& cellOccupancy = myCellOccupancy;
+	unsigned int* cellIndices = myCellIndices.data();
+	const bool stableSort = UsesStableSort(aFrame);
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				if (stableSort)
+				{
+					cellIndices[i] = boidsOut[i].cellIndex;
+				}
+				else
+				{
+					InterlockedAdd(counts[boidsOut[i].cellIndex], 1);
+					cellOccupancy.Mark(boidsOut[i].cellIndex);
+				}
+			}
+		});
+}
+
+void BoidComputerCPU::SortCompact(const FrameBufferData& aFrame)
+{
+	//flockSize is rewritten by the behavior pass like in SortSoA
+	const CompactBoid* boidsOut = myCompactOut.boids.data();
+	CompactBoid* boidsIn = myCompactIn.boids.data();
+	unsigned int* unsortedSumBuffer = myUnsortedSumBuffer.data();
+	myCompactIn.SetGrid(myCompactOut.grid);
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				const CompactBoid& b = boidsOut[i];
+				unsigned int offset = InterlockedDecrement(unsortedSumBuffer[b.cellIndex]);
+				boidsIn[offset - 1] = b;
+			}
+		});
+}
+
+void BoidComputerCPU::MainGriddedCompact(const FrameBufferData& aFrame)
+{
+	MainGriddedLayout(aFrame, GriddedCompact{ &myCompactIn, &myCompactOut, CompactCellCache(), CompactCellCache() });
+}
+
+void BoidComputerCPU::MainGriddedHalfShell(const FrameBufferData& aFrame)
+{
+	if (myPairBoids.size() < aFrame.boidCount)
+	{
+		myPairBoids.resize(aFrame.boidCount);
+		myPairAccumulators.resize(aFrame.boidCount);
+	}
+
+	PairBoid* pairBoids = myPairBoids.data();
+	BoidCS::FlockAccumulator* accumulators = myPairAccumulators.data();
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				const Boid b = LoadInput(i);
+				pairBoids[i] = { b.pos, b.vel, BoidCS::Normalize(b.vel), b.cellIndex };
+				accumulators[i] = BoidCS::FlockAccumulator();
+			}
+		});
+
+	//The grid is split into blocks of cellRings layers by a band of at least cellRings rows. Pairs only reach forward,
+	//so a block adds to its own and the next layers and to the bands on either side. Blocks of every other slab of
+	//layers and every third band never add to the same boid, which makes six phases that each run their blocks at the same time.
+	//Each block is done by one thread and the blocks only depend on the grid, which keeps the sums in the same order for any thread count.
+	const CellEnds sumBuffer = GetCellEnds();
+	const CellGrid& cellGrid = myCellGrid;
+	const unsigned int cellRings = (unsigned int)BoidCS::GetCellRings(aFrame);
+	const unsigned int slabCount = (aFrame.gridDims.z + cellRings - 1) / cellRings;
+	const unsigned int slabsPerPhase = (slabCount + 1) / 2;
+	const unsigned int bandsNeeded = 3 * ((HALF_SHELL_PHASE_BLOCKS + slabsPerPhase - 1) / slabsPerPhase);
+	const unsigned int ringBands = (aFrame.gridDims.y + cellRings - 1) / cellRings;
+	const unsigned int bandRows = cellRings * (ringBands > bandsNeeded ? ringBands / bandsNeeded : 1);
+	const unsigned int bandCount = (aFrame.gridDims.y + bandRows - 1) / bandRows;
+	const bool cellCulling = myCellCulling;
+	std::atomic<unsigned long long> pairs(0);
+	std::atomic<unsigned long long> culled(0);
+	for (unsigned int phase = 0; phase < 6; phase++)
+	{
+		const unsigned int slabParity = phase / 3;
+		const unsigned int bandPhase = phase % 3;
+		const unsigned int phaseBands = (bandCount + 2 - bandPhase) / 3;
+		const unsigned int phaseSlabs = (slabCount + 1 - slabParity) / 2;
+		myThreadPool.ParallelForChunks((size_t)phaseSlabs * phaseBands, [&](size_t aChunkIndex, unsigned int)
+			{
+				const unsigned int firstLayer = ((unsigned int)(aChunkIndex / phaseBands) * 2 + slabParity) * cellRings;
+				const unsigned int endLayer = firstLayer + cellRings < aFrame.gridDims.z ? firstLayer + cellRings : aFrame.gridDims.z;
+				const unsigned int firstRow = ((unsigned int)(aChunkIndex % phaseBands) * 3 + bandPhase) * bandRows;
+				const unsigned int endRow = firstRow + bandRows < aFrame.gridDims.y ? firstRow + bandRows : aFrame.gridDims.y;
+				NeighbourRanges ranges;
+				unsigned long long blockPairs = 0;
+				unsigned long long blockCulled = 0;
+				for (unsigned int layer = firstLayer; layer < endLayer; layer++)
+				{
+					//Walks the occupied cells of the band through its boids, so empty cells cost nothing
+					const unsigned int firstCell = cellGrid.GetRowFirstKey(layer, firstRow);
+					const unsigned int bandEnd = sumBuffer[cellGrid.GetRowFirstKey(layer, endRow) - 1];
+					unsigned int end = firstCell > 0 ? sumBuffer[firstCell - 1] : 0;
+					while (end < bandEnd)
+					{
+						const unsigned int start = end;
+						const unsigned int cell = pairBoids[start].cellIndex;
+						end = sumBuffer[cell];
+
+						for (unsigned int i = start; i < end; i++)
+						{
+							const PairBoid& b = pairBoids[i];
+							for (unsigned int j = i + 1; j < end; j++)
+							{
+								BoidCS::AccumulatePair(accumulators[i], b.pos, b.velDir, b.vel, accumulators[j], pairBoids[j].pos, pairBoids[j].velDir, pairBoids[j].vel, aFrame);
+							}
+						}
+						blockPairs += (unsigned long long)(end - start) * (end - start - 1) / 2;
+
+						//The range test is the same from both sides, so a pair can be culled from the lower boid
+						cellGrid.GatherForwardRanges(pairBoids[start].pos, cell, sumBuffer, ranges);
+						blockCulled += (unsigned long long)(end - start) * ranges.candidates;
+						for (unsigned int r = 0; r < ranges.count; r++)
+						{
+							for (unsigned int i = start; i < end; i++)
+							{
+								const PairBoid& b = pairBoids[i];
+								unsigned int rangeStart = ranges.start[r];
+								unsigned int rangeEnd = ranges.end[r];
+								if (cellCulling)
+									cellGrid.CullNeighbourRange(ranges, r, b.pos, b.velDir, sumBuffer, false, rangeStart, rangeEnd);
+								for (unsigned int j = rangeStart; j < rangeEnd; j++)
+								{
+									BoidCS::AccumulatePair(accumulators[i], b.pos, b.velDir, b.vel, accumulators[j], pairBoids[j].pos, pairBoids[j].velDir, pairBoids[j].vel, aFrame);
+								}
+								blockPairs += rangeEnd - rangeStart;
+								blockCulled -= rangeEnd - rangeStart;
+							}
+						}
+					}
+				}
+				pairs += blockPairs;
+				culled += blockCulled;
+			});
+	}
+	myStats.neighbourCandidates = pairs;
+	myStats.culledCandidates = culled;
+
+	float* closestSqr = myStepBounds ? myClosestSqr.data() : nullptr;
+	const bool trackMoves = myIncrementalRebin;
+	IncrementalCellRebin& rebin = myCellRebin;
+	myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int aThreadIndex)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				Boid b = LoadInput(i);
+				BoidCS::ApplyFlockAccumulator(b, accumulators[i], aFrame);
+				if (closestSqr)
+					closestSqr[i] = accumulators[i].closestSqr;
+				BoidCS::MoveBoid(b, aFrame);
+				const unsigned int oldKey = b.cellIndex;
+				if (trackMoves)
+					b.cellIndex = cellGrid.GetCellKey(b.pos);
+				const unsigned int cellKey = StoreOutput(i, b);
+				if (trackMoves && cellKey != oldKey)
+					rebin.AddMoved(aThreadIndex, (unsigned int)i, oldKey, cellKey);
+			}
+		});
+}
+
+bool BoidComputerCPU::GetListGridFrame(const FrameBufferData& aFrame, FrameBufferData& aOutGridFrame) const
+{
+	//The rings are worked out like SimulationFrameData::Fill does for the visual range
+	const float listRange = std::sqrt(aFrame.visualRangeSqr) + myListSkin;
+	const float rings = std::ceil(listRange / aFrame.cellSize - 0.001f);
+	if (!(rings <= (float)MAX_CELL_RINGS))
+		return false;
+
+	aOutGridFrame = aFrame;
+	aOutGridFrame.visualRangeSqr = listRange * listRange;
+	aOutGridFrame.cellRings = rings > 1.f ? (unsigned int)rings : 1;
+	return true;
+}
+
+bool BoidComputerCPU::BuildNeighbourLists(const FrameBufferData& aGridFrame)
+{
+	Vector3<float>* positions = myVerletLists.PrepareBuild(aGridFrame.boidCount);
+	myThreadPool.ParallelFor(aGridFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				positions[i] = LoadInputPos(i);
+			}
+		});
+
+	if (myVerletLists.Build(myCellGrid, GetCellEnds(), aGridFrame, myListSkin, myListBudgetBytes, myThreadPool))
+		return true;
+
+	myListRetryFrames = LIST_RETRY_FRAMES;
+	return false;
+}
+
+void BoidComputerCPU::MainNeighbourLists(const FrameBufferData& aFrame)
+{
+	//The lists hold every boid that can be in range, the FOV and range tests are the ones of the gridded passes
+	const unsigned int* neighbours = myVerletLists.GetNeighbours();
+	const unsigned int* offsets = myVerletLists.GetOffsets();
+	const VerletNeighbourLists& lists = myVerletLists;
+	const bool soa = myLayout == BoidLayout::SoA;
+	const bool compact = myLayout == BoidLayout::Compact;
+	float* closestSqr = myStepBounds ? myClosestSqr.data() : nullptr;
+	std::atomic<bool> movedTooFar(false);
+	const FrameBufferData* lodFrames = myLod ? myLodFrames : nullptr;
+	const unsigned int lodStep = myLodStep;
+	std::atomic<unsigned int> lodSkipped(0);
+	myThreadPool.ParallelFor(aFrame.boidCount, BEHAVIOR_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			bool chunkMovedTooFar = false;
+			LodCell lodCell;
+			unsigned int chunkSkipped = 0;
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				Boid b = LoadInput(i);
+				//Boids in the cells the LOD skips this step keep their velocity and only move
+				const FrameBufferData* behaviorFrame = lodFrames ? GetLodBehaviorFrame(b.pos, aFrame, lodFrames, lodStep, lodCell) : &aFrame;
+				if (behaviorFrame)
+				{
+					BoidCS::FlockAccumulator accumulator;
+					const Vector3<float> velDir = BoidCS::Normalize(b.vel);
+					if (soa)
+					{
+						const BoidStreams& boidsIn = myStreamsIn;
+						for (unsigned int n = offsets[i]; n < offsets[i + 1]; n++)
+						{
+							const unsigned int j = neighbours[n];
+							BoidCS::AccumulateNeighbour(accumulator, b.pos, velDir, { boidsIn.posX[j], boidsIn.posY[j], boidsIn.posZ[j] },
+								{ boidsIn.velX[j], boidsIn.velY[j], boidsIn.velZ[j] }, aFrame);
+						}
+					}
+					else if (compact)
+					{
+						const CompactBoids& boidsIn = myCompactIn;
+						CompactCellCache cellCache;
+						for (unsigned int n = offsets[i]; n < offsets[i + 1]; n++)
+						{
+							const unsigned int j = neighbours[n];
+							BoidCS::AccumulateNeighbour(accumulator, b.pos, velDir, boidsIn.LoadPos(j, cellCache), CompactBoids::DecodeVel(boidsIn.boids[j]), aFrame);
+						}
+					}
+					else
+					{
+						const Boid* boidsIn = myBoidsIn.data();
+						for (unsigned int n = offsets[i]; n < offsets[i + 1]; n++)
+						{
+							const unsigned int j = neighbours[n];
+							BoidCS::AccumulateNeighbour(accumulator, b.pos, velDir, boidsIn[j].pos, boidsIn[j].vel, aFrame);
+						}
+					}
+					BoidCS::ApplyFlockAccumulator(b, accumulator, *behaviorFrame);
+					if (closestSqr)
+						closestSqr[i] = accumulator.closestSqr;
+				}
+				else
+				{
+					chunkSkipped++;
+					if (closestSqr)
+						closestSqr[i] = FLT_MAX;
+				}
+				BoidCS::MoveBoid(b, aFrame);
+				chunkMovedTooFar = chunkMovedTooFar || lists.HasMovedTooFar((unsigned int)i, b.pos);
+				StoreOutput(i, b);
+			}
+			lodSkipped += chunkSkipped;
+			if (chunkMovedTooFar)
+				movedTooFar = true;
+		});
+	myStats.neighbourCandidates = myVerletLists.GetEntryCount();
+	myStats.lodSkippedBoids = lodSkipped;
+
+	//The output is the input of the next frame, which needs new lists if a boid got too far from where they were built
+	if (movedTooFar)
+		myVerletLists.Invalidate();
+	else
+		myVerletLists.AdvanceStep();
+}
+
+void BoidComputerCPU::MainSoA(const FrameBufferData& aFrame)
+{
+	const BoidStreams& boidsIn = myStreamsIn;
+	BoidStreams& boidsOut = myStreamsOut;
+	const NeighbourKernel::AccumulateRangeFunction accumulateRange = myKernel.accumulateRange;
+	float* closestSqr = myStepBounds ? myClosestSqr.data() : nullptr;
+	myThreadPool.ParallelFor(aFrame.boidCount, BEHAVIOR_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				Boid b = boidsIn.Load(i);
+				BoidCS::FlockAccumulator accumulator;
+				accumulateRange(accumulator, b.pos, BoidCS::Normalize(b.vel), boidsIn, 0, aFrame.boidCount, aFrame);
+				BoidCS::ApplyFlockAccumulator(b, accumulator, aFrame);
+				if (closestSqr)
+					closestSqr[i] = accumulator.closestSqr;
+				BoidCS::MoveBoid(b, aFrame);
+				boidsOut.Store(i, b);
+			}
+		});
+}
+
+void BoidComputerCPU::ReduceStepBounds(const unsigned int aBoidCount)
+{
+	myStats.stepBounds = myStepBounds;
+	myStats.maxSpeed = 0.f;
+	myStats.minSeparation = FLT_MAX;
+	if (!myStepBounds)
+		return;
+
+	//One bound per chunk, combined in chunk order afterwards
+	const size_t chunkCount = (aBoidCount + BOID_GRAIN_SIZE - 1) / BOID_GRAIN_SIZE;
+	if (myStepBoundChunks.size() < chunkCount)
+		myStepBoundChunks.resize(chunkCount);
+
+	const bool soa = myLayout == BoidLayout::SoA;
+	const bool compact = myLayout == BoidLayout::Compact;
+	const float* closestSqr = myClosestSqr.data();
+	StepBound* chunks = myStepBoundChunks.data();
+	myThreadPool.ParallelFor(aBoidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			StepBound bound = { 0.f, FLT_MAX };
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				Vector3<float> vel;
+				if (soa)
+					vel = { myStreamsOut.velX[i], myStreamsOut.velY[i], myStreamsOut.velZ[i] };
+				else if (compact)
+					vel = CompactBoids::DecodeVel(myCompactOut.boids[i]);
+				else
+					vel = myBoidsOut[i].vel;
+				const float speedSqr = vel.x * vel.x + vel.y * vel.y + vel.z * vel.z;
+				bound.maxSpeedSqr = speedSqr > bound.maxSpeedSqr ? speedSqr : bound.maxSpeedSqr;
+				bound.closestSqr = closestSqr[i] < bound.closestSqr ? closestSqr[i] : bound.closestSqr;
+			}
+			chunks[aBegin / BOID_GRAIN_SIZE] = bound;
+		});
+
+	StepBound bound = { 0.f, FLT_MAX };
+	for (size_t c = 0; c < chunkCount; c++)
+	{
+		bound.maxSpeedSqr = chunks[c].maxSpeedSqr > bound.maxSpeedSqr ? chunks[c].maxSpeedSqr : bound.maxSpeedSqr;
+		bound.closestSqr = chunks[c].closestSqr < bound.closestSqr ? chunks[c].closestSqr : bound.closestSqr;
+	}
+	myStats.maxSpeed = std::sqrt(bound.maxSpeedSqr);
+	myStats.minSeparation = bound.closestSqr < FLT_MAX ? std::sqrt(bound.closestSqr) : FLT_MAX;
+}
+
+void BoidComputerCPU::HashState(const FrameBufferData& aFrame)
+{
+	myStats.stateHash = 0;
+	myStats.hashMs = 0.f;
+	if (!aFrame.deterministic)
+		return;
+
+	//The boid hashes are summed, so the chunks can be added in any order
+	const auto start = PassClock::now();
+	const unsigned int boidCount = aFrame.boidCount;
+	std::atomic<unsigned long long> hashSum(0);
+	myThreadPool.ParallelFor(boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			unsigned long long chunkSum = 0;
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				chunkSum += StateHash::HashBoid(LoadOutput(i));
+			}
+			hashSum += chunkSum;
+		});
+	myStats.stateHash = StateHash::Finish(hashSum, boidCount);
+	myStats.hashMs = MillisecondsSince(start);
+}
+
+void BoidComputerCPU::SortStable(const FrameBufferData& aFrame)
+{
+	const unsigned int* cellIndices = myLayout == BoidLayout::SoA ? myStreamsOut.cellIndex.data() : myCellIndices.data();
+	myCellSort.Sort(cellIndices, aFrame.boidCount, myCellGrid.GetKeyCount(), mySumBuffer.data(), myThreadPool);
+	mySparseCellEnds = false;
+
+	//Gather in sorted order, the reads are random but the writes are sequential
+	const unsigned int* sortedIndices = myCellSort.GetSortedIndices();
+	if (myLayout == BoidLayout::SoA)
+	{
+		const BoidStreams& boidsOut = myStreamsOut;
+		BoidStreams& boidsIn = myStreamsIn;
+		myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					const unsigned int source = sortedIndices[i];
+					boidsIn.posX[i] = boidsOut.posX[source];
+					boidsIn.posY[i] = boidsOut.posY[source];
+					boidsIn.posZ[i] = boidsOut.posZ[source];
+					boidsIn.velX[i] = boidsOut.velX[source];
+					boidsIn.velY[i] = boidsOut.velY[source];
+					boidsIn.velZ[i] = boidsOut.velZ[source];
+					boidsIn.cellIndex[i] = boidsOut.cellIndex[source];
+				}
+			});
+	}
+	else if (myLayout == BoidLayout::Compact)
+	{
+		//flockSize is rewritten by the behavior pass like in SortSoA
+		const CompactBoid* boidsOut = myCompactOut.boids.data();
+		CompactBoid* boidsIn = myCompactIn.boids.data();
+		myCompactIn.SetGrid(myCompactOut.grid);
+		myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					boidsIn[i] = boidsOut[sortedIndices[i]];
+				}
+			});
+	}
+	else
+	{
+		const Boid* boidsOut = myBoidsOut.data();
+		Boid* boidsIn = myBoidsIn.data();
+		myThreadPool.ParallelFor(aFrame.boidCount, BOID_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t i = aBegin; i < aEnd; i++)
+				{
+					boidsIn[i] = boidsOut[sortedIndices[i]];
+				}
+			});
+	}
+}
+
+void BoidComputerCPU::BuildBehaviorTasks(const FrameBufferData& aFrame)
+{
+	//A boid costs the neighbour candidates of its cell, read from the scanned sum buffer, plus a fixed overhead.
+	//Sparse cells are estimated from their own occupancy to skip the scattered neighbour reads where they don't matter.
+	//Costs are summed per unit of COST_UNIT_SIZE sorted boids so hot cells can be split between units.
+	const size_t unitCount = (aFrame.boidCount + COST_UNIT_SIZE - 1) / COST_UNIT_SIZE;
+	if (unitCount == 0)
+		return;
+	if (myUnitCosts.size() < unitCount)
+		myUnitCosts.resize(unitCount);
+
+	const bool soa = myLayout == BoidLayout::SoA;
+	const bool compact = myLayout == BoidLayout::Compact;
+	const unsigned int* sortedCells = soa ? myStreamsIn.cellIndex.data() : nullptr;
+	const CompactBoid* sortedCompact = compact ? myCompactIn.boids.data() : nullptr;
+	const Boid* sortedBoids = soa || compact ? nullptr : myBoidsIn.data();
+	const CellGrid& cellGrid = myCellGrid;
+	const CellEnds sumBuffer = GetCellEnds();
+	unsigned long long* unitCosts = myUnitCosts.data();
+	const FrameBufferData* lodFrames = myLod ? myLodFrames : nullptr;
+	const unsigned int lodStep = myLodStep;
+	myThreadPool.ParallelFor(unitCount, COST_UNIT_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			NeighbourRanges ranges;
+			LodCell lodCell;
+			unsigned int lastCell = ~0u;
+			unsigned long long cellCost = 0;
+			for (size_t unit = aBegin; unit < aEnd; unit++)
+			{
+				const size_t end = (unit + 1) * COST_UNIT_SIZE < aFrame.boidCount ? (unit + 1) * COST_UNIT_SIZE : aFrame.boidCount;
+				unsigned long long cost = 0;
+				for (size_t i = unit * COST_UNIT_SIZE; i < end; i++)
+				{
+					const unsigned int cell = soa ? sortedCells[i] : (compact ? sortedCompact[i].cellIndex : sortedBoids[i].cellIndex);
+					if (cell != lastCell)
+					{
+						const unsigned int occupancy = sumBuffer[cell] - (cell > 0 ? sumBuffer[cell - 1] : 0);
+						const Vector3<float> pos = LoadInputPos(i);
+						cellCost = BOID_COST_OVERHEAD + 27ull * occupancy;
+						if (lodFrames && !GetLodBehaviorFrame(pos, aFrame, lodFrames, lodStep, lodCell))
+						{
+							//Only moved this step
+							cellCost = BOID_COST_OVERHEAD;
+						}
+						else if (occupancy >= DENSE_CELL_OCCUPANCY)
+						{
+							cellGrid.GatherNeighbourRanges(pos, cell, sumBuffer, ranges);
+							cellCost = BOID_COST_OVERHEAD + (unsigned long long)ranges.candidates;
+						}
+						lastCell = cell;
+					}
+					cost += cellCost;
+				}
+				unitCosts[unit] = cost;
+			}
+		});
+
+	myCostPrefixSum.InclusiveScan(unitCosts, unitCount, myThreadPool);
+
+	//Equal cost tasks, a task boundary is placed after the first unit that reaches its share of the total
+	const size_t maxTaskCount = (size_t)myThreadPool.GetThreadCount() * TASKS_PER_THREAD;
+	const unsigned int taskCount = (unsigned int)(unitCount < maxTaskCount ? unitCount : maxTaskCount);
+	const unsigned long long totalCost = unitCosts[unitCount - 1];
+	myTaskBounds.resize(taskCount + 1);
+	myTaskBounds[0] = 0;
+	for (unsigned int task = 1; task < taskCount; task++)
+	{
+		const unsigned long long target = totalCost / taskCount * task;
+		const size_t unit = (size_t)(std::lower_bound(unitCosts, unitCosts + unitCount, target) - unitCosts);
+		const size_t bound = (unit + 1) * COST_UNIT_SIZE;
+		myTaskBounds[task] = (unsigned int)(bound < aFrame.boidCount ? bound : aFrame.boidCount);
+	}
+	myTaskBounds[taskCount] = aFrame.boidCount;
+	myTaskCount = taskCount;
+}
+
+void BoidComputerCPU::ForEachBehaviorRange(const FrameBufferData& aFrame, const ThreadPool::RangeFunction& aFunction)
+{
+	if (myTaskCount == 0)
+	{
+		myThreadPool.ParallelFor(aFrame.boidCount, BEHAVIOR_GRAIN_SIZE, aFunction);
+		myStats.behaviorTasks = (unsigned int)((aFrame.boidCount + BEHAVIOR_GRAIN_SIZE - 1) / BEHAVIOR_GRAIN_SIZE);
+		myStats.steals = 0;
+		return;
+	}
+
+	myScheduler.Run(myTaskBounds.data(), myTaskCount, myThreadPool, aFunction);
+	myStats.behaviorTasks = myTaskCount;
+	myStats.steals = myScheduler.GetStealCount();
+}
@@ -0,0 +1,269 @@
+#pragma once
+#include <cfloat>
+#include <vector>
+#include "Boid.h"
+#include "BoidCS.h"
+#include "BoidStreams.h"
+#include "CellGrid.h"
+#include "CellOccupancy.h"
+#include "CellRebin.h"
+#include "CellSort.h"
+#include "CompactBoids.h"
+#include "NeighbourKernel.h"
+#include "NeighbourLists.h"
+#include "ThreadPool.h"
+#include "PrefixSum.h"
+#include "RenderInstances.h"
+#include "WorkStealing.h"
+
+struct FrameBufferData;
+
+struct CPUSimulationStats
+{
+	float clearMs = 0.f;
+	float countMs = 0.f;
+	float scanMs = 0.f;
+	float sortMs = 0.f; // With the stable sort clear and scan are part of the sort
+	float scheduleMs = 0.f;
+	float behaviorMs = 0.f;
+	float totalMs = 0.f;
+	// Neighbour candidates tested by the behavior pass
+	unsigned long long neighbourCandidates = 0;
+	unsigned int behaviorTasks = 0;
+	unsigned int steals = 0;
+	// Size of the sum buffer, the cell count or the hash table size
+	unsigned int cellKeys = 0;
+	// Bytes the clear wrote, and how many fewer than a clear of both sum buffers over their allocation
+	size_t clearedBytes = 0;
+	size_t clearBytesSaved = 0;
+	// 64 cell blocks the atomic count put boids in, the clear, scan and copy skip the others
+	unsigned int occupiedCellBlocks = 0;
+	// Set if the cells were fixed up incrementally instead of rebuilt, the time is in sortMs
+	bool rebinned = false;
+	unsigned int movedBoids = 0;
+	unsigned int shiftedBoids = 0;
+	// Set if the behavior pass visited every pair once, neighbourCandidates then counts pairs
+	bool halfShell = false;
+	// Candidates in the neighbour ranges that the cell culling skipped, not part of neighbourCandidates
+	unsigned long long culledCandidates = 0;
+	// Set if the behavior pass used the Verlet neighbour lists, the binning passes are skipped while they are reused
+	bool neighbourLists = false;
+	bool listsRebuilt = false;
+	// Set if the lists did not fit the memory budget, the frame ran without them
+	bool listsOverBudget = false;
+	unsigned int listAge = 0;
+	unsigned long long listEntries = 0;
+	size_t listBytes = 0;
+	// Only reduced with SetStepBounds. The largest speed after the step and the closest distance between two boids
+	// in each other's protected range, FLT_MAX if no boid had one.
+	bool stepBounds = false;
+	float maxSpeed = 0.f;
+	float minSeparation = FLT_MAX;
+	// Boids in cells the LOD skipped this step, they only moved with the velocity of their last update
+	unsigned int lodSkippedBoids = 0;
+	// Only with deterministic frames. The StateHash of the boids the run wrote, hashMs is part of totalMs.
+	unsigned long long stateHash = 0;
+	float hashMs = 0.f;
+};
+
+// Portable multithreaded implementation of the Boid_CS/Grid_CS pipeline.
+// Takes the same FrameBufferData as the shaders and has no D3D dependencies so it can run headless.
+class BoidComputerCPU
+{
+public:
+	void Init(const unsigned int aThreadCount = 0);
+	void SetThreadCount(const unsigned int aThreadCount);
+	unsigned int GetThreadCount() const;
+	// Converts the current state to the new layout, the old storage is released.
+	// The compact layout bins with row major cells, its positions are stored relative to them.
+	void SetLayout(const BoidLayout aLayout);
+	BoidLayout GetLayout() const;
+	// Bytes of one boid in the input or the output of the layout
+	static size_t GetBytesPerBoid(const BoidLayout aLayout);
+	// Vector width of the SoA neighbour kernel, falls back to the widest supported one
+	void SetInstructionSet(const InstructionSet aInstructionSet);
+	InstructionSet GetInstructionSet() const;
+	// Stable counting sort instead of the atomic count/sort of Grid_CS, gives the same result for any thread count.
+	// Frames with deterministic set always use it.
+	void SetStableSort(const bool aStableSort);
+	bool GetStableSort() const;
+	// Splits the gridded behavior pass by estimated neighbour cost and lets idle threads steal, instead of equal boid counts
+	void SetWorkStealing(const bool aWorkStealing);
+	bool GetWorkStealing() const;
+	// How cells map to the keys boids are binned and sorted by, see CellGrid
+	void SetCellOrder(const CellOrder aCellOrder);
+	// The order of the last run, Morton and Padded fall back to row major for grids that don't fit
+	CellOrder GetCellOrder() const;
+	// Only moves the boids that changed cell since the last frame instead of sorting all of them,
+	// falls back to a full rebuild when the grid changed or too many boids moved
+	void SetIncrementalRebin(const bool aIncrementalRebin);
+	bool GetIncrementalRebin() const;
+	// Visits every boid pair once from the lower cell and adds it to both boids, instead of once from each side.
+	// Only used with row major cells and without LOD, otherwise the pass falls back to the full neighbourhood.
+	void SetHalfShell(const bool aHalfShell);
+	bool GetHalfShell() const;
+	// Per boid, skips the cells of the neighbour ranges that are out of the visual range or inside the blind cone,
+	// see CellGrid::CullNeighbourRanges. The half shell pass only culls by range since a pair is tested from both sides.
+	void SetCellCulling(const bool aCellCulling);
+	bool GetCellCulling() const;
+	// Verlet neighbour lists within the visual range plus aSkin, reused until a boid has moved more than half the skin,
+	// see VerletNeighbourLists. Frames fall back to the cell ranges if the lists would take more than aBudgetBytes.
+	void SetNeighbourLists(const bool aNeighbourLists, const float aSkin, const size_t aBudgetBytes);
+	bool GetNeighbourLists() const;
+	// Morton and Padded cells fall back to row major if their key space would be larger than aCapacity.maxCells
+	void SetCapacity(const SimulationCapacity& aCapacity);
+	// Reduces the speed and separation bounds of an adaptive time step into the stats of every run
+	void SetStepBounds(const bool aStepBounds);
+	bool GetStepBounds() const;
+	void InitBoidTransforms(const FrameBufferData& aFrame);
+	void RunBoidsCPUGridded(const FrameBufferData& aFrame);
+	void RunBoidsCPU(const FrameBufferData& aFrame);
+	void SwapBuffers();
+	void UnInit();
+
+	// Output of the last run in the render layout, valid until the next call to Run or SwapBuffers.
+	// With the SoA layout the streams are packed into Boid records on the first call after a run.
+	const Boid* GetBoids();
+	// Input of the last run in the same slots and layout as GetBoids, the boids before the step
+	const Boid* GetPreviousBoids();
+	// GetBoids, or GetPreviousBoids with aPrevious, packed into 12 byte instances over the bounds of aFrame, see RenderInstance.
+	// Packs straight from the layout, valid until the next call with the same aPrevious.
+	const RenderInstance* PackRenderInstances(const FrameBufferData& aFrame, const bool aPrevious);
+	const CPUSimulationStats& GetStats() const;
+
+private:
+	void EnsureBoids(const FrameBufferData& aFrame);
+	template<typename Storage>
+	const Boid* PackRenderBoids(const Storage& aStorage, std::vector<Boid>& aOutBoids, bool& aDirty);
+	// Boid access in the current layout for the passes that don't have a version per layout
+	Boid LoadInput(const size_t aIndex) const;
+	CommonUtilities::Vector3<float> LoadInputPos(const size_t aIndex) const;
+	Boid LoadOutput(const size_t aIndex) const;
+	// Returns the key of the cell the boid is stored in
+	unsigned int StoreOutput(const size_t aIndex, const Boid& aBoid);
+	void EnsureCells(const unsigned int aKeyCount);
+	// The cell ends of the last binning, sparse after an atomic rebuild
+	CellEnds GetCellEnds() const;
+
+	void Clear(const FrameBufferData& aFrame);
+	void Count(const FrameBufferData& aFrame);
+	void Sum(const FrameBufferData& aFrame);
+	void Copy(const FrameBufferData& aFrame);
+	void Sort(const FrameBufferData& aFrame);
+	// The gridded behavior pass over one of the boid layouts, MainGridded, MainGriddedSoA and MainGriddedCompact pick the layout
+	template<typename Layout>
+	void MainGriddedLayout(const FrameBufferData& aFrame, const Layout& aLayout);
+	void MainGridded(const FrameBufferData& aFrame);
+
+	void CountSoA(const FrameBufferData& aFrame);
+	void SortSoA(const FrameBufferData& aFrame);
+	void MainGriddedSoA(const FrameBufferData& aFrame);
+	void MainSoA(const FrameBufferData& aFrame);
+	void MainGriddedHalfShell(const FrameBufferData& aFrame);
+
+	void RequantizeCompact(const FrameBufferData& aFrame);
+	void CountCompact(const FrameBufferData& aFrame);
+	void SortCompact(const FrameBufferData& aFrame);
+	void MainGriddedCompact(const FrameBufferData& aFrame);
+	void MainNeighbourLists(const FrameBufferData& aFrame);
+
+	bool UsesStableSort(const FrameBufferData& aFrame) const;
+	void SortStable(const FrameBufferData& aFrame);
+	void RebuildCells(const FrameBufferData& aFrame);
+	bool RebinIncremental(const FrameBufferData& aFrame);
+	bool GetListGridFrame(const FrameBufferData& aFrame, FrameBufferData& aOutGridFrame) const;
+	bool BuildNeighbourLists(const FrameBufferData& aGridFrame);
+
+	void ReduceStepBounds(const unsigned int aBoidCount);
+	void HashState(const FrameBufferData& aFrame);
+
+	void BuildBehaviorTasks(const FrameBufferData& aFrame);
+	void ForEachBehaviorRange(const FrameBufferData& aFrame, const ThreadPool::RangeFunction& aFunction);
+
+	ThreadPool myThreadPool;
+	ChainedPrefixSum<unsigned long long> myCostPrefixSum;
+	WorkStealingScheduler myScheduler;
+	CPUSimulationStats myStats;
+
+	std::vector<Boid> myBoidsIn;
+	std::vector<Boid> myBoidsOut;
+	BoidStreams myStreamsIn;
+	BoidStreams myStreamsOut;
+	CompactBoids myCompactIn;
+	CompactBoids myCompactOut;
+	std::vector<Boid> myDecodedBoids; // The compact input as Boid records for the brute force pass
+	FrameBufferData myStorageFrame = {}; // The frame of the last init or run, SetLayout stores compact boids with its grid
+	std::vector<Boid> myRenderBoids;
+	std::vector<Boid> myRenderPreviousBoids;
+	std::vector<RenderInstance> myRenderInstances;
+	std::vector<RenderInstance> myRenderPreviousInstances;
+	BoidLayout myLayout = BoidLayout::SoA;
+	unsigned int myRenderBoidCount = 0;
+	bool myRenderBoidsDirty = true;
+	bool myRenderPreviousBoidsDirty = true;
+
+	InstructionSet myInstructionSet = NeighbourKernel::GetBestSupported();
+	NeighbourKernel::Functions myKernel = NeighbourKernel::GetFunctions(myInstructionSet);
+	std::vector<unsigned int> mySumBuffer;
+	std::vector<unsigned int> myUnsortedSumBuffer; // The atomic count adds to it, zero outside the blocks marked in myCellOccupancy
+	std::vector<unsigned int> myCellIndices;
+	CellOccupancy myCellOccupancy;
+	bool mySparseCellEnds = false; // Set while mySumBuffer only holds the occupied blocks of the last atomic scan
+	StableCellSort myCellSort;
+	bool myStableSort = true;
+	CellGrid myCellGrid;
+	CellOrder myCellOrder = CellOrder::RowMajor;
+	SimulationCapacity myCapacity;
+
+	IncrementalCellRebin myCellRebin;
+	std::vector<Boid> myRebinScratch;
+	std::vector<CompactBoid> myCompactRebinScratch;
+	std::vector<unsigned short> myCompactFlockScratch;
+	FrameBufferData myRebinFrame = {};
+	bool myIncrementalRebin = true;
+	bool myRebinReady = false;
+
+	// Per slot input and sums of the half shell pass
+	struct PairBoid
+	{
+		CommonUtilities::Vector3<float> pos;
+		CommonUtilities::Vector3<float> vel;
+		CommonUtilities::Vector3<float> velDir;
+		unsigned int cellIndex;
+	};
+	std::vector<PairBoid> myPairBoids;
+	std::vector<BoidCS::FlockAccumulator> myPairAccumulators;
+	bool myHalfShell = true;
+	bool myCellCulling = true;
+
+	VerletNeighbourLists myVerletLists;
+	float myListSkin = 0.f;
+	size_t myListBudgetBytes = 0;
+	unsigned int myListRetryFrames = 0;
+	bool myNeighbourLists = false;
+
+	// Per slot closestSqr of the behavior passes and one reduced bound per boid chunk
+	struct StepBound
+	{
+		float maxSpeedSqr;
+		float closestSqr;
+	};
+	std::vector<float> myClosestSqr;
+	std::vector<StepBound> myStepBoundChunks;
+	bool myStepBounds = false;
+
+	// The frame of each LOD tier, with the deltaTime of its update interval, and the steps since InitBoidTransforms
+	FrameBufferData myLodFrames[MAX_LOD_TIER + 1];
+	unsigned int myLodStep = 0;
+	bool myLod = false;
+
+	std::vector<unsigned long long> myUnitCosts;
+	std::vector<unsigned int> myTaskBounds;
+	unsigned int myTaskCount = 0;
+	bool myWorkStealing = true;
+
+	CommonUtilities::Vector3<float> myInitMinPos;
+	CommonUtilities::Vector3<float> myInitMaxPos;
+	unsigned int myInitSeed = 0;
+	unsigned int myInitializedBoidCount = 0;
+};
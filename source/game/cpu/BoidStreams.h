@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include "Boid.h"
+
+enum class BoidLayout
+{
+	AoS,
+	SoA,
+	Compact // CompactBoids, quantized positions and half precision velocities
+};
+
+// Structure-of-arrays storage for the CPU passes. Positions and velocities are split per component
+// so a pass only streams the bytes it reads and the neighbour loop can load 4/8/16 boids at once.
+struct BoidStreams
+{
+	std::vector<float> posX;
+	std::vector<float> posY;
+	std::vector<float> posZ;
+	std::vector<float> velX;
+	std::vector<float> velY;
+	std::vector<float> velZ;
+	std::vector<unsigned int> cellIndex;
+	std::vector<unsigned int> flockSize;
+
+	void Resize(const size_t aCount)
+	{
+		posX.resize(aCount);
+		posY.resize(aCount);
+		posZ.resize(aCount);
+		velX.resize(aCount);
+		velY.resize(aCount);
+		velZ.resize(aCount);
+		cellIndex.resize(aCount);
+		flockSize.resize(aCount);
+	}
+
+	void Release()
+	{
+		*this = BoidStreams();
+	}
+
+	size_t Size() const
+	{
+		return posX.size();
+	}
+
+	Boid Load(const size_t aIndex) const
+	{
+		Boid boid;
+		boid.pos = { posX[aIndex], posY[aIndex], posZ[aIndex] };
+		boid.cellIndex = cellIndex[aIndex];
+		boid.vel = { velX[aIndex], velY[aIndex], velZ[aIndex] };
+		boid.flockSize = flockSize[aIndex];
+		return boid;
+	}
+
+	void Store(const size_t aIndex, const Boid& aBoid)
+	{
+		posX[aIndex] = aBoid.pos.x;
+		posY[aIndex] = aBoid.pos.y;
+		posZ[aIndex] = aBoid.pos.z;
+		cellIndex[aIndex] = aBoid.cellIndex;
+		velX[aIndex] = aBoid.vel.x;
+		velY[aIndex] = aBoid.vel.y;
+		velZ[aIndex] = aBoid.vel.z;
+		flockSize[aIndex] = aBoid.flockSize;
+	}
+};
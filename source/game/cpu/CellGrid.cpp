@@ -0,0 +1,459 @@
+#include "CellGrid.h"
+#include "BoidCS.h"
+#include "Boid.h"
+
+constexpr unsigned int MIN_HASH_BUCKETS = 4096;
+constexpr unsigned int MIN_HASH_BITS = 2; // A side of 4 cells or more never wraps the 3 wide stencil onto itself
+constexpr float MAX_HASH_COORD = 268435456.f;
+
+namespace
+{
+	unsigned int GetBitCount(const unsigned int aDim)
+	{
+		unsigned int bits = 0;
+		while (bits < 32 && (1ull << bits) < aDim)
+		{
+			bits++;
+		}
+		return bits;
+	}
+
+	//floor without the grid clamp, only limited to where the neighbour coordinates can't overflow
+	inline int FloorToCell(const float aCell)
+	{
+		float cell = aCell < MAX_HASH_COORD ? aCell : MAX_HASH_COORD;
+		cell = cell > -MAX_HASH_COORD ? cell : -MAX_HASH_COORD;
+
+		const int truncated = (int)cell;
+		return cell < (float)truncated ? truncated - 1 : truncated;
+	}
+}
+
+void CellGrid::Init(const FrameBufferData& aFrame, const CellOrder aOrder, const unsigned int aMaxKeyCount)
+{
+	InitKeys(aFrame, aOrder, aMaxKeyCount);
+	BuildStencilRows();
+}
+
+void CellGrid::InitKeys(const FrameBufferData& aFrame, const CellOrder aOrder, const unsigned int aMaxKeyCount)
+{
+	const unsigned int rings = (unsigned int)BoidCS::GetCellRings(aFrame);
+	if (aOrder == CellOrder::Hashed)
+	{
+		//About twice the boid count, the grid is used as is if it fits and otherwise its longest sides are folded
+		unsigned int tableBits = GetBitCount(MIN_HASH_BUCKETS);
+		while ((1ull << tableBits) < 2ull * aFrame.boidCount)
+		{
+			tableBits++;
+		}
+
+		//A side has to be wider than the stencil, or a row would wrap onto itself
+		const unsigned int minBits = GetBitCount(2 * rings + 2) > MIN_HASH_BITS ? GetBitCount(2 * rings + 2) : MIN_HASH_BITS;
+		const unsigned int dims[3] = { aFrame.gridDims.x, aFrame.gridDims.y, aFrame.gridDims.z };
+		for (unsigned int axis = 0; axis < 3; axis++)
+		{
+			myHashBits[axis] = GetBitCount(dims[axis]);
+			myHashBits[axis] = myHashBits[axis] > minBits ? myHashBits[axis] : minBits;
+		}
+		while (myHashBits[0] + myHashBits[1] + myHashBits[2] > tableBits)
+		{
+			unsigned int longest = myHashBits[1] > myHashBits[0] ? 1 : 0;
+			longest = myHashBits[2] > myHashBits[longest] ? 2 : longest;
+			if (myHashBits[longest] == minBits)
+				break;
+			myHashBits[longest]--;
+		}
+
+		myFrame = aFrame;
+		myOrder = CellOrder::Hashed;
+		myKeyCount = 1u << (myHashBits[0] + myHashBits[1] + myHashBits[2]);
+		return;
+	}
+
+	const bool sameGrid = myFrame.gridDims.x == aFrame.gridDims.x && myFrame.gridDims.y == aFrame.gridDims.y
+		&& myFrame.gridDims.z == aFrame.gridDims.z && myFrame.cellRings == aFrame.cellRings && myOrder == aOrder && myKeyCount != 0 && myMaxKeyCount == aMaxKeyCount;
+	myFrame = aFrame;
+	myMaxKeyCount = aMaxKeyCount;
+	if (sameGrid)
+		return;
+
+	myOrder = CellOrder::RowMajor;
+	myKeyCount = aFrame.cellCount;
+
+	if (aOrder == CellOrder::Padded)
+	{
+		//A ghost layer as thick as the stencil reaches
+		const unsigned long long padding = rings;
+		const unsigned long long yStep = aFrame.gridDims.x + 2 * padding;
+		const unsigned long long zStep = yStep * (aFrame.gridDims.y + 2 * padding);
+		const unsigned long long keyCount = zStep * (aFrame.gridDims.z + 2 * padding) + 1;
+		if (keyCount > aMaxKeyCount)
+			return;
+
+		myPadding = (unsigned int)padding;
+		myPaddedYStep = (unsigned int)yStep;
+		myPaddedZStep = (unsigned int)zStep;
+		myPaddedOrigin = (unsigned int)(1 + padding * (zStep + yStep + 1));
+		myOrder = CellOrder::Padded;
+		myKeyCount = (unsigned int)keyCount;
+		return;
+	}
+
+	//The aligned boxes of the Morton stencil only cover one ring
+	if (aOrder != CellOrder::Morton || rings > 1)
+		return;
+
+	const unsigned int dims[3] = { aFrame.gridDims.x, aFrame.gridDims.y, aFrame.gridDims.z };
+	unsigned int bits[3] = { GetBitCount(dims[0]), GetBitCount(dims[1]), GetBitCount(dims[2]) };
+	if (bits[0] + bits[1] + bits[2] > 32)
+		return;
+
+	//Interleave x, y, z from the lowest bit up, an axis that runs out of bits is skipped
+	unsigned int outBits[3][32] = {};
+	unsigned int outBit = 0;
+	for (unsigned int bit = 0; bit < 32; bit++)
+	{
+		for (unsigned int axis = 0; axis < 3; axis++)
+		{
+			if (bit < bits[axis])
+			{
+				outBits[axis][bit] = outBit++;
+			}
+		}
+	}
+
+	std::vector<unsigned int>* spreads[3] = { &mySpreadX, &mySpreadY, &mySpreadZ };
+	for (unsigned int axis = 0; axis < 3; axis++)
+	{
+		std::vector<unsigned int>& spread = *spreads[axis];
+		spread.resize(dims[axis]);
+		for (unsigned int coord = 0; coord < dims[axis]; coord++)
+		{
+			unsigned int key = 0;
+			for (unsigned int bit = 0; bit < bits[axis]; bit++)
+			{
+				key |= ((coord >> bit) & 1u) << outBits[axis][bit];
+			}
+			spread[coord] = key;
+		}
+	}
+
+	//Keys grow with every coordinate, so the last cell has the largest key
+	const unsigned long long keyCount = (unsigned long long)mySpreadX[dims[0] - 1] + mySpreadY[dims[1] - 1] + mySpreadZ[dims[2] - 1] + 1;
+	if (keyCount > aMaxKeyCount)
+		return;
+
+	myOrder = CellOrder::Morton;
+	myKeyCount = (unsigned int)keyCount;
+}
+
+void CellGrid::BuildStencilRows()
+{
+	//Same row order as the z and y loops of BoidBehaviorsGridded
+	const int rings = BoidCS::GetCellRings(myFrame);
+	const int yStep = (int)(myOrder == CellOrder::Padded ? myPaddedYStep : myFrame.gridDims.x);
+	const int zStep = (int)(myOrder == CellOrder::Padded ? myPaddedZStep : myFrame.gridDims.x * myFrame.gridDims.y);
+	myStencilRows.clear();
+	for (int z = -rings; z <= rings; z++)
+	{
+		for (int y = -rings; y <= rings; y++)
+		{
+			const int halfWidth = BoidCS::GetStencilRowHalfWidth(y, z, myFrame);
+			if (halfWidth >= 0)
+				myStencilRows.push_back({ y, z, halfWidth, z * zStep + y * yStep });
+		}
+	}
+}
+
+CellOrder CellGrid::GetOrder() const
+{
+	return myOrder;
+}
+
+unsigned int CellGrid::GetKeyCount() const
+{
+	return myKeyCount;
+}
+
+unsigned int CellGrid::GetCellKey(const Vector3<float>& aPos) const
+{
+	if (myOrder == CellOrder::RowMajor)
+		return BoidCS::GetCellIndex(aPos, myFrame);
+
+	if (myOrder == CellOrder::Hashed)
+	{
+		HashCoords coords = GetHashCoords(aPos);
+		return GetBucket(coords.x, coords.y, coords.z);
+	}
+
+	Vector3<unsigned int> coords = BoidCS::GetCellCoords(aPos, myFrame);
+	if (myOrder == CellOrder::Padded)
+		return myPaddedOrigin + coords.z * myPaddedZStep + coords.y * myPaddedYStep + coords.x;
+
+	return mySpreadX[coords.x] | mySpreadY[coords.y] | mySpreadZ[coords.z];
+}
+
+unsigned long long CellGrid::GetCellId(const Vector3<float>& aPos, const unsigned int aCellKey) const
+{
+	if (myOrder != CellOrder::Hashed)
+		return aCellKey;
+
+	HashCoords coords = GetHashCoords(aPos);
+	return ((unsigned long long)(coords.x & 0x1FFFFF) << 42) | ((unsigned long long)(coords.y & 0x1FFFFF) << 21) | (unsigned long long)(coords.z & 0x1FFFFF);
+}
+
+void CellGrid::GatherNeighbourRanges(const Vector3<float>& aPos, const unsigned int aCellKey, const CellEnds& aSumBuffer, NeighbourRanges& aOutRanges) const
+{
+	aOutRanges.count = 0;
+	aOutRanges.candidates = 0;
+
+	if (myOrder == CellOrder::RowMajor)
+	{
+		//The rows of BoidBehaviorsGridded, cells outside the grid read as empty on the GPU.
+		//Rows that leave the grid run into other rows, those are kept whole.
+		const int lastCell = (int)myFrame.cellCount - 1;
+		const Vector3<unsigned int> coords = BoidCS::GetCellCoords(aPos, myFrame);
+		for (const StencilRow& row : myStencilRows)
+		{
+			int first = (int)aCellKey + row.keyOffset - row.halfWidth;
+			int last = (int)aCellKey + row.keyOffset + row.halfWidth;
+			first = first < 0 ? 0 : first;
+			last = last > lastCell ? lastCell : last;
+			if (first > last)
+				continue;
+
+			const NeighbourRanges::Row cells = { (int)coords.y + row.y, (int)coords.z + row.z,
+				(int)coords.x - row.halfWidth, (int)coords.x + row.halfWidth, (unsigned int)first };
+			if (IsInsideGrid(cells))
+				aOutRanges.AddRow(first > 0 ? aSumBuffer[first - 1] : 0, aSumBuffer[last], cells);
+			else
+				aOutRanges.Add(first > 0 ? aSumBuffer[first - 1] : 0, aSumBuffer[last]);
+		}
+		return;
+	}
+
+	if (myOrder == CellOrder::Padded)
+	{
+		//The ghost cells are never binned and the stencil never leaves them, so the key before a row is never below 0.
+		//Ghost rows are empty, the ghost cells at the ends of a row are left out of its cells.
+		const Vector3<unsigned int> coords = BoidCS::GetCellCoords(aPos, myFrame);
+		const int lastX = (int)myFrame.gridDims.x - 1;
+		for (const StencilRow& row : myStencilRows)
+		{
+			const unsigned int first = aCellKey + (unsigned int)(row.keyOffset - row.halfWidth);
+			const int firstX = (int)coords.x - row.halfWidth;
+			NeighbourRanges::Row cells = { (int)coords.y + row.y, (int)coords.z + row.z, firstX, (int)coords.x + row.halfWidth, first };
+			cells.firstX = firstX < 0 ? 0 : firstX;
+			cells.lastX = cells.lastX > lastX ? lastX : cells.lastX;
+			cells.firstKey = first + (unsigned int)(cells.firstX - firstX);
+			aOutRanges.AddRow(aSumBuffer[first - 1], aSumBuffer[first + 2 * row.halfWidth], cells);
+		}
+		return;
+	}
+
+	if (myOrder == CellOrder::Hashed)
+	{
+		//A row of the stencil is one range unless it wraps around the table side
+		HashCoords coords = GetHashCoords(aPos);
+		for (const StencilRow& row : myStencilRows)
+		{
+			const int y = coords.y + row.y;
+			const int z = coords.z + row.z;
+			unsigned int first = GetBucket(coords.x - row.halfWidth, y, z);
+			unsigned int last = first;
+			NeighbourRanges::Row cells = { y, z, coords.x - row.halfWidth, coords.x - row.halfWidth, first };
+			for (int x = coords.x - row.halfWidth + 1; x <= coords.x + row.halfWidth; x++)
+			{
+				const unsigned int bucket = GetBucket(x, y, z);
+				if (bucket != last + 1)
+				{
+					aOutRanges.AddRow(first > 0 ? aSumBuffer[first - 1] : 0, aSumBuffer[last], cells);
+					first = bucket;
+					cells.firstX = x;
+					cells.firstKey = bucket;
+				}
+				last = bucket;
+				cells.lastX = x;
+			}
+			aOutRanges.AddRow(first > 0 ? aSumBuffer[first - 1] : 0, aSumBuffer[last], cells);
+		}
+		return;
+	}
+
+	//Neighbours past the grid edges don't exist here, the row-major stencil instead wraps to the next row.
+	//Per axis the 3 neighbour coordinates are an aligned pair, which only differs in the lowest key bit of the axis,
+	//and a single coordinate. The 8 pair/single combinations are boxes of up to 2x2x2 cells inside one aligned block
+	//of 8 keys, visiting a box in z, y, x order gives increasing keys that merge into at most 4 ranges.
+	Vector3<unsigned int> coords = BoidCS::GetCellCoords(aPos, myFrame);
+	const unsigned int coord[3] = { coords.x, coords.y, coords.z };
+	const unsigned int dims[3] = { myFrame.gridDims.x, myFrame.gridDims.y, myFrame.gridDims.z };
+	unsigned int boxFirst[3][2];
+	unsigned int boxCount[3][2];
+	for (unsigned int axis = 0; axis < 3; axis++)
+	{
+		const unsigned int pairFirst = coord[axis] & ~1u;
+		boxFirst[axis][0] = pairFirst;
+		boxCount[axis][0] = pairFirst + 1 < dims[axis] ? 2 : 1;
+
+		const bool singleBelow = pairFirst == coord[axis];
+		boxFirst[axis][1] = singleBelow ? coord[axis] - 1 : coord[axis] + 1;
+		boxCount[axis][1] = singleBelow ? (coord[axis] > 0 ? 1 : 0) : (coord[axis] + 1 < dims[axis] ? 1 : 0);
+	}
+
+	unsigned int runFirst = 0;
+	unsigned int runLast = 0;
+	bool hasRun = false;
+	for (unsigned int box = 0; box < 8; box++)
+	{
+		const unsigned int bx = box & 1u;
+		const unsigned int by = (box >> 1) & 1u;
+		const unsigned int bz = (box >> 2) & 1u;
+		for (unsigned int z = boxFirst[2][bz]; z < boxFirst[2][bz] + boxCount[2][bz]; z++)
+		{
+			for (unsigned int y = boxFirst[1][by]; y < boxFirst[1][by] + boxCount[1][by]; y++)
+			{
+				for (unsigned int x = boxFirst[0][bx]; x < boxFirst[0][bx] + boxCount[0][bx]; x++)
+				{
+					const unsigned int key = mySpreadX[x] | mySpreadY[y] | mySpreadZ[z];
+					if (hasRun && key == runLast + 1)
+					{
+						runLast = key;
+						continue;
+					}
+
+					if (hasRun)
+						aOutRanges.Add(runFirst > 0 ? aSumBuffer[runFirst - 1] : 0, aSumBuffer[runLast]);
+					runFirst = key;
+					runLast = key;
+					hasRun = true;
+				}
+			}
+		}
+	}
+
+	if (hasRun)
+		aOutRanges.Add(runFirst > 0 ? aSumBuffer[runFirst - 1] : 0, aSumBuffer[runLast]);
+}
+
+void CellGrid::CullNeighbourRanges(const NeighbourRanges& aRanges, const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+	const CellEnds& aSumBuffer, const bool aViewCone, NeighbourRanges& aOutRanges) const
+{
+	aOutRanges.count = 0;
+	aOutRanges.candidates = 0;
+
+	for (unsigned int r = 0; r < aRanges.count; r++)
+	{
+		unsigned int start;
+		unsigned int end;
+		CullNeighbourRange(aRanges, r, aPos, aVelDir, aSumBuffer, aViewCone, start, end);
+		aOutRanges.Add(start, end);
+	}
+}
+
+void CellGrid::CullNeighbourRange(const NeighbourRanges& aRanges, const unsigned int aRange, const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+	const CellEnds& aSumBuffer, const bool aViewCone, unsigned int& aOutStart, unsigned int& aOutEnd) const
+{
+	aOutStart = aRanges.start[aRange];
+	aOutEnd = aRanges.end[aRange];
+	if (!aRanges.isRow[aRange])
+		return;
+
+	//Hashed cells hold other cells a table side away as well, their boids are always out of range
+	const bool clampedGrid = myOrder != CellOrder::Hashed;
+	const NeighbourRanges::Row& row = aRanges.rows[aRange];
+	int firstX = row.firstX;
+	int lastX = row.lastX;
+	if (!BoidCS::CullCellRow(aPos, aVelDir, row.y, row.z, firstX, lastX, clampedGrid, aViewCone, myFrame))
+	{
+		aOutEnd = aOutStart;
+		return;
+	}
+
+	if (firstX == row.firstX && lastX == row.lastX)
+		return;
+
+	const unsigned int firstKey = row.firstKey + (unsigned int)(firstX - row.firstX);
+	const unsigned int lastKey = row.firstKey + (unsigned int)(lastX - row.firstX);
+	aOutStart = firstKey > 0 ? aSumBuffer[firstKey - 1] : 0;
+	aOutEnd = aSumBuffer[lastKey];
+}
+
+void CellGrid::GatherForwardRanges(const Vector3<float>& aPos, const unsigned int aCellKey, const CellEnds& aSumBuffer, NeighbourRanges& aOutRanges) const
+{
+	aOutRanges.count = 0;
+	aOutRanges.candidates = 0;
+
+	//The rows after the center row in full and the cells after the cell in the center row.
+	//Forward rows start past the cell itself, so the key before them is never below 0.
+	const int lastKey = (int)myKeyCount - 1;
+	const Vector3<unsigned int> coords = BoidCS::GetCellCoords(aPos, myFrame);
+	const int lastX = (int)myFrame.gridDims.x - 1;
+	for (const StencilRow& row : myStencilRows)
+	{
+		if (row.z < 0 || (row.z == 0 && row.y < 0))
+			continue;
+
+		const int offsetX = row.z == 0 && row.y == 0 ? 1 : -row.halfWidth;
+		const int first = (int)aCellKey + row.keyOffset + offsetX;
+		int last = (int)aCellKey + row.keyOffset + row.halfWidth;
+		last = last > lastKey ? lastKey : last;
+		if (first > last)
+			continue;
+
+		NeighbourRanges::Row cells = { (int)coords.y + row.y, (int)coords.z + row.z, (int)coords.x + offsetX, (int)coords.x + row.halfWidth, (unsigned int)first };
+		if (myOrder == CellOrder::Padded)
+		{
+			//Like GatherNeighbourRanges, the ghost cells at the ends are left out of the row
+			const int firstX = cells.firstX;
+			cells.firstX = firstX < 0 ? 0 : firstX;
+			cells.lastX = cells.lastX > lastX ? lastX : cells.lastX;
+			cells.firstKey += (unsigned int)(cells.firstX - firstX);
+		}
+		else if (!IsInsideGrid(cells) || last != (int)aCellKey + row.keyOffset + row.halfWidth)
+		{
+			aOutRanges.Add(aSumBuffer[first - 1], aSumBuffer[last]);
+			continue;
+		}
+		aOutRanges.AddRow(aSumBuffer[first - 1], aSumBuffer[last], cells);
+	}
+}
+
+bool CellGrid::SupportsForwardRanges() const
+{
+	if (myOrder == CellOrder::Padded)
+		return true;
+
+	const unsigned int stencilWidth = 2 * (unsigned int)BoidCS::GetCellRings(myFrame) + 1;
+	return myOrder == CellOrder::RowMajor && myFrame.gridDims.x >= stencilWidth && myFrame.gridDims.y >= stencilWidth;
+}
+
+unsigned int CellGrid::GetRowFirstKey(const unsigned int aLayer, const unsigned int aRow) const
+{
+	if (myOrder == CellOrder::Padded)
+		return 1 + (aLayer + myPadding) * myPaddedZStep + (aRow + myPadding) * myPaddedYStep;
+
+	return (aLayer * myFrame.gridDims.y + aRow) * myFrame.gridDims.x;
+}
+
+bool CellGrid::IsInsideGrid(const NeighbourRanges::Row& aRow) const
+{
+	return 0 <= aRow.y && aRow.y < (int)myFrame.gridDims.y && 0 <= aRow.z && aRow.z < (int)myFrame.gridDims.z
+		&& 0 <= aRow.firstX && aRow.lastX < (int)myFrame.gridDims.x;
+}
+
+CellGrid::HashCoords CellGrid::GetHashCoords(const Vector3<float>& aPos) const
+{
+	return {
+		FloorToCell((aPos.x - myFrame.minPos.x) / myFrame.cellSize),
+		FloorToCell((aPos.y - myFrame.minPos.y) / myFrame.cellSize),
+		FloorToCell((aPos.z - myFrame.minPos.z) / myFrame.cellSize) };
+}
+
+unsigned int CellGrid::GetBucket(const int aX, const int aY, const int aZ) const
+{
+	//The coordinates modulo the table sides, negative coordinates wrap as well
+	const unsigned int x = (unsigned int)aX & ((1u << myHashBits[0]) - 1);
+	const unsigned int y = (unsigned int)aY & ((1u << myHashBits[1]) - 1);
+	const unsigned int z = (unsigned int)aZ & ((1u << myHashBits[2]) - 1);
+	return x | (y << myHashBits[0]) | (z << (myHashBits[0] + myHashBits[1]));
+}
\ No newline at end of file
@@ -0,0 +1,154 @@
+#pragma once
+#include <vector>
+#include "Boid.h"
+#include "CellOccupancy.h"
+#include "hlsl/CBuffer.h"
+
+enum class CellOrder
+{
+	RowMajor,
+	Morton,
+	Hashed,
+	Padded
+};
+
+// Contiguous ranges of the sorted boid buffer that hold the neighbour cells of one cell
+struct NeighbourRanges
+{
+	// A range per stencil row, hashed rows can split in two where they wrap
+	static constexpr unsigned int MAX_RANGES = 2 * (2 * MAX_CELL_RINGS + 1) * (2 * MAX_CELL_RINGS + 1);
+
+	// The cells firstX..lastX of row y, z with the key of cell firstX, for CellGrid::CullNeighbourRanges
+	struct Row
+	{
+		int y;
+		int z;
+		int firstX;
+		int lastX;
+		unsigned int firstKey;
+	};
+
+	unsigned int start[MAX_RANGES];
+	unsigned int end[MAX_RANGES];
+	Row rows[MAX_RANGES];
+	bool isRow[MAX_RANGES];
+	unsigned int count = 0;
+	unsigned int candidates = 0;
+
+	// A range that is never culled
+	void Add(const unsigned int aStart, const unsigned int aEnd)
+	{
+		if (aStart == aEnd)
+			return;
+
+		start[count] = aStart;
+		end[count] = aEnd;
+		isRow[count] = false;
+		count++;
+		candidates += aEnd - aStart;
+	}
+
+	void AddRow(const unsigned int aStart, const unsigned int aEnd, const Row& aRow)
+	{
+		if (aStart == aEnd)
+			return;
+
+		start[count] = aStart;
+		end[count] = aEnd;
+		rows[count] = aRow;
+		isRow[count] = true;
+		count++;
+		candidates += aEnd - aStart;
+	}
+};
+
+// Maps cells to the keys the CPU passes bin and sort boids by.
+// RowMajor is getCellIndex from Grid_CS.hlsl. Morton interleaves the coordinate bits so the 27 neighbour cells
+// of a cell end up close to each other in the sorted buffer. Axes get their own bit counts, so the key space
+// is at most 8 times the cell count.
+// Hashed wraps the unclamped cell coordinates around a table of about twice the boid count, so memory and the cost
+// of the clear, scan and sort only depend on the boid count and the grid bounds don't limit the world. The table is
+// a row major grid with power of two sides, so rows stay contiguous like in RowMajor. Cells that share a bucket are
+// a table side apart and are sorted out by the range test.
+// Padded is RowMajor with a ghost layer of empty cells on every face and an empty key 0 in front, so the stencil of
+// any cell stays inside the sum buffer and gathering its rows needs no bounds checks. Rows no longer wrap into
+// the row before or after at the x faces.
+// The stencil covers cellRings rings of cells around a cell, rows that can't reach the visual range are dropped.
+// It is built once per Init as a table of rows, see BoidCS::GetStencilRowHalfWidth.
+class CellGrid
+{
+public:
+	// Falls back to RowMajor if the Morton or Padded key space would be larger than aMaxKeyCount, and from Morton for more than one ring
+	void Init(const FrameBufferData& aFrame, const CellOrder aOrder, const unsigned int aMaxKeyCount);
+
+	CellOrder GetOrder() const;
+	// Size of the sum buffer, the largest key + 1
+	unsigned int GetKeyCount() const;
+
+	unsigned int GetCellKey(const Vector3<float>& aPos) const;
+	// Identifies the cell itself, boids with the same id have the same neighbour ranges.
+	// The key for RowMajor, Morton and Padded, the packed coordinates for Hashed where cells can share a key.
+	unsigned long long GetCellId(const Vector3<float>& aPos, const unsigned int aCellKey) const;
+
+	// aPos is any position inside the cell with key aCellKey. Ranges of adjacent keys are merged.
+	void GatherNeighbourRanges(const Vector3<float>& aPos, const unsigned int aCellKey, const CellEnds& aSumBuffer, NeighbourRanges& aOutRanges) const;
+	// The ranges of aRanges that can hold a boid at aPos sees, rows trimmed to the cells the visual range reaches and
+	// with aViewCone cells inside the blind cone ahead of the boid dropped, see BoidCS::CullCellRow. Morton runs are never culled.
+	void CullNeighbourRanges(const NeighbourRanges& aRanges, const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const CellEnds& aSumBuffer, const bool aViewCone, NeighbourRanges& aOutRanges) const;
+	// CullNeighbourRanges for range aRange alone, an empty range if it is culled
+	void CullNeighbourRange(const NeighbourRanges& aRanges, const unsigned int aRange, const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const CellEnds& aSumBuffer, const bool aViewCone, unsigned int& aOutStart, unsigned int& aOutEnd) const;
+	// The half of the stencil after aCellKey without the cell itself, every cell pair of the full stencil is in
+	// the forward half of the lower cell. Only for RowMajor and Padded, see SupportsForwardRanges.
+	void GatherForwardRanges(const Vector3<float>& aPos, const unsigned int aCellKey, const CellEnds& aSumBuffer, NeighbourRanges& aOutRanges) const;
+	// The forward half is only exact when the stencil offsets don't overlap, which needs rows and layers wider than the stencil
+	bool SupportsForwardRanges() const;
+	// The keys of rows aFirstRow to aEndRow (y) of grid layer aLayer (z) are [GetRowFirstKey(aLayer, aFirstRow), GetRowFirstKey(aLayer, aEndRow)),
+	// padded rows include their ghost cells, which are empty. Forward ranges of a row only reach cellRings rows and layers on.
+	// RowMajor and Padded only.
+	unsigned int GetRowFirstKey(const unsigned int aLayer, const unsigned int aRow) const;
+
+private:
+	struct StencilRow
+	{
+		int y;
+		int z;
+		int halfWidth;
+		int keyOffset; // Key of the row center relative to the cell for RowMajor and Padded
+	};
+
+	struct HashCoords
+	{
+		int x;
+		int y;
+		int z;
+	};
+
+	void InitKeys(const FrameBufferData& aFrame, const CellOrder aOrder, const unsigned int aMaxKeyCount);
+	void BuildStencilRows();
+	bool IsInsideGrid(const NeighbourRanges::Row& aRow) const;
+	HashCoords GetHashCoords(const Vector3<float>& aPos) const;
+	unsigned int GetBucket(const int aX, const int aY, const int aZ) const;
+
+	// Bits of the hash table side per axis
+	unsigned int myHashBits[3] = {};
+
+	std::vector<StencilRow> myStencilRows;
+
+	// Key steps of the padded grid and the key of cell (0, 0, 0)
+	unsigned int myPadding = 0;
+	unsigned int myPaddedYStep = 0;
+	unsigned int myPaddedZStep = 0;
+	unsigned int myPaddedOrigin = 0;
+
+	FrameBufferData myFrame = {};
+	CellOrder myOrder = CellOrder::RowMajor;
+	unsigned int myKeyCount = 0;
+	unsigned int myMaxKeyCount = 0;
+
+	// Morton bits of every coordinate, key = x | y | z
+	std::vector<unsigned int> mySpreadX;
+	std::vector<unsigned int> mySpreadY;
+	std::vector<unsigned int> mySpreadZ;
+};
\ No newline at end of file
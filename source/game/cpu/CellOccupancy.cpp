@@ -0,0 +1,196 @@
+#include "CellOccupancy.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+constexpr size_t SUPER_BLOCK_WORD_GRAIN_SIZE = 4;
+constexpr size_t SUPER_BLOCK_GRAIN_SIZE = 64;
+
+void CellOccupancy::Resize(const unsigned int aCellCount)
+{
+	const size_t superBlockCount = ((size_t)aCellCount + OCCUPANCY_SUPER_BLOCK_CELLS - 1) >> OCCUPANCY_SUPER_BLOCK_SHIFT;
+	if (myBlockBits.size() < superBlockCount)
+	{
+		myBlockBits.resize(superBlockCount);
+		mySuperBlockBits.resize((superBlockCount + 63) / 64);
+	}
+	myCellCount = aCellCount > myCellCount ? aCellCount : myCellCount;
+}
+
+template<typename Function>
+void CellOccupancy::ForEachOccupiedSuperBlock(const unsigned int aSuperBlockCount, ThreadPool& aThreadPool, const Function& aFunction) const
+{
+	//Every word of super block bits covers 64 super blocks, an empty one skips all of them
+	const unsigned long long* superBlockBits = mySuperBlockBits.data();
+	aThreadPool.ParallelFor((aSuperBlockCount + 63) / 64, SUPER_BLOCK_WORD_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t word = aBegin; word < aEnd; word++)
+			{
+				const unsigned long long bits = superBlockBits[word];
+				for (unsigned int bit = 0; bit < 64 && bits >> bit != 0; bit++)
+				{
+					const unsigned int superBlock = (unsigned int)word * 64 + bit;
+					if (((bits >> bit) & 1) != 0 && superBlock < aSuperBlockCount)
+						aFunction(superBlock);
+				}
+			}
+		});
+}
+
+unsigned int CellOccupancy::Clear(unsigned int* aCounts, ThreadPool& aThreadPool)
+{
+	std::atomic<unsigned int> clearedCells(0);
+	unsigned long long* blockBits = myBlockBits.data();
+	const unsigned int cellCount = myCellCount;
+	ForEachOccupiedSuperBlock((unsigned int)myBlockBits.size(), aThreadPool, [&](const unsigned int aSuperBlock)
+		{
+			const unsigned long long bits = blockBits[aSuperBlock];
+			unsigned int cells = 0;
+			for (unsigned int bit = 0; bit < 64 && bits >> bit != 0; bit++)
+			{
+				if (((bits >> bit) & 1) == 0)
+					continue;
+
+				const unsigned int first = (aSuperBlock << OCCUPANCY_SUPER_BLOCK_SHIFT) + (bit << OCCUPANCY_BLOCK_SHIFT);
+				const unsigned int last = cellCount - first > OCCUPANCY_BLOCK_CELLS ? first + OCCUPANCY_BLOCK_CELLS : cellCount;
+				memset(aCounts + first, 0, (last - first) * sizeof(unsigned int));
+				cells += last - first;
+			}
+			blockBits[aSuperBlock] = 0;
+			clearedCells += cells;
+		});
+	std::fill(mySuperBlockBits.begin(), mySuperBlockBits.end(), 0ull);
+	return clearedCells;
+}
+
+void CellOccupancy::InclusiveScan(const unsigned int* aCounts, unsigned int* aOutSumBuffer, const unsigned int aCellCount, ThreadPool& aThreadPool)
+{
+	const unsigned int superBlockCount = (unsigned int)(((size_t)aCellCount + OCCUPANCY_SUPER_BLOCK_CELLS - 1) >> OCCUPANCY_SUPER_BLOCK_SHIFT);
+	mySuperBlockOffsets.assign(superBlockCount, 0);
+	if (myBlockOffsets.size() < (size_t)superBlockCount << (OCCUPANCY_SUPER_BLOCK_SHIFT - OCCUPANCY_BLOCK_SHIFT))
+		myBlockOffsets.resize((size_t)superBlockCount << (OCCUPANCY_SUPER_BLOCK_SHIFT - OCCUPANCY_BLOCK_SHIFT));
+
+	//Totals of the occupied super blocks, the empty ones add nothing
+	const unsigned long long* blockBits = myBlockBits.data();
+	unsigned int* superBlockOffsets = mySuperBlockOffsets.data();
+	ForEachOccupiedSuperBlock(superBlockCount, aThreadPool, [&](const unsigned int aSuperBlock)
+		{
+			const unsigned long long bits = blockBits[aSuperBlock];
+			unsigned int total = 0;
+			for (unsigned int bit = 0; bit < 64 && bits >> bit != 0; bit++)
+			{
+				if (((bits >> bit) & 1) == 0)
+					continue;
+
+				const unsigned int first = (aSuperBlock << OCCUPANCY_SUPER_BLOCK_SHIFT) + (bit << OCCUPANCY_BLOCK_SHIFT);
+				const unsigned int last = aCellCount - first > OCCUPANCY_BLOCK_CELLS ? first + OCCUPANCY_BLOCK_CELLS : aCellCount;
+				for (unsigned int cell = first; cell < last; cell++)
+				{
+					total += aCounts[cell];
+				}
+			}
+			superBlockOffsets[aSuperBlock] = total;
+		});
+
+	unsigned int offset = 0;
+	for (unsigned int superBlock = 0; superBlock < superBlockCount; superBlock++)
+	{
+		const unsigned int total = superBlockOffsets[superBlock];
+		superBlockOffsets[superBlock] = offset;
+		offset += total;
+	}
+
+	//Block offsets and cell ends of the occupied super blocks, empty blocks only get their offset
+	unsigned int* blockOffsets = myBlockOffsets.data();
+	ForEachOccupiedSuperBlock(superBlockCount, aThreadPool, [&](const unsigned int aSuperBlock)
+		{
+			const unsigned long long bits = blockBits[aSuperBlock];
+			unsigned int sum = superBlockOffsets[aSuperBlock];
+			for (unsigned int bit = 0; bit < 64; bit++)
+			{
+				const unsigned int block = (aSuperBlock << (OCCUPANCY_SUPER_BLOCK_SHIFT - OCCUPANCY_BLOCK_SHIFT)) + bit;
+				blockOffsets[block] = sum;
+				if (((bits >> bit) & 1) == 0)
+					continue;
+
+				const unsigned int first = block << OCCUPANCY_BLOCK_SHIFT;
+				const unsigned int last = aCellCount - first > OCCUPANCY_BLOCK_CELLS ? first + OCCUPANCY_BLOCK_CELLS : aCellCount;
+				for (unsigned int cell = first; cell < last; cell++)
+				{
+					sum += aCounts[cell];
+					aOutSumBuffer[cell] = sum;
+				}
+			}
+		});
+}
+
+CellEnds CellOccupancy::GetCellEnds(const unsigned int* aSumBuffer) const
+{
+	CellEnds cellEnds;
+	cellEnds.ends = aSumBuffer;
+	cellEnds.blockBits = myBlockBits.data();
+	cellEnds.blockOffsets = myBlockOffsets.data();
+	cellEnds.superBlockOffsets = mySuperBlockOffsets.data();
+	return cellEnds;
+}
+
+void CellOccupancy::Densify(unsigned int* aSumBuffer, const unsigned int aCellCount, ThreadPool& aThreadPool) const
+{
+	const CellEnds cellEnds = GetCellEnds(aSumBuffer);
+	const unsigned int superBlockCount = (unsigned int)(((size_t)aCellCount + OCCUPANCY_SUPER_BLOCK_CELLS - 1) >> OCCUPANCY_SUPER_BLOCK_SHIFT);
+	const unsigned long long* blockBits = myBlockBits.data();
+	aThreadPool.ParallelFor(superBlockCount, SUPER_BLOCK_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t superBlock = aBegin; superBlock < aEnd; superBlock++)
+			{
+				const unsigned int first = (unsigned int)superBlock << OCCUPANCY_SUPER_BLOCK_SHIFT;
+				const unsigned int last = aCellCount - first > OCCUPANCY_SUPER_BLOCK_CELLS ? first + OCCUPANCY_SUPER_BLOCK_CELLS : aCellCount;
+				const unsigned long long bits = blockBits[superBlock];
+				for (unsigned int blockFirst = first; blockFirst < last; blockFirst += OCCUPANCY_BLOCK_CELLS)
+				{
+					if (((bits >> ((blockFirst >> OCCUPANCY_BLOCK_SHIFT) & 63)) & 1) != 0)
+						continue;
+
+					const unsigned int blockLast = last - blockFirst > OCCUPANCY_BLOCK_CELLS ? blockFirst + OCCUPANCY_BLOCK_CELLS : last;
+					std::fill(aSumBuffer + blockFirst, aSumBuffer + blockLast, cellEnds[blockFirst]);
+				}
+			}
+		});
+}
+
+void CellOccupancy::CopyOccupied(const unsigned int* aSource, unsigned int* aDestination, const unsigned int aCellCount, ThreadPool& aThreadPool) const
+{
+	const unsigned int superBlockCount = (unsigned int)(((size_t)aCellCount + OCCUPANCY_SUPER_BLOCK_CELLS - 1) >> OCCUPANCY_SUPER_BLOCK_SHIFT);
+	const unsigned long long* blockBits = myBlockBits.data();
+	ForEachOccupiedSuperBlock(superBlockCount, aThreadPool, [&](const unsigned int aSuperBlock)
+		{
+			const unsigned long long bits = blockBits[aSuperBlock];
+			for (unsigned int bit = 0; bit < 64 && bits >> bit != 0; bit++)
+			{
+				if (((bits >> bit) & 1) == 0)
+					continue;
+
+				const unsigned int first = (aSuperBlock << OCCUPANCY_SUPER_BLOCK_SHIFT) + (bit << OCCUPANCY_BLOCK_SHIFT);
+				const unsigned int last = aCellCount - first > OCCUPANCY_BLOCK_CELLS ? first + OCCUPANCY_BLOCK_CELLS : aCellCount;
+				memcpy(aDestination + first, aSource + first, (last - first) * sizeof(unsigned int));
+			}
+		});
+}
+
+unsigned int CellOccupancy::GetOccupiedBlockCount() const
+{
+	unsigned int count = 0;
+	for (unsigned long long bits : myBlockBits)
+	{
+		for (; bits != 0; bits &= bits - 1)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+void CellOccupancy::Release()
+{
+	*this = CellOccupancy();
+}
\ No newline at end of file
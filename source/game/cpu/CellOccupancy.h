@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include "Interlocked.h"
+#include "ThreadPool.h"
+
+constexpr unsigned int OCCUPANCY_BLOCK_SHIFT = 6; // 64 cells per block bit
+constexpr unsigned int OCCUPANCY_SUPER_BLOCK_SHIFT = 12; // 4096 cells per super block bit, one word of block bits
+constexpr unsigned int OCCUPANCY_BLOCK_CELLS = 1u << OCCUPANCY_BLOCK_SHIFT;
+constexpr unsigned int OCCUPANCY_SUPER_BLOCK_CELLS = 1u << OCCUPANCY_SUPER_BLOCK_SHIFT;
+
+// Inclusive end offset of every cell key, what the neighbour passes read from the sum buffer.
+// Dense over a plain sum buffer, or sparse over the one CellOccupancy::InclusiveScan wrote, where only the cells of
+// occupied blocks are written and every cell of an empty block or super block ends at the offset of the block.
+struct CellEnds
+{
+	const unsigned int* ends = nullptr;
+	const unsigned long long* blockBits = nullptr; // Null for a dense sum buffer
+	const unsigned int* blockOffsets = nullptr;
+	const unsigned int* superBlockOffsets = nullptr;
+
+	unsigned int operator[](const unsigned int aCell) const
+	{
+		if (!blockBits)
+			return ends[aCell];
+
+		const unsigned int superBlock = aCell >> OCCUPANCY_SUPER_BLOCK_SHIFT;
+		const unsigned long long bits = blockBits[superBlock];
+		if (bits == 0)
+			return superBlockOffsets[superBlock];
+		const unsigned int block = aCell >> OCCUPANCY_BLOCK_SHIFT;
+		return ((bits >> (block & 63)) & 1) != 0 ? ends[aCell] : blockOffsets[block];
+	}
+};
+
+// Two level occupancy bitmap of the cell keys for the atomic count, scan, copy and sort passes.
+// Count marks the 64 cell blocks and the 4096 cell super blocks it adds boids to, the other passes skip the rest:
+// Clear only zeroes the counts of the blocks marked by the last count, the scan only reads the counts of marked blocks
+// and only writes their cells, and Copy only writes the marked blocks since sort never reads the others.
+// The scanned sum buffer is read through GetCellEnds, so a frame costs the occupied blocks plus one offset per super block.
+class CellOccupancy
+{
+public:
+	// Keeps the marks, aCellCount only grows like the sum buffers
+	void Resize(const unsigned int aCellCount);
+
+	// Called from the count threads
+	void Mark(const unsigned int aCell)
+	{
+		const unsigned int superBlock = aCell >> OCCUPANCY_SUPER_BLOCK_SHIFT;
+		const unsigned long long blockBit = 1ull << ((aCell >> OCCUPANCY_BLOCK_SHIFT) & 63);
+		if ((InterlockedLoad(myBlockBits[superBlock]) & blockBit) != 0)
+			return;
+
+		//Most boids land in blocks already marked, the atomics only run for the first boid of a block
+		InterlockedOr(myBlockBits[superBlock], blockBit);
+		const unsigned long long superBlockBit = 1ull << (superBlock & 63);
+		if ((InterlockedLoad(mySuperBlockBits[superBlock >> 6]) & superBlockBit) == 0)
+			InterlockedOr(mySuperBlockBits[superBlock >> 6], superBlockBit);
+	}
+
+	// Zeroes the marked blocks of aCounts and the marks, returns the cells cleared.
+	// aCounts has to be zero outside the marked blocks, which holds as long as only the marked cells are written.
+	unsigned int Clear(unsigned int* aCounts, ThreadPool& aThreadPool);
+	// Inclusive scan of the first aCellCount counts into the marked blocks of aOutSumBuffer, read it with GetCellEnds
+	void InclusiveScan(const unsigned int* aCounts, unsigned int* aOutSumBuffer, const unsigned int aCellCount, ThreadPool& aThreadPool);
+	// The ends of the last InclusiveScan, valid until the next Clear
+	CellEnds GetCellEnds(const unsigned int* aSumBuffer) const;
+	// Writes the cells of the empty blocks too, for passes that change the sum buffer in place
+	void Densify(unsigned int* aSumBuffer, const unsigned int aCellCount, ThreadPool& aThreadPool) const;
+	// Copies the marked blocks of the first aCellCount cells
+	void CopyOccupied(const unsigned int* aSource, unsigned int* aDestination, const unsigned int aCellCount, ThreadPool& aThreadPool) const;
+
+	unsigned int GetOccupiedBlockCount() const;
+	void Release();
+
+private:
+	template<typename Function>
+	void ForEachOccupiedSuperBlock(const unsigned int aSuperBlockCount, ThreadPool& aThreadPool, const Function& aFunction) const;
+
+	std::vector<unsigned long long> myBlockBits; // One word per super block
+	std::vector<unsigned long long> mySuperBlockBits;
+	std::vector<unsigned int> myBlockOffsets; // Only written in occupied super blocks
+	std::vector<unsigned int> mySuperBlockOffsets;
+	unsigned int myCellCount = 0;
+};
\ No newline at end of file
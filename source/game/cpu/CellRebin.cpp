@@ -0,0 +1,212 @@
+#include "CellRebin.h"
+#include <algorithm>
+
+constexpr size_t SUM_BUFFER_GRAIN_SIZE = 16384;
+
+void IncrementalCellRebin::BeginFrame(const unsigned int aThreadCount)
+{
+	if (myThreadMoves.size() != aThreadCount)
+		myThreadMoves.resize(aThreadCount);
+
+	for (ThreadMoves& threadMoves : myThreadMoves)
+	{
+		threadMoves.moves.clear();
+	}
+}
+
+void IncrementalCellRebin::AddMoved(const unsigned int aThreadIndex, const unsigned int aSlot, const unsigned int aOldKey, const unsigned int aNewKey)
+{
+	myThreadMoves[aThreadIndex].moves.push_back({ aSlot, aOldKey, aNewKey });
+}
+
+unsigned int IncrementalCellRebin::GetMovedCount() const
+{
+	size_t count = 0;
+	for (const ThreadMoves& threadMoves : myThreadMoves)
+	{
+		count += threadMoves.moves.size();
+	}
+	return (unsigned int)count;
+}
+
+void IncrementalCellRebin::Plan(const unsigned int* aSumBuffer, const unsigned int aBoidCount)
+{
+	myMoved.clear();
+	for (const ThreadMoves& threadMoves : myThreadMoves)
+	{
+		myMoved.insert(myMoved.end(), threadMoves.moves.begin(), threadMoves.moves.end());
+	}
+
+	//Slot breaks ties, so the plan is the same whichever thread reported a boid
+	std::sort(myMoved.begin(), myMoved.end(), [](const MovedBoid& aLeft, const MovedBoid& aRight)
+		{
+			return aLeft.newKey != aRight.newKey ? aLeft.newKey < aRight.newKey : aLeft.slot < aRight.slot;
+		});
+
+	const unsigned int movedCount = (unsigned int)myMoved.size();
+	myRemovedSlots.resize(movedCount);
+	myOldKeys.resize(movedCount);
+	for (unsigned int i = 0; i < movedCount; i++)
+	{
+		myRemovedSlots[i] = myMoved[i].slot;
+		myOldKeys[i] = myMoved[i].oldKey;
+	}
+	std::sort(myRemovedSlots.begin(), myRemovedSlots.end());
+	std::sort(myOldKeys.begin(), myOldKeys.end());
+
+	//Walk the old slots. A moved boid leaves a hole at its slot and is inserted at the old end of its new cell,
+	//the boids between two of these events all shift by the insertions minus the holes before them.
+	//Where the insertions and holes before a run balance out it stays, and the shifts before and after it touch separate slots.
+	myShifts.clear();
+	myLeftShifts.clear();
+	myRightShifts.clear();
+	myShiftGroupEnds.clear();
+	myShiftedCount = 0;
+	myMovedBoids.resize(movedCount);
+	unsigned int slot = 0;
+	unsigned int removed = 0;
+	unsigned int inserted = 0;
+	while (true)
+	{
+		const unsigned int nextRemoval = removed < movedCount ? myRemovedSlots[removed] : aBoidCount;
+		const unsigned int nextInsertion = inserted < movedCount ? aSumBuffer[myMoved[inserted].newKey] : aBoidCount;
+		const unsigned int event = nextRemoval < nextInsertion ? nextRemoval : nextInsertion;
+
+		if (slot < event && inserted != removed)
+		{
+			const Move shift = { slot, slot + inserted - removed, event - slot };
+			if (inserted < removed)
+				myLeftShifts.push_back(shift);
+			else
+				myRightShifts.push_back(shift);
+			myShiftedCount += shift.count;
+		}
+		else if (inserted == removed)
+		{
+			EndShiftGroup();
+		}
+
+		if (removed == movedCount && inserted == movedCount)
+			break;
+
+		while (inserted < movedCount && aSumBuffer[myMoved[inserted].newKey] == event)
+		{
+			myMovedBoids[inserted] = { myMoved[inserted].slot, event - removed + inserted, 1 };
+			inserted++;
+		}
+
+		slot = event;
+		if (removed < movedCount && myRemovedSlots[removed] == event)
+		{
+			removed++;
+			slot++;
+		}
+	}
+
+	EndShiftGroup();
+}
+
+void IncrementalCellRebin::EndShiftGroup()
+{
+	if (myLeftShifts.empty() && myRightShifts.empty())
+		return;
+
+	//Left shifts go front to back and right shifts back to front, so a run only lands on holes or runs that already moved
+	myShifts.insert(myShifts.end(), myLeftShifts.begin(), myLeftShifts.end());
+	myShifts.insert(myShifts.end(), myRightShifts.rbegin(), myRightShifts.rend());
+	myShiftGroupEnds.push_back((unsigned int)myShifts.size());
+	myLeftShifts.clear();
+	myRightShifts.clear();
+}
+
+void IncrementalCellRebin::UpdateSumBuffer(unsigned int* aSumBuffer, ThreadPool& aThreadPool)
+{
+	//Every old key ends one boid earlier and every new key one later, the difference carries over to the following cells.
+	//The runs of keys with the same difference are found first, the keys in between are then updated in parallel.
+	myDeltaRuns.clear();
+	const unsigned int movedCount = (unsigned int)myMoved.size();
+	unsigned int oldIndex = 0;
+	unsigned int newIndex = 0;
+	int delta = 0;
+	while (oldIndex < movedCount || newIndex < movedCount)
+	{
+		const unsigned int nextOld = oldIndex < movedCount ? myOldKeys[oldIndex] : ~0u;
+		const unsigned int nextNew = newIndex < movedCount ? myMoved[newIndex].newKey : ~0u;
+		const unsigned int key = nextOld < nextNew ? nextOld : nextNew;
+		while (oldIndex < movedCount && myOldKeys[oldIndex] == key)
+		{
+			delta--;
+			oldIndex++;
+		}
+		while (newIndex < movedCount && myMoved[newIndex].newKey == key)
+		{
+			delta++;
+			newIndex++;
+		}
+
+		if (delta == 0)
+			continue;
+
+		//The changes sum to zero, so a non zero delta always has a next event
+		const unsigned int afterOld = oldIndex < movedCount ? myOldKeys[oldIndex] : ~0u;
+		const unsigned int afterNew = newIndex < movedCount ? myMoved[newIndex].newKey : ~0u;
+		const unsigned int end = afterOld < afterNew ? afterOld : afterNew;
+		myDeltaRuns.push_back({ key, end, delta });
+	}
+
+	if (myDeltaRuns.empty())
+		return;
+
+	const DeltaRun* deltaRuns = myDeltaRuns.data();
+	const size_t runCount = myDeltaRuns.size();
+	const unsigned int firstKey = myDeltaRuns.front().firstKey;
+	aThreadPool.ParallelFor(myDeltaRuns.back().endKey - firstKey, SUM_BUFFER_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			const unsigned int begin = firstKey + (unsigned int)aBegin;
+			const unsigned int end = firstKey + (unsigned int)aEnd;
+			//The first run that ends after the chunk begins
+			size_t run = (size_t)(std::upper_bound(deltaRuns, deltaRuns + runCount, begin, [](const unsigned int aKey, const DeltaRun& aRun)
+				{
+					return aKey < aRun.endKey;
+				}) - deltaRuns);
+			for (; run < runCount && deltaRuns[run].firstKey < end; run++)
+			{
+				const unsigned int runBegin = deltaRuns[run].firstKey > begin ? deltaRuns[run].firstKey : begin;
+				const unsigned int runEnd = deltaRuns[run].endKey < end ? deltaRuns[run].endKey : end;
+				for (unsigned int cell = runBegin; cell < runEnd; cell++)
+				{
+					aSumBuffer[cell] = (unsigned int)((int)aSumBuffer[cell] + deltaRuns[run].delta);
+				}
+			}
+		});
+}
+
+const std::vector<IncrementalCellRebin::Move>& IncrementalCellRebin::GetShifts() const
+{
+	return myShifts;
+}
+
+const std::vector<IncrementalCellRebin::Move>& IncrementalCellRebin::GetMovedBoids() const
+{
+	return myMovedBoids;
+}
+
+unsigned int IncrementalCellRebin::GetShiftedCount() const
+{
+	return myShiftedCount;
+}
+
+void IncrementalCellRebin::Release()
+{
+	myThreadMoves = std::vector<ThreadMoves>();
+	myMoved = std::vector<MovedBoid>();
+	myRemovedSlots = std::vector<unsigned int>();
+	myOldKeys = std::vector<unsigned int>();
+	myShifts = std::vector<Move>();
+	myLeftShifts = std::vector<Move>();
+	myRightShifts = std::vector<Move>();
+	myShiftGroupEnds = std::vector<unsigned int>();
+	myMovedBoids = std::vector<Move>();
+	myDeltaRuns = std::vector<DeltaRun>();
+	myShiftedCount = 0;
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include "ThreadPool.h"
+
+// Keeps a cell sorted boid buffer sorted from one frame to the next by only moving the boids that changed cell.
+// The behavior pass reports every boid whose cell key changed. Plan then works out where those boids go, which runs
+// of the other boids have to shift to make room, and how the sum buffer changes. Planning follows the number of cell
+// crossings, but every boid between the first and last crossing that isn't balanced out by a crossing the other way
+// shifts, and every cell end in between changes, so a drift of the whole flock in one direction still touches most
+// of the boids and cells. Both run in parallel, the shifts in groups that don't share slots.
+// Boids that stay keep their order, boids that move in are placed after them and ordered by their old slot, so the
+// result doesn't depend on the thread count.
+class IncrementalCellRebin
+{
+public:
+	struct Move
+	{
+		unsigned int from;
+		unsigned int to;
+		unsigned int count;
+	};
+
+	// Clears the moves of the last frame
+	void BeginFrame(const unsigned int aThreadCount);
+	// Called from the pass threads, aThreadIndex is the thread pool index
+	void AddMoved(const unsigned int aThreadIndex, const unsigned int aSlot, const unsigned int aOldKey, const unsigned int aNewKey);
+	unsigned int GetMovedCount() const;
+
+	// Plans the moves for aBoidCount sorted boids, aSumBuffer still has the inclusive cell ends of the old order
+	void Plan(const unsigned int* aSumBuffer, const unsigned int aBoidCount);
+	// Applies the cell count changes of the planned moves
+	void UpdateSumBuffer(unsigned int* aSumBuffer, ThreadPool& aThreadPool);
+
+	// Runs of boids to shift, in an order where no run overwrites one that has yet to move.
+	// The moved boids have to be saved before and written after the shifts.
+	const std::vector<Move>& GetShifts() const;
+	// Calls aFunction with every shift. The groups between two slots every boid before has settled in touch separate
+	// slots and run in parallel, the shifts of a group run in order on one thread.
+	template<typename Function>
+	void ForEachShift(ThreadPool& aThreadPool, const Function& aFunction) const;
+	const std::vector<Move>& GetMovedBoids() const;
+	unsigned int GetShiftedCount() const;
+
+	void Release();
+
+private:
+	struct MovedBoid
+	{
+		unsigned int slot;
+		unsigned int oldKey;
+		unsigned int newKey;
+	};
+
+	struct DeltaRun
+	{
+		unsigned int firstKey;
+		unsigned int endKey;
+		int delta;
+	};
+
+	struct ThreadMoves
+	{
+		std::vector<MovedBoid> moves;
+		char padding[40] = {}; // Keep the vectors of different threads on separate cache lines
+	};
+
+	std::vector<ThreadMoves> myThreadMoves;
+	std::vector<MovedBoid> myMoved;
+	std::vector<unsigned int> myRemovedSlots;
+	std::vector<unsigned int> myOldKeys;
+	std::vector<Move> myShifts;
+	std::vector<Move> myLeftShifts;
+	std::vector<Move> myRightShifts;
+	std::vector<unsigned int> myShiftGroupEnds;
+	std::vector<Move> myMovedBoids;
+	std::vector<DeltaRun> myDeltaRuns;
+	unsigned int myShiftedCount = 0;
+
+	void EndShiftGroup();
+};
+
+template<typename Function>
+void IncrementalCellRebin::ForEachShift(ThreadPool& aThreadPool, const Function& aFunction) const
+{
+	const Move* shifts = myShifts.data();
+	const unsigned int* groupEnds = myShiftGroupEnds.data();
+	aThreadPool.ParallelFor(myShiftGroupEnds.size(), 1, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t group = aBegin; group < aEnd; group++)
+			{
+				for (unsigned int shift = group > 0 ? groupEnds[group - 1] : 0; shift < groupEnds[group]; shift++)
+				{
+					aFunction(shifts[shift]);
+				}
+			}
+		});
+}
\ No newline at end of file
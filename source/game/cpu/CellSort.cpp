@@ -0,0 +1,157 @@
+#include "CellSort.h"
+#include <cstring>
+
+constexpr unsigned int MAX_SORT_CHUNKS = 64;
+constexpr unsigned int MIN_SORT_CHUNK_SIZE = 16384;
+constexpr unsigned int MIN_CELLS_PER_BLOCK = 1024;
+constexpr unsigned int MAX_SORT_BLOCKS = 16384;
+constexpr size_t SORT_BLOCK_GRAIN_SIZE = 4;
+constexpr size_t SORT_OFFSET_GRAIN_SIZE = 256;
+
+void StableCellSort::Sort(const unsigned int* aCellIndices, const unsigned int aBoidCount, const unsigned int aCellCount,
+	unsigned int* aOutSumBuffer, ThreadPool& aThreadPool)
+{
+	if (aCellCount == 0)
+		return;
+
+	//Chunk boundaries only depend on the boid count, never on the thread count
+	unsigned int chunkCount = (aBoidCount + MIN_SORT_CHUNK_SIZE - 1) / MIN_SORT_CHUNK_SIZE;
+	chunkCount = chunkCount > MAX_SORT_CHUNKS ? MAX_SORT_CHUNKS : (chunkCount == 0 ? 1 : chunkCount);
+	const unsigned int chunkSize = (aBoidCount + chunkCount - 1) / chunkCount;
+
+	unsigned int blockShift = 0;
+	while ((1u << blockShift) < MIN_CELLS_PER_BLOCK || ((aCellCount - 1) >> blockShift) + 1 > MAX_SORT_BLOCKS)
+	{
+		blockShift++;
+	}
+	const unsigned int blockCount = ((aCellCount - 1) >> blockShift) + 1;
+
+	myHistograms.resize((size_t)chunkCount * blockCount);
+	myBlockStarts.resize(blockCount + 1);
+	if (myBinnedIndices.size() < aBoidCount)
+	{
+		myBinnedIndices.resize(aBoidCount);
+		myBinnedCells.resize(aBoidCount);
+		mySortedIndices.resize(aBoidCount);
+	}
+
+	unsigned int* histograms = myHistograms.data();
+	unsigned int* blockStarts = myBlockStarts.data();
+	unsigned int* binnedIndices = myBinnedIndices.data();
+	unsigned int* binnedCells = myBinnedCells.data();
+	unsigned int* sortedIndices = mySortedIndices.data();
+
+	//Private block histogram per chunk
+	aThreadPool.ParallelForChunks(chunkCount, [&](size_t aChunk, unsigned int)
+		{
+			unsigned int* histogram = histograms + aChunk * blockCount;
+			memset(histogram, 0, blockCount * sizeof(unsigned int));
+
+			const unsigned int begin = (unsigned int)aChunk * chunkSize;
+			const unsigned int end = begin + chunkSize < aBoidCount ? begin + chunkSize : aBoidCount;
+			for (unsigned int i = begin; i < end; i++)
+			{
+				histogram[aCellIndices[i] >> blockShift]++;
+			}
+		});
+
+	//Offsets in block major, chunk minor order, so every block is contiguous and in boid index order
+	aThreadPool.ParallelFor(blockCount, SORT_OFFSET_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t block = aBegin; block < aEnd; block++)
+			{
+				unsigned int total = 0;
+				for (unsigned int chunk = 0; chunk < chunkCount; chunk++)
+				{
+					total += histograms[chunk * blockCount + block];
+				}
+				blockStarts[block] = total;
+			}
+		});
+
+	unsigned int offset = 0;
+	for (unsigned int block = 0; block < blockCount; block++)
+	{
+		const unsigned int total = blockStarts[block];
+		blockStarts[block] = offset;
+		offset += total;
+	}
+	blockStarts[blockCount] = offset;
+
+	aThreadPool.ParallelFor(blockCount, SORT_OFFSET_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t block = aBegin; block < aEnd; block++)
+			{
+				unsigned int chunkOffset = blockStarts[block];
+				for (unsigned int chunk = 0; chunk < chunkCount; chunk++)
+				{
+					const unsigned int count = histograms[chunk * blockCount + block];
+					histograms[chunk * blockCount + block] = chunkOffset;
+					chunkOffset += count;
+				}
+			}
+		});
+
+	//Stable scatter into the blocks
+	aThreadPool.ParallelForChunks(chunkCount, [&](size_t aChunk, unsigned int)
+		{
+			unsigned int* blockOffsets = histograms + aChunk * blockCount;
+
+			const unsigned int begin = (unsigned int)aChunk * chunkSize;
+			const unsigned int end = begin + chunkSize < aBoidCount ? begin + chunkSize : aBoidCount;
+			for (unsigned int i = begin; i < end; i++)
+			{
+				const unsigned int cell = aCellIndices[i];
+				const unsigned int slot = blockOffsets[cell >> blockShift]++;
+				binnedIndices[slot] = i;
+				binnedCells[slot] = cell;
+			}
+		});
+
+	//Counting sort inside every block, the block owns its cells so the sum buffer needs no atomics
+	aThreadPool.ParallelFor(blockCount, SORT_BLOCK_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t block = aBegin; block < aEnd; block++)
+			{
+				const unsigned int firstCell = (unsigned int)block << blockShift;
+				const unsigned int lastCell = aCellCount - firstCell > (1u << blockShift) ? firstCell + (1u << blockShift) : aCellCount;
+				const unsigned int begin = blockStarts[block];
+				const unsigned int end = blockStarts[block + 1];
+
+				unsigned int* sumBuffer = aOutSumBuffer;
+				memset(sumBuffer + firstCell, 0, (lastCell - firstCell) * sizeof(unsigned int));
+				for (unsigned int i = begin; i < end; i++)
+				{
+					sumBuffer[binnedCells[i]]++;
+				}
+
+				unsigned int cellOffset = begin;
+				for (unsigned int cell = firstCell; cell < lastCell; cell++)
+				{
+					const unsigned int count = sumBuffer[cell];
+					sumBuffer[cell] = cellOffset;
+					cellOffset += count;
+				}
+
+				//The start offsets are bumped to the inclusive end offsets while scattering
+				for (unsigned int i = begin; i < end; i++)
+				{
+					sortedIndices[sumBuffer[binnedCells[i]]++] = binnedIndices[i];
+				}
+			}
+		});
+}
+
+const unsigned int* StableCellSort::GetSortedIndices() const
+{
+	return mySortedIndices.data();
+}
+
+void StableCellSort::Release()
+{
+	myHistograms = std::vector<unsigned int>();
+	myBlockStarts = std::vector<unsigned int>();
+	myBinnedIndices = std::vector<unsigned int>();
+	myBinnedCells = std::vector<unsigned int>();
+	mySortedIndices = std::vector<unsigned int>();
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+#include "ThreadPool.h"
+
+// Deterministic replacement for the count, scan and sort passes of Grid_CS.hlsl.
+// Boids are first binned into blocks of cells with a private histogram per chunk, then every block is
+// counting sorted on its own. No atomics are used and boids keep their index order inside a cell,
+// so the sorted order is the same for any thread count.
+class StableCellSort
+{
+public:
+	// aCellIndices[i] is the cell of boid i. Writes the inclusive end offset of every cell to aOutSumBuffer,
+	// the same layout the scan of the atomic path produces.
+	void Sort(const unsigned int* aCellIndices, const unsigned int aBoidCount, const unsigned int aCellCount,
+		unsigned int* aOutSumBuffer, ThreadPool& aThreadPool);
+
+	// Index of the boid in every sorted slot, valid until the next Sort
+	const unsigned int* GetSortedIndices() const;
+	void Release();
+
+private:
+	std::vector<unsigned int> myHistograms;
+	std::vector<unsigned int> myBlockStarts;
+	std::vector<unsigned int> myBinnedIndices;
+	std::vector<unsigned int> myBinnedCells;
+	std::vector<unsigned int> mySortedIndices;
+};
\ No newline at end of file
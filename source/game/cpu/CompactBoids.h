@@ -0,0 +1,210 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "Boid.h"
+#include "BoidCS.h"
+
+// IEEE half precision conversions, rounding to nearest even like the F16C instructions
+namespace HalfFloat
+{
+	inline unsigned short FromFloat(const float aValue)
+	{
+		unsigned int bits;
+		std::memcpy(&bits, &aValue, sizeof(float));
+		const unsigned int sign = (bits >> 16) & 0x8000u;
+		const unsigned int absBits = bits & 0x7FFFFFFFu;
+
+		//Too large for a half, NaN stays NaN
+		if (absBits >= 0x47800000u)
+			return (unsigned short)(sign | (absBits > 0x7F800000u ? 0x7E00u : 0x7C00u));
+
+		//Normal halves rebias the exponent, the rounding carry can move up into the exponent
+		if (absBits >= 0x38800000u)
+		{
+			const unsigned int rounded = absBits + 0x0FFFu + ((absBits >> 13) & 1u);
+			return (unsigned short)(sign | ((rounded - 0x38000000u) >> 13));
+		}
+
+		//Below half of the smallest subnormal
+		if (absBits < 0x33000000u)
+			return (unsigned short)sign;
+
+		//Subnormal halves are multiples of 2^-24
+		const unsigned int mantissa = (absBits & 0x007FFFFFu) | 0x00800000u;
+		const unsigned int shift = 126u - (absBits >> 23);
+		unsigned int half = mantissa >> shift;
+		const unsigned int remainder = mantissa & ((1u << shift) - 1u);
+		const unsigned int halfway = 1u << (shift - 1u);
+		if (remainder > halfway || (remainder == halfway && (half & 1u) != 0))
+			half++;
+		return (unsigned short)(sign | half);
+	}
+
+	inline float ToFloat(const unsigned short aHalf)
+	{
+		const unsigned int sign = (unsigned int)(aHalf & 0x8000u) << 16;
+		const unsigned int exponent = (aHalf >> 10) & 0x1Fu;
+		const unsigned int mantissa = aHalf & 0x3FFu;
+
+		unsigned int bits;
+		if (exponent == 0x1Fu)
+			bits = sign | 0x7F800000u | (mantissa << 13);
+		else if (exponent != 0)
+			bits = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+		else
+		{
+			const float subnormal = (float)mantissa * 5.9604645e-8f;
+			return sign != 0 ? -subnormal : subnormal;
+		}
+
+		float value;
+		std::memcpy(&value, &bits, sizeof(float));
+		return value;
+	}
+}
+
+// 16 byte boid of the compact layout. The position is an offset from the middle of the boid's cell in steps of
+// cellSize / COMPACT_OFFSET_STEPS, the velocity is half precision. flockSize is kept apart since only rendering reads it.
+struct CompactBoid
+{
+	short offset[3];
+	unsigned short vel[3];
+	unsigned int cellIndex;
+};
+
+// Middle of the cell of the last decoded boid, sorted boids share cells so it rarely has to be worked out again
+struct CompactCellCache
+{
+	unsigned int cellIndex = ~0u;
+	Vector3<float> middle;
+};
+
+constexpr float COMPACT_OFFSET_STEPS = 16384.f; // Offsets reach 2 cells from the middle, boids outside the bounds stay in the edge cells
+
+// Compact storage for the CPU passes, about half the bytes of the AoS and SoA layouts.
+// The offsets are relative to the row major cells of the grid the boids were stored with, so they are only valid with that grid.
+// cellIndex is always the row major cell of the decoded position, Store works it out instead of taking the boid's.
+struct CompactBoids
+{
+	std::vector<CompactBoid> boids;
+	std::vector<unsigned short> flockSize;
+	FrameBufferData grid = {}; // Only the bounds, cellSize and gridDims are used
+
+	void Resize(const size_t aCount)
+	{
+		boids.resize(aCount);
+		flockSize.resize(aCount);
+	}
+
+	void Release()
+	{
+		*this = CompactBoids();
+	}
+
+	size_t Size() const
+	{
+		return boids.size();
+	}
+
+	// Boids stored after this use the cells of aFrame
+	void SetGrid(const FrameBufferData& aFrame)
+	{
+		grid = aFrame;
+	}
+
+	bool HasGrid(const FrameBufferData& aFrame) const
+	{
+		return grid.cellSize == aFrame.cellSize && grid.minPos.x == aFrame.minPos.x && grid.minPos.y == aFrame.minPos.y && grid.minPos.z == aFrame.minPos.z
+			&& grid.gridDims.x == aFrame.gridDims.x && grid.gridDims.y == aFrame.gridDims.y && grid.gridDims.z == aFrame.gridDims.z;
+	}
+
+	// Middle of the row major cell aCellIndex
+	Vector3<float> GetCellMiddle(const unsigned int aCellIndex) const
+	{
+		const unsigned int layer = grid.gridDims.x * grid.gridDims.y;
+		const unsigned int z = aCellIndex / layer;
+		const unsigned int y = (aCellIndex - z * layer) / grid.gridDims.x;
+		const unsigned int x = aCellIndex - z * layer - y * grid.gridDims.x;
+		return {
+			grid.minPos.x + ((float)x + 0.5f) * grid.cellSize,
+			grid.minPos.y + ((float)y + 0.5f) * grid.cellSize,
+			grid.minPos.z + ((float)z + 0.5f) * grid.cellSize };
+	}
+
+	Vector3<float> DecodePos(const CompactBoid& aBoid, const Vector3<float>& aCellMiddle) const
+	{
+		const float step = grid.cellSize / COMPACT_OFFSET_STEPS;
+		return { aCellMiddle.x + (float)aBoid.offset[0] * step, aCellMiddle.y + (float)aBoid.offset[1] * step, aCellMiddle.z + (float)aBoid.offset[2] * step };
+	}
+
+	static Vector3<float> DecodeVel(const CompactBoid& aBoid)
+	{
+		return { HalfFloat::ToFloat(aBoid.vel[0]), HalfFloat::ToFloat(aBoid.vel[1]), HalfFloat::ToFloat(aBoid.vel[2]) };
+	}
+
+	Vector3<float> LoadPos(const size_t aIndex) const
+	{
+		return DecodePos(boids[aIndex], GetCellMiddle(boids[aIndex].cellIndex));
+	}
+
+	Vector3<float> LoadPos(const size_t aIndex, CompactCellCache& aInOutCache) const
+	{
+		const CompactBoid& compact = boids[aIndex];
+		if (compact.cellIndex != aInOutCache.cellIndex)
+		{
+			aInOutCache.cellIndex = compact.cellIndex;
+			aInOutCache.middle = GetCellMiddle(compact.cellIndex);
+		}
+		return DecodePos(compact, aInOutCache.middle);
+	}
+
+	Boid Load(const size_t aIndex) const
+	{
+		const CompactBoid& compact = boids[aIndex];
+		Boid boid;
+		boid.pos = DecodePos(compact, GetCellMiddle(compact.cellIndex));
+		boid.cellIndex = compact.cellIndex;
+		boid.vel = DecodeVel(compact);
+		boid.flockSize = flockSize[aIndex];
+		return boid;
+	}
+
+	void Store(const size_t aIndex, const Boid& aBoid)
+	{
+		const unsigned int cellIndex = BoidCS::GetCellIndex(aBoid.pos, grid);
+		const Vector3<float> middle = GetCellMiddle(cellIndex);
+		const float scale = COMPACT_OFFSET_STEPS / grid.cellSize;
+		const float offsets[3] = { (aBoid.pos.x - middle.x) * scale, (aBoid.pos.y - middle.y) * scale, (aBoid.pos.z - middle.z) * scale };
+
+		CompactBoid& compact = boids[aIndex];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			//Rounded to the nearest step, boids further out than the offsets reach are pulled in
+			const float rounded = std::floor(offsets[axis] + 0.5f);
+			compact.offset[axis] = (short)(rounded < -32768.f ? -32768.f : (rounded > 32767.f ? 32767.f : rounded));
+		}
+
+		//Rounding can put a boid next to a face into the neighbouring cell, it is pulled back a step at a time until
+		//the decoded position is in the cell it is stored with, the grid passes only ever see the decoded one
+		const Vector3<unsigned int> cell = BoidCS::GetCellCoords(aBoid.pos, grid);
+		for (;;)
+		{
+			const Vector3<unsigned int> decodedCell = BoidCS::GetCellCoords(DecodePos(compact, middle), grid);
+			if (decodedCell.x == cell.x && decodedCell.y == cell.y && decodedCell.z == cell.z)
+				break;
+
+			const bool outside[3] = { decodedCell.x != cell.x, decodedCell.y != cell.y, decodedCell.z != cell.z };
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (outside[axis])
+					compact.offset[axis] = (short)(compact.offset[axis] > 0 ? compact.offset[axis] - 1 : compact.offset[axis] + 1);
+			}
+		}
+		compact.vel[0] = HalfFloat::FromFloat(aBoid.vel.x);
+		compact.vel[1] = HalfFloat::FromFloat(aBoid.vel.y);
+		compact.vel[2] = HalfFloat::FromFloat(aBoid.vel.z);
+		compact.cellIndex = cellIndex;
+		flockSize[aIndex] = (unsigned short)(aBoid.flockSize < 0xFFFFu ? aBoid.flockSize : 0xFFFFu);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// CPU counterpart of HLSL InterlockedAdd on a plain uint buffer element
+inline unsigned int InterlockedAdd(unsigned int& aDestination, const unsigned int aValue)
+{
+#ifdef _MSC_VER
+	return (unsigned int)_InterlockedExchangeAdd(reinterpret_cast<volatile long*>(&aDestination), (long)aValue);
+#else
+	return __atomic_fetch_add(&aDestination, aValue, __ATOMIC_RELAXED);
+#endif
+}
+
+// Returns the value before the decrement, like InterlockedAdd(dest, -1, original) in HLSL
+inline unsigned int InterlockedDecrement(unsigned int& aDestination)
+{
+#ifdef _MSC_VER
+	return (unsigned int)_InterlockedExchangeAdd(reinterpret_cast<volatile long*>(&aDestination), -1L);
+#else
+	return __atomic_fetch_sub(&aDestination, 1u, __ATOMIC_RELAXED);
+#endif
+}
+
+// Returns the value before the or, like InterlockedOr(dest, value, original) in HLSL but on 64 bits
+inline unsigned long long InterlockedOr(unsigned long long& aDestination, const unsigned long long aValue)
+{
+#ifdef _MSC_VER
+	return (unsigned long long)_InterlockedOr64(reinterpret_cast<volatile __int64*>(&aDestination), (__int64)aValue);
+#else
+	return __atomic_fetch_or(&aDestination, aValue, __ATOMIC_RELAXED);
+#endif
+}
+
+
+// Plain read of a word other threads InterlockedOr into at the same time, without ordering anything around it
+inline unsigned long long InterlockedLoad(const unsigned long long& aSource)
+{
+#ifdef _MSC_VER
+	return (unsigned long long)__iso_volatile_load64(reinterpret_cast<const volatile __int64*>(&aSource));
+#else
+	return __atomic_load_n(&aSource, __ATOMIC_RELAXED);
+#endif
+}
\ No newline at end of file
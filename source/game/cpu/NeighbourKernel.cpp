@@ -0,0 +1,578 @@
+#include "NeighbourKernel.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define NEIGHBOUR_KERNEL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+//MSVC compiles intrinsics for any instruction set, gcc and clang need the target per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define KERNEL_TARGET(aTarget)
+#else
+#define KERNEL_TARGET(aTarget) __attribute__((target(aTarget)))
+#endif
+
+//The lanes have to round like the scalar code. gcc fuses a multiply and an add wherever the target has FMA, which avx512f
+//implies, and clang does within an expression, so contraction is off for the whole file. MSVC only contracts with /fp:contract.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace
+{
+	void AccumulateGriddedScalar(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+		const BoidStreams& aBoidsIn, const FrameBufferData& aFrame)
+	{
+		for (unsigned int r = 0; r < aRanges.count; r++)
+		{
+			BoidCS::AccumulateRange(aAccumulator, aPos, aVelDir, aBoidsIn, aRanges.start[r], aRanges.end[r], aFrame);
+		}
+	}
+
+#if defined(NEIGHBOUR_KERNEL_X86)
+	//SSE4, 4 candidates per iteration
+
+	struct AccumulatorSSE
+	{
+		__m128 centerX, centerY, centerZ;
+		__m128 closeX, closeY, closeZ;
+		__m128 velX, velY, velZ;
+		__m128 count;
+		__m128 closestSqr;
+	};
+
+	struct ConstantsSSE
+	{
+		__m128 posX, posY, posZ;
+		__m128 velDirX, velDirY, velDirZ;
+		__m128 fieldOfView, visualRangeSqr, protectedRangeSqr;
+	};
+
+	KERNEL_TARGET("sse4.1") inline void InitSSE(AccumulatorSSE& aAccumulator, ConstantsSSE& aConstants,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const FrameBufferData& aFrame)
+	{
+		__m128 zero = _mm_setzero_ps();
+		aAccumulator = { zero, zero, zero, zero, zero, zero, zero, zero, zero, zero, _mm_set1_ps(FLT_MAX) };
+
+		aConstants.posX = _mm_set1_ps(aPos.x);
+		aConstants.posY = _mm_set1_ps(aPos.y);
+		aConstants.posZ = _mm_set1_ps(aPos.z);
+		aConstants.velDirX = _mm_set1_ps(aVelDir.x);
+		aConstants.velDirY = _mm_set1_ps(aVelDir.y);
+		aConstants.velDirZ = _mm_set1_ps(aVelDir.z);
+		aConstants.fieldOfView = _mm_set1_ps(aFrame.fieldOfViewPercent);
+		aConstants.visualRangeSqr = _mm_set1_ps(aFrame.visualRangeSqr);
+		aConstants.protectedRangeSqr = _mm_set1_ps(aFrame.protectedRangeSqr);
+	}
+
+	KERNEL_TARGET("sse4.1") inline void AccumulateSSE(AccumulatorSSE& aAccumulator, const ConstantsSSE& aConstants,
+		__m128 aPosX, __m128 aPosY, __m128 aPosZ, __m128 aVelX, __m128 aVelY, __m128 aVelZ, __m128 aLaneMask)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 half = _mm_set1_ps(0.5f);
+
+		__m128 toX = _mm_sub_ps(aPosX, aConstants.posX);
+		__m128 toY = _mm_sub_ps(aPosY, aConstants.posY);
+		__m128 toZ = _mm_sub_ps(aPosZ, aConstants.posZ);
+		__m128 distSqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toX, toX), _mm_mul_ps(toY, toY)), _mm_mul_ps(toZ, toZ));
+		__m128 length = _mm_sqrt_ps(distSqr);
+
+		__m128 dot = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_div_ps(toX, length), aConstants.velDirX),
+			_mm_mul_ps(_mm_div_ps(toY, length), aConstants.velDirY)),
+			_mm_mul_ps(_mm_div_ps(toZ, length), aConstants.velDirZ));
+
+		//!(fieldOfViewPercent < x), NaN is inside the view like in the scalar test
+		__m128 inView = _mm_cmpnlt_ps(aConstants.fieldOfView, _mm_mul_ps(_mm_add_ps(dot, one), half));
+		__m128 inRange = _mm_and_ps(_mm_cmpgt_ps(distSqr, zero), _mm_cmplt_ps(distSqr, aConstants.visualRangeSqr));
+		__m128 mask = _mm_and_ps(_mm_and_ps(inView, inRange), aLaneMask);
+		__m128 closeMask = _mm_and_ps(mask, _mm_cmplt_ps(distSqr, aConstants.protectedRangeSqr));
+
+		aAccumulator.closeX = _mm_sub_ps(aAccumulator.closeX, _mm_and_ps(closeMask, _mm_div_ps(toX, distSqr)));
+		aAccumulator.closeY = _mm_sub_ps(aAccumulator.closeY, _mm_and_ps(closeMask, _mm_div_ps(toY, distSqr)));
+		aAccumulator.closeZ = _mm_sub_ps(aAccumulator.closeZ, _mm_and_ps(closeMask, _mm_div_ps(toZ, distSqr)));
+		aAccumulator.closestSqr = _mm_min_ps(aAccumulator.closestSqr, _mm_blendv_ps(_mm_set1_ps(FLT_MAX), distSqr, closeMask));
+		aAccumulator.centerX = _mm_add_ps(aAccumulator.centerX, _mm_and_ps(mask, aPosX));
+		aAccumulator.centerY = _mm_add_ps(aAccumulator.centerY, _mm_and_ps(mask, aPosY));
+		aAccumulator.centerZ = _mm_add_ps(aAccumulator.centerZ, _mm_and_ps(mask, aPosZ));
+		aAccumulator.velX = _mm_add_ps(aAccumulator.velX, _mm_and_ps(mask, aVelX));
+		aAccumulator.velY = _mm_add_ps(aAccumulator.velY, _mm_and_ps(mask, aVelY));
+		aAccumulator.velZ = _mm_add_ps(aAccumulator.velZ, _mm_and_ps(mask, aVelZ));
+		aAccumulator.count = _mm_add_ps(aAccumulator.count, _mm_and_ps(mask, one));
+	}
+
+	KERNEL_TARGET("sse4.1") inline void AccumulateRangeSSE(AccumulatorSSE& aAccumulator, const ConstantsSSE& aConstants,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd)
+	{
+		const float* posX = aBoidsIn.posX.data();
+		const float* posY = aBoidsIn.posY.data();
+		const float* posZ = aBoidsIn.posZ.data();
+		const float* velX = aBoidsIn.velX.data();
+		const float* velY = aBoidsIn.velY.data();
+		const float* velZ = aBoidsIn.velZ.data();
+		const __m128 allLanes = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		unsigned int i = aStart;
+		for (; i + 4 <= aEnd; i += 4)
+		{
+			AccumulateSSE(aAccumulator, aConstants,
+				_mm_loadu_ps(posX + i), _mm_loadu_ps(posY + i), _mm_loadu_ps(posZ + i),
+				_mm_loadu_ps(velX + i), _mm_loadu_ps(velY + i), _mm_loadu_ps(velZ + i), allLanes);
+		}
+
+		if (i < aEnd)
+		{
+			//No masked loads before AVX, the tail is copied into zero padded lanes
+			float tail[6][4] = {};
+			for (unsigned int lane = 0; i + lane < aEnd; lane++)
+			{
+				tail[0][lane] = posX[i + lane];
+				tail[1][lane] = posY[i + lane];
+				tail[2][lane] = posZ[i + lane];
+				tail[3][lane] = velX[i + lane];
+				tail[4][lane] = velY[i + lane];
+				tail[5][lane] = velZ[i + lane];
+			}
+			__m128 laneMask = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32((int)(aEnd - i)), _mm_setr_epi32(0, 1, 2, 3)));
+			AccumulateSSE(aAccumulator, aConstants,
+				_mm_loadu_ps(tail[0]), _mm_loadu_ps(tail[1]), _mm_loadu_ps(tail[2]),
+				_mm_loadu_ps(tail[3]), _mm_loadu_ps(tail[4]), _mm_loadu_ps(tail[5]), laneMask);
+		}
+	}
+
+	KERNEL_TARGET("sse4.1") inline float HorizontalSumSSE(__m128 aVector)
+	{
+		float lanes[4];
+		_mm_storeu_ps(lanes, aVector);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+
+	KERNEL_TARGET("sse4.1") inline float HorizontalMinSSE(__m128 aVector)
+	{
+		float lanes[4];
+		_mm_storeu_ps(lanes, aVector);
+		const float low = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+		const float high = lanes[2] < lanes[3] ? lanes[2] : lanes[3];
+		return low < high ? low : high;
+	}
+
+	KERNEL_TARGET("sse4.1") inline void ReduceSSE(BoidCS::FlockAccumulator& aOutAccumulator, const AccumulatorSSE& aAccumulator)
+	{
+		aOutAccumulator.center += Vector3<float>(HorizontalSumSSE(aAccumulator.centerX), HorizontalSumSSE(aAccumulator.centerY), HorizontalSumSSE(aAccumulator.centerZ));
+		aOutAccumulator.close += Vector3<float>(HorizontalSumSSE(aAccumulator.closeX), HorizontalSumSSE(aAccumulator.closeY), HorizontalSumSSE(aAccumulator.closeZ));
+		aOutAccumulator.avgVel += Vector3<float>(HorizontalSumSSE(aAccumulator.velX), HorizontalSumSSE(aAccumulator.velY), HorizontalSumSSE(aAccumulator.velZ));
+		aOutAccumulator.flockSize += (unsigned int)HorizontalSumSSE(aAccumulator.count);
+		const float closestSqr = HorizontalMinSSE(aAccumulator.closestSqr);
+		aOutAccumulator.closestSqr = closestSqr < aOutAccumulator.closestSqr ? closestSqr : aOutAccumulator.closestSqr;
+	}
+
+	KERNEL_TARGET("sse4.1") void AccumulateRangeSSE4(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd, const FrameBufferData& aFrame)
+	{
+		AccumulatorSSE accumulator;
+		ConstantsSSE constants;
+		InitSSE(accumulator, constants, aPos, aVelDir, aFrame);
+		AccumulateRangeSSE(accumulator, constants, aBoidsIn, aStart, aEnd);
+		ReduceSSE(aAccumulator, accumulator);
+	}
+
+	KERNEL_TARGET("sse4.1") void AccumulateGriddedSSE4(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+		const BoidStreams& aBoidsIn, const FrameBufferData& aFrame)
+	{
+		AccumulatorSSE accumulator;
+		ConstantsSSE constants;
+		InitSSE(accumulator, constants, aPos, aVelDir, aFrame);
+		for (unsigned int r = 0; r < aRanges.count; r++)
+		{
+			AccumulateRangeSSE(accumulator, constants, aBoidsIn, aRanges.start[r], aRanges.end[r]);
+		}
+		ReduceSSE(aAccumulator, accumulator);
+	}
+
+	//AVX2, 8 candidates per iteration
+
+	struct AccumulatorAVX
+	{
+		__m256 centerX, centerY, centerZ;
+		__m256 closeX, closeY, closeZ;
+		__m256 velX, velY, velZ;
+		__m256 count;
+		__m256 closestSqr;
+	};
+
+	struct ConstantsAVX
+	{
+		__m256 posX, posY, posZ;
+		__m256 velDirX, velDirY, velDirZ;
+		__m256 fieldOfView, visualRangeSqr, protectedRangeSqr;
+	};
+
+	KERNEL_TARGET("avx2") inline void InitAVX2(AccumulatorAVX& aAccumulator, ConstantsAVX& aConstants,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const FrameBufferData& aFrame)
+	{
+		__m256 zero = _mm256_setzero_ps();
+		aAccumulator = { zero, zero, zero, zero, zero, zero, zero, zero, zero, zero, _mm256_set1_ps(FLT_MAX) };
+
+		aConstants.posX = _mm256_set1_ps(aPos.x);
+		aConstants.posY = _mm256_set1_ps(aPos.y);
+		aConstants.posZ = _mm256_set1_ps(aPos.z);
+		aConstants.velDirX = _mm256_set1_ps(aVelDir.x);
+		aConstants.velDirY = _mm256_set1_ps(aVelDir.y);
+		aConstants.velDirZ = _mm256_set1_ps(aVelDir.z);
+		aConstants.fieldOfView = _mm256_set1_ps(aFrame.fieldOfViewPercent);
+		aConstants.visualRangeSqr = _mm256_set1_ps(aFrame.visualRangeSqr);
+		aConstants.protectedRangeSqr = _mm256_set1_ps(aFrame.protectedRangeSqr);
+	}
+
+	KERNEL_TARGET("avx2") inline void AccumulateAVX2(AccumulatorAVX& aAccumulator, const ConstantsAVX& aConstants,
+		__m256 aPosX, __m256 aPosY, __m256 aPosZ, __m256 aVelX, __m256 aVelY, __m256 aVelZ, __m256 aLaneMask)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.f);
+		const __m256 half = _mm256_set1_ps(0.5f);
+
+		__m256 toX = _mm256_sub_ps(aPosX, aConstants.posX);
+		__m256 toY = _mm256_sub_ps(aPosY, aConstants.posY);
+		__m256 toZ = _mm256_sub_ps(aPosZ, aConstants.posZ);
+		__m256 distSqr = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(toX, toX), _mm256_mul_ps(toY, toY)), _mm256_mul_ps(toZ, toZ));
+		__m256 length = _mm256_sqrt_ps(distSqr);
+
+		__m256 dot = _mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(_mm256_div_ps(toX, length), aConstants.velDirX),
+			_mm256_mul_ps(_mm256_div_ps(toY, length), aConstants.velDirY)),
+			_mm256_mul_ps(_mm256_div_ps(toZ, length), aConstants.velDirZ));
+
+		__m256 inView = _mm256_cmp_ps(aConstants.fieldOfView, _mm256_mul_ps(_mm256_add_ps(dot, one), half), _CMP_NLT_UQ);
+		__m256 inRange = _mm256_and_ps(_mm256_cmp_ps(distSqr, zero, _CMP_GT_OQ), _mm256_cmp_ps(distSqr, aConstants.visualRangeSqr, _CMP_LT_OQ));
+		__m256 mask = _mm256_and_ps(_mm256_and_ps(inView, inRange), aLaneMask);
+		__m256 closeMask = _mm256_and_ps(mask, _mm256_cmp_ps(distSqr, aConstants.protectedRangeSqr, _CMP_LT_OQ));
+
+		aAccumulator.closeX = _mm256_sub_ps(aAccumulator.closeX, _mm256_and_ps(closeMask, _mm256_div_ps(toX, distSqr)));
+		aAccumulator.closeY = _mm256_sub_ps(aAccumulator.closeY, _mm256_and_ps(closeMask, _mm256_div_ps(toY, distSqr)));
+		aAccumulator.closeZ = _mm256_sub_ps(aAccumulator.closeZ, _mm256_and_ps(closeMask, _mm256_div_ps(toZ, distSqr)));
+		aAccumulator.closestSqr = _mm256_min_ps(aAccumulator.closestSqr, _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), distSqr, closeMask));
+		aAccumulator.centerX = _mm256_add_ps(aAccumulator.centerX, _mm256_and_ps(mask, aPosX));
+		aAccumulator.centerY = _mm256_add_ps(aAccumulator.centerY, _mm256_and_ps(mask, aPosY));
+		aAccumulator.centerZ = _mm256_add_ps(aAccumulator.centerZ, _mm256_and_ps(mask, aPosZ));
+		aAccumulator.velX = _mm256_add_ps(aAccumulator.velX, _mm256_and_ps(mask, aVelX));
+		aAccumulator.velY = _mm256_add_ps(aAccumulator.velY, _mm256_and_ps(mask, aVelY));
+		aAccumulator.velZ = _mm256_add_ps(aAccumulator.velZ, _mm256_and_ps(mask, aVelZ));
+		aAccumulator.count = _mm256_add_ps(aAccumulator.count, _mm256_and_ps(mask, one));
+	}
+
+	KERNEL_TARGET("avx2") inline void AccumulateRangeAVX(AccumulatorAVX& aAccumulator, const ConstantsAVX& aConstants,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd)
+	{
+		const float* posX = aBoidsIn.posX.data();
+		const float* posY = aBoidsIn.posY.data();
+		const float* posZ = aBoidsIn.posZ.data();
+		const float* velX = aBoidsIn.velX.data();
+		const float* velY = aBoidsIn.velY.data();
+		const float* velZ = aBoidsIn.velZ.data();
+		const __m256 allLanes = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		unsigned int i = aStart;
+		for (; i + 8 <= aEnd; i += 8)
+		{
+			AccumulateAVX2(aAccumulator, aConstants,
+				_mm256_loadu_ps(posX + i), _mm256_loadu_ps(posY + i), _mm256_loadu_ps(posZ + i),
+				_mm256_loadu_ps(velX + i), _mm256_loadu_ps(velY + i), _mm256_loadu_ps(velZ + i), allLanes);
+		}
+
+		if (i < aEnd)
+		{
+			__m256i loadMask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(aEnd - i)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			AccumulateAVX2(aAccumulator, aConstants,
+				_mm256_maskload_ps(posX + i, loadMask), _mm256_maskload_ps(posY + i, loadMask), _mm256_maskload_ps(posZ + i, loadMask),
+				_mm256_maskload_ps(velX + i, loadMask), _mm256_maskload_ps(velY + i, loadMask), _mm256_maskload_ps(velZ + i, loadMask),
+				_mm256_castsi256_ps(loadMask));
+		}
+	}
+
+	KERNEL_TARGET("avx2") inline float HorizontalSumAVX(__m256 aVector)
+	{
+		float lanes[8];
+		_mm256_storeu_ps(lanes, aVector);
+		return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+	}
+
+	KERNEL_TARGET("avx2") inline void ReduceAVX2(BoidCS::FlockAccumulator& aOutAccumulator, const AccumulatorAVX& aAccumulator)
+	{
+		aOutAccumulator.center += Vector3<float>(HorizontalSumAVX(aAccumulator.centerX), HorizontalSumAVX(aAccumulator.centerY), HorizontalSumAVX(aAccumulator.centerZ));
+		aOutAccumulator.close += Vector3<float>(HorizontalSumAVX(aAccumulator.closeX), HorizontalSumAVX(aAccumulator.closeY), HorizontalSumAVX(aAccumulator.closeZ));
+		aOutAccumulator.avgVel += Vector3<float>(HorizontalSumAVX(aAccumulator.velX), HorizontalSumAVX(aAccumulator.velY), HorizontalSumAVX(aAccumulator.velZ));
+		aOutAccumulator.flockSize += (unsigned int)HorizontalSumAVX(aAccumulator.count);
+		const __m128 closestSqr4 = _mm_min_ps(_mm256_castps256_ps128(aAccumulator.closestSqr), _mm256_extractf128_ps(aAccumulator.closestSqr, 1));
+		const float closestSqr = HorizontalMinSSE(closestSqr4);
+		aOutAccumulator.closestSqr = closestSqr < aOutAccumulator.closestSqr ? closestSqr : aOutAccumulator.closestSqr;
+	}
+
+	KERNEL_TARGET("avx2") void AccumulateRangeAVX2(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd, const FrameBufferData& aFrame)
+	{
+		AccumulatorAVX accumulator;
+		ConstantsAVX constants;
+		InitAVX2(accumulator, constants, aPos, aVelDir, aFrame);
+		AccumulateRangeAVX(accumulator, constants, aBoidsIn, aStart, aEnd);
+		ReduceAVX2(aAccumulator, accumulator);
+	}
+
+	KERNEL_TARGET("avx2") void AccumulateGriddedAVX2(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+		const BoidStreams& aBoidsIn, const FrameBufferData& aFrame)
+	{
+		AccumulatorAVX accumulator;
+		ConstantsAVX constants;
+		InitAVX2(accumulator, constants, aPos, aVelDir, aFrame);
+		for (unsigned int r = 0; r < aRanges.count; r++)
+		{
+			AccumulateRangeAVX(accumulator, constants, aBoidsIn, aRanges.start[r], aRanges.end[r]);
+		}
+		ReduceAVX2(aAccumulator, accumulator);
+	}
+
+	//AVX-512, 16 candidates per iteration
+
+	struct Accumulator512
+	{
+		__m512 centerX, centerY, centerZ;
+		__m512 closeX, closeY, closeZ;
+		__m512 velX, velY, velZ;
+		__m512 count;
+		__m512 closestSqr;
+	};
+
+	struct Constants512
+	{
+		__m512 posX, posY, posZ;
+		__m512 velDirX, velDirY, velDirZ;
+		__m512 fieldOfView, visualRangeSqr, protectedRangeSqr;
+	};
+
+	KERNEL_TARGET("avx512f") inline void Init512(Accumulator512& aAccumulator, Constants512& aConstants,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const FrameBufferData& aFrame)
+	{
+		__m512 zero = _mm512_setzero_ps();
+		aAccumulator = { zero, zero, zero, zero, zero, zero, zero, zero, zero, zero, _mm512_set1_ps(FLT_MAX) };
+
+		aConstants.posX = _mm512_set1_ps(aPos.x);
+		aConstants.posY = _mm512_set1_ps(aPos.y);
+		aConstants.posZ = _mm512_set1_ps(aPos.z);
+		aConstants.velDirX = _mm512_set1_ps(aVelDir.x);
+		aConstants.velDirY = _mm512_set1_ps(aVelDir.y);
+		aConstants.velDirZ = _mm512_set1_ps(aVelDir.z);
+		aConstants.fieldOfView = _mm512_set1_ps(aFrame.fieldOfViewPercent);
+		aConstants.visualRangeSqr = _mm512_set1_ps(aFrame.visualRangeSqr);
+		aConstants.protectedRangeSqr = _mm512_set1_ps(aFrame.protectedRangeSqr);
+	}
+
+	KERNEL_TARGET("avx512f") inline void Accumulate512(Accumulator512& aAccumulator, const Constants512& aConstants,
+		__m512 aPosX, __m512 aPosY, __m512 aPosZ, __m512 aVelX, __m512 aVelY, __m512 aVelZ, __mmask16 aLaneMask)
+	{
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512 one = _mm512_set1_ps(1.f);
+		const __m512 half = _mm512_set1_ps(0.5f);
+
+		__m512 toX = _mm512_sub_ps(aPosX, aConstants.posX);
+		__m512 toY = _mm512_sub_ps(aPosY, aConstants.posY);
+		__m512 toZ = _mm512_sub_ps(aPosZ, aConstants.posZ);
+		__m512 distSqr = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(toX, toX), _mm512_mul_ps(toY, toY)), _mm512_mul_ps(toZ, toZ));
+		__m512 length = _mm512_sqrt_ps(distSqr);
+
+		__m512 dot = _mm512_add_ps(_mm512_add_ps(
+			_mm512_mul_ps(_mm512_div_ps(toX, length), aConstants.velDirX),
+			_mm512_mul_ps(_mm512_div_ps(toY, length), aConstants.velDirY)),
+			_mm512_mul_ps(_mm512_div_ps(toZ, length), aConstants.velDirZ));
+
+		__mmask16 mask = _mm512_mask_cmp_ps_mask(aLaneMask, aConstants.fieldOfView, _mm512_mul_ps(_mm512_add_ps(dot, one), half), _CMP_NLT_UQ);
+		mask = _mm512_mask_cmp_ps_mask(mask, distSqr, zero, _CMP_GT_OQ);
+		mask = _mm512_mask_cmp_ps_mask(mask, distSqr, aConstants.visualRangeSqr, _CMP_LT_OQ);
+		__mmask16 closeMask = _mm512_mask_cmp_ps_mask(mask, distSqr, aConstants.protectedRangeSqr, _CMP_LT_OQ);
+
+		aAccumulator.closeX = _mm512_mask_sub_ps(aAccumulator.closeX, closeMask, aAccumulator.closeX, _mm512_div_ps(toX, distSqr));
+		aAccumulator.closeY = _mm512_mask_sub_ps(aAccumulator.closeY, closeMask, aAccumulator.closeY, _mm512_div_ps(toY, distSqr));
+		aAccumulator.closeZ = _mm512_mask_sub_ps(aAccumulator.closeZ, closeMask, aAccumulator.closeZ, _mm512_div_ps(toZ, distSqr));
+		aAccumulator.closestSqr = _mm512_mask_min_ps(aAccumulator.closestSqr, closeMask, aAccumulator.closestSqr, distSqr);
+		aAccumulator.centerX = _mm512_mask_add_ps(aAccumulator.centerX, mask, aAccumulator.centerX, aPosX);
+		aAccumulator.centerY = _mm512_mask_add_ps(aAccumulator.centerY, mask, aAccumulator.centerY, aPosY);
+		aAccumulator.centerZ = _mm512_mask_add_ps(aAccumulator.centerZ, mask, aAccumulator.centerZ, aPosZ);
+		aAccumulator.velX = _mm512_mask_add_ps(aAccumulator.velX, mask, aAccumulator.velX, aVelX);
+		aAccumulator.velY = _mm512_mask_add_ps(aAccumulator.velY, mask, aAccumulator.velY, aVelY);
+		aAccumulator.velZ = _mm512_mask_add_ps(aAccumulator.velZ, mask, aAccumulator.velZ, aVelZ);
+		aAccumulator.count = _mm512_mask_add_ps(aAccumulator.count, mask, aAccumulator.count, one);
+	}
+
+	KERNEL_TARGET("avx512f") inline void AccumulateRange512(Accumulator512& aAccumulator, const Constants512& aConstants,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd)
+	{
+		const float* posX = aBoidsIn.posX.data();
+		const float* posY = aBoidsIn.posY.data();
+		const float* posZ = aBoidsIn.posZ.data();
+		const float* velX = aBoidsIn.velX.data();
+		const float* velY = aBoidsIn.velY.data();
+		const float* velZ = aBoidsIn.velZ.data();
+
+		unsigned int i = aStart;
+		for (; i + 16 <= aEnd; i += 16)
+		{
+			Accumulate512(aAccumulator, aConstants,
+				_mm512_loadu_ps(posX + i), _mm512_loadu_ps(posY + i), _mm512_loadu_ps(posZ + i),
+				_mm512_loadu_ps(velX + i), _mm512_loadu_ps(velY + i), _mm512_loadu_ps(velZ + i), 0xFFFF);
+		}
+
+		if (i < aEnd)
+		{
+			__mmask16 loadMask = (__mmask16)((1u << (aEnd - i)) - 1);
+			Accumulate512(aAccumulator, aConstants,
+				_mm512_maskz_loadu_ps(loadMask, posX + i), _mm512_maskz_loadu_ps(loadMask, posY + i), _mm512_maskz_loadu_ps(loadMask, posZ + i),
+				_mm512_maskz_loadu_ps(loadMask, velX + i), _mm512_maskz_loadu_ps(loadMask, velY + i), _mm512_maskz_loadu_ps(loadMask, velZ + i),
+				loadMask);
+		}
+	}
+
+	KERNEL_TARGET("avx512f") inline void Reduce512(BoidCS::FlockAccumulator& aOutAccumulator, const Accumulator512& aAccumulator)
+	{
+		aOutAccumulator.center += Vector3<float>(_mm512_reduce_add_ps(aAccumulator.centerX), _mm512_reduce_add_ps(aAccumulator.centerY), _mm512_reduce_add_ps(aAccumulator.centerZ));
+		aOutAccumulator.close += Vector3<float>(_mm512_reduce_add_ps(aAccumulator.closeX), _mm512_reduce_add_ps(aAccumulator.closeY), _mm512_reduce_add_ps(aAccumulator.closeZ));
+		aOutAccumulator.avgVel += Vector3<float>(_mm512_reduce_add_ps(aAccumulator.velX), _mm512_reduce_add_ps(aAccumulator.velY), _mm512_reduce_add_ps(aAccumulator.velZ));
+		aOutAccumulator.flockSize += (unsigned int)_mm512_reduce_add_ps(aAccumulator.count);
+		const float closestSqr = _mm512_reduce_min_ps(aAccumulator.closestSqr);
+		aOutAccumulator.closestSqr = closestSqr < aOutAccumulator.closestSqr ? closestSqr : aOutAccumulator.closestSqr;
+	}
+
+	KERNEL_TARGET("avx512f") void AccumulateRangeAVX512(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd, const FrameBufferData& aFrame)
+	{
+		Accumulator512 accumulator;
+		Constants512 constants;
+		Init512(accumulator, constants, aPos, aVelDir, aFrame);
+		AccumulateRange512(accumulator, constants, aBoidsIn, aStart, aEnd);
+		Reduce512(aAccumulator, accumulator);
+	}
+
+	KERNEL_TARGET("avx512f") void AccumulateGriddedAVX512(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+		const BoidStreams& aBoidsIn, const FrameBufferData& aFrame)
+	{
+		Accumulator512 accumulator;
+		Constants512 constants;
+		Init512(accumulator, constants, aPos, aVelDir, aFrame);
+		for (unsigned int r = 0; r < aRanges.count; r++)
+		{
+			AccumulateRange512(accumulator, constants, aBoidsIn, aRanges.start[r], aRanges.end[r]);
+		}
+		Reduce512(aAccumulator, accumulator);
+	}
+#endif
+
+	InstructionSet DetectInstructionSet()
+	{
+#if !defined(NEIGHBOUR_KERNEL_X86)
+		return InstructionSet::Scalar;
+#elif defined(_MSC_VER) && !defined(__clang__)
+		int info[4] = {};
+		__cpuid(info, 0);
+		const int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		const bool sse41 = (info[2] & (1 << 19)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+
+		//The OS has to save the ymm/zmm registers, not only the cpu support them
+		const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		const bool ymmState = (xcr0 & 0x6) == 0x6;
+		const bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+		int leaf7[4] = {};
+		if (maxLeaf >= 7)
+			__cpuidex(leaf7, 7, 0);
+		const bool avx2 = (leaf7[1] & (1 << 5)) != 0;
+		const bool avx512f = (leaf7[1] & (1 << 16)) != 0;
+
+		if (avx512f && zmmState)
+			return InstructionSet::AVX512;
+		if (avx2 && avx && ymmState)
+			return InstructionSet::AVX2;
+		if (sse41)
+			return InstructionSet::SSE4;
+		return InstructionSet::Scalar;
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return InstructionSet::AVX512;
+		if (__builtin_cpu_supports("avx2"))
+			return InstructionSet::AVX2;
+		if (__builtin_cpu_supports("sse4.1"))
+			return InstructionSet::SSE4;
+		return InstructionSet::Scalar;
+#endif
+	}
+}
+
+InstructionSet NeighbourKernel::GetBestSupported()
+{
+	static const InstructionSet best = DetectInstructionSet();
+	return best;
+}
+
+bool NeighbourKernel::IsSupported(const InstructionSet aInstructionSet)
+{
+	return aInstructionSet < InstructionSet::Count && aInstructionSet <= GetBestSupported();
+}
+
+const char* NeighbourKernel::GetName(const InstructionSet aInstructionSet)
+{
+	switch (aInstructionSet)
+	{
+	case InstructionSet::Scalar: return "Scalar";
+	case InstructionSet::SSE4: return "SSE4";
+	case InstructionSet::AVX2: return "AVX2";
+	case InstructionSet::AVX512: return "AVX-512";
+	default: return "Unknown";
+	}
+}
+
+NeighbourKernel::Functions NeighbourKernel::GetFunctions(const InstructionSet aInstructionSet)
+{
+	InstructionSet instructionSet = IsSupported(aInstructionSet) ? aInstructionSet : GetBestSupported();
+
+	Functions functions;
+	functions.accumulateRange = BoidCS::AccumulateRange;
+	functions.accumulateGridded = AccumulateGriddedScalar;
+
+#if defined(NEIGHBOUR_KERNEL_X86)
+	switch (instructionSet)
+	{
+	case InstructionSet::SSE4:
+		functions.accumulateRange = AccumulateRangeSSE4;
+		functions.accumulateGridded = AccumulateGriddedSSE4;
+		break;
+	case InstructionSet::AVX2:
+		functions.accumulateRange = AccumulateRangeAVX2;
+		functions.accumulateGridded = AccumulateGriddedAVX2;
+		break;
+	case InstructionSet::AVX512:
+		functions.accumulateRange = AccumulateRangeAVX512;
+		functions.accumulateGridded = AccumulateGriddedAVX512;
+		break;
+	default:
+		break;
+	}
+#else
+	(void)instructionSet;
+#endif
+
+	return functions;
+}
\ No newline at end of file
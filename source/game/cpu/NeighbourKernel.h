@@ -0,0 +1,43 @@
+#pragma once
+#include "BoidCS.h"
+#include "BoidStreams.h"
+#include "CellGrid.h"
+
+enum class InstructionSet
+{
+	Scalar,
+	SSE4,
+	AVX2,
+	AVX512,
+	Count
+};
+
+// Vectorized versions of the neighbour loop in BoidBehaviors/BoidBehaviorsGridded over the SoA streams.
+// Every lane does the same float operations as BoidCS::AccumulateNeighbour, so the FOV and range tests
+// match the scalar path exactly. Only the summation order of the accumulators differs.
+namespace NeighbourKernel
+{
+	typedef void (*AccumulateRangeFunction)(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir,
+		const BoidStreams& aBoidsIn, const unsigned int aStart, const unsigned int aEnd, const FrameBufferData& aFrame);
+
+	// Accumulates all neighbour ranges of a cell, gathered once per cell with CellGrid::GatherNeighbourRanges.
+	// The ranges are passed in since lambdas don't get the target of the enclosing SIMD function.
+	typedef void (*AccumulateGriddedFunction)(BoidCS::FlockAccumulator& aAccumulator,
+		const Vector3<float>& aPos, const Vector3<float>& aVelDir, const NeighbourRanges& aRanges,
+		const BoidStreams& aBoidsIn, const FrameBufferData& aFrame);
+
+	struct Functions
+	{
+		AccumulateRangeFunction accumulateRange = nullptr;
+		AccumulateGriddedFunction accumulateGridded = nullptr;
+	};
+
+	// Widest instruction set the CPU and OS support, checked once with cpuid
+	InstructionSet GetBestSupported();
+	bool IsSupported(const InstructionSet aInstructionSet);
+	const char* GetName(const InstructionSet aInstructionSet);
+
+	// Unsupported instruction sets fall back to the best supported one
+	Functions GetFunctions(const InstructionSet aInstructionSet);
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "NeighbourLists.h"
+#include <atomic>
+#include <climits>
+#include "BoidCS.h"
+
+constexpr size_t LIST_GRAIN_SIZE = 1024;
+constexpr float LIST_MOVE_SLACK = 0.99f; // Keeps float rounding in the move test from letting a pair slip through
+
+namespace
+{
+	//Calls aFunction(i, j) for every boid j within aRangeSqr of boid i, for the sorted boids [aBegin, aEnd)
+	template<typename Function>
+	void ForEachListPair(const Vector3<float>* aPositions, const size_t aBegin, const size_t aEnd, const CellGrid& aCellGrid,
+		const CellEnds& aSumBuffer, const float aRangeSqr, const Function& aFunction)
+	{
+		NeighbourRanges ranges;
+		unsigned long long rangesCell = ~0ull;
+		for (size_t i = aBegin; i < aEnd; i++)
+		{
+			const Vector3<float>& pos = aPositions[i];
+			const unsigned int cellKey = aCellGrid.GetCellKey(pos);
+			const unsigned long long cell = aCellGrid.GetCellId(pos, cellKey);
+			if (cell != rangesCell)
+			{
+				aCellGrid.GatherNeighbourRanges(pos, cellKey, aSumBuffer, ranges);
+				rangesCell = cell;
+			}
+
+			for (unsigned int r = 0; r < ranges.count; r++)
+			{
+				for (unsigned int j = ranges.start[r]; j < ranges.end[r]; j++)
+				{
+					const Vector3<float> vecTo = aPositions[j] - pos;
+					if (j != i && vecTo.Dot(vecTo) < aRangeSqr)
+						aFunction((unsigned int)i, j);
+				}
+			}
+		}
+	}
+}
+
+Vector3<float>* VerletNeighbourLists::PrepareBuild(const unsigned int aBoidCount)
+{
+	myValid = false;
+	myBuildPositions.resize(aBoidCount);
+	return myBuildPositions.data();
+}
+
+bool VerletNeighbourLists::Build(const CellGrid& aCellGrid, const CellEnds& aSumBuffer, const FrameBufferData& aFrame, const float aSkin,
+	const size_t aBudgetBytes, ThreadPool& aThreadPool)
+{
+	const unsigned int boidCount = (unsigned int)myBuildPositions.size();
+	const Vector3<float>* positions = myBuildPositions.data();
+	const float rangeSqr = aFrame.visualRangeSqr;
+	myOffsets.resize((size_t)boidCount + 1);
+	myOffsets[0] = 0;
+
+	//Count first, so the lists are only allocated if they fit the budget
+	unsigned int* counts = myOffsets.data() + 1;
+	std::atomic<unsigned long long> entryCount(0);
+	aThreadPool.ParallelFor(boidCount, LIST_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			unsigned long long chunkCount = 0;
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				counts[i] = 0;
+			}
+			ForEachListPair(positions, aBegin, aEnd, aCellGrid, aSumBuffer, rangeSqr, [&](unsigned int aSlot, unsigned int)
+				{
+					counts[aSlot]++;
+					chunkCount++;
+				});
+			entryCount += chunkCount;
+		});
+
+	const unsigned long long entries = entryCount;
+	const unsigned long long byteCount = (entries + boidCount + 1) * sizeof(unsigned int) + (unsigned long long)boidCount * sizeof(Vector3<float>);
+	if (entries > UINT_MAX || byteCount > aBudgetBytes)
+	{
+		myNeighbours.clear();
+		myNeighbours.shrink_to_fit();
+		return false;
+	}
+
+	myPrefixSum.InclusiveScan(counts, boidCount, aThreadPool);
+	myNeighbours.resize((size_t)entries);
+
+	const unsigned int* offsets = myOffsets.data();
+	unsigned int* neighbours = myNeighbours.data();
+	aThreadPool.ParallelFor(boidCount, LIST_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			//Same pairs in the same order as the count, each list is in the range order of the gridded passes
+			unsigned int slot = (unsigned int)aBegin;
+			unsigned int next = offsets[aBegin];
+			ForEachListPair(positions, aBegin, aEnd, aCellGrid, aSumBuffer, rangeSqr, [&](unsigned int aSlot, unsigned int aNeighbour)
+				{
+					if (aSlot != slot)
+					{
+						slot = aSlot;
+						next = offsets[aSlot];
+					}
+					neighbours[next++] = aNeighbour;
+				});
+		});
+
+	const float maxMove = aSkin * 0.5f * LIST_MOVE_SLACK;
+	myMaxMoveSqr = maxMove * maxMove;
+	myFrame = aFrame;
+	myAge = 0;
+	myValid = true;
+	return true;
+}
+
+bool VerletNeighbourLists::CanReuse(const FrameBufferData& aFrame) const
+{
+	//The cell keys and the stencil the lists were gathered with
+	return myValid && aFrame.boidCount == myFrame.boidCount && aFrame.visualRangeSqr == myFrame.visualRangeSqr
+		&& aFrame.cellSize == myFrame.cellSize && aFrame.cellRings == myFrame.cellRings
+		&& aFrame.minPos.x == myFrame.minPos.x && aFrame.minPos.y == myFrame.minPos.y && aFrame.minPos.z == myFrame.minPos.z
+		&& aFrame.gridDims.x == myFrame.gridDims.x && aFrame.gridDims.y == myFrame.gridDims.y && aFrame.gridDims.z == myFrame.gridDims.z;
+}
+
+void VerletNeighbourLists::Invalidate()
+{
+	myValid = false;
+}
+
+bool VerletNeighbourLists::HasMovedTooFar(const unsigned int aSlot, const Vector3<float>& aPos) const
+{
+	const Vector3<float> move = aPos - myBuildPositions[aSlot];
+	return myMaxMoveSqr < move.Dot(move);
+}
+
+void VerletNeighbourLists::AdvanceStep()
+{
+	myAge++;
+}
+
+unsigned int VerletNeighbourLists::GetAge() const
+{
+	return myAge;
+}
+
+const unsigned int* VerletNeighbourLists::GetNeighbours() const
+{
+	return myNeighbours.data();
+}
+
+const unsigned int* VerletNeighbourLists::GetOffsets() const
+{
+	return myOffsets.data();
+}
+
+unsigned long long VerletNeighbourLists::GetEntryCount() const
+{
+	return myNeighbours.size();
+}
+
+size_t VerletNeighbourLists::GetByteCount() const
+{
+	return (myOffsets.size() + myNeighbours.size()) * sizeof(unsigned int) + myBuildPositions.size() * sizeof(Vector3<float>);
+}
+
+void VerletNeighbourLists::Release()
+{
+	myValid = false;
+	myBuildPositions = std::vector<Vector3<float>>();
+	myOffsets = std::vector<unsigned int>();
+	myNeighbours = std::vector<unsigned int>();
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include "CellGrid.h"
+#include "PrefixSum.h"
+#include "ThreadPool.h"
+
+// Verlet neighbour lists, every boid keeps the slots of the boids within the visual range plus a skin.
+// The lists are built from cell ranges that cover the longer range and are reused until a boid has moved more than
+// half the skin since the build, so two boids that came into range since were both already in each other's list.
+// Reused steps skip the binning and only visit boids that can be in range.
+// Lists index slots of the sorted buffer, so the boids have to stay in their slots until the next build.
+// Stored as one array of 32 bit slots with an offset per boid.
+class VerletNeighbourLists
+{
+public:
+	// Positions of the sorted boids for the next Build, filled by the caller
+	CommonUtilities::Vector3<float>* PrepareBuild(const unsigned int aBoidCount);
+	// aCellGrid has to be initialized with the visual range of aFrame grown by aSkin.
+	// Fails without allocating the lists if they would take more than aBudgetBytes, the lists are then invalid.
+	bool Build(const CellGrid& aCellGrid, const CellEnds& aSumBuffer, const FrameBufferData& aFrame, const float aSkin,
+		const size_t aBudgetBytes, ThreadPool& aThreadPool);
+	// Valid lists built for the same boid count and cells as aFrame
+	bool CanReuse(const FrameBufferData& aFrame) const;
+	void Invalidate();
+
+	// Called from the pass threads with the position a boid moves to
+	bool HasMovedTooFar(const unsigned int aSlot, const CommonUtilities::Vector3<float>& aPos) const;
+	// Counts a step the lists were used for, the age is the number of steps since the build
+	void AdvanceStep();
+	unsigned int GetAge() const;
+
+	const unsigned int* GetNeighbours() const;
+	// The list of aSlot is [GetNeighbours() + aOffsets[aSlot], GetNeighbours() + aOffsets[aSlot + 1])
+	const unsigned int* GetOffsets() const;
+	unsigned long long GetEntryCount() const;
+	size_t GetByteCount() const;
+
+	void Release();
+
+private:
+	std::vector<CommonUtilities::Vector3<float>> myBuildPositions;
+	std::vector<unsigned int> myOffsets;
+	std::vector<unsigned int> myNeighbours;
+	ChainedPrefixSum<unsigned int> myPrefixSum;
+	FrameBufferData myFrame = {};
+	float myMaxMoveSqr = 0.f;
+	unsigned int myAge = 0;
+	bool myValid = false;
+};
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+#include "hlsl/ComputeShaderDefines.h"
+
+// CPU version of the multi-level scan in RunBoidsGPUGridded (sweepPrefixSum followed by groupBlockSum).
+// Every level scans blocks of DOUBLE_THREAD_GROUP_SIZE elements, the block totals are scanned one level up
+// and then added back to the blocks below.
+template<typename T>
+class MultiLevelPrefixSum
+{
+public:
+	void InclusiveScan(T* aData, const size_t aCount, ThreadPool& aThreadPool)
+	{
+		size_t levelCount = 0;
+		for (size_t count = aCount; count > 1; count = (count + BLOCK_SIZE - 1) / BLOCK_SIZE)
+		{
+			levelCount++;
+		}
+		if (myLevels.size() < levelCount)
+			myLevels.resize(levelCount);
+
+		ScanLevel(aData, aCount, 0, aThreadPool);
+	}
+
+private:
+	static constexpr size_t BLOCK_SIZE = DOUBLE_THREAD_GROUP_SIZE;
+	static constexpr size_t BLOCKS_PER_TASK = 64;
+
+	void ScanLevel(T* aData, const size_t aCount, const size_t aLevel, ThreadPool& aThreadPool)
+	{
+		if (aCount <= 1)
+			return;
+
+		const size_t blockCount = (aCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		std::vector<T>& blockTotals = myLevels[aLevel];
+		blockTotals.resize(blockCount);
+
+		aThreadPool.ParallelFor(blockCount, BLOCKS_PER_TASK, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t block = aBegin; block < aEnd; block++)
+				{
+					const size_t begin = block * BLOCK_SIZE;
+					const size_t end = begin + BLOCK_SIZE < aCount ? begin + BLOCK_SIZE : aCount;
+					T sum = T{};
+					for (size_t i = begin; i < end; i++)
+					{
+						sum += aData[i];
+						aData[i] = sum;
+					}
+					blockTotals[block] = sum;
+				}
+			});
+
+		if (blockCount == 1)
+			return;
+
+		ScanLevel(blockTotals.data(), blockCount, aLevel + 1, aThreadPool);
+
+		aThreadPool.ParallelFor(blockCount - 1, BLOCKS_PER_TASK, [&](size_t aBegin, size_t aEnd, unsigned int)
+			{
+				for (size_t block = aBegin + 1; block < aEnd + 1; block++)
+				{
+					const size_t begin = block * BLOCK_SIZE;
+					const size_t end = begin + BLOCK_SIZE < aCount ? begin + BLOCK_SIZE : aCount;
+					const T offset = blockTotals[block - 1];
+					for (size_t i = begin; i < end; i++)
+					{
+						aData[i] += offset;
+					}
+				}
+			});
+	}
+
+	std::vector<std::vector<T>> myLevels;
+};
+
+// Single pass chained scan with decoupled look-back. Every partition scans itself, publishes its total, then adds up
+// the totals of the partitions before it until one has published its inclusive prefix, and adds that to its elements
+// while they are still in cache. Memory is read and written once per element, the multi-level scan goes over it twice.
+// The pool hands out chunks in increasing order, so the partitions a look-back waits on are always being scanned.
+template<typename T>
+class ChainedPrefixSum
+{
+public:
+	void InclusiveScan(T* aData, const size_t aCount, ThreadPool& aThreadPool)
+	{
+		const size_t partitionCount = (aCount + PARTITION_SIZE - 1) / PARTITION_SIZE;
+		if (myStatusCapacity < partitionCount)
+		{
+			myStatus.reset(new PartitionStatus[partitionCount]);
+			myStatusCapacity = partitionCount;
+		}
+		for (size_t partition = 0; partition < partitionCount; partition++)
+		{
+			myStatus[partition].state.store(STATE_EMPTY, std::memory_order_relaxed);
+		}
+
+		PartitionStatus* status = myStatus.get();
+		aThreadPool.ParallelForChunks(partitionCount, [&](size_t aPartition, unsigned int)
+			{
+				const size_t begin = aPartition * PARTITION_SIZE;
+				const size_t end = begin + PARTITION_SIZE < aCount ? begin + PARTITION_SIZE : aCount;
+				T sum = T{};
+				for (size_t i = begin; i < end; i++)
+				{
+					sum += aData[i];
+					aData[i] = sum;
+				}
+
+				T prefix = T{};
+				if (aPartition > 0)
+				{
+					status[aPartition].aggregate = sum;
+					status[aPartition].state.store(STATE_AGGREGATE, std::memory_order_release);
+					prefix = LookBack(status, aPartition);
+				}
+				status[aPartition].inclusivePrefix = prefix + sum;
+				status[aPartition].state.store(STATE_PREFIX, std::memory_order_release);
+
+				if (prefix == T{})
+					return;
+				for (size_t i = begin; i < end; i++)
+				{
+					aData[i] += prefix;
+				}
+			});
+	}
+
+private:
+	static constexpr size_t PARTITION_SIZE = 16384 / sizeof(T) > 0 ? 16384 / sizeof(T) : 1;
+	static constexpr unsigned int STATE_EMPTY = 0;
+	static constexpr unsigned int STATE_AGGREGATE = 1; // The total of the partition is published
+	static constexpr unsigned int STATE_PREFIX = 2; // The total of every element up to the end of the partition is published
+
+	struct PartitionStatus
+	{
+		std::atomic<unsigned int> state{ STATE_EMPTY };
+		T aggregate = T{};
+		T inclusivePrefix = T{};
+	};
+
+	// Sum of every element before aPartition
+	static T LookBack(const PartitionStatus* aStatus, const size_t aPartition)
+	{
+		T prefix = T{};
+		for (size_t partition = aPartition; partition-- > 0;)
+		{
+			unsigned int state = aStatus[partition].state.load(std::memory_order_acquire);
+			while (state == STATE_EMPTY)
+			{
+				std::this_thread::yield();
+				state = aStatus[partition].state.load(std::memory_order_acquire);
+			}
+			if (state == STATE_PREFIX)
+				return prefix + aStatus[partition].inclusivePrefix;
+			prefix += aStatus[partition].aggregate;
+		}
+		return prefix;
+	}
+
+	std::unique_ptr<PartitionStatus[]> myStatus;
+	size_t myStatusCapacity = 0;
+};
\ No newline at end of file
@@ -0,0 +1,15 @@
+#include "RenderInstances.h"
+#include "ThreadPool.h"
+
+constexpr size_t INSTANCE_GRAIN_SIZE = 16384;
+
+void RenderInstances::PackBoids(const Boid* aBoids, const size_t aCount, const InstanceBufferData& aPacking, RenderInstance* aOutInstances, ThreadPool& aThreadPool)
+{
+	aThreadPool.ParallelFor(aCount, INSTANCE_GRAIN_SIZE, [&](size_t aBegin, size_t aEnd, unsigned int)
+		{
+			for (size_t i = aBegin; i < aEnd; i++)
+			{
+				aOutInstances[i] = Pack(aBoids[i], aPacking);
+			}
+		});
+}
\ No newline at end of file
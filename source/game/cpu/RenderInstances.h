@@ -0,0 +1,122 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include "Boid.h"
+#include "hlsl/CBuffer.h"
+#include "hlsl/ComputeShaderDefines.h"
+
+class ThreadPool;
+
+// 12 byte instance the boid vertex shader reads instead of the 32 byte Boid, packed like packInstance in Instance.hlsli.
+// data[0] and data[1] hold x and y in their low INSTANCE_POS_BITS bits and the two halves of z above them.
+// data[2] holds the octahedral heading in two INSTANCE_HEADING_BITS fields and the flock size in the top 8 bits,
+// as log2(1 + flockSize) in steps of 1 / INSTANCE_FLOCK_OCTAVE_STEPS.
+struct RenderInstance
+{
+	unsigned int data[3];
+};
+
+constexpr unsigned int INSTANCE_POS_MAX = (1u << INSTANCE_POS_BITS) - 1;
+constexpr unsigned int INSTANCE_HEADING_MAX = (1u << INSTANCE_HEADING_BITS) - 1;
+constexpr unsigned int INSTANCE_Z_LOW_BITS = 32 - INSTANCE_POS_BITS;
+
+// Mantissa bits of 2^((i + 0.5) / 16), where the flock size codes of an octave round up to the next one
+constexpr unsigned int INSTANCE_FLOCK_THRESHOLDS[] = { 0x02CD87u, 0x08980Fu, 0x0EA43Au, 0x14F4F0u, 0x1B8D3Au, 0x227043u, 0x29A15Bu, 0x3123F6u,
+	0x38FBAFu, 0x412C4Du, 0x49B9BEu, 0x52A81Eu, 0x5BFBB8u, 0x65B907u, 0x6FE4BAu, 0x7A83B3u };
+static_assert(sizeof(INSTANCE_FLOCK_THRESHOLDS) / sizeof(INSTANCE_FLOCK_THRESHOLDS[0]) == INSTANCE_FLOCK_OCTAVE_STEPS, "One threshold per step of an octave");
+
+namespace RenderInstances
+{
+	// The range positions are quantized over, the bounds of aFrame padded by INSTANCE_BOUNDS_PADDING of their size on every side.
+	// Rendering decodes with the range the instances were packed with, so the bounds can change between steps.
+	inline InstanceBufferData GetPacking(const FrameBufferData& aFrame)
+	{
+		const Vector3<float> size = aFrame.maxPos - aFrame.minPos;
+		InstanceBufferData packing = {};
+		packing.minPos = aFrame.minPos - size * INSTANCE_BOUNDS_PADDING;
+		packing.extent = size * (1.f + 2.f * INSTANCE_BOUNDS_PADDING);
+		return packing;
+	}
+
+	// Rounds aValue in [0, 1] to aMax steps, values outside are clamped and NaN is 0.
+	// Truncates after the range checks instead of calling floor, which is a library call without SSE4.1.
+	inline unsigned int Quantize(const float aValue, const unsigned int aMax)
+	{
+		const float scaled = aValue * (float)aMax + 0.5f;
+		return !(scaled >= 1.f) ? 0u : (scaled >= (float)aMax ? aMax : (unsigned int)scaled);
+	}
+
+	// Rounds log2(1 + aFlockSize) to steps of 1 / INSTANCE_FLOCK_OCTAVE_STEPS and clamps it to 8 bits.
+	// Reads the octave from the float exponent and the step from the mantissa, a log2 call costs about as much as the rest of Pack.
+	inline unsigned int EncodeFlockSize(const unsigned int aFlockSize)
+	{
+		const float value = (float)aFlockSize + 1.f;
+		unsigned int bits;
+		std::memcpy(&bits, &value, sizeof(float));
+		const unsigned int mantissa = bits & 0x7FFFFFu;
+		unsigned int code = ((bits >> 23) - 127u) * INSTANCE_FLOCK_OCTAVE_STEPS;
+		for (unsigned int i = 0; i < INSTANCE_FLOCK_OCTAVE_STEPS; i++)
+		{
+			code += mantissa >= INSTANCE_FLOCK_THRESHOLDS[i] ? 1u : 0u;
+		}
+		return code < 255 ? code : 255;
+	}
+
+	inline RenderInstance Pack(const Boid& aBoid, const InstanceBufferData& aPacking)
+	{
+		const unsigned int x = Quantize((aBoid.pos.x - aPacking.minPos.x) / aPacking.extent.x, INSTANCE_POS_MAX);
+		const unsigned int y = Quantize((aBoid.pos.y - aPacking.minPos.y) / aPacking.extent.y, INSTANCE_POS_MAX);
+		const unsigned int z = Quantize((aBoid.pos.z - aPacking.minPos.z) / aPacking.extent.z, INSTANCE_POS_MAX);
+
+		//Octahedral heading, the lower hemisphere is folded over the diagonals. A boid without velocity faces +z.
+		const float length = std::abs(aBoid.vel.x) + std::abs(aBoid.vel.y) + std::abs(aBoid.vel.z);
+		float u = 0.f;
+		float v = 0.f;
+		if (length > 0.f)
+		{
+			u = aBoid.vel.x / length;
+			v = aBoid.vel.y / length;
+			if (aBoid.vel.z < 0.f)
+			{
+				const float foldedU = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+				v = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+				u = foldedU;
+			}
+		}
+		const unsigned int headingU = Quantize(u * 0.5f + 0.5f, INSTANCE_HEADING_MAX);
+		const unsigned int headingV = Quantize(v * 0.5f + 0.5f, INSTANCE_HEADING_MAX);
+		const unsigned int flockSize = EncodeFlockSize(aBoid.flockSize);
+
+		RenderInstance instance;
+		instance.data[0] = x | (z << INSTANCE_POS_BITS);
+		instance.data[1] = y | ((z >> INSTANCE_Z_LOW_BITS) << INSTANCE_POS_BITS);
+		instance.data[2] = headingU | (headingV << INSTANCE_HEADING_BITS) | (flockSize << 24);
+		return instance;
+	}
+
+	// The inverse of Pack as unpackInstance in Instance.hlsli does it, aOutHeading is normalized
+	inline void Unpack(const RenderInstance& aInstance, const InstanceBufferData& aPacking, Vector3<float>& aOutPos, Vector3<float>& aOutHeading, float& aOutFlockSize)
+	{
+		const unsigned int x = aInstance.data[0] & INSTANCE_POS_MAX;
+		const unsigned int y = aInstance.data[1] & INSTANCE_POS_MAX;
+		const unsigned int z = (aInstance.data[0] >> INSTANCE_POS_BITS) | ((aInstance.data[1] >> INSTANCE_POS_BITS) << INSTANCE_Z_LOW_BITS);
+		aOutPos = {
+			aPacking.minPos.x + (float)x / (float)INSTANCE_POS_MAX * aPacking.extent.x,
+			aPacking.minPos.y + (float)y / (float)INSTANCE_POS_MAX * aPacking.extent.y,
+			aPacking.minPos.z + (float)z / (float)INSTANCE_POS_MAX * aPacking.extent.z };
+
+		Vector3<float> heading;
+		heading.x = (float)(aInstance.data[2] & INSTANCE_HEADING_MAX) / (float)INSTANCE_HEADING_MAX * 2.f - 1.f;
+		heading.y = (float)((aInstance.data[2] >> INSTANCE_HEADING_BITS) & INSTANCE_HEADING_MAX) / (float)INSTANCE_HEADING_MAX * 2.f - 1.f;
+		heading.z = 1.f - std::abs(heading.x) - std::abs(heading.y);
+		const float fold = heading.z < 0.f ? -heading.z : 0.f;
+		heading.x += heading.x >= 0.f ? -fold : fold;
+		heading.y += heading.y >= 0.f ? -fold : fold;
+		aOutHeading = heading.GetNormalized();
+
+		aOutFlockSize = std::exp2((float)(aInstance.data[2] >> 24) / (float)INSTANCE_FLOCK_OCTAVE_STEPS) - 1.f;
+	}
+
+	// Packs aCount boids into aOutInstances on the threads of aThreadPool
+	void PackBoids(const Boid* aBoids, const size_t aCount, const InstanceBufferData& aPacking, RenderInstance* aOutInstances, ThreadPool& aThreadPool);
+}
\ No newline at end of file
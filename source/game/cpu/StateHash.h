@@ -0,0 +1,41 @@
+#pragma once
+#include <cstring>
+#include "Boid.h"
+
+// Hash of the simulation state for comparing runs bit for bit.
+// Covers the position and velocity bits of every boid. The boid hashes are summed, so the result doesn't depend on
+// the slots the boids are sorted to or the order threads add their chunks in, two states with the same boids match.
+namespace StateHash
+{
+	// splitmix64 finalizer
+	inline unsigned long long Mix(unsigned long long aValue)
+	{
+		aValue ^= aValue >> 30;
+		aValue *= 0xBF58476D1CE4E5B9ull;
+		aValue ^= aValue >> 27;
+		aValue *= 0x94D049BB133111EBull;
+		aValue ^= aValue >> 31;
+		return aValue;
+	}
+
+	inline unsigned long long HashBoid(const Boid& aBoid)
+	{
+		unsigned int bits[6];
+		std::memcpy(&bits[0], &aBoid.pos.x, sizeof(float));
+		std::memcpy(&bits[1], &aBoid.pos.y, sizeof(float));
+		std::memcpy(&bits[2], &aBoid.pos.z, sizeof(float));
+		std::memcpy(&bits[3], &aBoid.vel.x, sizeof(float));
+		std::memcpy(&bits[4], &aBoid.vel.y, sizeof(float));
+		std::memcpy(&bits[5], &aBoid.vel.z, sizeof(float));
+
+		unsigned long long hash = Mix(((unsigned long long)bits[0] << 32) | bits[1]);
+		hash = Mix(hash ^ (((unsigned long long)bits[2] << 32) | bits[3]));
+		return Mix(hash ^ (((unsigned long long)bits[4] << 32) | bits[5]));
+	}
+
+	// Sum of the boid hashes, mixed with the boid count
+	inline unsigned long long Finish(const unsigned long long aBoidHashSum, const unsigned int aBoidCount)
+	{
+		return Mix(aBoidHashSum ^ Mix(aBoidCount));
+	}
+}
\ No newline at end of file
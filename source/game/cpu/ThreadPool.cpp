@@ -0,0 +1,128 @@
+#include "ThreadPool.h"
+
+ThreadPool::~ThreadPool()
+{
+	UnInit();
+}
+
+void ThreadPool::Init(const unsigned int aThreadCount)
+{
+	UnInit();
+
+	unsigned int threadCount = aThreadCount;
+	if (threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if (threadCount == 0)
+		threadCount = 1;
+
+	myShutdownFlag = false;
+	myJobGeneration = 0;
+	myWorkers.reserve(threadCount - 1);
+	for (unsigned int i = 1; i < threadCount; i++)
+	{
+		myWorkers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+void ThreadPool::UnInit()
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myShutdownFlag = true;
+	}
+	myWorkCondition.notify_all();
+
+	for (std::thread& worker : myWorkers)
+	{
+		worker.join();
+	}
+	myWorkers.clear();
+}
+
+unsigned int ThreadPool::GetThreadCount() const
+{
+	return (unsigned int)myWorkers.size() + 1;
+}
+
+void ThreadPool::ParallelForChunks(const size_t aChunkCount, const ChunkFunction& aFunction)
+{
+	if (aChunkCount == 0)
+		return;
+
+	if (myWorkers.empty() || aChunkCount == 1)
+	{
+		for (size_t i = 0; i < aChunkCount; i++)
+		{
+			aFunction(i, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myJob = &aFunction;
+		myJobChunkCount = aChunkCount;
+		myNextChunk.store(0, std::memory_order_relaxed);
+		myActiveWorkers = (unsigned int)myWorkers.size();
+		myJobGeneration++;
+	}
+	myWorkCondition.notify_all();
+
+	RunChunks(0);
+
+	std::unique_lock<std::mutex> lock(myMutex);
+	myDoneCondition.wait(lock, [this] { return myActiveWorkers == 0; });
+	myJob = nullptr;
+}
+
+void ThreadPool::ParallelFor(const size_t aCount, const size_t aGrainSize, const RangeFunction& aFunction)
+{
+	const size_t grainSize = aGrainSize == 0 ? 1 : aGrainSize;
+	const size_t chunkCount = (aCount + grainSize - 1) / grainSize;
+
+	ParallelForChunks(chunkCount, [&](size_t aChunkIndex, unsigned int aThreadIndex)
+		{
+			const size_t begin = aChunkIndex * grainSize;
+			const size_t end = begin + grainSize < aCount ? begin + grainSize : aCount;
+			aFunction(begin, end, aThreadIndex);
+		});
+}
+
+void ThreadPool::WorkerLoop(const unsigned int aThreadIndex)
+{
+	unsigned long long seenGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(myMutex);
+			myWorkCondition.wait(lock, [&] { return myShutdownFlag || myJobGeneration != seenGeneration; });
+			if (myShutdownFlag)
+				return;
+			seenGeneration = myJobGeneration;
+		}
+
+		RunChunks(aThreadIndex);
+
+		bool lastWorker = false;
+		{
+			std::lock_guard<std::mutex> lock(myMutex);
+			myActiveWorkers--;
+			lastWorker = myActiveWorkers == 0;
+		}
+		if (lastWorker)
+			myDoneCondition.notify_one();
+	}
+}
+
+void ThreadPool::RunChunks(const unsigned int aThreadIndex)
+{
+	const ChunkFunction& job = *myJob;
+	const size_t chunkCount = myJobChunkCount;
+	for (;;)
+	{
+		const size_t chunk = myNextChunk.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= chunkCount)
+			return;
+		job(chunk, aThreadIndex);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for the CPU simulation passes.
+// The calling thread takes part in every job as thread index 0.
+class ThreadPool
+{
+public:
+	typedef std::function<void(size_t aChunkIndex, unsigned int aThreadIndex)> ChunkFunction;
+	typedef std::function<void(size_t aBegin, size_t aEnd, unsigned int aThreadIndex)> RangeFunction;
+
+	ThreadPool() = default;
+	ThreadPool(const ThreadPool& aThreadPool) = delete;
+	ThreadPool& operator=(const ThreadPool& aThreadPool) = delete;
+	~ThreadPool();
+
+	// 0 picks std::thread::hardware_concurrency
+	void Init(const unsigned int aThreadCount = 0);
+	void UnInit();
+	unsigned int GetThreadCount() const;
+
+	// Runs aFunction once for every chunk index in [0, aChunkCount). Chunks are handed out dynamically.
+	void ParallelForChunks(const size_t aChunkCount, const ChunkFunction& aFunction);
+
+	// Splits [0, aCount) into chunks of aGrainSize elements. Chunk boundaries only depend on aCount and aGrainSize.
+	void ParallelFor(const size_t aCount, const size_t aGrainSize, const RangeFunction& aFunction);
+
+private:
+	void WorkerLoop(const unsigned int aThreadIndex);
+	void RunChunks(const unsigned int aThreadIndex);
+
+	std::vector<std::thread> myWorkers;
+	std::mutex myMutex;
+	std::condition_variable myWorkCondition;
+	std::condition_variable myDoneCondition;
+
+	const ChunkFunction* myJob = nullptr;
+	size_t myJobChunkCount = 0;
+	std::atomic<size_t> myNextChunk{ 0 };
+	unsigned int myActiveWorkers = 0;
+	unsigned long long myJobGeneration = 0;
+	bool myShutdownFlag = false;
+};
@@ -0,0 +1,96 @@
+#include "WorkStealing.h"
+
+namespace
+{
+	//A queue is the task range [begin, end) packed in one word so owner and thieves can claim with a single CAS
+	unsigned long long PackRange(const unsigned int aBegin, const unsigned int aEnd)
+	{
+		return (unsigned long long)aBegin | ((unsigned long long)aEnd << 32);
+	}
+
+	unsigned int RangeBegin(const unsigned long long aRange)
+	{
+		return (unsigned int)(aRange & 0xFFFFFFFFull);
+	}
+
+	unsigned int RangeEnd(const unsigned long long aRange)
+	{
+		return (unsigned int)(aRange >> 32);
+	}
+}
+
+void WorkStealingScheduler::Run(const unsigned int* aTaskBounds, const unsigned int aTaskCount, ThreadPool& aThreadPool, const ThreadPool::RangeFunction& aFunction)
+{
+	const unsigned int queueCount = aThreadPool.GetThreadCount();
+	if (queueCount != myQueueCount)
+	{
+		myQueues.reset(new WorkerQueue[queueCount]);
+		myQueueCount = queueCount;
+	}
+
+	for (unsigned int queue = 0; queue < queueCount; queue++)
+	{
+		const unsigned int begin = (unsigned int)((unsigned long long)aTaskCount * queue / queueCount);
+		const unsigned int end = (unsigned int)((unsigned long long)aTaskCount * (queue + 1) / queueCount);
+		myQueues[queue].range.store(PackRange(begin, end), std::memory_order_relaxed);
+	}
+	myStealCount.store(0, std::memory_order_relaxed);
+
+	//One chunk per queue, the thread that picks up a chunk works that queue and then steals
+	aThreadPool.ParallelForChunks(queueCount, [&](size_t aQueue, unsigned int aThreadIndex)
+		{
+			const unsigned int queue = (unsigned int)aQueue;
+			unsigned int task = 0;
+			while (PopFront(queue, task) || Steal(queue, task))
+			{
+				if (aTaskBounds[task] < aTaskBounds[task + 1])
+					aFunction(aTaskBounds[task], aTaskBounds[task + 1], aThreadIndex);
+			}
+		});
+}
+
+unsigned int WorkStealingScheduler::GetStealCount() const
+{
+	return myStealCount.load(std::memory_order_relaxed);
+}
+
+bool WorkStealingScheduler::PopFront(const unsigned int aQueue, unsigned int& aOutTask)
+{
+	std::atomic<unsigned long long>& range = myQueues[aQueue].range;
+	unsigned long long current = range.load(std::memory_order_acquire);
+	while (RangeBegin(current) < RangeEnd(current))
+	{
+		if (range.compare_exchange_weak(current, PackRange(RangeBegin(current) + 1, RangeEnd(current)), std::memory_order_acq_rel))
+		{
+			aOutTask = RangeBegin(current);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool WorkStealingScheduler::Steal(const unsigned int aQueue, unsigned int& aOutTask)
+{
+	for (unsigned int offset = 1; offset < myQueueCount; offset++)
+	{
+		const unsigned int victim = (aQueue + offset) % myQueueCount;
+		std::atomic<unsigned long long>& range = myQueues[victim].range;
+		unsigned long long current = range.load(std::memory_order_acquire);
+		while (RangeBegin(current) < RangeEnd(current))
+		{
+			//Take the back half, the victim keeps working on the front that is close to what it just did
+			const unsigned int begin = RangeBegin(current);
+			const unsigned int end = RangeEnd(current);
+			const unsigned int split = begin + (end - begin) / 2;
+			if (range.compare_exchange_weak(current, PackRange(begin, split), std::memory_order_acq_rel))
+			{
+				//Our own queue is empty here, and empty queues are never written by other threads
+				myQueues[aQueue].range.store(PackRange(split + 1, end), std::memory_order_release);
+				myStealCount.fetch_add(1, std::memory_order_relaxed);
+				aOutTask = split;
+				return true;
+			}
+		}
+	}
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include "ThreadPool.h"
+
+// Runs a list of tasks given by their boundaries on the thread pool. Every worker starts with a contiguous
+// slice of the tasks, pops from the front of it, and when it runs dry steals the back half of another worker's slice.
+// Tasks are expected to be roughly equal in cost, see BoidComputerCPU::BuildBehaviorTasks.
+class WorkStealingScheduler
+{
+public:
+	// Task t covers [aTaskBounds[t], aTaskBounds[t + 1])
+	void Run(const unsigned int* aTaskBounds, const unsigned int aTaskCount, ThreadPool& aThreadPool, const ThreadPool::RangeFunction& aFunction);
+
+	// Steals during the last Run
+	unsigned int GetStealCount() const;
+
+private:
+	struct WorkerQueue
+	{
+		std::atomic<unsigned long long> range{ 0 };
+		char padding[56] = {}; // Keep the queues on separate cache lines
+	};
+
+	bool PopFront(const unsigned int aQueue, unsigned int& aOutTask);
+	bool Steal(const unsigned int aQueue, unsigned int& aOutTask);
+
+	std::unique_ptr<WorkerQueue[]> myQueues;
+	unsigned int myQueueCount = 0;
+	std::atomic<unsigned int> myStealCount{ 0 };
+};
\ No newline at end of file
@@ -119,7 +119,7 @@ int APIENTRY wWinMain(
 		boidSim.UpdateFrameBuffer();
 
 		graphicsEngine.PrepareFrame(boidSim.GetClearColor());
-		boidSim.SimulateGPU();
+		boidSim.Simulate();
 		boidSim.Render();
 
 		if (ImGui::Button("Quit"))
@@ -14,6 +14,7 @@ workspace "game"
 include "../../premake/common.lua"
 include (dirs.engine)
 include (dirs.external)
+include (dirs.headless)
 -------------------------------------------------------------
 project "game"
 	location (dirs.localfiles)
@@ -33,6 +33,7 @@ void Settings::SaveBoidSimulationSettings(const SimulationSettings& aSimulationS
 	{
 		//simulation
 		{"boidCount", s.boidCount},
+		{"memoryBudgetMB", s.memoryBudgetMB},
 		{"griddingOn", s.griddingOn},
 		{"cellSizeMult", s.cellSizeMult},
 		{"gravity", s.gravity},
@@ -48,6 +49,37 @@ void Settings::SaveBoidSimulationSettings(const SimulationSettings& aSimulationS
 		{"turnMagin", s.turnMagin},
 		{"minPos", { s.minPos.x, s.minPos.y, s.minPos.z }},
 		{"maxPos", { s.maxPos.x, s.maxPos.y, s.maxPos.z }},
+		{"fixedTimeStep", s.fixedTimeStep},
+		{"stepRate", s.stepRate},
+		{"maxStepsPerFrame", s.maxStepsPerFrame},
+		{"renderInterpolation", s.renderInterpolation},
+		{"adaptiveTimeStep", s.adaptiveTimeStep},
+		{"adaptiveStepFraction", s.adaptiveStepFraction},
+		{"minStepTime", s.minStepTime},
+		{"maxStepTime", s.maxStepTime},
+		{"simulationLod", s.simulationLod},
+		{"lodDistance", s.lodDistance},
+		{"lodMaxTier", s.lodMaxTier},
+		{"lodFrustum", s.lodFrustum},
+		{"deterministic", s.deterministic},
+		{"initSeed", s.initSeed},
+		{"cpuSimulation", s.cpu.enabled},
+		{"cpuThreadCount", s.cpu.threadCount},
+		{"cpuStructureOfArrays", s.cpu.structureOfArrays},
+		{"cpuCompactStorage", s.cpu.compactStorage},
+		{"cpuInstructionSet", s.cpu.instructionSet},
+		{"cpuStableSort", s.cpu.stableSort},
+		{"cpuWorkStealing", s.cpu.workStealing},
+		{"cpuCellOrder", s.cpu.cellOrder},
+		{"cpuIncrementalRebin", s.cpu.incrementalRebin},
+		{"cpuHalfShell", s.cpu.halfShell},
+		{"cpuCellCulling", s.cpu.cellCulling},
+		{"cpuNeighbourLists", s.cpu.neighbourLists},
+		{"cpuNeighbourListSkin", s.cpu.neighbourListSkin},
+		{"cpuNeighbourListBudgetMB", s.cpu.neighbourListBudgetMB},
+		{"gpuLazyGrid", s.gpu.lazyGrid},
+		{"gpuLazyGridMargin", s.gpu.lazyGridMargin},
+		{"gpuLazyGridMaxFrames", s.gpu.lazyGridMaxFrames},
 		//player
 		{"boidAttraction", p.boidAttraction },
 		{"maxVelocity", p.maxVelocity },
@@ -95,6 +127,7 @@ void Settings::LoadBoidSimulationSettings(SimulationSettings& aOutSimulationSett
 	auto& p = aOutPlayerSettings;
 	//simulation
 	s.boidCount = data["boidCount"];
+	s.memoryBudgetMB = data.value("memoryBudgetMB", s.memoryBudgetMB); //optional so older settings files still load
 	s.griddingOn = data["griddingOn"];
 	s.cellSizeMult = data["cellSizeMult"];
 	s.gravity = data["gravity"];
@@ -111,6 +144,42 @@ void Settings::LoadBoidSimulationSettings(SimulationSettings& aOutSimulationSett
 	s.minPos = { data["minPos"][0], data["minPos"][1], data["minPos"][2] };
 	s.maxPos = { data["maxPos"][0], data["maxPos"][1], data["maxPos"][2] };
 	s.maxPos = { data["maxPos"][0], data["maxPos"][1], data["maxPos"][2] };
+	//time step, optional so older settings files still load
+	s.fixedTimeStep = data.value("fixedTimeStep", s.fixedTimeStep);
+	s.stepRate = data.value("stepRate", s.stepRate);
+	s.maxStepsPerFrame = data.value("maxStepsPerFrame", s.maxStepsPerFrame);
+	s.renderInterpolation = data.value("renderInterpolation", s.renderInterpolation);
+	s.adaptiveTimeStep = data.value("adaptiveTimeStep", s.adaptiveTimeStep);
+	s.adaptiveStepFraction = data.value("adaptiveStepFraction", s.adaptiveStepFraction);
+	s.minStepTime = data.value("minStepTime", s.minStepTime);
+	s.maxStepTime = data.value("maxStepTime", s.maxStepTime);
+	//lod, optional so older settings files still load
+	s.simulationLod = data.value("simulationLod", s.simulationLod);
+	s.lodDistance = data.value("lodDistance", s.lodDistance);
+	s.lodMaxTier = data.value("lodMaxTier", s.lodMaxTier);
+	s.lodFrustum = data.value("lodFrustum", s.lodFrustum);
+	//reproducibility, optional so older settings files still load
+	s.deterministic = data.value("deterministic", s.deterministic);
+	s.initSeed = data.value("initSeed", s.initSeed);
+	//cpu, optional so older settings files still load
+	s.cpu.enabled = data.value("cpuSimulation", s.cpu.enabled);
+	s.cpu.threadCount = data.value("cpuThreadCount", s.cpu.threadCount);
+	s.cpu.structureOfArrays = data.value("cpuStructureOfArrays", s.cpu.structureOfArrays);
+	s.cpu.compactStorage = data.value("cpuCompactStorage", s.cpu.compactStorage);
+	s.cpu.instructionSet = data.value("cpuInstructionSet", s.cpu.instructionSet);
+	s.cpu.stableSort = data.value("cpuStableSort", s.cpu.stableSort);
+	s.cpu.workStealing = data.value("cpuWorkStealing", s.cpu.workStealing);
+	s.cpu.cellOrder = data.value("cpuCellOrder", s.cpu.cellOrder);
+	s.cpu.incrementalRebin = data.value("cpuIncrementalRebin", s.cpu.incrementalRebin);
+	s.cpu.halfShell = data.value("cpuHalfShell", s.cpu.halfShell);
+	s.cpu.cellCulling = data.value("cpuCellCulling", s.cpu.cellCulling);
+	s.cpu.neighbourLists = data.value("cpuNeighbourLists", s.cpu.neighbourLists);
+	s.cpu.neighbourListSkin = data.value("cpuNeighbourListSkin", s.cpu.neighbourListSkin);
+	s.cpu.neighbourListBudgetMB = data.value("cpuNeighbourListBudgetMB", s.cpu.neighbourListBudgetMB);
+	//gpu
+	s.gpu.lazyGrid = data.value("gpuLazyGrid", s.gpu.lazyGrid);
+	s.gpu.lazyGridMargin = data.value("gpuLazyGridMargin", s.gpu.lazyGridMargin);
+	s.gpu.lazyGridMaxFrames = data.value("gpuLazyGridMaxFrames", s.gpu.lazyGridMaxFrames);
 
 	//player
 	p.boidAttraction = data["boidAttraction"];
@@ -4,9 +4,35 @@
 using namespace CommonUtilities;
 constexpr float halfSize = 300.f;
 
+struct CPUSettings
+{
+	bool enabled = false;
+	int threadCount = 0;
+	bool structureOfArrays = true;
+	bool compactStorage = false; //Quantized positions and half precision velocities, overrides structureOfArrays
+	int instructionSet = -1; //-1 picks the widest supported
+	bool stableSort = true;
+	bool workStealing = true;
+	int cellOrder = 0; //CellOrder, 0 row major, 1 Morton, 2 hashed, 3 padded
+	bool incrementalRebin = true;
+	bool halfShell = false; //Visits every pair once, but is split between threads by grid slab instead of by cost
+	bool cellCulling = true;
+	bool neighbourLists = false;
+	float neighbourListSkin = 3.f; //Added to the visual range, lists are rebuilt once a boid has moved half of it
+	int neighbourListBudgetMB = 1024;
+};
+
+struct GPUSettings
+{
+	bool lazyGrid = false;
+	float lazyGridMargin = 2.f; //Added to the search range, the grid is rebuilt once a boid may have moved this far
+	int lazyGridMaxFrames = 8;
+};
+
 struct SimulationSettings
 {
 	int boidCount = 500000;
+	int memoryBudgetMB = 2048; //Boid and cell buffers, caps the boid and cell counts, see SimulationFrameData::GetCapacity
 	bool griddingOn = true;
 	float cellSizeMult = 1.f;
 	float gravity = 0.f;
@@ -22,8 +48,28 @@ struct SimulationSettings
 	float turnSpeed = 3.2f;
 	float turnMagin = 5.f;
 
+	bool fixedTimeStep = true;
+	int stepRate = 60; //Simulation steps per second of scaled time
+	int maxStepsPerFrame = 8; //Catch-up cap, time beyond it is dropped instead of piling up
+	bool renderInterpolation = true;
+	bool adaptiveTimeStep = false; //CPU backend only, the step follows the speed and separation bounds of the last one
+	float adaptiveStepFraction = 0.2f; //Largest move per step as a fraction of the protected range, see GetAdaptiveStepTime
+	float minStepTime = 1.f / 480.f;
+	float maxStepTime = 1.f / 15.f;
+
+	bool simulationLod = false; //Gridded only, far cells update their behavior less often and move on in between
+	float lodDistance = 200.f; //Cells within it update every step, every doubling of the distance beyond it halves the rate
+	int lodMaxTier = 3; //Far cells update every 1 << lodMaxTier steps
+	bool lodFrustum = true; //Cells outside the view frustum take lodMaxTier
+
+	bool deterministic = false; //Same state for any thread count and run, cells are kept in a fixed order and the state is hashed every frame
+	int initSeed = 0; //Mixed into the init stream of every boid, 0 starts like before there was a seed
+
 	Vector3<float> minPos = { -halfSize * 2.f, -halfSize, -halfSize };
 	Vector3<float> maxPos = { halfSize * 2.f, halfSize, halfSize };
+
+	CPUSettings cpu;
+	GPUSettings gpu;
 };
 
 struct PlayerSettings
@@ -0,0 +1,149 @@
+#include "SimulationFrameData.h"
+#include <cfloat>
+#include <cmath>
+#include "hlsl/CBuffer.h"
+#include "Boid.h"
+#include "cpu/BoidCS.h"
+#include "cpu/BoidComputerCPU.h"
+#include "cpu/CellGrid.h"
+
+constexpr unsigned int MAX_BOIDS_PER_CELL = 50000;
+constexpr float MIN_ADAPTIVE_STEP_TIME = 1e-5f;
+constexpr unsigned int MIN_BUFFER_CAPACITY = 4096;
+constexpr unsigned long long MAX_BUFFER_BYTES = 0xFFFFFFFFull; //The byte width of a D3D11 buffer is 32 bit
+
+void SimulationFrameData::Fill(FrameBufferData& aOutFrameBufferData, const SimulationSettings& aSimulationSettings)
+{
+	FrameBufferData& f = aOutFrameBufferData;
+	const SimulationSettings& s = aSimulationSettings;
+
+	f.cohesionFactor = s.cohesionFactor;
+	f.separationFactor = s.separationFactor;
+	f.alignmentFactor = s.alignmentFactor;
+	f.fieldOfViewPercent = s.fieldOfView / 360.f;
+	f.visualRangeSqr = s.visualRange * s.visualRange;
+	f.protectedRangeSqr = s.protectedRange * s.protectedRange;
+	f.gravity = s.gravity;
+
+	f.maxSpeed = s.maxSpeed;
+	f.minSpeed = s.minSpeed;
+	f.turnMargin = s.turnMagin;
+	f.turnSpeed = s.turnSpeed;
+
+	f.minPos = s.minPos;
+	f.maxPos = s.maxPos;
+
+	//Only the GPU gridded pass reuses a stale binning, its cells have to cover the visual range plus the margin
+	const bool lazyGrid = s.griddingOn && !s.cpu.enabled && s.gpu.lazyGrid && 0.f < s.gpu.lazyGridMargin;
+	f.lazyGridMargin = lazyGrid ? s.gpu.lazyGridMargin : 0.f;
+	const float searchRange = s.visualRange + f.lazyGridMargin;
+
+	auto cubeSize = s.maxPos - s.minPos;
+	float cellSize = searchRange * s.cellSizeMult;
+
+	f.cellSize = cellSize;
+
+	f.gridDims = {
+		(unsigned int)(ceil(cubeSize.x / cellSize)),
+		(unsigned int)(ceil(cubeSize.y / cellSize)),
+		(unsigned int)(ceil(cubeSize.z / cellSize)) };
+
+	f.cellCount = f.gridDims.x * f.gridDims.y * f.gridDims.z;
+	//Cells smaller than the visual range need more rings of neighbour cells, the rounding of cellSize can't add one
+	f.cellRings = (unsigned int)ceil(searchRange / cellSize - 0.001f);
+	f.cellRings = f.cellRings > 1 ? f.cellRings : 1;
+	f.boidCount = s.boidCount;
+
+	//Tiers are assigned per grid cell, the brute force passes run every boid every step
+	const bool lod = s.griddingOn && s.simulationLod && 0.f < s.lodDistance && 0 < s.lodMaxTier;
+	f.lodDistance = lod ? s.lodDistance : 0.f;
+	f.lodMaxTier = lod ? ((unsigned int)s.lodMaxTier < MAX_LOD_TIER ? (unsigned int)s.lodMaxTier : MAX_LOD_TIER) : 0;
+	f.lodFrustum = lod && s.lodFrustum ? 1 : 0;
+
+	f.initSeed = (unsigned int)s.initSeed;
+	f.deterministic = s.deterministic ? 1 : 0;
+}
+
+float SimulationFrameData::GetAdaptiveStepTime(const SimulationSettings& aSimulationSettings, const float aMaxSpeed, const float aMinSeparation)
+{
+	const SimulationSettings& s = aSimulationSettings;
+	//A step of 0 would never advance, the min step is kept above it
+	const float minStepTime = s.minStepTime > MIN_ADAPTIVE_STEP_TIME ? s.minStepTime : MIN_ADAPTIVE_STEP_TIME;
+	const float maxStepTime = s.maxStepTime > minStepTime ? s.maxStepTime : minStepTime;
+	if (!(aMaxSpeed > 0.f))
+		return maxStepTime;
+
+	//The fastest boid moves at most the fraction of the protected range
+	float stepTime = s.adaptiveStepFraction * s.protectedRange / aMaxSpeed;
+	//The separation of two boids aMinSeparation apart changes their velocity by separationFactor / aMinSeparation per second,
+	//keep it under the same fraction of the speed so tight clusters don't push each other through and past
+	if (0.f < s.separationFactor && aMinSeparation < FLT_MAX)
+	{
+		const float separationStepTime = s.adaptiveStepFraction * aMaxSpeed * aMinSeparation / s.separationFactor;
+		stepTime = separationStepTime < stepTime ? separationStepTime : stepTime;
+	}
+	return stepTime < minStepTime ? minStepTime : (stepTime < maxStepTime ? stepTime : maxStepTime);
+}
+
+SimulationCapacity SimulationFrameData::GetCapacity(const FrameBufferData& aFrameBufferData, const SimulationSettings& aSimulationSettings)
+{
+	const FrameBufferData& f = aFrameBufferData;
+	const SimulationSettings& s = aSimulationSettings;
+	//Both steps of the boids and of the render instances, the CPU backend keeps the boids on the host in its layout
+	const BoidLayout layout = s.cpu.compactStorage ? BoidLayout::Compact : BoidLayout::AoS;
+	const unsigned long long boidSize = s.cpu.enabled ? BoidComputerCPU::GetBytesPerBoid(layout) : sizeof(Boid);
+	const unsigned long long bytesPerBoid = 2 * (boidSize + sizeof(RenderInstance));
+	//sumBuffer and unsortedSumBuffer, the hashed grid of the CPU backend is sized by the boid count instead
+	const unsigned long long bytesPerCell = 2 * sizeof(unsigned int);
+	const bool boundedGrid = s.griddingOn && (!s.cpu.enabled || s.cpu.cellOrder != (int)CellOrder::Hashed || s.cpu.compactStorage);
+
+	const unsigned long long budget = (unsigned long long)(s.memoryBudgetMB > 0 ? s.memoryBudgetMB : 0) * 1024 * 1024;
+	const unsigned long long boidBytes = (unsigned long long)(s.boidCount > 0 ? s.boidCount : 0) * bytesPerBoid;
+	const unsigned long long cellBytes = boundedGrid ? (unsigned long long)f.cellCount * bytesPerCell : 0;
+
+	unsigned long long maxBoids = budget > cellBytes ? (budget - cellBytes) / bytesPerBoid : 0;
+	unsigned long long maxCells = budget > boidBytes ? (budget - boidBytes) / bytesPerCell : 0;
+	maxBoids = maxBoids < MAX_BUFFER_BYTES / sizeof(Boid) ? maxBoids : MAX_BUFFER_BYTES / sizeof(Boid);
+	maxCells = maxCells < MAX_BUFFER_BYTES / sizeof(unsigned int) ? maxCells : MAX_BUFFER_BYTES / sizeof(unsigned int);
+
+	SimulationCapacity capacity;
+	capacity.maxBoids = (unsigned int)maxBoids;
+	capacity.maxCells = (unsigned int)maxCells;
+	return capacity;
+}
+
+unsigned int SimulationFrameData::GetBufferCapacity(const unsigned int aCurrent, const unsigned int aNeeded, const unsigned int aLimit)
+{
+	if (aNeeded <= aCurrent && (aCurrent <= MIN_BUFFER_CAPACITY || aCurrent / 4 <= aNeeded))
+		return aCurrent;
+
+	unsigned long long capacity = (unsigned long long)aNeeded + aNeeded / 2;
+	capacity = capacity > MIN_BUFFER_CAPACITY ? capacity : MIN_BUFFER_CAPACITY;
+	capacity = capacity < aLimit ? capacity : aLimit;
+	return capacity > aNeeded ? (unsigned int)capacity : aNeeded;
+}
+
+bool SimulationFrameData::IsValid(const FrameBufferData& aFrameBufferData, const SimulationSettings& aSimulationSettings)
+{
+	const FrameBufferData& f = aFrameBufferData;
+	const SimulationSettings& s = aSimulationSettings;
+	auto cubeSize = s.maxPos - s.minPos;
+	//The hashed grid of the CPU backend is sized by the boid count, the cell count doesn't matter.
+	//Compact storage always bins with row major cells.
+	const bool boundedGrid = !s.cpu.enabled || s.cpu.cellOrder != (int)CellOrder::Hashed || s.cpu.compactStorage;
+	const SimulationCapacity capacity = GetCapacity(f, s);
+
+	bool invalidSettings = (
+		cubeSize.x <= 0
+		|| cubeSize.y <= 0
+		|| cubeSize.z <= 0
+		|| (boundedGrid && f.cellCount == 0)
+		|| (s.griddingOn && boundedGrid && f.cellCount > capacity.maxCells)
+		|| (unsigned int)s.boidCount > capacity.maxBoids
+		|| (s.griddingOn && boundedGrid && (unsigned int)s.boidCount / f.cellCount > MAX_BOIDS_PER_CELL)
+		|| (!s.griddingOn && (unsigned int)s.boidCount > MAX_BOIDS_PER_CELL)
+		|| (s.griddingOn && f.cellRings > MAX_CELL_RINGS)
+		);
+
+	return !invalidSettings;
+}
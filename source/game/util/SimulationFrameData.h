@@ -0,0 +1,27 @@
+#pragma once
+#include "Boid.h"
+#include "util/SettingsStructs.h"
+
+struct FrameBufferData;
+
+namespace SimulationFrameData
+{
+	// Writes the simulation constants (behavior factors, bounds, grid) of the frame buffer. deltaTime is left to the caller.
+	void Fill(FrameBufferData& aOutFrameBufferData, const SimulationSettings& aSimulationSettings);
+
+	// Largest step that moves the fastest boid at most adaptiveStepFraction of the protected range and changes the velocity
+	// of the closest two boids by at most that fraction of aMaxSpeed. Clamped to minStepTime..maxStepTime.
+	float GetAdaptiveStepTime(const SimulationSettings& aSimulationSettings, const float aMaxSpeed, const float aMinSeparation);
+
+	// Boid and cell counts the memoryBudgetMB setting has room for next to the cells and boids of aFrameBufferData.
+	// Counts the boid, render instance and sum buffers of the backend the settings pick.
+	SimulationCapacity GetCapacity(const FrameBufferData& aFrameBufferData, const SimulationSettings& aSimulationSettings);
+
+	// Elements to allocate for aNeeded in a buffer of aCurrent, aCurrent if it can stay. Grows by half of aNeeded on top and
+	// shrinks once less than a quarter is used, so counts that change a little every frame don't reallocate every frame.
+	// The headroom stops at aLimit, aNeeded itself is never cut.
+	unsigned int GetBufferCapacity(const unsigned int aCurrent, const unsigned int aNeeded, const unsigned int aLimit);
+
+	// Same limits as the auto halt, false if the simulation must not run with these settings
+	bool IsValid(const FrameBufferData& aFrameBufferData, const SimulationSettings& aSimulationSettings);
+};
@@ -0,0 +1,981 @@
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "hlsl/CBuffer.h"
+#include "cpu/BoidComputerCPU.h"
+#include "cpu/PrefixSum.h"
+#include "util/Settings.h"
+#include "util/SimulationFrameData.h"
+
+// Runs the CPU backend without a window or GPU, for parameter studies on render nodes.
+// Reads simulationSettings.json from the working directory like the game does.
+
+struct HeadlessOptions
+{
+	int frames = 600;
+	int threads = -1;
+	float deltaTime = -1.f; //Negative uses the stepRate setting, the step the game takes with a fixed time step
+	int boidCount = -1;
+	int memoryBudgetMB = -1;
+	int structureOfArrays = -1;
+	int compactStorage = -1;
+	int instructionSet = -2; //-2 keeps the cpuInstructionSet setting
+	int stableSort = -1;
+	int workStealing = -1;
+	int cellOrder = -1;
+	int incrementalRebin = -1;
+	int halfShell = -1;
+	int cellCulling = -1;
+	int neighbourLists = -1;
+	float listSkin = -1.f;
+	int listBudgetMB = -1;
+	int adaptiveTimeStep = -1;
+	float lodDistance = -1.f; //0 turns the LOD off
+	int lodMaxTier = -1;
+	int deterministic = -1;
+	long long initSeed = -1;
+	float compactTolerance = -1.f; //Set by --validate-compact, the largest position error allowed
+	bool validateInstructionSets = false;
+	float instanceTolerance = -1.f; //Set by --validate-instances, how far past the quantization bounds an error may go, as a fraction of them
+	bool renderInstances = false;
+	bool scanBenchmark = false;
+};
+
+static const char* CELL_ORDER_NAMES[] = { "rowmajor", "morton", "hashed", "padded" };
+constexpr int VALIDATION_BOID_COUNT = 4096; //Default of --validate-compact, its runs are brute force
+constexpr int VALIDATION_REPORTS = 10;
+constexpr int VALIDATION_GRID_FRAMES = 60; //Most frames the gridded checks run, the reference of --validate-compact is brute force
+constexpr int VALIDATION_INSTANCE_FRAMES = 60; //Most frames --validate-instances runs
+constexpr int VALIDATION_ISA_FRAMES = 10; //Most frames --validate-isa runs, every frame runs each kernel over all boid pairs
+constexpr int DETERMINISTIC_COST_FRAMES = 60; //Most frames the deterministic run is compared against a normal one for
+constexpr float VALIDATION_BOIDS_PER_CELL = 4.f; //The gridded checks shrink the bounds to this density so boids near cell faces have neighbours
+static const size_t SCAN_BENCHMARK_COUNTS[] = { 1000000, 10000000, 100000000 };
+constexpr int SCAN_BENCHMARK_REPEATS = 5;
+
+static void PrintUsage()
+{
+	printf("usage: headless [--frames N] [--threads N] [--dt SECONDS] [--boids N] [--aos | --soa | --compact] [--isa auto|scalar|sse4|avx2|avx512]\n");
+	printf("                [--sort stable|atomic] [--schedule steal|even] [--cells rowmajor|morton|hashed|padded]\n");
+	printf("                [--rebin incremental|full] [--pairs full|half] [--cull on|off]\n");
+	printf("                [--lists on|off] [--skin UNITS] [--list-budget MB] [--adaptive on|off]\n");
+	printf("                [--lod DIST] [--lod-tiers N] [--deterministic on|off] [--seed N] [--validate-compact TOLERANCE]\n");
+	printf("                [--instances on|off] [--budget MB] [--scan-benchmark] [--validate-isa]\n");
+	printf("                [--validate-instances TOLERANCE]\n");
+	printf("  --threads 0 uses all cores, default is the cpuThreadCount setting\n");
+}
+
+static bool ParseInstructionSet(const char* aName, int& aOutInstructionSet)
+{
+	const char* names[] = { "auto", "scalar", "sse4", "avx2", "avx512" };
+	for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+	{
+		if (strcmp(aName, names[i]) == 0)
+		{
+			aOutInstructionSet = i - 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool ParseCellOrder(const char* aName, int& aOutCellOrder)
+{
+	for (int i = 0; i < (int)(sizeof(CELL_ORDER_NAMES) / sizeof(CELL_ORDER_NAMES[0])); i++)
+	{
+		if (strcmp(aName, CELL_ORDER_NAMES[i]) == 0)
+		{
+			aOutCellOrder = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool ParseOptions(int argc, char* argv[], HeadlessOptions& aOutOptions)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--frames") == 0 && hasValue)
+			aOutOptions.frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+			aOutOptions.threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--dt") == 0 && hasValue)
+			aOutOptions.deltaTime = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--boids") == 0 && hasValue)
+			aOutOptions.boidCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--budget") == 0 && hasValue)
+			aOutOptions.memoryBudgetMB = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--lod") == 0 && hasValue)
+			aOutOptions.lodDistance = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--lod-tiers") == 0 && hasValue)
+			aOutOptions.lodMaxTier = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+			aOutOptions.initSeed = strtoll(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--skin") == 0 && hasValue)
+			aOutOptions.listSkin = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--list-budget") == 0 && hasValue)
+			aOutOptions.listBudgetMB = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--validate-compact") == 0 && hasValue)
+			aOutOptions.compactTolerance = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--scan-benchmark") == 0)
+			aOutOptions.scanBenchmark = true;
+		else if (strcmp(argv[i], "--validate-isa") == 0)
+			aOutOptions.validateInstructionSets = true;
+		else if (strcmp(argv[i], "--validate-instances") == 0 && hasValue)
+			aOutOptions.instanceTolerance = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--aos") == 0)
+		{
+			aOutOptions.structureOfArrays = 0;
+			aOutOptions.compactStorage = 0;
+		}
+		else if (strcmp(argv[i], "--soa") == 0)
+		{
+			aOutOptions.structureOfArrays = 1;
+			aOutOptions.compactStorage = 0;
+		}
+		else if (strcmp(argv[i], "--compact") == 0)
+			aOutOptions.compactStorage = 1;
+		else if (strcmp(argv[i], "--sort") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "stable") == 0)
+				aOutOptions.stableSort = 1;
+			else if (strcmp(argv[i], "atomic") == 0)
+				aOutOptions.stableSort = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--schedule") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "steal") == 0)
+				aOutOptions.workStealing = 1;
+			else if (strcmp(argv[i], "even") == 0)
+				aOutOptions.workStealing = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--rebin") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "incremental") == 0)
+				aOutOptions.incrementalRebin = 1;
+			else if (strcmp(argv[i], "full") == 0)
+				aOutOptions.incrementalRebin = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--pairs") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "half") == 0)
+				aOutOptions.halfShell = 1;
+			else if (strcmp(argv[i], "full") == 0)
+				aOutOptions.halfShell = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--lists") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "on") == 0)
+				aOutOptions.neighbourLists = 1;
+			else if (strcmp(argv[i], "off") == 0)
+				aOutOptions.neighbourLists = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--adaptive") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "on") == 0)
+				aOutOptions.adaptiveTimeStep = 1;
+			else if (strcmp(argv[i], "off") == 0)
+				aOutOptions.adaptiveTimeStep = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--deterministic") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "on") == 0)
+				aOutOptions.deterministic = 1;
+			else if (strcmp(argv[i], "off") == 0)
+				aOutOptions.deterministic = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--instances") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "on") == 0)
+				aOutOptions.renderInstances = true;
+			else if (strcmp(argv[i], "off") == 0)
+				aOutOptions.renderInstances = false;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--cull") == 0 && hasValue)
+		{
+			i++;
+			if (strcmp(argv[i], "on") == 0)
+				aOutOptions.cellCulling = 1;
+			else if (strcmp(argv[i], "off") == 0)
+				aOutOptions.cellCulling = 0;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--cells") == 0 && hasValue)
+		{
+			i++;
+			if (!ParseCellOrder(argv[i], aOutOptions.cellOrder))
+				return false;
+		}
+		else if (strcmp(argv[i], "--isa") == 0 && hasValue)
+		{
+			if (!ParseInstructionSet(argv[++i], aOutOptions.instructionSet))
+				return false;
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+static BoidLayout GetLayout(const CPUSettings& aCPUSettings)
+{
+	if (aCPUSettings.compactStorage)
+		return BoidLayout::Compact;
+	return aCPUSettings.structureOfArrays ? BoidLayout::SoA : BoidLayout::AoS;
+}
+
+static void ConfigureComputer(BoidComputerCPU& aBoidComputer, const SimulationSettings& aSimSettings, const BoidLayout aLayout)
+{
+	aBoidComputer.Init((unsigned int)aSimSettings.cpu.threadCount);
+	aBoidComputer.SetLayout(aLayout);
+	if (aSimSettings.cpu.instructionSet >= 0)
+		aBoidComputer.SetInstructionSet((InstructionSet)aSimSettings.cpu.instructionSet);
+	aBoidComputer.SetStableSort(aSimSettings.cpu.stableSort);
+	aBoidComputer.SetWorkStealing(aSimSettings.cpu.workStealing);
+	aBoidComputer.SetCellOrder((CellOrder)aSimSettings.cpu.cellOrder);
+	aBoidComputer.SetIncrementalRebin(aSimSettings.cpu.incrementalRebin);
+	aBoidComputer.SetHalfShell(aSimSettings.cpu.halfShell);
+	aBoidComputer.SetCellCulling(aSimSettings.cpu.cellCulling);
+	aBoidComputer.SetNeighbourLists(aSimSettings.cpu.neighbourLists, aSimSettings.cpu.neighbourListSkin,
+		(size_t)(aSimSettings.cpu.neighbourListBudgetMB > 0 ? aSimSettings.cpu.neighbourListBudgetMB : 0) * 1024 * 1024);
+	aBoidComputer.SetStepBounds(aSimSettings.adaptiveTimeStep);
+}
+
+// Shrinks the bounds around the far corner to VALIDATION_BOIDS_PER_CELL boids per cell and fills aOutFrame with them.
+// The far corner is where the float positions are coarsest next to the compact offset steps.
+static void FillDenseGrid(SimulationSettings& aInOutSettings, const FrameBufferData& aFrame, FrameBufferData& aOutFrame)
+{
+	const float cellSize = aInOutSettings.visualRange * aInOutSettings.cellSizeMult;
+	const float boundsSize = cellSize * std::cbrt((float)aFrame.boidCount / VALIDATION_BOIDS_PER_CELL);
+	aInOutSettings.minPos = aInOutSettings.maxPos - Vector3<float>(boundsSize, boundsSize, boundsSize);
+	aOutFrame = aFrame;
+	SimulationFrameData::Fill(aOutFrame, aInOutSettings);
+}
+
+// Steps the compact layout gridded with the atomic sort and cell culling, in half shell and full neighbourhood mode,
+// and checks the flock size of every boid against a brute force count over the decoded boids the step read.
+// Returns the number of boids with a different flock size or a decoded position outside the cell they are stored in.
+static unsigned long long ValidateCompactGrid(const SimulationSettings& aSimSettings, const FrameBufferData& aFrame, const int aFrames)
+{
+	SimulationSettings gridSettings = aSimSettings;
+	gridSettings.griddingOn = true;
+	gridSettings.deterministic = false;
+	gridSettings.simulationLod = false;
+	gridSettings.cpu.neighbourLists = false;
+	gridSettings.cpu.stableSort = false;
+	gridSettings.cpu.cellCulling = true;
+	gridSettings.cpu.cellOrder = (int)CellOrder::RowMajor;
+	FrameBufferData gridFrame;
+	FillDenseGrid(gridSettings, aFrame, gridFrame);
+
+	const int frames = aFrames < VALIDATION_GRID_FRAMES ? aFrames : VALIDATION_GRID_FRAMES;
+	unsigned long long mismatches = 0;
+	for (int halfShell = 0; halfShell < 2; halfShell++)
+	{
+		gridSettings.cpu.halfShell = halfShell == 1;
+		BoidComputerCPU compact;
+		ConfigureComputer(compact, gridSettings, BoidLayout::Compact);
+		compact.InitBoidTransforms(gridFrame);
+
+		unsigned long long runMismatches = 0;
+		unsigned long long wrongCells = 0;
+		unsigned int largestDifference = 0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			compact.RunBoidsCPUGridded(gridFrame);
+			const Boid* boidsIn = compact.GetPreviousBoids();
+			const std::vector<Boid> previousBoids(boidsIn, boidsIn + gridFrame.boidCount);
+			const Boid* boidsOut = compact.GetBoids();
+			for (unsigned int i = 0; i < gridFrame.boidCount; i++)
+			{
+				//The cell the boid is stored in has to be the cell of its decoded position, the neighbour ranges come from both
+				if (boidsOut[i].cellIndex != BoidCS::GetCellIndex(boidsOut[i].pos, gridFrame))
+					wrongCells++;
+
+				Boid reference = previousBoids[i];
+				BoidCS::BoidBehaviors(reference, previousBoids.data(), gridFrame);
+				if (reference.flockSize != boidsOut[i].flockSize)
+				{
+					const unsigned int difference = reference.flockSize > boidsOut[i].flockSize ? reference.flockSize - boidsOut[i].flockSize : boidsOut[i].flockSize - reference.flockSize;
+					largestDifference = difference > largestDifference ? difference : largestDifference;
+					runMismatches++;
+				}
+			}
+			compact.SwapBuffers();
+		}
+		printf("  gridded, atomic sort, cell culling, %s pairs: %llu flock sizes of %d frames differ from brute force, by at most %u, %llu boids decode outside their cell\n",
+			halfShell == 1 ? "half shell" : "full", runMismatches, frames, largestDifference, wrongCells);
+		mismatches += runMismatches + wrongCells;
+		compact.UnInit();
+	}
+	return mismatches;
+}
+
+// Steps the compact layout next to a full precision AoS run from the same boids and reports how far the trajectories drift apart.
+// Both run brute force, which never reorders the boids, so the same slot is the same boid in both runs.
+// Fails if a position is ever further than aTolerance from the full precision one, if a boid decodes outside the cell it is
+// stored in, or if ValidateCompactGrid finds a mismatch.
+static int ValidateCompact(const SimulationSettings& aSimSettings, const FrameBufferData& aFrame, const int aFrames, const float aTolerance)
+{
+	BoidComputerCPU reference;
+	BoidComputerCPU compact;
+	ConfigureComputer(reference, aSimSettings, BoidLayout::AoS);
+	ConfigureComputer(compact, aSimSettings, BoidLayout::Compact);
+	reference.InitBoidTransforms(aFrame);
+	compact.InitBoidTransforms(aFrame);
+
+	printf("validating compact storage against full precision, %u boids, %u threads, position steps of %.6f units\n",
+		aFrame.boidCount, compact.GetThreadCount(), aFrame.cellSize / COMPACT_OFFSET_STEPS);
+
+	const int reportInterval = aFrames / VALIDATION_REPORTS > 0 ? aFrames / VALIDATION_REPORTS : 1;
+	double maxPosError = 0.0;
+	double maxVelError = 0.0;
+	unsigned long long wrongCells = 0;
+	for (int frame = 0; frame < aFrames; frame++)
+	{
+		reference.RunBoidsCPU(aFrame);
+		compact.RunBoidsCPU(aFrame);
+
+		const Boid* referenceBoids = reference.GetBoids();
+		const Boid* compactBoids = compact.GetBoids();
+		double framePosError = 0.0;
+		double frameVelError = 0.0;
+		double posErrorSqrSum = 0.0;
+		double velErrorSqrSum = 0.0;
+		for (unsigned int i = 0; i < aFrame.boidCount; i++)
+		{
+			const Vector3<float> posDiff = compactBoids[i].pos - referenceBoids[i].pos;
+			const Vector3<float> velDiff = compactBoids[i].vel - referenceBoids[i].vel;
+			const double posErrorSqr = (double)posDiff.x * posDiff.x + (double)posDiff.y * posDiff.y + (double)posDiff.z * posDiff.z;
+			const double velErrorSqr = (double)velDiff.x * velDiff.x + (double)velDiff.y * velDiff.y + (double)velDiff.z * velDiff.z;
+			framePosError = posErrorSqr > framePosError ? posErrorSqr : framePosError;
+			frameVelError = velErrorSqr > frameVelError ? velErrorSqr : frameVelError;
+			posErrorSqrSum += posErrorSqr;
+			velErrorSqrSum += velErrorSqr;
+			if (compactBoids[i].cellIndex != BoidCS::GetCellIndex(compactBoids[i].pos, aFrame))
+				wrongCells++;
+		}
+		framePosError = std::sqrt(framePosError);
+		frameVelError = std::sqrt(frameVelError);
+		maxPosError = framePosError > maxPosError ? framePosError : maxPosError;
+		maxVelError = frameVelError > maxVelError ? frameVelError : maxVelError;
+
+		if ((frame + 1) % reportInterval == 0 || frame + 1 == aFrames)
+		{
+			const double boids = aFrame.boidCount > 0 ? (double)aFrame.boidCount : 1.0;
+			printf("  frame %d position error max %.6f rms %.6f, velocity error max %.6f rms %.6f\n", frame + 1,
+				framePosError, std::sqrt(posErrorSqrSum / boids), frameVelError, std::sqrt(velErrorSqrSum / boids));
+		}
+
+		reference.SwapBuffers();
+		compact.SwapBuffers();
+	}
+
+	reference.UnInit();
+	compact.UnInit();
+
+	const unsigned long long gridMismatches = ValidateCompactGrid(aSimSettings, aFrame, aFrames);
+	const bool passed = maxPosError <= aTolerance && wrongCells == 0 && gridMismatches == 0;
+	printf("largest position error %.6f units (%.4f of a cell), velocity error %.6f, tolerance %.6f, %llu boids decoded outside their cell, %llu gridded mismatches: %s\n",
+		maxPosError, maxPosError / aFrame.cellSize, maxVelError, aTolerance, wrongCells, gridMismatches, passed ? "passed" : "FAILED");
+	return passed ? 0 : 2;
+}
+
+// Steps the SoA layout gridded with the scalar kernel and runs every supported neighbour kernel over all boid pairs the
+// step read. The lanes sum in another order than the scalar loop, but the range tests have to give the same neighbours
+// and the closest distance is a minimum, so both have to match exactly. A fused multiply add in the distances shows up
+// in the closest distances long before it flips a flock size. Fails if either differs.
+static int ValidateInstructionSets(const SimulationSettings& aSimSettings, const FrameBufferData& aFrame, const int aFrames)
+{
+	SimulationSettings gridSettings = aSimSettings;
+	gridSettings.griddingOn = true;
+	gridSettings.simulationLod = false;
+	gridSettings.cpu.neighbourLists = false;
+	gridSettings.cpu.halfShell = false;
+	gridSettings.cpu.instructionSet = (int)InstructionSet::Scalar;
+	FrameBufferData gridFrame;
+	FillDenseGrid(gridSettings, aFrame, gridFrame);
+
+	BoidComputerCPU boidComputer;
+	ConfigureComputer(boidComputer, gridSettings, BoidLayout::SoA);
+	boidComputer.InitBoidTransforms(gridFrame);
+
+	const int frames = aFrames < VALIDATION_ISA_FRAMES ? aFrames : VALIDATION_ISA_FRAMES;
+	printf("validating the neighbour kernels against the scalar one, %u boids, %d frames\n", gridFrame.boidCount, frames);
+
+	NeighbourKernel::Functions kernels[(int)InstructionSet::Count];
+	bool supported[(int)InstructionSet::Count] = {};
+	unsigned long long flockMismatches[(int)InstructionSet::Count] = {};
+	unsigned long long closestMismatches[(int)InstructionSet::Count] = {};
+	for (int i = 0; i < (int)InstructionSet::Count; i++)
+	{
+		supported[i] = NeighbourKernel::IsSupported((InstructionSet)i);
+		kernels[i] = NeighbourKernel::GetFunctions((InstructionSet)i);
+	}
+
+	BoidStreams boidStreams;
+	boidStreams.Resize(gridFrame.boidCount);
+	for (int frame = 0; frame < frames; frame++)
+	{
+		boidComputer.RunBoidsCPUGridded(gridFrame);
+		const Boid* boidsIn = boidComputer.GetPreviousBoids();
+		for (unsigned int i = 0; i < gridFrame.boidCount; i++)
+		{
+			boidStreams.Store(i, boidsIn[i]);
+		}
+
+		for (unsigned int i = 0; i < gridFrame.boidCount; i++)
+		{
+			const Vector3<float> velDir = BoidCS::Normalize(boidsIn[i].vel);
+			BoidCS::FlockAccumulator reference;
+			kernels[(int)InstructionSet::Scalar].accumulateRange(reference, boidsIn[i].pos, velDir, boidStreams, 0, gridFrame.boidCount, gridFrame);
+			for (int k = (int)InstructionSet::Scalar + 1; k < (int)InstructionSet::Count; k++)
+			{
+				if (!supported[k])
+					continue;
+				BoidCS::FlockAccumulator accumulator;
+				kernels[k].accumulateRange(accumulator, boidsIn[i].pos, velDir, boidStreams, 0, gridFrame.boidCount, gridFrame);
+				if (accumulator.flockSize != reference.flockSize)
+					flockMismatches[k]++;
+				if (accumulator.closestSqr != reference.closestSqr)
+					closestMismatches[k]++;
+			}
+		}
+		boidComputer.SwapBuffers();
+	}
+	boidComputer.UnInit();
+
+	bool passed = true;
+	for (int k = (int)InstructionSet::Scalar + 1; k < (int)InstructionSet::Count; k++)
+	{
+		if (!supported[k])
+		{
+			printf("  %s: not supported\n", NeighbourKernel::GetName((InstructionSet)k));
+			continue;
+		}
+		printf("  %s: %llu flock sizes and %llu closest distances differ from scalar\n",
+			NeighbourKernel::GetName((InstructionSet)k), flockMismatches[k], closestMismatches[k]);
+		passed = passed && flockMismatches[k] == 0 && closestMismatches[k] == 0;
+	}
+	printf("%s\n", passed ? "passed" : "FAILED");
+	return passed ? 0 : 2;
+}
+
+// Times the multi-level scan the cell offsets use against the single pass chained scan over sum buffers of cell counts.
+// Both scan the same counts in place, the best of SCAN_BENCHMARK_REPEATS runs is reported. Fails if the results differ.
+static int BenchmarkScans(const int aThreadCount)
+{
+	ThreadPool threadPool;
+	threadPool.Init((unsigned int)aThreadCount);
+	printf("inclusive scans of unsigned int cell counts, best of %d runs, %u threads\n", SCAN_BENCHMARK_REPEATS, threadPool.GetThreadCount());
+
+	MultiLevelPrefixSum<unsigned int> multiLevel;
+	ChainedPrefixSum<unsigned int> chained;
+	bool passed = true;
+	for (const size_t count : SCAN_BENCHMARK_COUNTS)
+	{
+		//A quarter of the cells hold up to 3 boids, the rest are empty like most of a sparse grid
+		std::vector<unsigned int> counts(count);
+		unsigned int random = 1;
+		for (size_t i = 0; i < count; i++)
+		{
+			random = random * 1664525u + 1013904223u;
+			counts[i] = (random >> 28) < 4 ? random >> 28 : 0;
+		}
+
+		std::vector<unsigned int> multiLevelData(count);
+		std::vector<unsigned int> chainedData(count);
+		double multiLevelMs = DBL_MAX;
+		double chainedMs = DBL_MAX;
+		for (int repeat = 0; repeat < SCAN_BENCHMARK_REPEATS; repeat++)
+		{
+			multiLevelData = counts;
+			auto start = std::chrono::steady_clock::now();
+			multiLevel.InclusiveScan(multiLevelData.data(), count, threadPool);
+			const double multiLevelRunMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			multiLevelMs = multiLevelRunMs < multiLevelMs ? multiLevelRunMs : multiLevelMs;
+
+			chainedData = counts;
+			start = std::chrono::steady_clock::now();
+			chained.InclusiveScan(chainedData.data(), count, threadPool);
+			const double chainedRunMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			chainedMs = chainedRunMs < chainedMs ? chainedRunMs : chainedMs;
+		}
+
+		const bool equal = multiLevelData == chainedData;
+		passed = passed && equal;
+		const double bytes = (double)count * sizeof(unsigned int);
+		printf("  %zu cells: multi-level %.3f ms (%.2f GB/s), chained %.3f ms (%.2f GB/s), %.2fx%s\n", count,
+			multiLevelMs, bytes / (multiLevelMs * 1e6), chainedMs, bytes / (chainedMs * 1e6), multiLevelMs / chainedMs, equal ? "" : ", RESULTS DIFFER");
+	}
+	threadPool.UnInit();
+	return passed ? 0 : 2;
+}
+
+// Largest difference between the boids of the last run and their render instances after a round trip through Unpack.
+// The heading error is in degrees, boids without velocity are skipped. The flock size error is relative.
+static void MeasureInstanceError(BoidComputerCPU& aBoidComputer, const FrameBufferData& aFrame, double& aOutPosError, double& aOutHeadingError, double& aOutFlockError)
+{
+	const InstanceBufferData packing = RenderInstances::GetPacking(aFrame);
+	const RenderInstance* instances = aBoidComputer.PackRenderInstances(aFrame, false);
+	const Boid* boids = aBoidComputer.GetBoids();
+	double posErrorSqr = 0.0;
+	aOutHeadingError = 0.0;
+	aOutFlockError = 0.0;
+	for (unsigned int i = 0; i < aFrame.boidCount; i++)
+	{
+		Vector3<float> pos;
+		Vector3<float> heading;
+		float flockSize;
+		RenderInstances::Unpack(instances[i], packing, pos, heading, flockSize);
+
+		const Vector3<float> posDiff = pos - boids[i].pos;
+		const double errorSqr = (double)posDiff.x * posDiff.x + (double)posDiff.y * posDiff.y + (double)posDiff.z * posDiff.z;
+		posErrorSqr = errorSqr > posErrorSqr ? errorSqr : posErrorSqr;
+
+		//The angle from the cross and dot product in double, an acos of a float dot product is off by more than the quantization
+		const Vector3<double> h = { (double)heading.x, (double)heading.y, (double)heading.z };
+		const Vector3<double> v = { (double)boids[i].vel.x, (double)boids[i].vel.y, (double)boids[i].vel.z };
+		const double crossLength = h.Cross(v).Length();
+		const double dot = h.Dot(v);
+		if (crossLength > 0.0 || dot > 0.0)
+		{
+			const double headingError = std::atan2(crossLength, dot) * 180.0 / 3.14159265358979;
+			aOutHeadingError = headingError > aOutHeadingError ? headingError : aOutHeadingError;
+		}
+
+		const double flockError = std::abs((double)flockSize - boids[i].flockSize) / (1.0 + boids[i].flockSize);
+		aOutFlockError = flockError > aOutFlockError ? flockError : aOutFlockError;
+	}
+	aOutPosError = std::sqrt(posErrorSqr);
+}
+
+// Steps the boids brute force and unpacks the render instances of every step. Quantizing moves a position at most half a
+// step per axis, a few float roundings of the extent and the coordinates added. The octahedral heading moves at most half
+// a step on both axes, which turns the heading by at most 3 * sqrt(2) / INSTANCE_HEADING_MAX radians. The flock size is
+// rounded to half a step of log2(1 + flockSize). Fails if an error goes past its bound by more than aTolerance of it.
+static int ValidateInstances(const SimulationSettings& aSimSettings, const FrameBufferData& aFrame, const int aFrames, const float aTolerance)
+{
+	BoidComputerCPU boidComputer;
+	ConfigureComputer(boidComputer, aSimSettings, GetLayout(aSimSettings.cpu));
+	boidComputer.InitBoidTransforms(aFrame);
+
+	const InstanceBufferData packing = RenderInstances::GetPacking(aFrame);
+	const float extents[3] = { packing.extent.x, packing.extent.y, packing.extent.z };
+	const float minPositions[3] = { packing.minPos.x, packing.minPos.y, packing.minPos.z };
+	double posBoundSqr = 0.0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const double extent = (double)extents[axis];
+		const double minPos = std::abs((double)minPositions[axis]);
+		const double maxPos = std::abs((double)minPositions[axis] + extent);
+		const double axisBound = 0.5 * extent / INSTANCE_POS_MAX + 4.0 * FLT_EPSILON * (extent + (minPos > maxPos ? minPos : maxPos));
+		posBoundSqr += axisBound * axisBound;
+	}
+	const double posBound = std::sqrt(posBoundSqr);
+	const double headingBound = 3.0 * std::sqrt(2.0) / INSTANCE_HEADING_MAX * 180.0 / 3.14159265358979;
+	const double flockBound = std::exp2(0.5 / INSTANCE_FLOCK_OCTAVE_STEPS) - 1.0;
+	const double slack = 1.0 + (double)aTolerance;
+
+	const int frames = aFrames < VALIDATION_INSTANCE_FRAMES ? aFrames : VALIDATION_INSTANCE_FRAMES;
+	printf("validating render instances, %u boids, %d frames, bounds position %.6f units, heading %.4f degrees, flock size %.2f%%\n",
+		aFrame.boidCount, frames, posBound, headingBound, flockBound * 100.0);
+
+	double maxPosError = 0.0;
+	double maxHeadingError = 0.0;
+	double maxFlockError = 0.0;
+	int failedFrames = 0;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		boidComputer.RunBoidsCPU(aFrame);
+		double posError;
+		double headingError;
+		double flockError;
+		MeasureInstanceError(boidComputer, aFrame, posError, headingError, flockError);
+		boidComputer.SwapBuffers();
+
+		maxPosError = posError > maxPosError ? posError : maxPosError;
+		maxHeadingError = headingError > maxHeadingError ? headingError : maxHeadingError;
+		maxFlockError = flockError > maxFlockError ? flockError : maxFlockError;
+		if (posError > posBound * slack || headingError > headingBound * slack || flockError > flockBound * slack)
+		{
+			if (failedFrames == 0)
+			{
+				printf("  frame %d position error %.6f, heading %.4f degrees, flock size %.2f%%\n",
+					frame + 1, posError, headingError, flockError * 100.0);
+			}
+			failedFrames++;
+		}
+	}
+	boidComputer.UnInit();
+
+	const bool passed = failedFrames == 0;
+	printf("largest position error %.6f units, heading %.4f degrees, flock size %.2f%%, tolerance %.2f of the bounds, %d frames over: %s\n",
+		maxPosError, maxHeadingError, maxFlockError * 100.0, aTolerance, failedFrames, passed ? "passed" : "FAILED");
+	return passed ? 0 : 2;
+}
+
+// Steps the same boids with deterministic mode on and off, one step of each in turn so both see the same load,
+// and prints what the stable sort and the state hash deterministic mode forces cost per step.
+static void MeasureDeterministicCost(const SimulationSettings& aSimSettings, const FrameBufferData& aFrame, const SimulationCapacity& aCapacity, const int aFrames)
+{
+	const int frames = aFrames < DETERMINISTIC_COST_FRAMES ? aFrames : DETERMINISTIC_COST_FRAMES;
+	if (frames <= 0)
+		return;
+
+	const BoidLayout layout = GetLayout(aSimSettings.cpu);
+	FrameBufferData runFrames[2] = { aFrame, aFrame };
+	runFrames[0].deterministic = true;
+	runFrames[1].deterministic = false;
+	BoidComputerCPU computers[2];
+	CPUSimulationStats sums[2];
+	for (int run = 0; run < 2; run++)
+	{
+		ConfigureComputer(computers[run], aSimSettings, layout);
+		computers[run].SetCapacity(aCapacity);
+		computers[run].InitBoidTransforms(runFrames[run]);
+	}
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (int run = 0; run < 2; run++)
+		{
+			if (aSimSettings.griddingOn)
+			{
+				computers[run].RunBoidsCPUGridded(runFrames[run]);
+			}
+			else
+			{
+				computers[run].RunBoidsCPU(runFrames[run]);
+				computers[run].SwapBuffers();
+			}
+			const CPUSimulationStats& stats = computers[run].GetStats();
+			sums[run].totalMs += stats.totalMs;
+			sums[run].sortMs += stats.sortMs;
+			sums[run].hashMs += stats.hashMs;
+		}
+	}
+	for (int run = 0; run < 2; run++)
+		computers[run].UnInit();
+
+	const float count = (float)frames;
+	printf("  deterministic %.3f ms/frame (stable sort %.3f, hash %.3f), normal %.3f ms/frame (%s sort %.3f), fixed step over %d frames\n",
+		sums[0].totalMs / count, sums[0].sortMs / count, sums[0].hashMs / count,
+		sums[1].totalMs / count, aSimSettings.cpu.stableSort ? "stable" : "atomic", sums[1].sortMs / count, frames);
+}
+
+int main(int argc, char* argv[])
+{
+	HeadlessOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	SimulationSettings simSettings;
+	GraphicsSettings graphicsSettings;
+	PlayerSettings playerSettings;
+	Settings::LoadBoidSimulationSettings(simSettings, graphicsSettings, playerSettings);
+	//Always the CPU backend, so the GPU only settings stay out of the frame data
+	simSettings.cpu.enabled = true;
+	if (options.boidCount >= 0)
+		simSettings.boidCount = options.boidCount;
+	if (options.memoryBudgetMB >= 0)
+		simSettings.memoryBudgetMB = options.memoryBudgetMB;
+	if (options.threads >= 0)
+		simSettings.cpu.threadCount = options.threads;
+	if (options.structureOfArrays >= 0)
+		simSettings.cpu.structureOfArrays = options.structureOfArrays == 1;
+	if (options.compactStorage >= 0)
+		simSettings.cpu.compactStorage = options.compactStorage == 1;
+	if (options.instructionSet >= -1)
+		simSettings.cpu.instructionSet = options.instructionSet;
+	if (options.stableSort >= 0)
+		simSettings.cpu.stableSort = options.stableSort == 1;
+	if (options.workStealing >= 0)
+		simSettings.cpu.workStealing = options.workStealing == 1;
+	if (options.cellOrder >= 0)
+		simSettings.cpu.cellOrder = options.cellOrder;
+	if (options.incrementalRebin >= 0)
+		simSettings.cpu.incrementalRebin = options.incrementalRebin == 1;
+	if (options.halfShell >= 0)
+		simSettings.cpu.halfShell = options.halfShell == 1;
+	if (options.cellCulling >= 0)
+		simSettings.cpu.cellCulling = options.cellCulling == 1;
+	if (options.neighbourLists >= 0)
+		simSettings.cpu.neighbourLists = options.neighbourLists == 1;
+	if (options.listSkin >= 0.f)
+		simSettings.cpu.neighbourListSkin = options.listSkin;
+	if (options.listBudgetMB >= 0)
+		simSettings.cpu.neighbourListBudgetMB = options.listBudgetMB;
+	if (options.adaptiveTimeStep >= 0)
+		simSettings.adaptiveTimeStep = options.adaptiveTimeStep == 1;
+	if (options.lodDistance >= 0.f)
+	{
+		simSettings.simulationLod = options.lodDistance > 0.f;
+		simSettings.lodDistance = options.lodDistance;
+	}
+	if (options.lodMaxTier >= 0)
+		simSettings.lodMaxTier = options.lodMaxTier;
+	if (options.deterministic >= 0)
+		simSettings.deterministic = options.deterministic == 1;
+	if (options.initSeed >= 0)
+		simSettings.initSeed = (int)(unsigned int)options.initSeed;
+	//There is no view, the LOD camera sits in the middle of the bounds
+	simSettings.lodFrustum = false;
+	if (simSettings.cpu.cellOrder < 0 || simSettings.cpu.cellOrder >= (int)(sizeof(CELL_ORDER_NAMES) / sizeof(CELL_ORDER_NAMES[0])))
+		simSettings.cpu.cellOrder = 0;
+	//The compact layout only bins with row major cells
+	if (simSettings.cpu.compactStorage)
+		simSettings.cpu.cellOrder = (int)CellOrder::RowMajor;
+	if (options.scanBenchmark)
+		return BenchmarkScans(simSettings.cpu.threadCount);
+	const bool validateCompact = options.compactTolerance >= 0.f;
+	const bool validateInstances = options.instanceTolerance >= 0.f;
+	if (validateCompact || options.validateInstructionSets || validateInstances)
+	{
+		simSettings.griddingOn = false;
+		simSettings.adaptiveTimeStep = false;
+		simSettings.boidCount = options.boidCount >= 0 ? options.boidCount : VALIDATION_BOID_COUNT;
+	}
+
+	FrameBufferData frameBufferData = {};
+	frameBufferData.camPos = (simSettings.minPos + simSettings.maxPos) * 0.5f;
+	SimulationFrameData::Fill(frameBufferData, simSettings);
+	frameBufferData.deltaTime = options.deltaTime >= 0.f ? options.deltaTime : 1.f / (float)(simSettings.stepRate > 0 ? simSettings.stepRate : 1);
+	frameBufferData.playerAttraction = 0.f;
+
+	const SimulationCapacity capacity = SimulationFrameData::GetCapacity(frameBufferData, simSettings);
+	if (!SimulationFrameData::IsValid(frameBufferData, simSettings))
+	{
+		printf("invalid settings: %u boids, %u cells, the %d MB budget has room for %u boids or %u cells next to them\n",
+			frameBufferData.boidCount, frameBufferData.cellCount, simSettings.memoryBudgetMB, capacity.maxBoids, capacity.maxCells);
+		return 1;
+	}
+
+	if (validateCompact)
+		return ValidateCompact(simSettings, frameBufferData, options.frames, options.compactTolerance);
+	if (options.validateInstructionSets)
+		return ValidateInstructionSets(simSettings, frameBufferData, options.frames);
+	if (validateInstances)
+		return ValidateInstances(simSettings, frameBufferData, options.frames, options.instanceTolerance);
+
+	const BoidLayout layout = GetLayout(simSettings.cpu);
+	BoidComputerCPU boidComputer;
+	ConfigureComputer(boidComputer, simSettings, layout);
+	boidComputer.SetCapacity(capacity);
+	boidComputer.InitBoidTransforms(frameBufferData);
+
+	printf("%u boids, %u cells (%ux%ux%u), %s, %s, %s sort, %s cells, %s rebin, %s pairs, cell culling %s, %s, %s step, LOD %s, seed %u%s, %u threads\n",
+		frameBufferData.boidCount, frameBufferData.cellCount,
+		frameBufferData.gridDims.x, frameBufferData.gridDims.y, frameBufferData.gridDims.z,
+		simSettings.griddingOn ? "gridded" : "brute force",
+		layout == BoidLayout::SoA ? NeighbourKernel::GetName(boidComputer.GetInstructionSet()) : (layout == BoidLayout::Compact ? "compact" : "AoS"),
+		simSettings.cpu.stableSort || frameBufferData.deterministic ? "stable" : "atomic",
+		CELL_ORDER_NAMES[simSettings.cpu.cellOrder],
+		simSettings.cpu.incrementalRebin ? "incremental" : "full",
+		simSettings.cpu.halfShell ? "half shell" : "all",
+		simSettings.cpu.cellCulling ? "on" : "off",
+		simSettings.cpu.neighbourLists ? "neighbour lists" : "cell ranges",
+		simSettings.adaptiveTimeStep ? "adaptive" : "fixed",
+		frameBufferData.lodMaxTier > 0 ? "on" : "off",
+		frameBufferData.initSeed, frameBufferData.deterministic ? ", deterministic" : "",
+		boidComputer.GetThreadCount());
+
+	const FrameBufferData initialFrame = frameBufferData; //The adaptive step changes the step time of frameBufferData
+	CPUSimulationStats statsSum;
+	unsigned long long movedBoids = 0;
+	unsigned long long shiftedBoids = 0;
+	unsigned long long lodSkippedBoids = 0;
+	int rebinnedFrames = 0;
+	int occupancyFrames = 0;
+	unsigned long long occupiedCellBlocks = 0;
+	int listFrames = 0;
+	int listBuilds = 0;
+	int overBudgetFrames = 0;
+	size_t listBytes = 0;
+	double simulatedSeconds = 0.0;
+	float minStepTime = frameBufferData.deltaTime;
+	float maxStepTime = frameBufferData.deltaTime;
+	float minSeparation = FLT_MAX;
+	double instanceMs = 0.0;
+	double instancePosError = 0.0;
+	double instanceHeadingError = 0.0;
+	double instanceFlockError = 0.0;
+	const auto start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < options.frames; frame++)
+	{
+		//Every frame is one step, the adaptive one follows the bounds of the step before like in the game
+		const CPUSimulationStats& lastStats = boidComputer.GetStats();
+		if (simSettings.adaptiveTimeStep && lastStats.stepBounds)
+		{
+			frameBufferData.deltaTime = SimulationFrameData::GetAdaptiveStepTime(simSettings, lastStats.maxSpeed, lastStats.minSeparation);
+			minStepTime = frameBufferData.deltaTime < minStepTime ? frameBufferData.deltaTime : minStepTime;
+			maxStepTime = frameBufferData.deltaTime > maxStepTime ? frameBufferData.deltaTime : maxStepTime;
+		}
+		simulatedSeconds += frameBufferData.deltaTime;
+
+		if (simSettings.griddingOn)
+			boidComputer.RunBoidsCPUGridded(frameBufferData);
+		else
+			boidComputer.RunBoidsCPU(frameBufferData);
+
+		//Both steps, like the game packs them for interpolated rendering, before the brute force swap
+		if (options.renderInstances)
+		{
+			const auto packStart = std::chrono::steady_clock::now();
+			boidComputer.PackRenderInstances(frameBufferData, false);
+			boidComputer.PackRenderInstances(frameBufferData, true);
+			instanceMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - packStart).count();
+			if (frame + 1 == options.frames)
+				MeasureInstanceError(boidComputer, frameBufferData, instancePosError, instanceHeadingError, instanceFlockError);
+		}
+
+		if (!simSettings.griddingOn)
+			boidComputer.SwapBuffers();
+
+		const CPUSimulationStats& stats = boidComputer.GetStats();
+		//One line per step, so the first step two runs differ in shows up in a diff of their output
+		if (frameBufferData.deterministic)
+			printf("  frame %d hash %016llx\n", frame, stats.stateHash);
+		statsSum.clearMs += stats.clearMs;
+		statsSum.countMs += stats.countMs;
+		statsSum.scanMs += stats.scanMs;
+		statsSum.sortMs += stats.sortMs;
+		statsSum.scheduleMs += stats.scheduleMs;
+		statsSum.behaviorMs += stats.behaviorMs;
+		statsSum.behaviorTasks += stats.behaviorTasks;
+		statsSum.steals += stats.steals;
+		statsSum.totalMs += stats.totalMs;
+		statsSum.hashMs += stats.hashMs;
+		statsSum.neighbourCandidates += stats.neighbourCandidates;
+		statsSum.culledCandidates += stats.culledCandidates;
+		statsSum.clearedBytes += stats.clearedBytes;
+		statsSum.clearBytesSaved += stats.clearBytesSaved;
+		lodSkippedBoids += stats.lodSkippedBoids;
+		if (stats.occupiedCellBlocks > 0)
+		{
+			occupancyFrames++;
+			occupiedCellBlocks += stats.occupiedCellBlocks;
+		}
+		if (stats.neighbourLists)
+		{
+			listFrames++;
+			listBuilds += stats.listsRebuilt ? 1 : 0;
+			listBytes = stats.listBytes > listBytes ? stats.listBytes : listBytes;
+		}
+		overBudgetFrames += stats.listsOverBudget ? 1 : 0;
+		minSeparation = stats.stepBounds && stats.minSeparation < minSeparation ? stats.minSeparation : minSeparation;
+		if (stats.rebinned)
+		{
+			movedBoids += stats.movedBoids;
+			shiftedBoids += stats.shiftedBoids;
+			rebinnedFrames++;
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const float frames = (float)(options.frames > 0 ? options.frames : 1);
+	printf("%d frames in %.3f s, %.3f ms/frame\n", options.frames, seconds, statsSum.totalMs / frames);
+	printf("  clear %.3f  count %.3f  scan %.3f  sort %.3f  schedule %.3f  behavior %.3f (ms/frame)\n",
+		statsSum.clearMs / frames, statsSum.countMs / frames, statsSum.scanMs / frames,
+		statsSum.sortMs / frames, statsSum.scheduleMs / frames, statsSum.behaviorMs / frames);
+	printf("  %.1f behavior tasks, %.1f steals (per frame)\n", (float)statsSum.behaviorTasks / frames, (float)statsSum.steals / frames);
+	printf("  %.3f s simulated, %.3f s per second of compute, step %.5f..%.5f s\n", simulatedSeconds,
+		statsSum.totalMs > 0.f ? simulatedSeconds / (statsSum.totalMs * 0.001) : 0.0, minStepTime, maxStepTime);
+	if (frameBufferData.deterministic)
+	{
+		printf("  state hash %016llx, hashing %.3f ms/frame\n", boidComputer.GetStats().stateHash, statsSum.hashMs / frames);
+		MeasureDeterministicCost(simSettings, initialFrame, capacity, options.frames);
+	}
+	const size_t bytesPerBoid = BoidComputerCPU::GetBytesPerBoid(layout);
+	printf("  %zu bytes per boid, %.1f MB of boid input and output\n", bytesPerBoid, (double)bytesPerBoid * 2 * frameBufferData.boidCount / (1024.0 * 1024.0));
+	printf("  %d MB budget, room for %u boids next to these cells and %u cells next to these boids\n",
+		simSettings.memoryBudgetMB, capacity.maxBoids, capacity.maxCells);
+	if (options.renderInstances)
+	{
+		const InstanceBufferData packing = RenderInstances::GetPacking(frameBufferData);
+		const float posStep = packing.extent.x / (float)INSTANCE_POS_MAX;
+		printf("  render instances %.3f ms/frame for both steps, %zu instead of %zu bytes per boid\n",
+			instanceMs / frames, sizeof(RenderInstance), sizeof(Boid));
+		printf("  last frame round trip error: position %.6f units (steps of %.6f), heading %.3f degrees, flock size %.1f%%\n",
+			instancePosError, posStep, instanceHeadingError, instanceFlockError * 100.0);
+	}
+	if (minSeparation < FLT_MAX)
+		printf("  closest separation %.4f, protected range %.4f\n", minSeparation, simSettings.protectedRange);
+	if (simSettings.griddingOn)
+	{
+		const unsigned int cellKeys = boidComputer.GetStats().cellKeys;
+		printf("  %u cell keys, %.1f MB of sum buffers\n", cellKeys, (double)cellKeys * 2 * sizeof(unsigned int) / (1024.0 * 1024.0));
+		printf("  %.2f MB cleared, %.2f MB fewer than clearing the allocated sum buffers (per frame)\n",
+			(double)statsSum.clearedBytes / frames / (1024.0 * 1024.0), (double)statsSum.clearBytesSaved / frames / (1024.0 * 1024.0));
+		if (occupancyFrames > 0)
+		{
+			const unsigned int cellBlocks = (cellKeys + OCCUPANCY_BLOCK_CELLS - 1) / OCCUPANCY_BLOCK_CELLS;
+			const double occupied = (double)occupiedCellBlocks / occupancyFrames;
+			printf("  %.1f of %u cell blocks occupied per counted frame (%.1f%%)\n", occupied, cellBlocks, 100.0 * occupied / cellBlocks);
+		}
+		if (rebinnedFrames > 0)
+		{
+			printf("  %d frames rebinned incrementally, %.1f moved and %.1f shifted boids per rebinned frame\n",
+				rebinnedFrames, (double)movedBoids / rebinnedFrames, (double)shiftedBoids / rebinnedFrames);
+		}
+	}
+	if (listFrames > 0 || overBudgetFrames > 0)
+	{
+		printf("  %d frames on neighbour lists, %d builds, %.1f MB of lists, %d frames over budget\n",
+			listFrames, listBuilds, (double)listBytes / (1024.0 * 1024.0), overBudgetFrames);
+	}
+	if (statsSum.neighbourCandidates > 0 && statsSum.behaviorMs > 0.f)
+	{
+		const double pairsPerSecond = (double)statsSum.neighbourCandidates / (statsSum.behaviorMs * 0.001);
+		printf("  %.1f M neighbour %s/s, %.1f M per thread\n", pairsPerSecond * 1e-6,
+			boidComputer.GetStats().halfShell ? "pairs" : "candidates", pairsPerSecond * 1e-6 / boidComputer.GetThreadCount());
+	}
+	if (frameBufferData.lodMaxTier > 0)
+	{
+		printf("  %.1f%% of the boid behaviors skipped by the LOD, within %.1f units every step, every %u steps at most\n",
+			100.0 * (double)lodSkippedBoids / ((double)frameBufferData.boidCount * frames), frameBufferData.lodDistance, 1u << frameBufferData.lodMaxTier);
+	}
+	if (statsSum.culledCandidates > 0)
+	{
+		const double culledShare = (double)statsSum.culledCandidates / (double)(statsSum.culledCandidates + statsSum.neighbourCandidates);
+		printf("  %.1f M %s culled per frame", (double)statsSum.culledCandidates * 1e-6 / frames, boidComputer.GetStats().halfShell ? "pairs" : "candidates");
+		if (statsSum.neighbourCandidates > 0)
+			printf(", %.1f%% of the neighbour ranges", culledShare * 100.0);
+		printf("\n");
+	}
+
+	boidComputer.UnInit();
+	return 0;
+}
@@ -0,0 +1,56 @@
+include "../../premake/common.lua"
+
+-------------------------------------------------------------
+project "headless"
+	location (dirs.localfiles)
+
+	kind "ConsoleApp"
+	language "C++"
+	cppdialect "C++17"
+
+	debugdir ("%{dirs.bin}")
+	targetdir ("%{dirs.bin}")
+	targetname("%{prj.name}_%{cfg.buildcfg}")
+	objdir ("%{dirs.temp}")
+
+	includedirs {
+		dirs.engine,
+		dirs.external,
+		dirs.game
+	}
+
+	files {
+		"**.cpp",
+		"../game/cpu/**.h",
+		"../game/cpu/**.cpp",
+		"../game/util/Settings.cpp",
+		"../game/util/SimulationFrameData.cpp",
+	}
+
+	filter "configurations:Debug"
+		defines {"_DEBUG"}
+		runtime "Debug"
+		symbols "on"
+
+	filter "configurations:Release"
+		defines "_RELEASE"
+		runtime "Release"
+		optimize "on"
+
+	filter "configurations:Retail"
+		defines "_RETAIL"
+		runtime "Release"
+		optimize "on"
+
+	filter "system:linux"
+		links { "pthread" }
+
+	filter "system:windows"
+		symbols "On"
+		systemversion "latest"
+		warnings "Extra"
+
+		fatalwarnings { "All" }
+		flags {
+			"MultiProcessorCompile"
+		}
\ No newline at end of file